@@ -33,6 +33,36 @@
 #define ACTIVEOBJECT_TYPE_INVALID 0
 // Other types are defined in content_object.h
 
+/*
+	An object message starting with command 0 is a position update: the
+	command, the position as v3f1000 and then whatever else the object
+	sends with it.
+
+	For clients using protocol 11 or newer, the server turns position
+	updates into these, and the client turns them back into command 0
+	before the object sees them:
+
+	AO_CMD_POSITION_BASE, sent reliably:
+		u8 command
+		u8 base sequence number
+		v3s32 position in thousandths
+		the rest of the original message
+	AO_CMD_POSITION_DELTA:
+		u8 command
+		u8 base sequence number
+		v3s16 difference from the base position in AO_DELTA_QUANTUM
+		thousandths
+		the rest of the original message
+
+	A delta only applies if the client has the base it refers to.
+*/
+#define AO_CMD_POSITION 0
+#define AO_CMD_POSITION_BASE 0x80
+#define AO_CMD_POSITION_DELTA 0x81
+#define AO_DELTA_QUANTUM 10
+// Length of the command and the position of a position update
+#define AO_POSITION_SIZE 13
+
 struct ActiveObjectMessage
 {
 	ActiveObjectMessage(u16 id_, bool reliable_=true, std::string data_=""):
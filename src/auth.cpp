@@ -30,6 +30,8 @@
 #include <sstream>
 #include "strfnd.h"
 #include "debug.h"
+#include "filesys.h"
+#include <stdio.h>
 
 // Convert a privileges value into a human-readable string,
 // with each component separated by a comma.
@@ -86,42 +88,102 @@ uint64_t stringToPrivs(std::string str)
 	return privs;
 }
 
-AuthManager::AuthManager(const std::string &authfilepath):
-		m_authfilepath(authfilepath),
-		m_modified(false)
+AuthManager::AuthManager(const std::string &savedir):
+		m_savedir(savedir),
+		m_database(NULL),
+		m_database_read(NULL),
+		m_database_write(NULL)
 {
 	m_mutex.Init();
 
-	try{
-		load();
-	}
-	catch(SerializationError &e)
-	{
-		dstream<<"WARNING: AuthManager: creating "
-				<<m_authfilepath<<std::endl;
+	// The destructor doesn't run if the constructor throws
+	try {
+		openDatabase();
+	} catch (BaseException &e) {
+		closeDatabase();
+		throw;
 	}
 }
 
 AuthManager::~AuthManager()
 {
-	save();
+	closeDatabase();
 }
 
-void AuthManager::load()
+void AuthManager::closeDatabase()
 {
-	JMutexAutoLock lock(m_mutex);
+	if (m_database_read)
+		sqlite3_finalize(m_database_read);
+	if (m_database_write)
+		sqlite3_finalize(m_database_write);
+	if (m_database)
+		sqlite3_close(m_database);
+	m_database_read = NULL;
+	m_database_write = NULL;
+	m_database = NULL;
+}
 
-	dstream<<"AuthManager: loading from "<<m_authfilepath<<std::endl;
-	std::ifstream is(m_authfilepath.c_str(), std::ios::binary);
-	if(is.good() == false)
-	{
-		dstream<<"AuthManager: failed loading from "<<m_authfilepath<<std::endl;
-		throw SerializationError("AuthManager::load(): Couldn't open file");
+void AuthManager::openDatabase()
+{
+	std::string dbp = m_savedir + DIR_DELIM + "auth.sqlite";
+	std::string txtp = m_savedir + DIR_DELIM + "auth.txt";
+	// auth.txt is renamed once it's in the database, so if it's still
+	// there the import hasn't been finished yet
+	bool needs_import = fs::PathExists(txtp);
+	int d;
+
+	fs::CreateAllDirs(m_savedir);
+
+	d = sqlite3_open_v2(dbp.c_str(), &m_database, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	if (d != SQLITE_OK) {
+		dstream<<"WARNING: AuthManager: database failed to open: "<<sqlite3_errmsg(m_database)<<std::endl;
+		throw FileNotGoodException("auth.sqlite: Cannot open database file");
 	}
 
-	for(;;)
-	{
-		if(is.eof() || is.good() == false)
+	d = sqlite3_exec(m_database,
+		"CREATE TABLE IF NOT EXISTS `auth` ("
+			"`name` TEXT NOT NULL PRIMARY KEY,"
+			"`password` TEXT,"
+			"`privs` INT"
+		");"
+	, NULL, NULL, NULL);
+	if (d != SQLITE_OK)
+		throw FileNotGoodException("auth.sqlite: Could not create database structure");
+
+	d = sqlite3_prepare(m_database, "SELECT `password`, `privs` FROM `auth` WHERE `name`=? LIMIT 1", -1, &m_database_read, NULL);
+	if (d != SQLITE_OK) {
+		dstream<<"WARNING: AuthManager: read statement failed to prepare: "<<sqlite3_errmsg(m_database)<<std::endl;
+		throw FileNotGoodException("auth.sqlite: Cannot prepare read statement");
+	}
+
+	d = sqlite3_prepare(m_database, "REPLACE INTO `auth` VALUES(?, ?, ?)", -1, &m_database_write, NULL);
+	if (d != SQLITE_OK) {
+		dstream<<"WARNING: AuthManager: write statement failed to prepare: "<<sqlite3_errmsg(m_database)<<std::endl;
+		throw FileNotGoodException("auth.sqlite: Cannot prepare write statement");
+	}
+
+	if (needs_import)
+		importFile(txtp);
+}
+
+void AuthManager::importFile(const std::string &path)
+{
+	dstream<<"AuthManager: importing "<<path<<std::endl;
+	std::ifstream is(path.c_str(), std::ios::binary);
+	if (is.good() == false) {
+		dstream<<"ERROR: AuthManager: failed importing from "<<path<<std::endl;
+		throw FileNotGoodException("auth.txt: Cannot open file for import");
+	}
+
+	// All or nothing, so a failed import is simply redone on the next start
+	if (sqlite3_exec(m_database, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) {
+		dstream<<"ERROR: AuthManager: import failed to begin: "<<sqlite3_errmsg(m_database)<<std::endl;
+		throw FileNotGoodException("auth.sqlite: Cannot begin import");
+	}
+
+	u32 count = 0;
+	for (;;) {
+		if (is.eof() || is.good() == false)
 			break;
 
 		// Read a line
@@ -133,6 +195,8 @@ void AuthManager::load()
 		// Read name
 		std::string name;
 		std::getline(iss, name, ':');
+		if (name == "")
+			continue;
 
 		// Read password
 		std::string pwd;
@@ -141,83 +205,122 @@ void AuthManager::load()
 		// Read privileges
 		std::string stringprivs;
 		std::getline(iss, stringprivs, ':');
-		uint64_t privs = stringToPrivs(stringprivs);
 
-		// Store it
 		AuthData ad;
 		ad.pwd = pwd;
-		ad.privs = privs;
-		m_authdata[name] = ad;
+		ad.privs = stringToPrivs(stringprivs);
+		if (!write(name, ad)) {
+			sqlite3_exec(m_database, "ROLLBACK;", NULL, NULL, NULL);
+			m_authdata.clear();
+			throw FileNotGoodException("auth.sqlite: Cannot import auth.txt");
+		}
+		count++;
+	}
+
+	if (sqlite3_exec(m_database, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+		dstream<<"ERROR: AuthManager: import failed to commit: "<<sqlite3_errmsg(m_database)<<std::endl;
+		sqlite3_exec(m_database, "ROLLBACK;", NULL, NULL, NULL);
+		m_authdata.clear();
+		throw FileNotGoodException("auth.sqlite: Cannot commit import");
+	}
+
+	// Only what's asked for is kept in memory
+	m_authdata.clear();
+
+	// If auth.txt stayed it would be imported again on every start,
+	// overwriting whatever changed in the database since
+	std::string old_path = path + ".old";
+	if (rename(path.c_str(), old_path.c_str()) != 0) {
+		dstream<<"ERROR: AuthManager: failed to rename "<<path<<" to "<<old_path<<std::endl;
+		throw FileNotGoodException("auth.txt: Cannot rename after import");
 	}
 
-	m_modified = false;
+	dstream<<"AuthManager: imported "<<count<<" players, "<<path
+			<<" was renamed to "<<old_path<<std::endl;
 }
 
-void AuthManager::save()
+bool AuthManager::find(const std::string &username, AuthData &ad)
 {
-	JMutexAutoLock lock(m_mutex);
+	core::map<std::string, AuthData>::Node *n;
+	n = m_authdata.find(username);
+	if (n != NULL) {
+		ad = n->getValue();
+		return true;
+	}
 
-	dstream<<"AuthManager: saving to "<<m_authfilepath<<std::endl;
-	std::ofstream os(m_authfilepath.c_str(), std::ios::binary);
-	if(os.good() == false)
-	{
-		dstream<<"AuthManager: failed saving to "<<m_authfilepath<<std::endl;
-		throw SerializationError("AuthManager::save(): Couldn't open file");
+	if (sqlite3_bind_text(m_database_read, 1, username.c_str(), username.size(), NULL) != SQLITE_OK)
+		dstream<<"WARNING: AuthManager: could not bind name: "<<sqlite3_errmsg(m_database)<<std::endl;
+
+	bool found = false;
+	if (sqlite3_step(m_database_read) == SQLITE_ROW) {
+		const char *pwd = (const char*)sqlite3_column_text(m_database_read, 0);
+		if (pwd)
+			ad.pwd = pwd;
+		ad.privs = sqlite3_column_int64(m_database_read, 1);
+		found = true;
 	}
 
-	for(core::map<std::string, AuthData>::Iterator
-			i = m_authdata.getIterator();
-			i.atEnd()==false; i++)
-	{
-		std::string name = i.getNode()->getKey();
-		if(name == "")
-			continue;
-		AuthData ad = i.getNode()->getValue();
-		os<<name<<":"<<ad.pwd<<":"<<privsToString(ad.privs)<<"\n";
+	sqlite3_reset(m_database_read);
+
+	if (found)
+		m_authdata[username] = ad;
+
+	return found;
+}
+
+bool AuthManager::write(const std::string &username, const AuthData &ad)
+{
+	bool ok = true;
+
+	m_authdata[username] = ad;
+
+	if (sqlite3_bind_text(m_database_write, 1, username.c_str(), username.size(), NULL) != SQLITE_OK)
+		dstream<<"WARNING: AuthManager: could not bind name: "<<sqlite3_errmsg(m_database)<<std::endl;
+	if (sqlite3_bind_text(m_database_write, 2, ad.pwd.c_str(), ad.pwd.size(), NULL) != SQLITE_OK)
+		dstream<<"WARNING: AuthManager: could not bind password: "<<sqlite3_errmsg(m_database)<<std::endl;
+	if (sqlite3_bind_int64(m_database_write, 3, (sqlite3_int64)ad.privs) != SQLITE_OK)
+		dstream<<"WARNING: AuthManager: could not bind privs: "<<sqlite3_errmsg(m_database)<<std::endl;
+	if (sqlite3_step(m_database_write) != SQLITE_DONE) {
+		dstream<<"WARNING: AuthManager: failed to save "<<username<<": "<<sqlite3_errmsg(m_database)<<std::endl;
+		ok = false;
 	}
 
-	m_modified = false;
+	sqlite3_reset(m_database_write);
+
+	return ok;
 }
 
 bool AuthManager::exists(const std::string &username)
 {
 	JMutexAutoLock lock(m_mutex);
 
-	core::map<std::string, AuthData>::Node *n;
-	n = m_authdata.find(username);
-	if(n == NULL)
-		return false;
-	return true;
+	AuthData ad;
+	return find(username, ad);
 }
 
 void AuthManager::set(const std::string &username, AuthData ad)
 {
 	JMutexAutoLock lock(m_mutex);
 
-	m_authdata[username] = ad;
-
-	m_modified = true;
+	write(username, ad);
 }
 
 void AuthManager::add(const std::string &username)
 {
 	JMutexAutoLock lock(m_mutex);
 
-	m_authdata[username] = AuthData();
-
-	m_modified = true;
+	write(username, AuthData());
 }
 
 std::string AuthManager::getPassword(const std::string &username)
 {
 	JMutexAutoLock lock(m_mutex);
 
-	core::map<std::string, AuthData>::Node *n;
-	n = m_authdata.find(username);
-	if(n == NULL)
+	AuthData ad;
+	if (!find(username, ad))
 		throw AuthNotFoundException("");
 
-	return n->getValue().pwd;
+	return ad.pwd;
 }
 
 void AuthManager::setPassword(const std::string &username,
@@ -225,50 +328,33 @@ void AuthManager::setPassword(const std::string &username,
 {
 	JMutexAutoLock lock(m_mutex);
 
-	core::map<std::string, AuthData>::Node *n;
-	n = m_authdata.find(username);
-	if(n == NULL)
+	AuthData ad;
+	if (!find(username, ad))
 		throw AuthNotFoundException("");
 
-	AuthData ad = n->getValue();
 	ad.pwd = password;
-	n->setValue(ad);
-
-	m_modified = true;
+	write(username, ad);
 }
 
 uint64_t AuthManager::getPrivs(const std::string &username)
 {
 	JMutexAutoLock lock(m_mutex);
 
-	core::map<std::string, AuthData>::Node *n;
-	n = m_authdata.find(username);
-	if(n == NULL)
+	AuthData ad;
+	if (!find(username, ad))
 		throw AuthNotFoundException("");
 
-	return n->getValue().privs;
+	return ad.privs;
 }
 
 void AuthManager::setPrivs(const std::string &username, uint64_t privs)
 {
 	JMutexAutoLock lock(m_mutex);
 
-	core::map<std::string, AuthData>::Node *n;
-	n = m_authdata.find(username);
-	if(n == NULL)
+	AuthData ad;
+	if (!find(username, ad))
 		throw AuthNotFoundException("");
 
-	AuthData ad = n->getValue();
 	ad.privs = privs;
-	n->setValue(ad);
-
-	m_modified = true;
+	write(username, ad);
 }
-
-bool AuthManager::isModified()
-{
-	JMutexAutoLock lock(m_mutex);
-	return m_modified;
-}
-
-
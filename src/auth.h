@@ -32,6 +32,10 @@
 #include "common_irrlicht.h"
 #include "exceptions.h"
 
+extern "C" {
+	#include "sqlite3.h"
+}
+
 using namespace jthread;
 
 // Player privileges. These form a bitmask stored in the privs field
@@ -81,13 +85,18 @@ public:
 	{}
 };
 
+/*
+	Auth data is kept in auth.sqlite in the world directory. An account
+	is read from the database the first time it's asked for and written
+	back as soon as it's changed, so neither startup nor a change goes
+	through every account. An auth.txt left from before is imported
+	when the database is first created.
+*/
 class AuthManager
 {
 public:
-	AuthManager(const std::string &authfilepath);
+	AuthManager(const std::string &savedir);
 	~AuthManager();
-	void load();
-	void save();
 	bool exists(const std::string &username);
 	void set(const std::string &username, AuthData ad);
 	void add(const std::string &username);
@@ -96,12 +105,24 @@ public:
 			const std::string &password);
 	uint64_t getPrivs(const std::string &username);
 	void setPrivs(const std::string &username, uint64_t privs);
-	bool isModified();
 private:
+	void openDatabase();
+	// Finalizes the statements and closes the database, if they're open
+	void closeDatabase();
+	// Reads an old auth.txt into the database, throws if that fails
+	void importFile(const std::string &path);
+	// Gets the cached or stored data of username, false if there's none
+	bool find(const std::string &username, AuthData &ad);
+	// Caches and stores the data of username, false if it wasn't stored
+	bool write(const std::string &username, const AuthData &ad);
+
 	JMutex m_mutex;
-	std::string m_authfilepath;
+	std::string m_savedir;
+	sqlite3 *m_database;
+	sqlite3_stmt *m_database_read;
+	sqlite3_stmt *m_database_write;
+	// Accounts read or written so far
 	core::map<std::string, AuthData> m_authdata;
-	bool m_modified;
 };
 
 #endif
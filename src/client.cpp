@@ -161,7 +161,8 @@ void * MeshUpdateThread::Thread()
 			continue;
 		}
 
-		ScopeProfiler sp(g_profiler, "Client: Mesh making");
+		static u32 prof_mesh = g_profiler->getId("Client: Mesh making");
+		ScopeProfiler sp(g_profiler, prof_mesh);
 
 		if (q->data && q->data->m_refresh_only) {
 			MapBlock *block = m_env->getMap().getBlockNoCreateNoEx(q->p);
@@ -410,7 +411,8 @@ void Client::step(float dtime)
 	*/
 	const float map_timer_and_unload_dtime = 5.25;
 	if (m_map_timer_and_unload_interval.step(dtime, map_timer_and_unload_dtime)) {
-		ScopeProfiler sp(g_profiler, "Client: map timer and unload");
+		static u32 prof_unload = g_profiler->getId("Client: map timer and unload");
+		ScopeProfiler sp(g_profiler, prof_unload);
 		core::list<v3s16> deleted_blocks;
 		m_env.getMap().timerUpdate(map_timer_and_unload_dtime,
 				g_settings->getFloat("client_unload_unused_data_timeout"),
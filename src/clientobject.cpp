@@ -33,7 +33,10 @@
 */
 
 ClientActiveObject::ClientActiveObject(u16 id):
-	ActiveObject(id)
+	ActiveObject(id),
+	m_net_base_position(0,0,0),
+	m_net_base_seq(0),
+	m_net_has_base(false)
 {
 }
 
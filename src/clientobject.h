@@ -83,6 +83,11 @@ public:
 	// get the content type of whatever this is
 	virtual content_t getContent() {return CONTENT_IGNORE;}
 
+	// Base for position deltas from the server, see activeobject.h
+	v3s32 m_net_base_position;
+	u8 m_net_base_seq;
+	bool m_net_has_base;
+
 protected:
 	// Used for creating objects based on type
 	typedef ClientActiveObject* (*Factory)();
@@ -29,7 +29,7 @@
 
 #include "utility.h"
 
-#define PROTOCOL_VERSION 10
+#define PROTOCOL_VERSION 11
 /* the last protocol version used by 0.3.x minetest-c55 clients */
 #define PROTOCOL_DOTTHREE 3
 /* this is the oldest protocol that we will allow to connect
@@ -154,6 +154,10 @@ enum ToClientCommand
 			u16 message length
 			string message
 		}
+
+		Since protocol 11 position updates may be sent as
+		AO_CMD_POSITION_BASE and AO_CMD_POSITION_DELTA messages, see
+		activeobject.h
 	*/
 
 	TOCLIENT_HP = 0x33,
@@ -82,7 +82,8 @@ void Clouds::render()
 	if (SceneManager->getSceneNodeRenderPass() != scene::ESNRP_SOLID)
 		return;
 
-	ScopeProfiler sp(g_profiler, "Rendering of clouds, avg", SPT_AVG);
+	static u32 prof_render = g_profiler->getId("Rendering of clouds, avg");
+	ScopeProfiler sp(g_profiler, prof_render, SPT_AVG);
 
 	driver->setTransform(video::ETS_WORLD, AbsoluteTransformation);
 	driver->setMaterial(m_material);
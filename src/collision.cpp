@@ -30,6 +30,8 @@
 #include "main.h" // g_profiler
 #include "profiler.h"
 #include "content_mapnode.h"
+#include <jmutex.h>
+#include <jmutexautolock.h>
 
 // Helper function:
 // Checks for collision of a moving aabbox with a static aabbox
@@ -160,10 +162,83 @@ int axisAlignedCollision(
 	return -1;
 }
 
+/*
+	A box that a moving object may collide with
+*/
+struct NearbyCollisionInfo
+{
+	aabb3f box;
+	v3s16 position;
+	bool is_unloaded;
+	bool is_step_up;
+};
+
+/*
+	collisionMoveSimple() collects boxes into a vector that is kept for
+	the next call, so that it doesn't have to allocate every time. The
+	vectors are pooled, so each thread moving things at the same time
+	gets its own.
+*/
+class CollisionScratchPool
+{
+public:
+	CollisionScratchPool()
+	{
+		m_mutex.Init();
+	}
+	~CollisionScratchPool()
+	{
+		for (u32 i=0; i<m_free.size(); i++) {
+			delete m_free[i];
+		}
+	}
+
+	std::vector<NearbyCollisionInfo> *get()
+	{
+		{
+			JMutexAutoLock lock(m_mutex);
+			if (m_free.size() > 0) {
+				std::vector<NearbyCollisionInfo> *v = m_free.back();
+				m_free.pop_back();
+				return v;
+			}
+		}
+		return new std::vector<NearbyCollisionInfo>;
+	}
+
+	void put(std::vector<NearbyCollisionInfo> *v)
+	{
+		v->clear();
+		JMutexAutoLock lock(m_mutex);
+		m_free.push_back(v);
+	}
+
+private:
+	JMutex m_mutex;
+	std::vector<std::vector<NearbyCollisionInfo>*> m_free;
+};
+
+static CollisionScratchPool g_collision_scratch;
+
+// Gets a vector from the pool and gives it back when going out of scope
+class CollisionScratch
+{
+public:
+	CollisionScratch():
+		boxes(*g_collision_scratch.get())
+	{}
+	~CollisionScratch()
+	{
+		g_collision_scratch.put(&boxes);
+	}
+
+	std::vector<NearbyCollisionInfo> &boxes;
+};
+
 // Helper function:
 // Checks if moving the movingbox up by the given distance would hit a ceiling.
 bool wouldCollideWithCeiling(
-		const std::vector<aabb3f> &staticboxes,
+		const std::vector<NearbyCollisionInfo> &cinfo,
 		const aabb3f &movingbox,
 		f32 y_increase, f32 d)
 {
@@ -171,11 +246,11 @@ bool wouldCollideWithCeiling(
 
 	assert(y_increase >= 0);
 
-	for(std::vector<aabb3f>::const_iterator
-			i = staticboxes.begin();
-			i != staticboxes.end(); i++)
+	for(std::vector<NearbyCollisionInfo>::const_iterator
+			i = cinfo.begin();
+			i != cinfo.end(); i++)
 	{
-		const aabb3f& staticbox = *i;
+		const aabb3f& staticbox = i->box;
 		if((movingbox.MaxEdge.Y - d <= staticbox.MinEdge.Y) &&
 				(movingbox.MaxEdge.Y + y_increase > staticbox.MinEdge.Y) &&
 				(movingbox.MinEdge.X < staticbox.MaxEdge.X) &&
@@ -188,13 +263,37 @@ bool wouldCollideWithCeiling(
 	return false;
 }
 
+/* Adds box at node p to the boxes if it is within the swept area */
+static void addCollisionBox(std::vector<NearbyCollisionInfo> &cinfo,
+		const aabb3f &sweep, const aabb3f &box, v3s16 p, bool is_unloaded)
+{
+	aabb3f b = box;
+	v3f off = intToFloat(p, BS);
+	b.MinEdge += off;
+	b.MaxEdge += off;
+	if (!b.intersectsWithBox(sweep))
+		return;
+	NearbyCollisionInfo info;
+	info.box = b;
+	info.position = p;
+	info.is_unloaded = is_unloaded;
+	info.is_step_up = false;
+	cinfo.push_back(info);
+}
+
 collisionMoveResult collisionMoveSimple(Map *map,
 		f32 pos_max_d, const aabb3f &box_0,
 		f32 stepheight, f32 dtime,
 		v3f &pos_f, v3f &speed_f, v3f &accel_f)
 {
+	// Run for every moving object, so the counters are kept by id
+	static u32 prof_move = g_profiler->getId("collisionMoveSimple avg");
+	static u32 prof_collect = g_profiler->getId("collisionMoveSimple collect boxes avg");
+	static u32 prof_boxes = g_profiler->getId("collisionMoveSimple boxes avg");
+	static u32 prof_loop = g_profiler->getId("collisionMoveSimple dtime loop avg");
+
 	//TimeTaker tt("collisionMoveSimple");
-	    ScopeProfiler sp(g_profiler, "collisionMoveSimple avg", SPT_AVG);
+	ScopeProfiler sp(g_profiler, prof_move, SPT_AVG);
 
 	collisionMoveResult result;
 
@@ -216,20 +315,42 @@ collisionMoveResult collisionMoveSimple(Map *map,
 	speed_f.X = rangelim(speed_f.X,-5000,5000);
 	speed_f.Z = rangelim(speed_f.Z,-5000,5000);
 
+	/*
+		Collision uncertainty radius
+		Make it a bit larger than the maximum distance of movement
+	*/
+	f32 d = pos_max_d * 1.1;
+
+	// This should always apply, otherwise there are glitches
+	assert(d > pos_max_d);
+
 	/*
 	Collect node boxes in movement range
 	*/
-	std::vector<aabb3f> cboxes;
-	std::vector<bool> is_unloaded;
-	std::vector<bool> is_step_up;
-	std::vector<bool> is_object;
-	std::vector<v3s16> node_positions;
+	CollisionScratch scratch;
+	std::vector<NearbyCollisionInfo> &cinfo = scratch.boxes;
 	{
 		//TimeTaker tt2("collisionMoveSimple collect boxes");
-		ScopeProfiler sp(g_profiler, "collisionMoveSimple collect boxes avg", SPT_AVG);
+		ScopeProfiler sp(g_profiler, prof_collect, SPT_AVG);
+
+		/*
+			Only boxes the object could touch on the way matter: those
+			in the area swept by the box, with room for the collision
+			allowance, checking for ground and stepping up.
+		*/
+		v3f newpos_f = pos_f + speed_f * dtime;
+		f32 margin = MYMAX(d, 0.15*BS);
+		aabb3f sweep(
+			MYMIN(pos_f.X, newpos_f.X) + box_0.MinEdge.X - margin,
+			MYMIN(pos_f.Y, newpos_f.Y) + box_0.MinEdge.Y - margin,
+			MYMIN(pos_f.Z, newpos_f.Z) + box_0.MinEdge.Z - margin,
+			MYMAX(pos_f.X, newpos_f.X) + box_0.MaxEdge.X + margin,
+			MYMAX(pos_f.Y, newpos_f.Y) + box_0.MaxEdge.Y + margin + stepheight,
+			MYMAX(pos_f.Z, newpos_f.Z) + box_0.MaxEdge.Z + margin
+		);
 
 		v3s16 oldpos_i = floatToInt(pos_f, BS);
-		v3s16 newpos_i = floatToInt(pos_f + speed_f * dtime, BS);
+		v3s16 newpos_i = floatToInt(newpos_f, BS);
 		s16 min_x = MYMIN(oldpos_i.X, newpos_i.X) + (box_0.MinEdge.X / BS) - 1;
 		s16 min_y = MYMIN(oldpos_i.Y, newpos_i.Y) + (box_0.MinEdge.Y / BS) - 1;
 		s16 min_z = MYMIN(oldpos_i.Z, newpos_i.Z) + (box_0.MinEdge.Z / BS) - 1;
@@ -237,6 +358,8 @@ collisionMoveResult collisionMoveSimple(Map *map,
 		s16 max_y = MYMAX(oldpos_i.Y, newpos_i.Y) + (box_0.MaxEdge.Y / BS) + 1;
 		s16 max_z = MYMAX(oldpos_i.Z, newpos_i.Z) + (box_0.MaxEdge.Z / BS) + 1;
 
+		const aabb3f unloaded_box(-BS/2,-BS/2,-BS/2, BS/2,BS/2,BS/2);
+
 		for (s16 x = min_x; x <= max_x; x++) {
 		for (s16 y = min_y; y <= max_y; y++) {
 		for (s16 z = min_z; z <= max_z; z++) {
@@ -246,20 +369,13 @@ collisionMoveResult collisionMoveSimple(Map *map,
 			MapNode n = map->getNodeNoEx(p,&pos_ok);
 			if (!pos_ok) {
 				// Collide with unloaded nodes
-				aabb3f box = getNodeBox(p, BS);
-				cboxes.push_back(box);
-				is_unloaded.push_back(true);
-				is_step_up.push_back(false);
-				node_positions.push_back(p);
-				is_object.push_back(false);
+				addCollisionBox(cinfo, sweep, unloaded_box, p, true);
 				continue;
 			}
 			const ContentFeatures &f = content_features(n);
 			if(f.walkable == false)
 				continue;
 
-			std::vector<NodeBox> nodeboxes = f.getNodeBoxes(n);
-
 #ifndef SERVER
 			if (f.draw_type == CDT_FENCELIKE || f.draw_type == CDT_WALLLIKE) {
 				static const int boxcheck[4][2] = {
@@ -268,101 +384,52 @@ collisionMoveResult collisionMoveSimple(Map *map,
 					{1,2},
 					{1,3}
 				};
-				nodeboxes = content_features(CONTENT_STONE_WALL).getNodeBoxes(n);
+				const std::vector<aabb3f> &nodeboxes =
+					content_features(CONTENT_STONE_WALL).getCollisionBoxes(n);
 				int bps = ((nodeboxes.size()-2)/4); // boxes per section
 				u8 np = 1;
-				{
-					aabb3f box = nodeboxes[0].m_box;
-					box.MinEdge += v3f(x, y, z)*BS;
-					if (f.jumpable == false)
-						box.MaxEdge.Y = 1.0*BS;
-					box.MaxEdge += v3f(x, y, z)*BS;
-					cboxes.push_back(box);
-					is_unloaded.push_back(false);
-					is_step_up.push_back(false);
-					node_positions.push_back(p);
-					is_object.push_back(false);
-				}
+				addCollisionBox(cinfo, sweep, nodeboxes[0], p, false);
 				for (int k=0; k<8; k++) {
 					if ((n.param2&(np<<k)) == 0)
 						continue;
 					if (k > 3) {
 						for (int j=0; j<2; j++) {
 							for (int i=0; i<bps; i++) {
-								aabb3f box = nodeboxes[i+2+(bps*boxcheck[k%4][j])].m_box;
-								box.MinEdge += v3f(x, y, z)*BS;
-								if (f.jumpable == false)
-									box.MaxEdge.Y = 1.0*BS;
-								box.MaxEdge += v3f(x, y, z)*BS;
-								cboxes.push_back(box);
-								is_unloaded.push_back(false);
-								is_step_up.push_back(false);
-								node_positions.push_back(p);
-								is_object.push_back(false);
+								addCollisionBox(cinfo, sweep,
+									nodeboxes[i+2+(bps*boxcheck[k%4][j])], p, false);
 							}
 						}
 					}else{
 						for (int i=0; i<bps; i++) {
-							aabb3f box = nodeboxes[i+2+(bps*(k%4))].m_box;
-							box.MinEdge += v3f(x, y, z)*BS;
-							if (f.jumpable == false)
-								box.MaxEdge.Y = 1.0*BS;
-							box.MaxEdge += v3f(x, y, z)*BS;
-							cboxes.push_back(box);
-							is_unloaded.push_back(false);
-							is_step_up.push_back(false);
-							node_positions.push_back(p);
-							is_object.push_back(false);
+							addCollisionBox(cinfo, sweep,
+								nodeboxes[i+2+(bps*(k%4))], p, false);
 						}
 					}
 				}
-				nodeboxes.clear();
 			}else
 #endif
 			{
 				/* TODO: obb for rotated nodeboxes */
-				for (std::vector<NodeBox>::iterator i = nodeboxes.begin(); i != nodeboxes.end(); i++) {
-					aabb3f box = (*i).m_box;
-					box.MinEdge += v3f(x, y, z)*BS;
-					if (f.jumpable == false)
-						box.MaxEdge.Y = 1.0*BS;
-					box.MaxEdge += v3f(x, y, z)*BS;
-					cboxes.push_back(box);
-					is_unloaded.push_back(false);
-					is_step_up.push_back(false);
-					node_positions.push_back(p);
-					is_object.push_back(false);
+				const std::vector<aabb3f> &nodeboxes = f.getCollisionBoxes(n);
+				for (std::vector<aabb3f>::const_iterator i = nodeboxes.begin(); i != nodeboxes.end(); i++) {
+					addCollisionBox(cinfo, sweep, *i, p, false);
 				}
-				nodeboxes.clear();
 			}
 		}
 		}
 		}
 	} // tt2
-
-	assert(cboxes.size() == is_unloaded.size());
-	assert(cboxes.size() == is_step_up.size());
-	assert(cboxes.size() == node_positions.size());
-	assert(cboxes.size() == is_object.size());
+	g_profiler->avg(prof_boxes, cinfo.size());
 
 	/*
 		Collision detection
 	*/
 
-	/*
-		Collision uncertainty radius
-		Make it a bit larger than the maximum distance of movement
-	*/
-	f32 d = pos_max_d * 1.1;
-
-	// This should always apply, otherwise there are glitches
-	assert(d > pos_max_d);
-
 	int loopcount = 0;
 
 	while (dtime > BS*1e-10) {
 		//TimeTaker tt3("collisionMoveSimple dtime loop");
-			ScopeProfiler sp(g_profiler, "collisionMoveSimple dtime loop avg", SPT_AVG);
+		ScopeProfiler sp(g_profiler, prof_loop, SPT_AVG);
 
 		// Avoid infinite loop
 		loopcount++;
@@ -383,15 +450,15 @@ collisionMoveResult collisionMoveSimple(Map *map,
 		/*
 		Go through every nodebox, find nearest collision
 		*/
-		for (u32 boxindex = 0; boxindex < cboxes.size(); boxindex++) {
+		for (u32 boxindex = 0; boxindex < cinfo.size(); boxindex++) {
 			// Ignore if already stepped up this nodebox.
-			if (is_step_up[boxindex])
+			if (cinfo[boxindex].is_step_up)
 				continue;
 
 			// Find nearest collision of the two boxes (raytracing-like)
 			f32 dtime_tmp;
 			int collided = axisAlignedCollision(
-				cboxes[boxindex],
+				cinfo[boxindex].box,
 				movingbox,
 				speed_f,
 				d,
@@ -413,13 +480,13 @@ collisionMoveResult collisionMoveSimple(Map *map,
 		}else{
 			// Otherwise, a collision occurred.
 
-			const aabb3f& cbox = cboxes[nearest_boxindex];
+			const aabb3f& cbox = cinfo[nearest_boxindex].box;
 
 			// Check for stairs.
 			bool step_up = (nearest_collided != 1) && // must not be Y direction
 					(movingbox.MinEdge.Y < cbox.MaxEdge.Y) &&
 					(movingbox.MinEdge.Y + stepheight > cbox.MaxEdge.Y) &&
-					(!wouldCollideWithCeiling(cboxes, movingbox,
+					(!wouldCollideWithCeiling(cinfo, movingbox,
 							cbox.MaxEdge.Y - movingbox.MinEdge.Y,
 							d));
 
@@ -440,17 +507,17 @@ collisionMoveResult collisionMoveSimple(Map *map,
 			}
 
 			bool is_collision = true;
-			if (is_unloaded[nearest_boxindex])
+			if (cinfo[nearest_boxindex].is_unloaded)
 				is_collision = false;
 
 			CollisionInfo info;
-			info.node_p = node_positions[nearest_boxindex];
+			info.node_p = cinfo[nearest_boxindex].position;
 			info.old_speed = speed_f;
 
 			// Set the speed component that caused the collision to zero
 			if (step_up) {
 				// Special case: Handle stairs
-				is_step_up[nearest_boxindex] = true;
+				cinfo[nearest_boxindex].is_step_up = true;
 				is_collision = false;
 			}else{
 				switch (nearest_collided) {
@@ -484,8 +551,8 @@ collisionMoveResult collisionMoveSimple(Map *map,
 	aabb3f box = box_0;
 	box.MinEdge += pos_f;
 	box.MaxEdge += pos_f;
-	for (u32 boxindex = 0; boxindex < cboxes.size(); boxindex++) {
-		const aabb3f& cbox = cboxes[boxindex];
+	for (u32 boxindex = 0; boxindex < cinfo.size(); boxindex++) {
+		const aabb3f& cbox = cinfo[boxindex].box;
 
 		/*
 			See if the object is touching ground.
@@ -502,7 +569,7 @@ collisionMoveResult collisionMoveSimple(Map *map,
 			cbox.MaxEdge.Z-d > box.MinEdge.Z &&
 			cbox.MinEdge.Z+d < box.MaxEdge.Z
 		) {
-			if (is_step_up[boxindex]) {
+			if (cinfo[boxindex].is_step_up) {
 				pos_f.Y += (cbox.MaxEdge.Y - box.MinEdge.Y);
 				box = box_0;
 				box.MinEdge += pos_f;
@@ -510,7 +577,7 @@ collisionMoveResult collisionMoveSimple(Map *map,
 			}
 			if (fabs(cbox.MaxEdge.Y-box.MinEdge.Y) < 0.15*BS) {
 				result.touching_ground = true;
-				if (is_unloaded[boxindex])
+				if (cinfo[boxindex].is_unloaded)
 					result.standing_on_unloaded = true;
 			}
 		}
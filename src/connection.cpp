@@ -32,109 +32,194 @@
 namespace con
 {
 
-BufferedPacket makePacket(Address &address, u8 *data, u32 datasize,
-		u32 protocol_id, u16 sender_peer_id, u8 channel)
-{
-	u32 packet_size = datasize + BASE_HEADER_SIZE;
-	BufferedPacket p(packet_size);
-	p.address = address;
+/*
+	PacketBuffer
+*/
 
-	writeU32(&p.data[0], protocol_id);
-	writeU16(&p.data[4], sender_peer_id);
-	writeU8(&p.data[6], channel);
+/*
+	Freed blocks are kept in lists by size class, each class twice the
+	size of the previous one. Bigger blocks aren't kept.
+*/
+#define PACKET_POOL_MIN_SIZE 64
+#define PACKET_POOL_CLASSES 6
+#define PACKET_POOL_MAX_FREE 256
 
-	memcpy(&p.data[BASE_HEADER_SIZE], data, datasize);
+struct PacketBlock
+{
+	unsigned int refcount;
+	// Size class, -1 if not pooled
+	s32 pool_class;
+	PacketBlock *next;
 
-	return p;
-}
+	u8 *data()
+	{
+		return (u8*)(this+1);
+	}
+};
 
-BufferedPacket makePacket(Address &address, SharedBuffer<u8> &data,
-		u32 protocol_id, u16 sender_peer_id, u8 channel)
+class PacketPool
 {
-	return makePacket(address, *data, data.getSize(),
-			protocol_id, sender_peer_id, channel);
-}
+public:
+	PacketPool()
+	{
+		m_mutex.Init();
+		for(u32 i=0; i<PACKET_POOL_CLASSES; i++)
+		{
+			m_free[i] = NULL;
+			m_free_count[i] = 0;
+		}
+	}
+	~PacketPool()
+	{
+		for(u32 i=0; i<PACKET_POOL_CLASSES; i++)
+		{
+			while(m_free[i])
+			{
+				PacketBlock *b = m_free[i];
+				m_free[i] = b->next;
+				delete[] (u8*)b;
+			}
+		}
+	}
 
-SharedBuffer<u8> makeOriginalPacket(
-		SharedBuffer<u8> data)
-{
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	PacketBlock* get(u32 size)
+	{
+		s32 c = 0;
+		u32 capacity = PACKET_POOL_MIN_SIZE;
+		while(capacity < size)
+		{
+			capacity *= 2;
+			c++;
+		}
+		if(c >= PACKET_POOL_CLASSES)
+		{
+			c = -1;
+			capacity = size;
+		}
+		else
+		{
+			JMutexAutoLock lock(m_mutex);
+			PacketBlock *b = m_free[c];
+			if(b)
+			{
+				m_free[c] = b->next;
+				m_free_count[c]--;
+				return b;
+			}
+		}
+		PacketBlock *b = (PacketBlock*)new u8[sizeof(PacketBlock) + capacity];
+		b->pool_class = c;
+		b->next = NULL;
+		return b;
+	}
+
+	void put(PacketBlock *b)
+	{
+		s32 c = b->pool_class;
+		if(c >= 0)
+		{
+			JMutexAutoLock lock(m_mutex);
+			if(m_free_count[c] < PACKET_POOL_MAX_FREE)
+			{
+				b->next = m_free[c];
+				m_free[c] = b;
+				m_free_count[c]++;
+				return;
+			}
+		}
+		delete[] (u8*)b;
+	}
 
-	writeU8(&b[0], TYPE_ORIGINAL);
+private:
+	JMutex m_mutex;
+	PacketBlock *m_free[PACKET_POOL_CLASSES];
+	u32 m_free_count[PACKET_POOL_CLASSES];
+};
 
-	memcpy(&b[header_size], *data, data.getSize());
+static PacketPool g_packet_pool;
 
-	return b;
+PacketBuffer::PacketBuffer(u32 size):
+	m_block(NULL),
+	m_data(NULL),
+	m_size(size)
+{
+	if(m_size == 0)
+		return;
+	m_block = g_packet_pool.get(m_size);
+	m_block->refcount = 1;
+	m_data = m_block->data();
 }
 
-core::list<SharedBuffer<u8> > makeSplitPacket(
-		SharedBuffer<u8> data,
-		u32 chunksize_max,
-		u16 seqnum)
+PacketBuffer::PacketBuffer(const u8 *data, u32 size):
+	m_block(NULL),
+	m_data(NULL),
+	m_size(size)
 {
-	// Chunk packets, containing the TYPE_SPLIT header
-	core::list<SharedBuffer<u8> > chunks;
-
-	u32 chunk_header_size = 7;
-	u32 maximum_data_size = chunksize_max - chunk_header_size;
-	u32 start = 0;
-	u32 end = 0;
-	u32 chunk_num = 0;
-	do{
-		end = start + maximum_data_size - 1;
-		if(end > data.getSize() - 1)
-			end = data.getSize() - 1;
+	if(m_size == 0)
+		return;
+	m_block = g_packet_pool.get(m_size);
+	m_block->refcount = 1;
+	m_data = m_block->data();
+	memcpy(m_data, data, m_size);
+}
 
-		u32 payload_size = end - start + 1;
-		u32 packet_size = chunk_header_size + payload_size;
+PacketBuffer::PacketBuffer(const PacketBuffer &buffer):
+	m_block(buffer.m_block),
+	m_data(buffer.m_data),
+	m_size(buffer.m_size)
+{
+	if(m_block)
+		sharedbuffer_ref(&m_block->refcount);
+}
 
-		SharedBuffer<u8> chunk(packet_size);
+PacketBuffer & PacketBuffer::operator=(const PacketBuffer &buffer)
+{
+	if(this == &buffer)
+		return *this;
+	drop();
+	m_block = buffer.m_block;
+	m_data = buffer.m_data;
+	m_size = buffer.m_size;
+	if(m_block)
+		sharedbuffer_ref(&m_block->refcount);
+	return *this;
+}
 
-		writeU8(&chunk[0], TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
-		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+PacketBuffer::~PacketBuffer()
+{
+	drop();
+}
 
-		chunks.push_back(chunk);
+void PacketBuffer::drop()
+{
+	if(m_block == NULL)
+		return;
+	if(sharedbuffer_unref(&m_block->refcount) == 0)
+		g_packet_pool.put(m_block);
+	m_block = NULL;
+}
 
-		start = end + 1;
-		chunk_num++;
-	}
-	while(end != data.getSize() - 1);
+BufferedPacket makePacket(Address &address, u8 *data, u32 datasize,
+		u32 protocol_id, u16 sender_peer_id, u8 channel)
+{
+	u32 packet_size = datasize + BASE_HEADER_SIZE;
+	BufferedPacket p(packet_size);
+	p.address = address;
 
-	u16 chunk_count = chunks.getSize();
+	writeU32(&p.data[0], protocol_id);
+	writeU16(&p.data[4], sender_peer_id);
+	writeU8(&p.data[6], channel);
 
-	core::list<SharedBuffer<u8> >::Iterator i = chunks.begin();
-	for(; i != chunks.end(); i++)
-	{
-		// Write chunk_count
-		writeU16(&((*i)[3]), chunk_count);
-	}
+	memcpy(&p.data[BASE_HEADER_SIZE], data, datasize);
 
-	return chunks;
+	return p;
 }
 
-core::list<SharedBuffer<u8> > makeAutoSplitPacket(
-		SharedBuffer<u8> data,
-		u32 chunksize_max,
-		u16 &split_seqnum)
+BufferedPacket makePacket(Address &address, SharedBuffer<u8> &data,
+		u32 protocol_id, u16 sender_peer_id, u8 channel)
 {
-	u32 original_header_size = 1;
-	core::list<SharedBuffer<u8> > list;
-	if(data.getSize() + original_header_size > chunksize_max)
-	{
-		list = makeSplitPacket(data, chunksize_max, split_seqnum);
-		split_seqnum++;
-		return list;
-	}
-	else
-	{
-		list.push_back(makeOriginalPacket(data));
-	}
-	return list;
+	return makePacket(address, *data, data.getSize(),
+			protocol_id, sender_peer_id, channel);
 }
 
 SharedBuffer<u8> makeReliablePacket(
@@ -163,68 +248,82 @@ SharedBuffer<u8> makeReliablePacket(
 	ReliablePacketBuffer
 */
 
+#define RPB_SLOT(seqnum) ((seqnum) & (RELIABLE_BUFFER_SIZE-1))
+
+ReliablePacketBuffer::ReliablePacketBuffer():
+	m_count(0),
+	m_oldest(0),
+	m_newest(0)
+{
+	for(u32 i=0; i<RELIABLE_BUFFER_SIZE; i++)
+		m_slots[i] = NULL;
+}
+ReliablePacketBuffer::~ReliablePacketBuffer()
+{
+	for(u32 i=0; i<RELIABLE_BUFFER_SIZE; i++)
+		delete m_slots[i];
+}
+
 void ReliablePacketBuffer::print()
 {
-	core::list<BufferedPacket>::Iterator i;
-	i = m_list.begin();
-	for(; i != m_list.end(); i++)
+	if(empty())
+		return;
+	for(u16 s=m_oldest; ; s++)
 	{
-		u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
-		dout_con<<s<<" ";
+		if(m_slots[RPB_SLOT(s)])
+			dout_con<<s<<" ";
+		if(s == m_newest)
+			break;
 	}
 }
 bool ReliablePacketBuffer::empty()
 {
-	return m_list.empty();
+	return m_count == 0;
 }
 u32 ReliablePacketBuffer::size()
 {
-	return m_list.getSize();
+	return m_count;
 }
-RPBSearchResult ReliablePacketBuffer::findPacket(u16 seqnum)
+BufferedPacket* ReliablePacketBuffer::findPacket(u16 seqnum)
 {
-	core::list<BufferedPacket>::Iterator i;
-	i = m_list.begin();
-	for(; i != m_list.end(); i++)
-	{
-		u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
-		/*dout_con<<"findPacket(): finding seqnum="<<seqnum
-				<<", comparing to s="<<s<<std::endl;*/
-		if(s == seqnum)
-			break;
-	}
-	return i;
+	BufferedPacket *p = m_slots[RPB_SLOT(seqnum)];
+	if(p == NULL)
+		return NULL;
+	// The slot may hold a packet from another round of seqnums
+	if(readU16(&(p->data[BASE_HEADER_SIZE+1])) != seqnum)
+		return NULL;
+	return p;
 }
-RPBSearchResult ReliablePacketBuffer::notFound()
+void ReliablePacketBuffer::findOldest()
 {
-	return m_list.end();
+	if(empty())
+		return;
+	while(m_slots[RPB_SLOT(m_oldest)] == NULL)
+		m_oldest++;
 }
 u16 ReliablePacketBuffer::getFirstSeqnum()
 {
 	if(empty())
 		throw NotFoundException("Buffer is empty");
-	BufferedPacket p = *m_list.begin();
-	return readU16(&p.data[BASE_HEADER_SIZE+1]);
+	findOldest();
+	return m_oldest;
 }
 BufferedPacket ReliablePacketBuffer::popFirst()
 {
-	if(empty())
-		throw NotFoundException("Buffer is empty");
-	BufferedPacket p = *m_list.begin();
-	core::list<BufferedPacket>::Iterator i = m_list.begin();
-	m_list.erase(i);
-	return p;
+	return popSeqnum(getFirstSeqnum());
 }
 BufferedPacket ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
-	RPBSearchResult r = findPacket(seqnum);
-	if(r == notFound()){
+	BufferedPacket *p = findPacket(seqnum);
+	if(p == NULL){
 		dout_con<<"Not found"<<std::endl;
 		throw NotFoundException("seqnum not found in buffer");
 	}
-	BufferedPacket p = *r;
-	m_list.erase(r);
-	return p;
+	BufferedPacket r = *p;
+	delete p;
+	m_slots[RPB_SLOT(seqnum)] = NULL;
+	m_count--;
+	return r;
 }
 void ReliablePacketBuffer::insert(BufferedPacket &p)
 {
@@ -233,82 +332,97 @@ void ReliablePacketBuffer::insert(BufferedPacket &p)
 	assert(type == TYPE_RELIABLE);
 	u16 seqnum = readU16(&p.data[BASE_HEADER_SIZE+1]);
 
-	// Find the right place for the packet and insert it there
-
-	// If list is empty, just add it
-	if(m_list.empty())
+	if(empty())
 	{
-		m_list.push_back(p);
-		// Done.
-		return;
-	}
-	// Otherwise find the right place
-	core::list<BufferedPacket>::Iterator i;
-	i = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	for(; i != m_list.end(); i++){
-		u16 s = readU16(&(i->data[BASE_HEADER_SIZE+1]));
-		if(s == seqnum){
-			throw AlreadyExistsException("Same seqnum in list");
-		}
-		if(seqnum_higher(s, seqnum)){
-			break;
-		}
+		m_oldest = seqnum;
+		m_newest = seqnum;
 	}
-	// If we're at the end of the list, add the packet to the
-	// end of the list
-	if(i == m_list.end())
+	else
 	{
-		m_list.push_back(p);
-		// Done.
-		return;
+		if(findPacket(seqnum))
+			throw AlreadyExistsException("Same seqnum in buffer");
+		findOldest();
+		u16 oldest = m_oldest;
+		u16 newest = m_newest;
+		if(seqnum_higher(oldest, seqnum))
+			oldest = seqnum;
+		if(seqnum_higher(seqnum, newest))
+			newest = seqnum;
+		// Everything has to have a slot of its own
+		if((u16)(newest - oldest) >= RELIABLE_BUFFER_SIZE)
+			throw AlreadyExistsException("Seqnum doesn't fit in buffer");
+		m_oldest = oldest;
+		m_newest = newest;
 	}
-	// Insert before i
-	m_list.insert_before(i, p);
+
+	m_slots[RPB_SLOT(seqnum)] = new BufferedPacket(p);
+	m_count++;
 }
 
-void ReliablePacketBuffer::incrementTimeouts(float dtime)
+bool ReliablePacketBuffer::canInsert(u16 seqnum)
 {
-	core::list<BufferedPacket>::Iterator i;
-	i = m_list.begin();
-	for(; i != m_list.end(); i++){
-		i->time += dtime;
-		i->totaltime += dtime;
+	if(empty())
+		return true;
+	findOldest();
+	return (u16)(seqnum - m_oldest) < RELIABLE_BUFFER_SIZE;
+}
+
+void ReliablePacketBuffer::popOlderThan(u16 seqnum)
+{
+	while(!empty())
+	{
+		u16 first = getFirstSeqnum();
+		if(!seqnum_higher(seqnum, first))
+			break;
+		popSeqnum(first);
 	}
 }
 
-void ReliablePacketBuffer::resetTimedOuts(float timeout)
+void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
-	core::list<BufferedPacket>::Iterator i;
-	i = m_list.begin();
-	for(; i != m_list.end(); i++){
-		if(i->time >= timeout)
-			i->time = 0.0;
+	u32 left = m_count;
+	for(u16 s=m_oldest; left > 0; s++)
+	{
+		BufferedPacket *p = m_slots[RPB_SLOT(s)];
+		if(p == NULL)
+			continue;
+		p->time += dtime;
+		p->totaltime += dtime;
+		left--;
 	}
 }
 
 bool ReliablePacketBuffer::anyTotaltimeReached(float timeout)
 {
-	core::list<BufferedPacket>::Iterator i;
-	i = m_list.begin();
-	for(; i != m_list.end(); i++){
-		if(i->totaltime >= timeout)
+	u32 left = m_count;
+	for(u16 s=m_oldest; left > 0; s++)
+	{
+		BufferedPacket *p = m_slots[RPB_SLOT(s)];
+		if(p == NULL)
+			continue;
+		if(p->totaltime >= timeout)
 			return true;
+		left--;
 	}
 	return false;
 }
 
-core::list<BufferedPacket> ReliablePacketBuffer::getTimedOuts(float timeout)
+void ReliablePacketBuffer::getTimedOuts(float timeout,
+		std::vector<BufferedPacket*> &dst)
 {
-	core::list<BufferedPacket> timed_outs;
-	core::list<BufferedPacket>::Iterator i;
-	i = m_list.begin();
-	for(; i != m_list.end(); i++)
+	u32 left = m_count;
+	for(u16 s=m_oldest; left > 0; s++)
 	{
-		if(i->time >= timeout)
-			timed_outs.push_back(*i);
+		BufferedPacket *p = m_slots[RPB_SLOT(s)];
+		if(p == NULL)
+			continue;
+		if(p->time >= timeout)
+		{
+			dst.push_back(p);
+			p->time = 0.0;
+		}
+		left--;
 	}
-	return timed_outs;
 }
 
 /*
@@ -454,6 +568,8 @@ Peer::Peer(u16 a_id, Address a_address):
 	ping_timer(0.0),
 	resend_timeout(0.5),
 	avg_rtt(-1.0),
+	min_rtt(-1.0),
+	congestion_window(RELIABLE_WINDOW_MIN),
 	has_sent_with_id(false),
 	m_sendtime_accu(0),
 	m_max_packets_per_second(10),
@@ -468,10 +584,18 @@ Peer::~Peer()
 void Peer::reportRTT(float rtt)
 {
 	if(rtt >= 0.0){
-		if(rtt < 0.01){
+		if(min_rtt < 0.0 || rtt < min_rtt)
+			min_rtt = rtt;
+		/*
+			Only slow down if packets start taking longer than the link
+			itself does, which means they are getting queued somewhere.
+			A link that is just far away can go at full speed.
+		*/
+		float queueing = rtt - min_rtt;
+		if(queueing < 0.01){
 			if(m_max_packets_per_second < 100)
 				m_max_packets_per_second += 10;
-		} else if(rtt < 0.2){
+		} else if(queueing < 0.2){
 			if(m_max_packets_per_second < 100)
 				m_max_packets_per_second += 2;
 		} else {
@@ -504,6 +628,32 @@ void Peer::reportRTT(float rtt)
 	if(timeout > RESEND_TIMEOUT_MAX)
 		timeout = RESEND_TIMEOUT_MAX;
 	resend_timeout = timeout;
+
+	/*
+		Keep about two round trips worth of packets in flight so that
+		the packet rate rather than the latency limits sending. The
+		window grows by a packet for each ACK so it doesn't jump up
+		all at once.
+	*/
+	if(rtt >= 0.0 && avg_rtt > 0.0)
+	{
+		float target = m_max_packets_per_second * avg_rtt * 2;
+		if(target < RELIABLE_WINDOW_MIN)
+			target = RELIABLE_WINDOW_MIN;
+		if(target > RELIABLE_WINDOW_MAX)
+			target = RELIABLE_WINDOW_MAX;
+		if(congestion_window + 1 < target)
+			congestion_window += 1;
+		else
+			congestion_window = target;
+	}
+}
+
+void Peer::reportLoss()
+{
+	congestion_window /= 2;
+	if(congestion_window < RELIABLE_WINDOW_MIN)
+		congestion_window = RELIABLE_WINDOW_MIN;
 }
 
 /*
@@ -517,8 +667,13 @@ Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout):
 	m_peer_id(0),
 	m_bc_peerhandler(NULL),
 	m_bc_receive_timeout(0),
-	m_indentation(0)
+	m_indentation(0),
+	m_event_signal(NULL)
 {
+	// TODO: We can not know how many layers of header there are.
+	// For now, just assume there are no other than the base headers.
+	m_receive_buffer = SharedBuffer<u8>(100000 + BASE_HEADER_SIZE);
+
 	m_socket.setTimeoutMs(5);
 
 	Start();
@@ -532,8 +687,13 @@ Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
 	m_peer_id(0),
 	m_bc_peerhandler(peerhandler),
 	m_bc_receive_timeout(0),
-	m_indentation(0)
+	m_indentation(0),
+	m_event_signal(NULL)
 {
+	// TODO: We can not know how many layers of header there are.
+	// For now, just assume there are no other than the base headers.
+	m_receive_buffer = SharedBuffer<u8>(100000 + BASE_HEADER_SIZE);
+
 	m_socket.setTimeoutMs(5);
 
 	Start();
@@ -589,7 +749,10 @@ void * Connection::Thread()
 void Connection::putEvent(ConnectionEvent &e)
 {
 	assert(e.type != CONNEVENT_NONE);
+	e.time_ms = porting::getTimeMs();
 	m_event_queue.push_back(e);
+	if(m_event_signal)
+		m_event_signal->Post();
 }
 
 void Connection::processCommand(ConnectionCommand &c)
@@ -644,12 +807,19 @@ void Connection::send(float dtime)
 		Peer *peer = getPeerNoEx(packet.peer_id);
 		if(!peer)
 			continue;
-		if(peer->channels[packet.channelnum].outgoing_reliables.size() >= 5){
+		Channel *channel = &peer->channels[packet.channelnum];
+		if(channel->outgoing_reliables.size()
+				>= (u32)peer->congestion_window){
+			postponed_packets.push_back(packet);
+		} else if(packet.reliable && !channel->outgoing_reliables.canInsert(
+				channel->next_outgoing_seqnum)){
+			// The oldest unacked one is too far behind to buffer this
 			postponed_packets.push_back(packet);
 		} else if(peer->m_num_sent < peer->m_max_num_sent){
-			rawSendAsPacket(packet.peer_id, packet.channelnum,
-					packet.data, packet.reliable);
-			peer->m_num_sent++;
+			if(rawSendAsPacket(packet))
+				peer->m_num_sent++;
+			else
+				postponed_packets.push_back(packet);
 		} else {
 			postponed_packets.push_back(packet);
 		}
@@ -672,11 +842,9 @@ void Connection::send(float dtime)
 // Receive packets from the network and buffers and create ConnectionEvents
 void Connection::receive()
 {
-	u32 datasize = 100000;
-	// TODO: We can not know how many layers of header there are.
-	// For now, just assume there are no other than the base headers.
-	u32 packet_maxsize = datasize + BASE_HEADER_SIZE;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	SharedBuffer<u8> &packetdata = m_receive_buffer;
+	u32 packet_maxsize = packetdata.getSize();
+	u32 datasize = packet_maxsize - BASE_HEADER_SIZE;
 
 	bool single_wait_done = false;
 
@@ -906,9 +1074,6 @@ void Connection::runTimeouts(float dtime)
 		float resend_timeout = peer->resend_timeout;
 		for(u16 i=0; i<CHANNEL_COUNT; i++)
 		{
-			core::list<BufferedPacket> timed_outs;
-			core::list<BufferedPacket>::Iterator j;
-
 			Channel *channel = &peer->channels[i];
 
 			// Remove timed out incomplete unreliable split packets
@@ -933,14 +1098,13 @@ void Connection::runTimeouts(float dtime)
 
 			// Re-send timed out outgoing reliables
 
-			timed_outs = channel->
-					outgoing_reliables.getTimedOuts(resend_timeout);
-
-			channel->outgoing_reliables.resetTimedOuts(resend_timeout);
+			m_timed_outs.clear();
+			channel->outgoing_reliables.getTimedOuts(resend_timeout,
+					m_timed_outs);
 
-			j = timed_outs.begin();
-			for(; j != timed_outs.end(); j++)
+			for(u32 k=0; k<m_timed_outs.size(); k++)
 			{
+				BufferedPacket *j = m_timed_outs[k];
 				u16 peer_id = readPeerId(*(j->data));
 				u8 channel = readChannel(*(j->data));
 				u16 seqnum = readU16(&(j->data[BASE_HEADER_SIZE+1]));
@@ -962,6 +1126,8 @@ void Connection::runTimeouts(float dtime)
 				// checked channel because it was cached.
 				peer->reportRTT(resend_timeout);
 			}
+			if(m_timed_outs.size() != 0)
+				peer->reportLoss();
 		}
 
 		/*
@@ -974,6 +1140,7 @@ void Connection::runTimeouts(float dtime)
 			SharedBuffer<u8> data(2);
 			writeU8(&data[0], TYPE_CONTROL);
 			writeU8(&data[1], CONTROLTYPE_PING);
+			// Skipped if the channel is full, its resends keep the peer up
 			rawSendAsPacket(peer->id, 0, data, true);
 
 			peer->ping_timer = 0.0;
@@ -1081,17 +1248,35 @@ void Connection::send(u16 peer_id, u8 channelnum,
 	if(reliable)
 		chunksize_max -= RELIABLE_HEADER_SIZE;
 
-	core::list<SharedBuffer<u8> > originals;
-	originals = makeAutoSplitPacket(data, chunksize_max,
-			channel->next_outgoing_split_seqnum);
-
-	core::list<SharedBuffer<u8> >::Iterator i;
-	i = originals.begin();
-	for(; i != originals.end(); i++)
+	if(data.getSize() + ORIGINAL_HEADER_SIZE <= chunksize_max)
 	{
-		SharedBuffer<u8> original = *i;
+		OutgoingPacket packet(peer_id, channelnum, data, reliable);
+		writeU8(&packet.header[0], TYPE_ORIGINAL);
+		packet.header_size = ORIGINAL_HEADER_SIZE;
+		m_outgoing_queue.push_back(packet);
+		return;
+	}
 
-		sendAsPacket(peer_id, channelnum, original, reliable);
+	/*
+		Split it in chunks, which are all sent straight from data
+	*/
+	u16 seqnum = channel->next_outgoing_split_seqnum;
+	channel->next_outgoing_split_seqnum++;
+	u32 chunkdata_max = chunksize_max - SPLIT_HEADER_SIZE;
+	u32 chunk_count = (data.getSize() + chunkdata_max - 1) / chunkdata_max;
+	for(u32 i=0; i<chunk_count; i++)
+	{
+		OutgoingPacket packet(peer_id, channelnum, data, reliable);
+		packet.offset = i * chunkdata_max;
+		packet.size = data.getSize() - packet.offset;
+		if(packet.size > chunkdata_max)
+			packet.size = chunkdata_max;
+		writeU8(&packet.header[0], TYPE_SPLIT);
+		writeU16(&packet.header[1], seqnum);
+		writeU16(&packet.header[3], chunk_count);
+		writeU16(&packet.header[5], i);
+		packet.header_size = SPLIT_HEADER_SIZE;
+		m_outgoing_queue.push_back(packet);
 	}
 }
 
@@ -1102,25 +1287,61 @@ void Connection::sendAsPacket(u16 peer_id, u8 channelnum,
 	m_outgoing_queue.push_back(packet);
 }
 
-void Connection::rawSendAsPacket(u16 peer_id, u8 channelnum,
+bool Connection::rawSendAsPacket(u16 peer_id, u8 channelnum,
 		SharedBuffer<u8> data, bool reliable)
 {
-	Peer *peer = getPeerNoEx(peer_id);
+	OutgoingPacket packet(peer_id, channelnum, data, reliable);
+	return rawSendAsPacket(packet);
+}
+
+bool Connection::rawSendAsPacket(const OutgoingPacket &packet)
+{
+	Peer *peer = getPeerNoEx(packet.peer_id);
+	// Gone, so there's nothing to keep it for
 	if(!peer)
-		return;
-	Channel *channel = &(peer->channels[channelnum]);
+		return true;
+	Channel *channel = &(peer->channels[packet.channelnum]);
+
+	/*
+		A reliable packet that isn't buffered is never resent, and the
+		peer would wait for its seqnum forever
+	*/
+	if(packet.reliable
+			&& !channel->outgoing_reliables.canInsert(channel->next_outgoing_seqnum))
+		return false;
 
-	if(reliable)
+	/*
+		Put all the headers and the data in the buffer it is sent from
+	*/
+	u32 headers_size = BASE_HEADER_SIZE + packet.header_size;
+	if(packet.reliable)
+		headers_size += RELIABLE_HEADER_SIZE;
+	BufferedPacket p(headers_size + packet.size);
+	p.address = peer->address;
+
+	writeU32(&p.data[0], m_protocol_id);
+	writeU16(&p.data[4], m_peer_id);
+	writeU8(&p.data[6], packet.channelnum);
+	u32 pos = BASE_HEADER_SIZE;
+
+	u16 seqnum = 0;
+	if(packet.reliable)
 	{
-		u16 seqnum = channel->next_outgoing_seqnum;
+		seqnum = channel->next_outgoing_seqnum;
 		channel->next_outgoing_seqnum++;
+		writeU8(&p.data[pos], TYPE_RELIABLE);
+		writeU16(&p.data[pos+1], seqnum);
+		pos += RELIABLE_HEADER_SIZE;
+	}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(data, seqnum);
-
-		// Add base headers and make a packet
-		BufferedPacket p = makePacket(peer->address, reliable,
-				m_protocol_id, m_peer_id, channelnum);
+	if(packet.header_size != 0)
+		memcpy(&p.data[pos], packet.header, packet.header_size);
+	pos += packet.header_size;
+	if(packet.size != 0)
+		memcpy(&p.data[pos], &packet.data[packet.offset], packet.size);
 
+	if(packet.reliable)
+	{
 		try{
 			// Buffer the packet
 			channel->outgoing_reliables.insert(p);
@@ -1128,24 +1349,18 @@ void Connection::rawSendAsPacket(u16 peer_id, u8 channelnum,
 		catch(AlreadyExistsException &e)
 		{
 			PrintInfo(derr_con);
-			derr_con<<"WARNING: Going to send a reliable packet "
-					"seqnum="<<seqnum<<" that is already "
-					"in outgoing buffer"<<std::endl;
-			//assert(0);
+			derr_con<<"WARNING: Not sending a reliable packet "
+					"seqnum="<<seqnum<<" that can't be put in "
+					"the outgoing buffer: "<<e.what()<<std::endl;
+			// Nothing has seen the seqnum, so it can be given out again
+			channel->next_outgoing_seqnum--;
+			return false;
 		}
-
-		// Send the packet
-		rawSend(p);
 	}
-	else
-	{
-		// Add base headers and make a packet
-		BufferedPacket p = makePacket(peer->address, data,
-				m_protocol_id, m_peer_id, channelnum);
 
-		// Send the packet
-		rawSend(p);
-	}
+	// Send the packet
+	rawSend(p);
+	return true;
 }
 
 void Connection::rawSend(const BufferedPacket &packet)
@@ -1223,25 +1438,16 @@ bool Connection::getFromBuffers(u16 &peer_id, SharedBuffer<u8> &dst)
 bool Connection::checkIncomingBuffers(Channel *channel, u16 &peer_id,
 		SharedBuffer<u8> &dst)
 {
-	u16 firstseqnum = 0;
 	// Clear old packets from start of buffer
-	try{
-	for(;;){
-		firstseqnum = channel->incoming_reliables.getFirstSeqnum();
-		if(seqnum_higher(channel->next_incoming_seqnum, firstseqnum))
-			channel->incoming_reliables.popFirst();
-		else
-			break;
-	}
-	// This happens if all packets are old
-	}catch(con::NotFoundException)
-	{}
+	channel->incoming_reliables.popOlderThan(channel->next_incoming_seqnum);
 
 	if(channel->incoming_reliables.empty() == false)
 	{
-		if(firstseqnum == channel->next_incoming_seqnum)
+		if(channel->incoming_reliables.findPacket(
+				channel->next_incoming_seqnum) != NULL)
 		{
-			BufferedPacket p = channel->incoming_reliables.popFirst();
+			BufferedPacket p = channel->incoming_reliables.popSeqnum(
+					channel->next_incoming_seqnum);
 
 			peer_id = readPeerId(*p.data);
 			u8 channelnum = readChannel(*p.data);
@@ -1443,6 +1649,12 @@ SharedBuffer<u8> Connection::processPacket(Channel *channel,
 		//DEBUG
 		//assert(channel->incoming_reliables.size() < 100);
 
+		// Don't ACK what can't be buffered, it will be sent again
+		if(is_future_packet && (u16)(seqnum - channel->next_incoming_seqnum)
+				>= RELIABLE_BUFFER_SIZE)
+			throw InvalidIncomingDataException
+					("Reliable packet too far ahead to buffer");
+
 		// Send a CONTROLTYPE_ACK
 		SharedBuffer<u8> reply(4);
 		writeU8(&reply[0], TYPE_CONTROL);
@@ -1467,6 +1679,8 @@ SharedBuffer<u8> Connection::processPacket(Channel *channel,
 					peer_id,
 					channelnum);
 			try{
+				channel->incoming_reliables.popOlderThan(
+						channel->next_incoming_seqnum);
 				channel->incoming_reliables.insert(packet);
 
 				/*PrintInfo();
@@ -1593,9 +1807,15 @@ void Connection::Disconnect()
 }
 
 u32 Connection::Receive(u16 &peer_id, SharedBuffer<u8> &data)
+{
+	u32 time_ms;
+	return Receive(peer_id, data, true, time_ms);
+}
+
+u32 Connection::Receive(u16 &peer_id, SharedBuffer<u8> &data, bool wait, u32 &time_ms)
 {
 	for(;;){
-		ConnectionEvent e = waitEvent(m_bc_receive_timeout);
+		ConnectionEvent e = waitEvent(wait ? m_bc_receive_timeout : 0);
 		if(e.type != CONNEVENT_NONE)
 			dout_con<<getDesc()<<": Receive: got event: "
 					<<e.describe()<<std::endl;
@@ -1604,7 +1824,8 @@ u32 Connection::Receive(u16 &peer_id, SharedBuffer<u8> &data)
 			throw NoIncomingDataException("No incoming data");
 		case CONNEVENT_DATA_RECEIVED:
 			peer_id = e.peer_id;
-			data = SharedBuffer<u8>(e.data);
+			time_ms = e.time_ms;
+			data = e.data;
 			return e.data.getSize();
 		case CONNEVENT_PEER_ADDED: {
 			Peer tmp(e.peer_id, e.address);
@@ -28,6 +28,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
 #include "debug.h"
 #include "common_irrlicht.h"
 #include "socket.h"
@@ -120,9 +121,55 @@ inline bool seqnum_higher(u16 higher, u16 lower)
 	if(lower > higher && lower - higher > SEQNUM_MAX/2){
 		return true;
 	}
+	if(higher > lower && higher - lower > SEQNUM_MAX/2){
+		return false;
+	}
 	return (higher > lower);
 }
 
+struct PacketBlock;
+
+/*
+	A reference counted buffer for a whole datagram. The memory comes
+	from a pool and goes back there when the last reference is dropped,
+	so sending and buffering packets doesn't keep allocating.
+*/
+class PacketBuffer
+{
+public:
+	PacketBuffer():
+		m_block(NULL),
+		m_data(NULL),
+		m_size(0)
+	{}
+	PacketBuffer(u32 size);
+	// Copies the data
+	PacketBuffer(const u8 *data, u32 size);
+	PacketBuffer(const PacketBuffer &buffer);
+	PacketBuffer & operator=(const PacketBuffer &buffer);
+	~PacketBuffer();
+
+	u8 & operator[](u32 i) const
+	{
+		return m_data[i];
+	}
+	u8 * operator*() const
+	{
+		return m_data;
+	}
+	u32 getSize() const
+	{
+		return m_size;
+	}
+
+private:
+	void drop();
+
+	PacketBlock *m_block;
+	u8 *m_data;
+	u32 m_size;
+};
+
 struct BufferedPacket
 {
 	BufferedPacket(u8 *a_data, u32 a_size):
@@ -131,7 +178,7 @@ struct BufferedPacket
 	BufferedPacket(u32 a_size):
 		data(a_size), time(0.0), totaltime(0.0)
 	{}
-	SharedBuffer<u8> data; // Data of the packet, including headers
+	PacketBuffer data; // Data of the packet, including headers
 	float time; // Seconds from buffering the packet or re-sending
 	float totaltime; // Seconds from buffering the packet
 	Address address; // Sender or destination
@@ -143,23 +190,6 @@ BufferedPacket makePacket(Address &address, u8 *data, u32 datasize,
 BufferedPacket makePacket(Address &address, SharedBuffer<u8> &data,
 		u32 protocol_id, u16 sender_peer_id, u8 channel);
 
-// Add the TYPE_ORIGINAL header to the data
-SharedBuffer<u8> makeOriginalPacket(
-		SharedBuffer<u8> data);
-
-// Split data in chunks and add TYPE_SPLIT headers to them
-core::list<SharedBuffer<u8> > makeSplitPacket(
-		SharedBuffer<u8> data,
-		u32 chunksize_max,
-		u16 seqnum);
-
-// Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
-// Increments split_seqnum if a split packet is made
-core::list<SharedBuffer<u8> > makeAutoSplitPacket(
-		SharedBuffer<u8> data,
-		u32 chunksize_max,
-		u16 &split_seqnum);
-
 // Add the TYPE_RELIABLE header to the data
 SharedBuffer<u8> makeReliablePacket(
 		SharedBuffer<u8> data,
@@ -256,6 +286,7 @@ checking at all.
 * [5] u16 chunk_num
 */
 #define TYPE_SPLIT 2
+#define SPLIT_HEADER_SIZE 7
 /*
 * RELIABLE: Delivery of all RELIABLE packets shall be forced by ACKs,
 * and they shall be delivered in the same order as sent. This is done
@@ -274,32 +305,64 @@ checking at all.
 #define SEQNUM_INITIAL 65500
 
 /*
-	A buffer which stores reliable packets and sorts them internally
-	for fast access to the smallest one.
+	Reliable packets are buffered in a window of this many sequence
+	numbers. Has to be a power of two.
 */
+#define RELIABLE_BUFFER_SIZE 512
+// Limits of the amount of unacknowledged reliable packets in a channel
+#define RELIABLE_WINDOW_MIN 5
+#define RELIABLE_WINDOW_MAX (RELIABLE_BUFFER_SIZE/2)
+
+/*
+	A buffer which stores reliable packets in a ring indexed by seqnum,
+	so inserting, finding and removing a packet doesn't need a search.
 
-typedef core::list<BufferedPacket>::Iterator RPBSearchResult;
+	All the packets in it have to fit in RELIABLE_BUFFER_SIZE
+	consecutive sequence numbers.
+*/
 
 class ReliablePacketBuffer
 {
 public:
+	ReliablePacketBuffer();
+	~ReliablePacketBuffer();
 
 	void print();
 	bool empty();
 	u32 size();
-	RPBSearchResult findPacket(u16 seqnum);
-	RPBSearchResult notFound();
+	// NULL if not found
+	BufferedPacket* findPacket(u16 seqnum);
 	u16 getFirstSeqnum();
 	BufferedPacket popFirst();
 	BufferedPacket popSeqnum(u16 seqnum);
+	// Throws AlreadyExistsException if seqnum is already in the buffer
+	// or doesn't fit in the window
 	void insert(BufferedPacket &p);
+	// Whether a packet newer than all in the buffer, with seqnum, fits
+	bool canInsert(u16 seqnum);
+	// Removes all the packets older than seqnum
+	void popOlderThan(u16 seqnum);
 	void incrementTimeouts(float dtime);
-	void resetTimedOuts(float timeout);
 	bool anyTotaltimeReached(float timeout);
-	core::list<BufferedPacket> getTimedOuts(float timeout);
+	/*
+		Adds the packets that haven't been sent in timeout seconds to
+		dst and resets their time. The pointers are valid until the
+		buffer is next modified.
+	*/
+	void getTimedOuts(float timeout, std::vector<BufferedPacket*> &dst);
 
 private:
-	core::list<BufferedPacket> m_list;
+	// Moves m_oldest forward to the first packet in the buffer
+	void findOldest();
+
+	BufferedPacket *m_slots[RELIABLE_BUFFER_SIZE];
+	u32 m_count;
+	// No packet is older than m_oldest or newer than m_newest
+	u16 m_oldest;
+	u16 m_newest;
+
+	ReliablePacketBuffer(const ReliablePacketBuffer &);
+	ReliablePacketBuffer &operator=(const ReliablePacketBuffer &);
 };
 
 /*
@@ -376,11 +439,13 @@ public:
 	virtual ~Peer();
 
 	/*
-		Calculates avg_rtt and resend_timeout.
+		Calculates avg_rtt, resend_timeout and the send limits.
 
 		rtt=-1 only recalculates resend_timeout
 	*/
 	void reportRTT(float rtt);
+	// Called when reliable packets had to be re-sent
+	void reportLoss();
 
 	Channel channels[CHANNEL_COUNT];
 
@@ -396,6 +461,10 @@ public:
 	float resend_timeout;
 	// Updated when an ACK is received
 	float avg_rtt;
+	// Lowest rtt seen, the latency of the link without queueing
+	float min_rtt;
+	// How many reliable packets a channel can have unacknowledged
+	float congestion_window;
 	// This is set to true when the peer has actually sent something
 	// with the id we have given to it
 	bool has_sent_with_id;
@@ -416,7 +485,17 @@ struct OutgoingPacket
 {
 	u16 peer_id;
 	u8 channelnum;
+	/*
+		The packet is made of header followed by size bytes of data
+		starting at offset. The data is shared by all the chunks of a
+		split packet, and by all the peers it is sent to.
+	*/
 	SharedBuffer<u8> data;
+	u32 offset;
+	u32 size;
+	// TYPE_ORIGINAL or TYPE_SPLIT header, none for control packets
+	u8 header[SPLIT_HEADER_SIZE];
+	u8 header_size;
 	bool reliable;
 
 	OutgoingPacket(u16 peer_id_, u8 channelnum_, SharedBuffer<u8> data_,
@@ -424,6 +503,9 @@ struct OutgoingPacket
 		peer_id(peer_id_),
 		channelnum(channelnum_),
 		data(data_),
+		offset(0),
+		size(data_.getSize()),
+		header_size(0),
 		reliable(reliable_)
 	{
 	}
@@ -440,11 +522,13 @@ struct ConnectionEvent
 {
 	enum ConnectionEventType type;
 	u16 peer_id;
-	Buffer<u8> data;
+	SharedBuffer<u8> data;
 	bool timeout;
 	Address address;
+	// When the event was queued, in porting::getTimeMs() time
+	u32 time_ms;
 
-	ConnectionEvent(): type(CONNEVENT_NONE) {}
+	ConnectionEvent(): type(CONNEVENT_NONE), time_ms(0) {}
 
 	std::string describe()
 	{
@@ -499,7 +583,7 @@ struct ConnectionCommand
 	Address address;
 	u16 peer_id;
 	u8 channelnum;
-	Buffer<u8> data;
+	SharedBuffer<u8> data;
 	bool reliable;
 
 	ConnectionCommand(): type(CONNCMD_NONE) {}
@@ -562,6 +646,15 @@ public:
 	bool Connected();
 	void Disconnect();
 	u32 Receive(u16 &peer_id, SharedBuffer<u8> &data);
+	/*
+		Same as Receive(), but doesn't wait for data if wait is false,
+		and sets time_ms to when the data arrived
+	*/
+	u32 Receive(u16 &peer_id, SharedBuffer<u8> &data, bool wait, u32 &time_ms);
+	// Amount of received data and peer changes not picked up yet
+	u32 GetEventQueueSize(){ return m_event_queue.size(); }
+	// Posted whenever a new event is queued, NULL for none
+	void SetEventSignal(JSemaphore *signal){ m_event_signal = signal; }
 	void SendToAll(u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void Send(u16 peer_id, u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void RunTimeouts(float dtime); // dummy
@@ -583,8 +676,13 @@ private:
 	void send(u16 peer_id, u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void sendAsPacket(u16 peer_id, u8 channelnum,
 			SharedBuffer<u8> data, bool reliable);
-	void rawSendAsPacket(u16 peer_id, u8 channelnum,
+	bool rawSendAsPacket(u16 peer_id, u8 channelnum,
 			SharedBuffer<u8> data, bool reliable);
+	/*
+		Adds the headers and sends the packet. Returns false, without
+		sending, if it is reliable and can't be kept for resending.
+	*/
+	bool rawSendAsPacket(const OutgoingPacket &packet);
 	void rawSend(const BufferedPacket &packet);
 	Peer* getPeer(u16 peer_id);
 	Peer* getPeerNoEx(u16 peer_id);
@@ -609,6 +707,10 @@ private:
 	bool deletePeer(u16 peer_id, bool timeout);
 
 	Queue<OutgoingPacket> m_outgoing_queue;
+	// Scratch space for runTimeouts()
+	std::vector<BufferedPacket*> m_timed_outs;
+	// Datagrams are received into this
+	SharedBuffer<u8> m_receive_buffer;
 	MutexedQueue<ConnectionEvent> m_event_queue;
 	MutexedQueue<ConnectionCommand> m_command_queue;
 
@@ -631,6 +733,8 @@ private:
 	void PrintInfo();
 	std::string getDesc();
 	u16 m_indentation;
+
+	JSemaphore *m_event_signal;
 };
 
 } // namespace
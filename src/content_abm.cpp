@@ -0,0 +1,1890 @@
+/************************************************************************
+* content_abm.cpp
+* voxelands - 3d voxel world sandbox game
+* Copyright (C) Lisa 'darkrose' Milne 2013-2015 <lisa@ltmnet.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*
+* License updated from GPLv2 or later to GPLv3 or later by Lisa Milne
+* for Voxelands.
+************************************************************************/
+
+#include "content_abm.h"
+#include "environment.h"
+#include "content_mapnode.h"
+#include "mineral.h"
+#include "nodemetadata.h"
+#include "mapblock.h"
+#include "content_sao.h"
+#include "plantgrowth.h"
+#include "settings.h"
+#include "log.h"
+
+#define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
+
+/*
+	Each of these is run on a node of an active block at the interval
+	and with the chance in abm_list, n is the node at p, state.envticks
+	its environment ticks, already incremented for this run.
+
+	Note that map modifications should be done using the event-making
+	map methods so that the server gets information about them.
+*/
+
+// footsteps in grass fade away
+static void abm_grass_footsteps(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 3) {
+		n.setContent(CONTENT_GRASS);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// footsteps in grass fade away
+static void abm_grass_footsteps_autumn(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 3) {
+		n.setContent(CONTENT_GRASS_AUTUMN);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// convert mud under proper lighting to grass
+static void abm_mud(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_top = map->getNodeNoEx(p+v3s16(0,1,0));
+	if (content_features(n_top).air_equivalent) {
+		if (p.Y > (state.coldzone+10) && p.Y < 1024) {
+			// should only change to snow if there's nothing above it
+			std::vector<content_t> search;
+			search.push_back(CONTENT_SNOW);
+			search.push_back(CONTENT_AIR);
+			if (!env->searchNearInv(p,v3s16(0,0,0),v3s16(0,32,0),search,NULL)) {
+				n.setContent(CONTENT_MUDSNOW);
+				map->addNodeWithEvent(p, n);
+			}
+		}else if (n_top.getLightBlend(env->getDayNightRatio()) >= 13) {
+			if (state.season == ENV_SEASON_AUTUMN || state.season == ENV_SEASON_WINTER) {
+				n.setContent(CONTENT_GROWING_GRASS_AUTUMN);
+			}else{
+				n.setContent(CONTENT_GROWING_GRASS);
+			}
+			n.param2 = 0;
+			map->addNodeWithEvent(p, n);
+		}
+	}
+}
+
+// grass growing over mud
+static void abm_growing_grass_autumn(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_top = map->getNodeNoEx(p+v3s16(0,1,0));
+	if (content_features(n_top).air_equivalent) {
+		if (state.season != ENV_SEASON_WINTER)
+			plantgrowth_grass(env,p);
+	}else{
+		n.setContent(CONTENT_MUD);
+		map->addNodeWithEvent(p,n);
+	}
+}
+
+// grass growing over mud
+static void abm_growing_grass(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.season == ENV_SEASON_WINTER || state.season == ENV_SEASON_AUTUMN) {
+		n.setContent(CONTENT_GROWING_GRASS_AUTUMN);
+		map->addNodeWithEvent(p,n);
+	}
+	abm_growing_grass_autumn(env,state,p,n);
+}
+
+// water freezes near nothing warm in the cold
+static void abm_water(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (p.Y > state.coldzone && p.Y < 1024) {
+		s16 range = (p.Y > state.coldzone) ? 2 : 4;
+		std::vector<content_t> search;
+		search.push_back(CONTENT_LAVASOURCE);
+		search.push_back(CONTENT_LAVA);
+		search.push_back(CONTENT_FIRE);
+		if (env->searchNear(p,v3s16(range,1,range),search,NULL)) {
+			n.setContent(CONTENT_ICE);
+			map->addNodeWithEvent(p, n);
+		}
+	}
+}
+
+// ice melts near lava and fire, and below ground
+static void abm_ice(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	bool found = false;
+	if (p.Y > 0) {
+		s16 range = (p.Y > state.coldzone) ? 2 : 4;
+		std::vector<content_t> search;
+		search.push_back(CONTENT_LAVASOURCE);
+		search.push_back(CONTENT_LAVA);
+		search.push_back(CONTENT_FIRE);
+		found = env->searchNear(p,v3s16(range,1,range),search,NULL);
+	}else{
+		found = true;
+	}
+	if (found) {
+		if (env->searchNear(p,v3s16(5,1,5),CONTENT_WATERSOURCE,NULL)) {
+			n.setContent(CONTENT_WATER);
+			map->addNodeWithEvent(p, n);
+		}else{
+			n.setContent(CONTENT_WATERSOURCE);
+			map->addNodeWithEvent(p, n);
+		}
+	}
+}
+
+// snow melts or falls
+static void abm_snow(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_test = map->getNodeNoEx(p+v3s16(0,-1,0));
+	if (n_test.getContent() == CONTENT_AIR || p.Y < (state.coldzone-10))
+		map->removeNodeWithEvent(p);
+}
+
+// snow melts near lava and fire, and below ground
+static void abm_snow_block(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (p.Y < 1) {
+		if (env->searchNear(p,v3s16(3,1,3),CONTENT_WATERSOURCE,NULL)) {
+			n.setContent(CONTENT_WATER);
+			map->addNodeWithEvent(p, n);
+		}else{
+			n.setContent(CONTENT_WATERSOURCE);
+			map->addNodeWithEvent(p, n);
+		}
+	}else{
+		std::vector<content_t> search;
+		search.push_back(CONTENT_LAVASOURCE);
+		search.push_back(CONTENT_LAVA);
+		search.push_back(CONTENT_FIRE);
+		if (env->searchNear(p,v3s16(3,1,3),search,NULL)) {
+			n.setContent(CONTENT_WATERSOURCE);
+			map->addNodeWithEvent(p, n);
+		}
+	}
+}
+
+// grow stuff on farm dirt
+static void abm_farm_dirt(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	s16 max_d = 3;
+	v3s16 temp_p = p;
+	v3s16 test_p;
+	MapNode testnode;
+	u8 water_found = 0; // 1 = flowing, 2 = source
+	bool ignore_found = false;
+	for(s16 z=-max_d; water_found < 2 && z<=max_d; z++) {
+	for(s16 x=-max_d; water_found < 2 && x<=max_d; x++) {
+		test_p = temp_p + v3s16(x,0,z);
+		testnode = map->getNodeNoEx(test_p);
+		if (testnode.getContent() == CONTENT_WATERSOURCE) {
+			water_found = 2;
+		}else if (testnode.getContent() == CONTENT_WATER) {
+			water_found = 1;
+		}else if (testnode.getContent() == CONTENT_IGNORE) {
+			ignore_found = true;
+		}
+	}
+	}
+
+	if (water_found) {
+		test_p = temp_p + v3s16(0,1,0);
+		testnode = map->getNodeNoEx(test_p);
+		if (content_features(testnode).draw_type == CDT_PLANTLIKE) {
+			if (content_features(testnode).param2_type == CPT_PLANTGROWTH) {
+				plantgrowth_plant(env,test_p);
+			}else if (content_features(testnode).special_alternate_node != CONTENT_IGNORE) {
+				plantgrowth_seed(env,test_p);
+			}
+		}else if (content_features(testnode).draw_type == CDT_MELONLIKE) {
+			if (content_features(testnode).param2_type == CPT_PLANTGROWTH)
+				plantgrowth_plant(env,test_p);
+		}else if (testnode.getContent() == CONTENT_CACTUS) {
+			plantgrowth_cactus(env,test_p);
+		}else if (testnode.getContent() == CONTENT_FERTILIZER) {
+			plantgrowth_fertilizer(env,test_p);
+		}else if (testnode.getContent() == CONTENT_AIR) {
+			int chance = 5;
+			if (water_found == 1)
+				chance = 2;
+			if (myrand()%chance == 0) {
+				// revert to mud
+				n.setContent(CONTENT_MUD);
+				map->addNodeWithEvent(p,n);
+			}else{
+				// grow flower
+				n.setContent(CONTENT_FLOWER_STEM);
+				map->addNodeWithEvent(test_p,n);
+			}
+		}
+	}else if (!ignore_found) {
+		// revert to mud
+		n.setContent(CONTENT_MUD);
+		map->addNodeWithEvent(p,n);
+	}
+}
+
+// make vines die
+static void abm_farm_grapevine(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_btm = map->getNodeNoEx(p+v3s16(0,-1,0));
+	if (
+		n_btm.getContent() != CONTENT_FARM_GRAPEVINE
+		&& n_btm.getContent() != CONTENT_FARM_DIRT
+		&& n_btm.getContent() != CONTENT_MUD
+	) {
+		n.setContent(CONTENT_DEAD_VINE);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// make vines die
+static void abm_farm_trellis_grape(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_btm = map->getNodeNoEx(p+v3s16(0,-1,0));
+	if (
+		n_btm.getContent() != CONTENT_FARM_TRELLIS_GRAPE
+		&& n_btm.getContent() != CONTENT_FARM_DIRT
+		&& n_btm.getContent() != CONTENT_MUD
+	) {
+		n.setContent(CONTENT_TRELLIS_DEAD_VINE);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// convert grass into mud if under something else than air
+static void abm_grass(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_top = map->getNodeNoEx(p+v3s16(0,1,0));
+	ContentFeatures &f = content_features(n_top);
+	if (f.air_equivalent) {
+		if (state.envticks > 2) {
+			if (
+				p.Y > (state.coldzone-10)
+				&& p.Y < 1024
+				&& (
+					env->getTime()%60 > 10
+					|| myrand_range(0,10) == 0
+				)
+			) {
+				// should only change to snow if there's nothing above it
+				std::vector<content_t> search;
+				search.push_back(CONTENT_SNOW);
+				search.push_back(CONTENT_AIR);
+				if (!env->searchNearInv(p,v3s16(0,0,0),v3s16(0,32,0),search,NULL)) {
+					n.setContent(CONTENT_MUDSNOW);
+					map->addNodeWithEvent(p, n);
+				}
+			}else if (
+				(
+					state.season == ENV_SEASON_WINTER
+					|| state.season == ENV_SEASON_AUTUMN
+				) && (
+					env->getTime()%60 > 10
+					|| myrand_range(0,10) == 0
+				)
+			) {
+				n.setContent(CONTENT_GRASS_AUTUMN);
+				map->addNodeWithEvent(p, n);
+			}
+		}
+		int f = (700-(p.Y*2))+10;
+		if (p.Y > 1 && myrand()%f == 0) {
+			if (n_top.getContent() == CONTENT_AIR && n_top.getLightBlend(env->getDayNightRatio()) >= 13) {
+				v3f pp = intToFloat(p,BS);
+				Player *nearest = env->getNearestConnectedPlayer(pp);
+				if (nearest == NULL || nearest->getPosition().getDistanceFrom(pp)/BS > 20.0) {
+					std::vector<content_t> search;
+					search.push_back(CONTENT_WILDGRASS_SHORT);
+					if (state.season != ENV_SEASON_SPRING)
+						search.push_back(CONTENT_WILDGRASS_LONG);
+					search.push_back(CONTENT_FLOWER_STEM);
+					search.push_back(CONTENT_FLOWER_ROSE);
+					search.push_back(CONTENT_FLOWER_TULIP);
+					search.push_back(CONTENT_FLOWER_DAFFODIL);
+					if (!env->searchNear(p,v3s16(1,1,1),search,NULL)) {
+						n_top.setContent(CONTENT_WILDGRASS_SHORT);
+						map->addNodeWithEvent(p+v3s16(0,1,0), n_top);
+					}
+				}
+			}
+		}
+	}else if (n_top.getContent() != CONTENT_IGNORE) {
+		n.setContent(CONTENT_GRASS_AUTUMN);
+		map->addNodeWithEvent(p,n);
+	}
+}
+
+// convert snow into mud if under something else than air
+static void abm_mudsnow(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	{
+		MapNode n_top = map->getNodeNoEx(p+v3s16(0,1,0));
+		u32 ch = env->getTime()%60;
+		if (n_top.getContent() == CONTENT_SNOW) {
+			return;
+		}else if (
+			p.Y < (state.coldzone-10)
+			&& (
+				ch > 10
+				|| (
+					n_top.getLightBlend(env->getDayNightRatio()) >= 13
+					&& myrand_range(0,5) == 0
+				) || myrand_range(0,10) == 0
+			)
+		) {
+			n.setContent(CONTENT_GRASS_AUTUMN);
+			map->addNodeWithEvent(p, n);
+		}else if (
+			content_features(n_top).air_equivalent == false
+			&& n_top.getContent() != CONTENT_IGNORE
+			&& content_features(n_top).draw_type != CDT_PLANTLIKE
+			&& content_features(n_top).draw_type != CDT_PLANTLIKE_SML
+			&& content_features(n_top).draw_type != CDT_PLANTLIKE_LGE
+			&& n_top.getContent() != CONTENT_SIGN
+			&& n_top.getContent() != CONTENT_SNOW
+		) {
+			n.setContent(CONTENT_MUD);
+			map->addNodeWithEvent(p, n);
+		}
+	}
+	abm_grass(env,state,p,n);
+}
+
+// autumn grass changes with the seasons
+static void abm_grass_autumn(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_top = map->getNodeNoEx(p+v3s16(0,1,0));
+	ContentFeatures &f = content_features(n_top);
+	u32 ch = env->getTime()%60;
+	if (n_top.getContent() == CONTENT_SNOW) {
+		n.setContent(CONTENT_MUDSNOW);
+		map->addNodeWithEvent(p,n);
+	}else if (f.air_equivalent) {
+		if ((state.season == ENV_SEASON_SPRING && myrand_range(0,10) == 0) || state.season == ENV_SEASON_SUMMER) {
+			n.setContent(CONTENT_GRASS);
+			map->addNodeWithEvent(p,n);
+		}else if (state.season == ENV_SEASON_WINTER && p.Y > (state.coldzone-5) && (ch > 10 || myrand_range(0,5) == 0)) {
+			// should only change to snow if there's nothing above it
+			std::vector<content_t> search;
+			search.push_back(CONTENT_SNOW);
+			search.push_back(CONTENT_AIR);
+			if (!env->searchNearInv(p,v3s16(0,0,0),v3s16(0,32,0),search,NULL)) {
+				n.setContent(CONTENT_MUDSNOW);
+				map->addNodeWithEvent(p, n);
+			}
+		}else{
+			int f = (700-(p.Y*2))+10;
+			if (p.Y > 1 && myrand()%f == 0) {
+				if (n_top.getContent() == CONTENT_AIR && n_top.getLightBlend(env->getDayNightRatio()) >= 13) {
+					v3f pp = intToFloat(p,BS);
+					Player *nearest = env->getNearestConnectedPlayer(pp);
+					if (nearest == NULL || nearest->getPosition().getDistanceFrom(pp)/BS > 20.0) {
+						std::vector<content_t> search;
+						search.push_back(CONTENT_WILDGRASS_SHORT);
+						search.push_back(CONTENT_WILDGRASS_LONG);
+						search.push_back(CONTENT_FLOWER_STEM);
+						search.push_back(CONTENT_FLOWER_ROSE);
+						search.push_back(CONTENT_FLOWER_TULIP);
+						search.push_back(CONTENT_FLOWER_DAFFODIL);
+						if (!env->searchNear(p,v3s16(1,1,1),search,NULL)) {
+							n_top.setContent(CONTENT_WILDGRASS_SHORT);
+							map->addNodeWithEvent(p+v3s16(0,1,0), n_top);
+						}
+					}
+				}
+			}
+		}
+	}else{
+		n.setContent(CONTENT_MUD);
+		map->addNodeWithEvent(p,n);
+	}
+}
+
+// wild grass grows, flowers, and dies
+static void abm_wildgrass_short(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_btm = map->getNodeNoEx(p+v3s16(0,-1,0));
+	if (
+		n_btm.getContent() == CONTENT_GRASS
+		|| n_btm.getContent() == CONTENT_GRASS_AUTUMN
+		|| n_btm.getContent() == CONTENT_MUDSNOW
+		|| n_btm.getContent() == CONTENT_MUD
+	) {
+		if (p.Y > -1 && state.envticks > 10) {
+			MapNode n_top = map->getNodeNoEx(p+v3s16(0,1,0));
+			if (n_btm.getContent() != CONTENT_MUD) {
+				if (n_top.getLightBlend(env->getDayNightRatio()) >= 13) {
+					u32 chance = 20;
+					switch (state.season) {
+					case ENV_SEASON_SUMMER:
+						chance = 10;
+						break;
+					case ENV_SEASON_AUTUMN:
+						chance = 15;
+						break;
+					case ENV_SEASON_SPRING:
+						chance = 5;
+						break;
+					default:;
+					}
+					if (myrand_range(0,chance) == 0) {
+						n.setContent(CONTENT_FLOWER_STEM);
+						map->addNodeWithEvent(p, n);
+					}else{
+						n.setContent(CONTENT_WILDGRASS_LONG);
+						map->addNodeWithEvent(p, n);
+					}
+				}
+			}
+		}
+	}else{
+		n.setContent(CONTENT_DEADGRASS);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// wild grass grows, flowers, and dies
+static void abm_wildgrass_long(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (p.Y > -1) {
+		u32 chance = 50;
+		switch (state.season) {
+		case ENV_SEASON_SUMMER:
+			chance = 25;
+			break;
+		case ENV_SEASON_AUTUMN:
+			chance = 10;
+			break;
+		case ENV_SEASON_WINTER:
+			chance = 5;
+			break;
+		default:;
+		}
+		if (myrand_range(0,chance) == 0) {
+			n.setContent(CONTENT_DEADGRASS);
+			map->addNodeWithEvent(p, n);
+		}
+	}
+}
+
+// flower stems blossom
+static void abm_flower_stem(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_btm = map->getNodeNoEx(p+v3s16(0,-1,0));
+	int ch = 0;
+	if (
+		n_btm.getContent() == CONTENT_GRASS
+		|| n_btm.getContent() == CONTENT_GRASS_AUTUMN
+		|| n_btm.getContent() == CONTENT_MUD
+	)
+		ch = 100;
+	if (n_btm.getContent() == CONTENT_FARM_DIRT)
+		ch = 50;
+	if (ch) {
+		if (state.season == ENV_SEASON_SPRING)
+			return;
+		if ((ch == 50 || p.Y > -1) && state.envticks > 20) {
+			MapNode n_top = map->getNodeNoEx(p+v3s16(0,1,0));
+			if (n_top.getLightBlend(env->getDayNightRatio()) >= 13) {
+				switch (myrand()%3) {
+				case 0:
+					n.setContent(CONTENT_FLOWER_ROSE);
+					map->addNodeWithEvent(p, n);
+					break;
+				case 1:
+					n.setContent(CONTENT_FLOWER_DAFFODIL);
+					map->addNodeWithEvent(p, n);
+					break;
+				case 2:
+					n.setContent(CONTENT_FLOWER_TULIP);
+					map->addNodeWithEvent(p, n);
+					break;
+				}
+			}
+		}
+	}else{
+		n.setContent(CONTENT_DEADGRASS);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// dead grass rots away
+static void abm_deadgrass(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_btm = map->getNodeNoEx(p+v3s16(0,-1,0));
+	content_t c = n_btm.getContent();
+	if (
+		(
+			c != CONTENT_MUD
+			&& c != CONTENT_GRASS
+			&& c != CONTENT_GRASS_AUTUMN
+			&& c != CONTENT_MUDSNOW
+		)
+		|| state.envticks > 20
+	) {
+		map->removeNodeWithEvent(p);
+	}
+}
+
+// flowers wilt in autumn and winter
+static void abm_flower(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_under = map->getNodeNoEx(p+v3s16(0,-1,0));
+	if (n_under.getContent() == CONTENT_GRASS || n_under.getContent() == CONTENT_GRASS_AUTUMN) {
+		u32 chance = 0;
+		switch (state.season) {
+		case ENV_SEASON_AUTUMN:
+			chance = 10;
+			break;
+		case ENV_SEASON_WINTER:
+			chance = 5;
+			break;
+		default:;
+		}
+		if (chance && myrand_range(0,chance) == 0) {
+			n.setContent(CONTENT_WILDGRASS_SHORT);
+			map->addNodeWithEvent(p, n);
+		}
+	}else if (n_under.getContent() != CONTENT_FLOWER_POT && n_under.getContent() != CONTENT_FARM_DIRT) {
+		n.setContent(CONTENT_WILDGRASS_SHORT);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// cactus flowers and fruit
+static void abm_cactus(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 30) {
+		bool fully_grown = false;
+		int found = 1;
+		v3s16 p_test = p;
+		MapNode n_test = map->getNodeNoEx(v3s16(p.X, p.Y+1, p.Z));
+
+		// can't grow anything if there's something above the cactus
+		if (n_test.getContent() != CONTENT_AIR)
+			return;
+
+		while (fully_grown == false) {
+			p_test.Y--;
+			n_test = map->getNodeNoEx(p_test);
+
+			// look down the cactus counting the number of cactus nodes
+			if (n_test.getContent() == CONTENT_CACTUS) {
+				found++;
+
+				// cacti don't grow above 4 naturally, don't grow flowers on tall cactus-pillars
+				if (found > 4) {
+					break;
+				}
+			}else{
+				// cacti grow to 3 nodes on sand
+				// and 4 nodes on farm dirt
+				if (n_test.getContent() == CONTENT_SAND) {
+					if (found == 3) {
+						fully_grown = true;
+						break;
+					}else{
+						break;
+					}
+				}else if (n_test.getContent() == CONTENT_FARM_DIRT) {
+					if (found == 4) {
+						fully_grown = true;
+						break;
+					}else{
+						break;
+					}
+				}
+			}
+		}
+
+		if (fully_grown == true) {
+			n.setContent(CONTENT_CACTUS_BLOSSOM);
+			map->addNodeWithEvent(v3s16(p.X, p.Y+1, p.Z), n);
+		}
+	}
+}
+
+// cactus flowers and fruit
+static void abm_cactus_blossom(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 30) {
+		MapNode n_test=map->getNodeNoEx(v3s16(p.X, p.Y-1, p.Z));
+		if (n_test.getContent() == CONTENT_CACTUS) {
+			n.setContent(CONTENT_CACTUS_FLOWER);
+			map->addNodeWithEvent(p, n);
+		}
+	}
+}
+
+// cactus flowers and fruit
+static void abm_cactus_flower(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 30) {
+		MapNode n_test=map->getNodeNoEx(v3s16(p.X, p.Y-1, p.Z));
+		// sometimes fruit, sometimes the flower dies
+		if (n_test.getContent() == CONTENT_CACTUS && myrand()%10 < 6) {
+			n.setContent(CONTENT_CACTUS_FRUIT);
+			map->addNodeWithEvent(p, n);
+		}else{
+			map->removeNodeWithEvent(p);
+		}
+	}
+}
+
+// cactus flowers and fruit
+static void abm_cactus_fruit(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 60) {
+		MapNode n_test=map->getNodeNoEx(v3s16(p.X, p.Y-1, p.Z));
+		// when the fruit dies, sometimes a new blossom appears
+		if (n_test.getContent() == CONTENT_CACTUS && myrand()%10 == 0) {
+			n.setContent(CONTENT_CACTUS_BLOSSOM);
+			map->addNodeWithEvent(p, n);
+		}else{
+			map->removeNodeWithEvent(p);
+			if (state.active_object_count_wider < 10) {
+				v3f rot_pos = intToFloat(p, BS);
+				rot_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
+				ServerActiveObject *obj = new ItemSAO(env, 0, rot_pos, "CraftItem mush 1");
+				env->addActiveObject(obj);
+			}
+		}
+	}
+}
+
+// leaf decay
+static void abm_leaves(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	v3s16 leaf_p = p;
+	std::vector<content_t> search;
+	search.push_back(CONTENT_TREE);
+	search.push_back(CONTENT_YOUNG_TREE);
+	search.push_back(CONTENT_APPLE_TREE);
+	search.push_back(CONTENT_YOUNG_APPLE_TREE);
+	search.push_back(CONTENT_JUNGLETREE);
+	search.push_back(CONTENT_YOUNG_JUNGLETREE);
+	search.push_back(CONTENT_CONIFER_TREE);
+	search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+	search.push_back(CONTENT_IGNORE);
+	if (!env->searchNear(p,v3s16(3,3,3),search,NULL)) {
+		map->removeNodeWithEvent(leaf_p);
+		if (myrand()%10 == 0) {
+			v3f sapling_pos = intToFloat(leaf_p, BS);
+			sapling_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
+			ServerActiveObject *obj = new ItemSAO(env, 0, sapling_pos, "MaterialItem2 " + itos(n.getContent()) + " 1");
+			env->addActiveObject(obj);
+		}
+	}else if (n.getContent() == CONTENT_LEAVES) {
+		if (state.season == ENV_SEASON_AUTUMN) {
+			n.setContent(CONTENT_LEAVES_AUTUMN);
+			map->addNodeWithEvent(p,n);
+		}else if (state.season == ENV_SEASON_WINTER) {
+			n.setContent(CONTENT_LEAVES_WINTER);
+			map->addNodeWithEvent(p,n);
+		}
+	}else if (n.getContent() == CONTENT_LEAVES_AUTUMN) {
+		if (state.season == ENV_SEASON_WINTER) {
+			n.setContent(CONTENT_LEAVES_WINTER);
+			map->addNodeWithEvent(p,n);
+		}else if (state.season != ENV_SEASON_AUTUMN) {
+			n.setContent(CONTENT_LEAVES);
+			map->addNodeWithEvent(p,n);
+		}
+	}else if (n.getContent() == CONTENT_LEAVES_WINTER) {
+		if (state.season == ENV_SEASON_AUTUMN) {
+			n.setContent(CONTENT_LEAVES_AUTUMN);
+			map->addNodeWithEvent(p,n);
+		}else if (state.season == ENV_SEASON_WINTER) {
+			if (myrand_range(0,5) && p.Y > 0) {
+				n.setContent(CONTENT_LEAVES_SNOWY);
+				map->addNodeWithEvent(p,n);
+			}
+		}else{
+			n.setContent(CONTENT_LEAVES);
+			map->addNodeWithEvent(p,n);
+		}
+	}else if (n.getContent() == CONTENT_LEAVES_SNOWY) {
+		if (state.season != ENV_SEASON_WINTER) {
+			n.setContent(CONTENT_LEAVES_WINTER);
+			map->addNodeWithEvent(p,n);
+		}
+	}
+}
+
+// growing apples!
+static void abm_apple_leaves(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks%30 == 0 && state.season == ENV_SEASON_SPRING) {
+		if (env->searchNear(p,v3s16(3,3,3),CONTENT_APPLE_TREE,NULL)) {
+			if (!env->searchNear(p,v3s16(1,1,1),CONTENT_APPLE_BLOSSOM,NULL)) {
+				n.setContent(CONTENT_APPLE_BLOSSOM);
+				map->addNodeWithEvent(p, n);
+			}
+			return;
+		}
+	}
+	// let it fall through to leaf decay
+	if (myrand()%4 == 0)
+		abm_leaves(env,state,p,n);
+}
+
+// apple blossoms become apples
+static void abm_apple_blossom(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 30) {
+		// don't turn all blossoms to apples
+		// blossoms look nice
+		if (env->searchNear(p,v3s16(3,3,3),CONTENT_APPLE_TREE,NULL)) {
+			u32 found_apple = 0;
+
+			for(s16 x=-2; x<=2; x++)
+			for(s16 y=-2; y<=2; y++)
+			for(s16 z=-2; z<=2; z++)
+			{
+				MapNode n_test = map->getNodeNoEx(p+v3s16(x,y,z));
+				if (n_test.getContent() == CONTENT_APPLE) {
+					++found_apple;
+				}
+			}
+			if (found_apple < state.season) {
+				n.setContent(CONTENT_APPLE);
+				map->addNodeWithEvent(p, n);
+			}
+		}else{
+			map->removeNodeWithEvent(p);
+			if (myrand()%5 == 0) {
+				n.setContent(CONTENT_APPLE_LEAVES);
+				map->addNodeWithEvent(p, n);
+				v3f blossom_pos = intToFloat(p, BS);
+				blossom_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
+				ServerActiveObject *obj = new ItemSAO(env, 0, blossom_pos, "CraftItem apple_blossom 1");
+				env->addActiveObject(obj);
+			}
+		}
+	}
+}
+
+// fire that goes out
+static void abm_fire_shortterm(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.unsafe_fire) {
+		if (state.envticks > 2) {
+			s16 bs_rad = g_settings->getS16("borderstone_radius");
+			bs_rad += 2;
+			// if any node is border stone protected, don't spread
+			if (!env->searchNear(p,v3s16(bs_rad,bs_rad,bs_rad),CONTENT_BORDERSTONE,NULL)) {
+				for(s16 x=-1; x<=1; x++)
+				for(s16 y=-1; y<=1; y++)
+				for(s16 z=-1; z<=1; z++)
+				{
+					MapNode n_test = map->getNodeNoEx(p+v3s16(x,y,z));
+					if (n_test.getContent() == CONTENT_FIRE || n_test.getContent() == CONTENT_FIRE_SHORTTERM)
+						continue;
+					if (content_features(n_test).flammable > 0) {
+						content_t c = n_test.getContent();
+						if (content_features(c).onact_also_affects != v3s16(0,0,0)) {
+							v3s16 p_other = p+v3s16(x,y,z)+n_test.getEffectedRotation();
+							n_test.setContent(CONTENT_FIRE_SHORTTERM);
+							map->addNodeWithEvent(p_other, n_test);
+						}
+						n_test.setContent(CONTENT_FIRE_SHORTTERM);
+						map->addNodeWithEvent(p+v3s16(x,y,z), n_test);
+					}
+				}
+			}
+		}
+		if (state.envticks > 10) {
+			map->removeNodeWithEvent(p);
+			v3f ash_pos = intToFloat(p, BS);
+			ash_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
+			ServerActiveObject *obj = new ItemSAO(env, 0, ash_pos, "CraftItem lump_of_ash 1");
+			env->addActiveObject(obj);
+		}
+	}else if (state.envticks > 2) {
+		map->removeNodeWithEvent(p);
+		v3f ash_pos = intToFloat(p, BS);
+		ash_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
+		ServerActiveObject *obj = new ItemSAO(env, 0, ash_pos, "CraftItem lump_of_ash 1");
+		env->addActiveObject(obj);
+	}
+}
+
+// fire that spreads just a little
+static void abm_fire(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_below = map->getNodeNoEx(p+v3s16(0,-1,0));
+	if (!content_features(n_below).flammable) {
+		map->removeNodeWithEvent(p);
+	}else{
+		s16 bs_rad = g_settings->getS16("borderstone_radius");
+		bs_rad += 2;
+		// if any node is border stone protected, don't spread
+		if (!env->searchNear(p,v3s16(bs_rad,bs_rad,bs_rad),CONTENT_BORDERSTONE,NULL)) {
+			for(s16 x=-1; x<=1; x++)
+			for(s16 y=0; y<=1; y++)
+			for(s16 z=-1; z<=1; z++)
+			{
+				MapNode n_test = map->getNodeNoEx(p+v3s16(x,y,z));
+				if (n_test.getContent() == CONTENT_FIRE || n_test.getContent() == CONTENT_FIRE_SHORTTERM)
+					continue;
+				if (content_features(n_test).flammable > 0) {
+					content_t c = n_test.getContent();
+					if (content_features(c).onact_also_affects != v3s16(0,0,0)) {
+						v3s16 p_other = p+v3s16(x,y,z)+n_test.getEffectedRotation();
+						n_test.setContent(CONTENT_FIRE_SHORTTERM);
+						map->addNodeWithEvent(p_other, n_test);
+					}
+					n_test.setContent(CONTENT_FIRE_SHORTTERM);
+					map->addNodeWithEvent(p+v3s16(x,y,z), n_test);
+				}
+			}
+		}
+	}
+}
+
+// boom
+static void abm_flash(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	map->removeNodeWithEvent(p);
+}
+
+// boom
+static void abm_tnt(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	NodeMetadata *meta = map->getNodeMetadata(p);
+	if (meta && meta->getEnergy() == ENERGY_MAX) {
+		if (g_settings->getBool("enable_tnt")) {
+			s16 bs_rad = g_settings->getS16("borderstone_radius");
+			bs_rad += 3;
+			// if any node is border stone protected, don't destroy anything
+			if (!env->searchNear(p,v3s16(bs_rad,bs_rad,bs_rad),CONTENT_BORDERSTONE,NULL)) {
+				for(s16 x=-2; x<=2; x++)
+				for(s16 y=-2; y<=2; y++)
+				for(s16 z=-2; z<=2; z++)
+				{
+					MapNode n_test = map->getNodeNoEx(p+v3s16(x,y,z));
+					if (n_test.getContent() == CONTENT_AIR)
+						continue;
+					if (n_test.getContent() == CONTENT_TNT) {
+						meta = map->getNodeMetadata(p+v3s16(x,y,z));
+						if (meta && !meta->getEnergy())
+							meta->energise(ENERGY_MAX,p,p,p+v3s16(x,y,z));
+						continue;
+					}
+					if (
+						(x == -2 && y == -2)
+						|| (x == 2 && y == -2)
+						|| (x == -2 && y == 2)
+						|| (x == 2 && y == 2)
+						|| (z == -2 && y == -2)
+						|| (z == 2 && y == -2)
+						|| (z == -2 && y == 2)
+						|| (z == 2 && y == 2)
+						|| (x == -2 && z == -2)
+						|| (x == 2 && z == -2)
+						|| (x == -2 && z == 2)
+						|| (x == 2 && z == 2)
+					) {
+						if (myrand()%3 == 0)
+							continue;
+					}
+					n_test.setContent(CONTENT_FLASH);
+					env->addDelayedNodeChange(p+v3s16(x,y,z), n_test);
+				}
+			}
+		}
+		// but still blow up
+		map->removeNodeWithEvent(p);
+		env->addEnvEvent(ENV_EVENT_SOUND,intToFloat(p,BS),"env-tnt");
+	}
+}
+
+// MESE is dead
+static void abm_mese(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (p.Y > 0) {
+		n.setContent(CONTENT_MITHRIL_BLOCK);
+		map->addNodeWithEvent(p, n);
+	}else{
+		n.setContent(CONTENT_STONE);
+		n.param1 = MINERAL_MITHRIL;
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// cobble becomes mossy underwater
+static void abm_cobble(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 30 && state.envticks%4 == 0) {
+		MapNode a = map->getNodeNoEx(p+v3s16(0,1,0));
+		if (a.getContent() == CONTENT_WATERSOURCE) {
+			n.setContent(CONTENT_MOSSYCOBBLE);
+			map->addNodeWithEvent(p,n);
+		}else{
+			bool found = false;
+			/* moss also grows */
+			for (s16 i=0; !found && i<6; i++) {
+				a = map->getNodeNoEx(p+g_6dirs[i]);
+				if (a.getContent() == CONTENT_MOSSYCOBBLE) {
+					n.setContent(CONTENT_MOSSYCOBBLE);
+					map->addNodeWithEvent(p,n);
+					found = true;
+				}
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_sapling(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 1000) {
+		// full grown tree
+		actionstream<<"A sapling grows into a tree at "<<PP(p)<<std::endl;
+		std::vector<content_t> search;
+		search.push_back(CONTENT_AIR);
+		search.push_back(CONTENT_TREE);
+		search.push_back(CONTENT_YOUNG_TREE);
+		search.push_back(CONTENT_APPLE_TREE);
+		search.push_back(CONTENT_YOUNG_APPLE_TREE);
+		search.push_back(CONTENT_JUNGLETREE);
+		search.push_back(CONTENT_YOUNG_JUNGLETREE);
+		search.push_back(CONTENT_CONIFER_TREE);
+		search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+		search.push_back(CONTENT_LEAVES);
+		search.push_back(CONTENT_LEAVES_AUTUMN);
+		search.push_back(CONTENT_LEAVES_WINTER);
+		search.push_back(CONTENT_LEAVES_SNOWY);
+		search.push_back(CONTENT_JUNGLELEAVES);
+		search.push_back(CONTENT_CONIFER_LEAVES);
+		search.push_back(CONTENT_APPLE_LEAVES);
+		search.push_back(CONTENT_APPLE_BLOSSOM);
+		search.push_back(CONTENT_APPLE);
+		search.push_back(CONTENT_IGNORE);
+
+		core::map<v3s16, MapBlock*> modified_blocks;
+		if (!env->searchNearInv(p,v3s16(-10,2,-10),v3s16(10,12,10),search,NULL)) {
+			plantgrowth_largetree(env,p);
+		}else{
+			plantgrowth_tree(env,p);
+		}
+	}else if (state.envticks > 15) {
+		std::vector<content_t> search;
+		search.push_back(CONTENT_AIR);
+		search.push_back(CONTENT_TREE);
+		search.push_back(CONTENT_YOUNG_TREE);
+		search.push_back(CONTENT_APPLE_TREE);
+		search.push_back(CONTENT_YOUNG_APPLE_TREE);
+		search.push_back(CONTENT_JUNGLETREE);
+		search.push_back(CONTENT_YOUNG_JUNGLETREE);
+		search.push_back(CONTENT_CONIFER_TREE);
+		search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+		search.push_back(CONTENT_LEAVES);
+		search.push_back(CONTENT_LEAVES_AUTUMN);
+		search.push_back(CONTENT_LEAVES_WINTER);
+		search.push_back(CONTENT_LEAVES_SNOWY);
+		search.push_back(CONTENT_JUNGLELEAVES);
+		search.push_back(CONTENT_CONIFER_LEAVES);
+		search.push_back(CONTENT_APPLE_LEAVES);
+		search.push_back(CONTENT_APPLE_BLOSSOM);
+		search.push_back(CONTENT_APPLE);
+		search.push_back(CONTENT_IGNORE);
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			v3s16 h;
+			if (!env->searchNearInv(p,v3s16(-2,2,-2),v3s16(2,7,2),search,&h)) {
+				// young tree 1
+				MapNode nn(CONTENT_YOUNG_TREE);
+				map->addNodeWithEvent(p,nn);
+				nn.setContent(CONTENT_LEAVES);
+				map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_young_tree(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 15) {
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			content_t above = map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
+			std::vector<content_t> search;
+			search.push_back(CONTENT_AIR);
+			search.push_back(CONTENT_TREE);
+			search.push_back(CONTENT_YOUNG_TREE);
+			search.push_back(CONTENT_APPLE_TREE);
+			search.push_back(CONTENT_YOUNG_APPLE_TREE);
+			search.push_back(CONTENT_JUNGLETREE);
+			search.push_back(CONTENT_YOUNG_JUNGLETREE);
+			search.push_back(CONTENT_CONIFER_TREE);
+			search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+			search.push_back(CONTENT_LEAVES);
+			search.push_back(CONTENT_LEAVES_AUTUMN);
+			search.push_back(CONTENT_LEAVES_WINTER);
+			search.push_back(CONTENT_LEAVES_SNOWY);
+			search.push_back(CONTENT_JUNGLELEAVES);
+			search.push_back(CONTENT_CONIFER_LEAVES);
+			search.push_back(CONTENT_APPLE_LEAVES);
+			search.push_back(CONTENT_APPLE_BLOSSOM);
+			search.push_back(CONTENT_APPLE);
+			search.push_back(CONTENT_IGNORE);
+			if (above == CONTENT_LEAVES) {
+				// young tree 2
+				v3s16 h;
+				if (!env->searchNearInv(p,v3s16(-1,2,-1),v3s16(1,4,1),search,&h)) {
+					MapNode nn(CONTENT_YOUNG_TREE);
+					map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,0),nn);
+					nn.setContent(CONTENT_LEAVES);
+					map->addNodeWithEvent(p+v3s16(0,3,0),nn);
+					map->addNodeWithEvent(p+v3s16(1,2,0),nn);
+					map->addNodeWithEvent(p+v3s16(-1,2,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,1),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,-1),nn);
+				}
+			}else if (above == CONTENT_YOUNG_TREE && state.envticks > 40) {
+				content_t abv = map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
+				content_t top = map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
+				if (abv == CONTENT_YOUNG_TREE && top == CONTENT_LEAVES) {
+					if (map->getNodeNoEx(p+v3s16(1,2,0)).getContent() == CONTENT_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(1,2,0));
+					if (map->getNodeNoEx(p+v3s16(-1,2,0)).getContent() == CONTENT_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(-1,2,0));
+					if (map->getNodeNoEx(p+v3s16(0,2,1)).getContent() == CONTENT_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,2,1));
+					if (map->getNodeNoEx(p+v3s16(0,2,-1)).getContent() == CONTENT_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,2,-1));
+					// full grown tree
+					actionstream<<"A sapling grows into a tree at "
+						<<PP(p)<<std::endl;
+
+					if (!env->searchNearInv(p,v3s16(-10,2,-10),v3s16(10,12,10),search,NULL)) {
+						plantgrowth_largetree(env,p);
+					}else{
+						plantgrowth_tree(env,p);
+					}
+				}
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_apple_sapling(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 1000) {
+		actionstream<<"A sapling grows into a tree at "<<PP(p)<<std::endl;
+
+		plantgrowth_appletree(env,p);
+	}else if (state.envticks > 15) {
+		std::vector<content_t> search;
+		search.push_back(CONTENT_AIR);
+		search.push_back(CONTENT_TREE);
+		search.push_back(CONTENT_YOUNG_TREE);
+		search.push_back(CONTENT_APPLE_TREE);
+		search.push_back(CONTENT_YOUNG_APPLE_TREE);
+		search.push_back(CONTENT_JUNGLETREE);
+		search.push_back(CONTENT_YOUNG_JUNGLETREE);
+		search.push_back(CONTENT_CONIFER_TREE);
+		search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+		search.push_back(CONTENT_LEAVES);
+		search.push_back(CONTENT_LEAVES_AUTUMN);
+		search.push_back(CONTENT_LEAVES_WINTER);
+		search.push_back(CONTENT_LEAVES_SNOWY);
+		search.push_back(CONTENT_JUNGLELEAVES);
+		search.push_back(CONTENT_CONIFER_LEAVES);
+		search.push_back(CONTENT_APPLE_LEAVES);
+		search.push_back(CONTENT_APPLE_BLOSSOM);
+		search.push_back(CONTENT_APPLE);
+		search.push_back(CONTENT_IGNORE);
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			v3s16 h;
+			if (!env->searchNearInv(p,v3s16(-2,2,-2),v3s16(2,7,2),search,&h)) {
+				// young tree 1
+				MapNode nn(CONTENT_YOUNG_APPLE_TREE);
+				map->addNodeWithEvent(p,nn);
+				nn.setContent(CONTENT_APPLE_LEAVES);
+				map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_young_apple_tree(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 15) {
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			content_t above = map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
+			std::vector<content_t> search;
+			search.push_back(CONTENT_AIR);
+			search.push_back(CONTENT_TREE);
+			search.push_back(CONTENT_YOUNG_TREE);
+			search.push_back(CONTENT_APPLE_TREE);
+			search.push_back(CONTENT_YOUNG_APPLE_TREE);
+			search.push_back(CONTENT_JUNGLETREE);
+			search.push_back(CONTENT_YOUNG_JUNGLETREE);
+			search.push_back(CONTENT_CONIFER_TREE);
+			search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+			search.push_back(CONTENT_LEAVES);
+			search.push_back(CONTENT_LEAVES_AUTUMN);
+			search.push_back(CONTENT_LEAVES_WINTER);
+			search.push_back(CONTENT_LEAVES_SNOWY);
+			search.push_back(CONTENT_JUNGLELEAVES);
+			search.push_back(CONTENT_CONIFER_LEAVES);
+			search.push_back(CONTENT_APPLE_LEAVES);
+			search.push_back(CONTENT_APPLE_BLOSSOM);
+			search.push_back(CONTENT_APPLE);
+			search.push_back(CONTENT_IGNORE);
+			if (above == CONTENT_APPLE_LEAVES) {
+				// young tree 2
+				v3s16 h;
+				if (!env->searchNearInv(p,v3s16(-1,2,-1),v3s16(1,4,1),search,&h)) {
+					MapNode nn(CONTENT_YOUNG_APPLE_TREE);
+					map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,0),nn);
+					nn.setContent(CONTENT_APPLE_LEAVES);
+					map->addNodeWithEvent(p+v3s16(0,3,0),nn);
+					map->addNodeWithEvent(p+v3s16(1,2,0),nn);
+					map->addNodeWithEvent(p+v3s16(-1,2,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,1),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,-1),nn);
+				}
+			}else if (above == CONTENT_YOUNG_APPLE_TREE && state.envticks > 40) {
+				content_t abv = map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
+				content_t top = map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
+				if (abv == CONTENT_YOUNG_APPLE_TREE && top == CONTENT_APPLE_LEAVES) {
+					if (map->getNodeNoEx(p+v3s16(1,2,0)).getContent() == CONTENT_APPLE_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(1,2,0));
+					if (map->getNodeNoEx(p+v3s16(-1,2,0)).getContent() == CONTENT_APPLE_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(-1,2,0));
+					if (map->getNodeNoEx(p+v3s16(0,2,1)).getContent() == CONTENT_APPLE_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,2,1));
+					if (map->getNodeNoEx(p+v3s16(0,2,-1)).getContent() == CONTENT_APPLE_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,2,-1));
+					actionstream<<"A sapling grows into a tree at "
+						<<PP(p)<<std::endl;
+
+					plantgrowth_appletree(env,p);
+				}
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_junglesapling(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 1000) {
+		actionstream<<"A sapling grows into a jungle tree at "<<PP(p)<<std::endl;
+
+		plantgrowth_jungletree(env,p);
+	}else if (state.envticks > 15) {
+		std::vector<content_t> search;
+		search.push_back(CONTENT_AIR);
+		search.push_back(CONTENT_TREE);
+		search.push_back(CONTENT_YOUNG_TREE);
+		search.push_back(CONTENT_APPLE_TREE);
+		search.push_back(CONTENT_YOUNG_APPLE_TREE);
+		search.push_back(CONTENT_JUNGLETREE);
+		search.push_back(CONTENT_YOUNG_JUNGLETREE);
+		search.push_back(CONTENT_CONIFER_TREE);
+		search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+		search.push_back(CONTENT_LEAVES);
+		search.push_back(CONTENT_LEAVES_AUTUMN);
+		search.push_back(CONTENT_LEAVES_WINTER);
+		search.push_back(CONTENT_LEAVES_SNOWY);
+		search.push_back(CONTENT_JUNGLELEAVES);
+		search.push_back(CONTENT_CONIFER_LEAVES);
+		search.push_back(CONTENT_APPLE_LEAVES);
+		search.push_back(CONTENT_APPLE_BLOSSOM);
+		search.push_back(CONTENT_APPLE);
+		search.push_back(CONTENT_IGNORE);
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			v3s16 h;
+			if (!env->searchNearInv(p,v3s16(-2,2,-2),v3s16(2,10,2),search,&h)) {
+				// young tree 1
+				MapNode nn(CONTENT_YOUNG_JUNGLETREE);
+				map->addNodeWithEvent(p,nn);
+				nn.setContent(CONTENT_JUNGLELEAVES);
+				map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_young_jungletree(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 15) {
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			content_t above = map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
+			std::vector<content_t> search;
+			search.push_back(CONTENT_AIR);
+			search.push_back(CONTENT_TREE);
+			search.push_back(CONTENT_YOUNG_TREE);
+			search.push_back(CONTENT_APPLE_TREE);
+			search.push_back(CONTENT_YOUNG_APPLE_TREE);
+			search.push_back(CONTENT_JUNGLETREE);
+			search.push_back(CONTENT_YOUNG_JUNGLETREE);
+			search.push_back(CONTENT_CONIFER_TREE);
+			search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+			search.push_back(CONTENT_LEAVES);
+			search.push_back(CONTENT_LEAVES_AUTUMN);
+			search.push_back(CONTENT_LEAVES_WINTER);
+			search.push_back(CONTENT_LEAVES_SNOWY);
+			search.push_back(CONTENT_JUNGLELEAVES);
+			search.push_back(CONTENT_CONIFER_LEAVES);
+			search.push_back(CONTENT_APPLE_LEAVES);
+			search.push_back(CONTENT_APPLE_BLOSSOM);
+			search.push_back(CONTENT_APPLE);
+			search.push_back(CONTENT_IGNORE);
+			if (above == CONTENT_JUNGLELEAVES) {
+				// young tree 2
+				v3s16 h;
+				if (!env->searchNearInv(p,v3s16(-1,2,-1),v3s16(1,5,1),search,&h)) {
+					MapNode nn(CONTENT_YOUNG_JUNGLETREE);
+					map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,3,0),nn);
+					nn.setContent(CONTENT_JUNGLELEAVES);
+					map->addNodeWithEvent(p+v3s16(0,4,0),nn);
+					map->addNodeWithEvent(p+v3s16(1,3,0),nn);
+					map->addNodeWithEvent(p+v3s16(-1,3,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,3,1),nn);
+					map->addNodeWithEvent(p+v3s16(0,3,-1),nn);
+				}
+			}else if (above == CONTENT_YOUNG_JUNGLETREE && state.envticks > 40) {
+				content_t abv = map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
+				content_t abv1 = map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
+				content_t top = map->getNodeNoEx(p+v3s16(0,4,0)).getContent();
+				if (abv == CONTENT_YOUNG_JUNGLETREE && abv1 == CONTENT_YOUNG_JUNGLETREE && top == CONTENT_JUNGLELEAVES) {
+					if (map->getNodeNoEx(p+v3s16(1,3,0)).getContent() == CONTENT_JUNGLELEAVES)
+						map->removeNodeWithEvent(p+v3s16(1,3,0));
+					if (map->getNodeNoEx(p+v3s16(-1,3,0)).getContent() == CONTENT_JUNGLELEAVES)
+						map->removeNodeWithEvent(p+v3s16(-1,3,0));
+					if (map->getNodeNoEx(p+v3s16(0,3,1)).getContent() == CONTENT_JUNGLELEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,3,1));
+					if (map->getNodeNoEx(p+v3s16(0,3,-1)).getContent() == CONTENT_JUNGLELEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,3,-1));
+					actionstream<<"A sapling grows into a jungle tree at "
+						<<PP(p)<<std::endl;
+
+					plantgrowth_jungletree(env,p);
+				}
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_conifer_sapling(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 1000) {
+		actionstream<<"A sapling grows into a conifer tree at "<<PP(p)<<std::endl;
+
+		plantgrowth_conifertree(env,p);
+	}else if (state.envticks > 15) {
+		std::vector<content_t> search;
+		search.push_back(CONTENT_AIR);
+		search.push_back(CONTENT_TREE);
+		search.push_back(CONTENT_YOUNG_TREE);
+		search.push_back(CONTENT_APPLE_TREE);
+		search.push_back(CONTENT_YOUNG_APPLE_TREE);
+		search.push_back(CONTENT_JUNGLETREE);
+		search.push_back(CONTENT_YOUNG_JUNGLETREE);
+		search.push_back(CONTENT_CONIFER_TREE);
+		search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+		search.push_back(CONTENT_LEAVES);
+		search.push_back(CONTENT_LEAVES_AUTUMN);
+		search.push_back(CONTENT_LEAVES_WINTER);
+		search.push_back(CONTENT_LEAVES_SNOWY);
+		search.push_back(CONTENT_JUNGLELEAVES);
+		search.push_back(CONTENT_CONIFER_LEAVES);
+		search.push_back(CONTENT_APPLE_LEAVES);
+		search.push_back(CONTENT_APPLE_BLOSSOM);
+		search.push_back(CONTENT_APPLE);
+		search.push_back(CONTENT_IGNORE);
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			v3s16 h;
+			if (!env->searchNearInv(p,v3s16(-2,2,-2),v3s16(2,12,2),search,&h)) {
+				// young tree 1
+				MapNode nn(CONTENT_YOUNG_CONIFER_TREE);
+				map->addNodeWithEvent(p,nn);
+				nn.setContent(CONTENT_CONIFER_LEAVES);
+				map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+			}
+		}
+	}
+}
+
+// make trees from saplings!
+static void abm_young_conifer_tree(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (state.envticks > 15) {
+		content_t below = map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
+		if (
+			below == CONTENT_MUD
+			|| below == CONTENT_GRASS
+			|| below == CONTENT_GRASS_FOOTSTEPS
+			|| below == CONTENT_GRASS_AUTUMN
+			|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+		) {
+			content_t above = map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
+			std::vector<content_t> search;
+			search.push_back(CONTENT_AIR);
+			search.push_back(CONTENT_TREE);
+			search.push_back(CONTENT_YOUNG_TREE);
+			search.push_back(CONTENT_APPLE_TREE);
+			search.push_back(CONTENT_YOUNG_APPLE_TREE);
+			search.push_back(CONTENT_JUNGLETREE);
+			search.push_back(CONTENT_YOUNG_JUNGLETREE);
+			search.push_back(CONTENT_CONIFER_TREE);
+			search.push_back(CONTENT_YOUNG_CONIFER_TREE);
+			search.push_back(CONTENT_LEAVES);
+			search.push_back(CONTENT_LEAVES_AUTUMN);
+			search.push_back(CONTENT_LEAVES_WINTER);
+			search.push_back(CONTENT_LEAVES_SNOWY);
+			search.push_back(CONTENT_JUNGLELEAVES);
+			search.push_back(CONTENT_CONIFER_LEAVES);
+			search.push_back(CONTENT_APPLE_LEAVES);
+			search.push_back(CONTENT_APPLE_BLOSSOM);
+			search.push_back(CONTENT_APPLE);
+			search.push_back(CONTENT_IGNORE);
+			if (above == CONTENT_CONIFER_LEAVES) {
+				// young tree 2
+				v3s16 h;
+				if (!env->searchNearInv(p,v3s16(-1,2,-1),v3s16(1,5,1),search,&h)) {
+					MapNode nn(CONTENT_YOUNG_CONIFER_TREE);
+					map->addNodeWithEvent(p+v3s16(0,1,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,0),nn);
+					nn.setContent(CONTENT_CONIFER_LEAVES);
+					map->addNodeWithEvent(p+v3s16(0,3,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,4,0),nn);
+					map->addNodeWithEvent(p+v3s16(1,2,0),nn);
+					map->addNodeWithEvent(p+v3s16(-1,2,0),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,1),nn);
+					map->addNodeWithEvent(p+v3s16(0,2,-1),nn);
+				}
+			}else if (above == CONTENT_YOUNG_CONIFER_TREE && state.envticks > 40) {
+				content_t abv = map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
+				content_t top = map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
+				if (abv == CONTENT_YOUNG_CONIFER_TREE && top == CONTENT_CONIFER_LEAVES) {
+					if (map->getNodeNoEx(p+v3s16(1,2,0)).getContent() == CONTENT_CONIFER_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(1,2,0));
+					if (map->getNodeNoEx(p+v3s16(-1,2,0)).getContent() == CONTENT_CONIFER_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(-1,2,0));
+					if (map->getNodeNoEx(p+v3s16(0,2,1)).getContent() == CONTENT_CONIFER_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,2,1));
+					if (map->getNodeNoEx(p+v3s16(0,2,-1)).getContent() == CONTENT_CONIFER_LEAVES)
+						map->removeNodeWithEvent(p+v3s16(0,2,-1));
+					actionstream<<"A sapling grows into a conifer tree at "
+						<<PP(p)<<std::endl;
+
+					plantgrowth_conifertree(env,p);
+				}
+			}
+		}
+	}
+}
+
+// apples should fall if there is no leaves block holding it
+static void abm_apple(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	v3s16 apple_p = p;
+	std::vector<content_t> search;
+	search.push_back(CONTENT_APPLE_LEAVES);
+	search.push_back(CONTENT_IGNORE);
+	if (!env->searchNear(p,v3s16(1,1,1),search,NULL)) {
+		map->removeNodeWithEvent(apple_p);
+		v3f apple_pos = intToFloat(apple_p, BS);
+		apple_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
+		ServerActiveObject *obj = new ItemSAO(env, 0, apple_pos, "CraftItem apple 1");
+		env->addActiveObject(obj);
+	}else if ((state.envticks > 600 || (state.envticks > 100 && state.season == ENV_SEASON_WINTER)) && state.active_object_count_wider < 10) {
+		n.setContent(CONTENT_APPLE_LEAVES);
+		map->addNodeWithEvent(p,n);
+		v3f rot_pos = intToFloat(p, BS);
+		rot_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
+		ServerActiveObject *obj = new ItemSAO(env, 0, rot_pos, "CraftItem mush 1");
+		env->addActiveObject(obj);
+	}
+}
+
+// grow sponges on sand in water
+static void abm_sand(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_top1 = map->getNodeNoEx(p+v3s16(0,1,0));
+	MapNode n_top2 = map->getNodeNoEx(p+v3s16(0,2,0));
+	if (
+		p.Y < -30
+		&& n_top1.getContent() == CONTENT_WATERSOURCE
+		&& n_top2.getContent() == CONTENT_WATERSOURCE
+	) {
+		s16 max_d = 8;
+		v3s16 test_p;
+		MapNode testnode;
+		int found = 0;
+		for(s16 z=-max_d; found < 2 && z<=max_d; z++) {
+		for(s16 y=-max_d; found < 2 && y<=max_d; y++) {
+		for(s16 x=-max_d; found < 2 && x<=max_d; x++) {
+			test_p = p + v3s16(x,y,z);
+			testnode = map->getNodeNoEx(test_p);
+			if (testnode.getContent() == CONTENT_SPONGE_FULL)
+				found++;
+		}
+		}
+		}
+		if (found < 2) {
+			n_top1.setContent(CONTENT_SPONGE_FULL);
+			map->addNodeWithEvent(p+v3s16(0,1,0), n_top1);
+		}
+	}
+}
+
+// make sponge soak up water
+static void abm_sponge(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	v3s16 test_p;
+	MapNode testnode;
+	bool sponge_soaked = false;
+	s16 max_d = 2;
+	for(s16 z=-max_d; z<=max_d; z++) {
+	for(s16 y=-max_d; y<=max_d; y++) {
+	for(s16 x=-max_d; x<=max_d; x++) {
+		test_p = p + v3s16(x,y,z);
+		testnode = map->getNodeNoEx(test_p);
+		if (testnode.getContent() == CONTENT_WATERSOURCE) {
+			sponge_soaked = true;
+			testnode.setContent(CONTENT_AIR);
+			map->addNodeWithEvent(test_p, testnode);
+		}
+	}
+	}
+	}
+	if (sponge_soaked) {
+		n.setContent(CONTENT_SPONGE_FULL);
+		map->addNodeWithEvent(p, n);
+	}
+}
+
+// make papyrus grow near water
+static void abm_papyrus(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode n_btm = map->getNodeNoEx(p+v3s16(0,-1,0));
+	if (n_btm.getContent() == CONTENT_MUD) {
+		if (env->searchNear(p,v3s16(2,2,2),CONTENT_WATERSOURCE,NULL))
+			plantgrowth_plant(env,p,3);
+	}
+}
+
+// steam dissipates
+static void abm_steam(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	map->removeNodeWithEvent(p);
+}
+
+// make lava cool near water
+static void abm_lava(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode testnode;
+	v3s16 test_p;
+	std::vector<content_t> search;
+	bool found = false;
+	search.push_back(CONTENT_WATER);
+	search.push_back(CONTENT_WATERSOURCE);
+	if (p.Y > 60 && p.Y < 1024) {
+		found = true;
+	}else if (env->searchNear(p,v3s16(1,1,1),search,&test_p)) {
+		testnode = map->getNodeNoEx(test_p);
+		found = true;
+		testnode.setContent(CONTENT_STEAM);
+		env->addDelayedNodeChange(test_p, testnode);
+		if (!state.has_steam_sound) {
+			env->addEnvEvent(ENV_EVENT_SOUND,intToFloat(p,BS),"env-steam");
+			state.has_steam_sound = true;
+		}
+	}
+
+	if (found == true && n.getContent() == CONTENT_LAVASOURCE) {
+		int material = myrand()%50;
+		switch(material) {
+		case 0:
+		case 1:
+		case 2:
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+		case 7:
+			n = MapNode(CONTENT_STONE, MINERAL_COAL);
+			break;
+		case 8:
+		case 9:
+		case 10:
+		case 11:
+			n = MapNode(CONTENT_STONE, MINERAL_IRON);
+			break;
+		case 12:
+		case 13:
+		case 14:
+		case 15:
+			n = MapNode(CONTENT_STONE, MINERAL_TIN);
+			break;
+		case 16:
+		case 17:
+		case 18:
+		case 19:
+			n = MapNode(CONTENT_STONE, MINERAL_QUARTZ);
+			break;
+		case 20:
+		case 21:
+		case 22:
+		case 23:
+			n = MapNode(CONTENT_STONE, MINERAL_COPPER);
+			break;
+		case 24:
+			n = MapNode(CONTENT_STONE, MINERAL_SILVER);
+			break;
+		case 25:
+			n = MapNode(CONTENT_STONE, MINERAL_GOLD);
+			break;
+		default:
+			n.setContent(CONTENT_ROUGHSTONE);
+			break;
+		}
+		map->addNodeWithEvent(p, n);
+	}else if (found == true) {
+		n.setContent(CONTENT_ROUGHSTONE);
+		map->addNodeWithEvent(p, n);
+	}
+
+}
+
+// fix air that should be sunlit but isn't
+static void abm_air_light(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (
+		state.daylight
+		&& p.Y-state.block->getPosRelative().Y > 8
+		&& n.getLightBlend(env->getDayNightRatio()) < 10
+	) {
+		// CHECK AND FIX!
+		core::map<v3s16, MapBlock*> modified_blocks;
+		map->propagateSunlight(p,modified_blocks);
+		// Send a MEET_OTHER event
+		MapEditEvent event;
+		event.type = MEET_OTHER;
+		for(core::map<v3s16, MapBlock*>::Iterator
+			i = modified_blocks.getIterator();
+			i.atEnd() == false; i++)
+		{
+			v3s16 p = i.getNode()->getKey();
+			event.modified_blocks.insert(p, true);
+		}
+		map->dispatchEvent(&event);
+	}
+}
+
+// set from fix_light_bug by content_abm_init()
+static bool abm_fix_light_bug = false;
+
+// air becomes vacuum in space
+static void abm_air(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (p.Y >= 1024 && state.envticks > 1 && !env->searchNear(p,v3s16(5,5,5),CONTENT_LIFE_SUPPORT,NULL)) {
+		n.setContent(CONTENT_VACUUM);
+		map->addNodeWithEvent(p,n);
+	}else if (abm_fix_light_bug) {
+		abm_air_light(env,state,p,n);
+	}
+}
+
+// vacuum becomes air below space
+static void abm_vacuum(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (p.Y < 1024) {
+		n.setContent(CONTENT_AIR);
+		map->addNodeWithEvent(p,n);
+	}
+}
+
+// life support fills space with air
+static void abm_life_support(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	MapNode testnode;
+	v3s16 testpos;
+	for (s16 x=-5; x<5; x++)
+	for (s16 y=-5; y<5; y++)
+	for (s16 z=-5; z<5; z++) {
+		testpos = p+v3s16(x,y,z);
+		testnode = map->getNodeNoEx(testpos);
+		if (testnode.getContent() != CONTENT_VACUUM)
+			continue;
+		testnode.setContent(CONTENT_AIR);
+		map->addNodeWithEvent(testpos,testnode);
+	}
+}
+
+// snow falls on cold surfaces
+static void abm_snowfall(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n)
+{
+	Map *map = &env->getMap();
+	if (p.Y > (state.coldzone+5) && p.Y < 1024) {
+		std::vector<content_t> search;
+		search.push_back(CONTENT_AIR);
+		// check that it's on top, and somewhere snow could fall
+		// not 100% because torches
+		if (
+			!env->searchNearInv(p,v3s16(0,1,0),v3s16(0,16,0),search,NULL)
+			&& !env->searchNear(p,v3s16(3,3,3),CONTENT_FIRE,NULL)
+		) {
+			MapNode n_top(CONTENT_SNOW);
+			map->addNodeWithEvent(p+v3s16(0,1,0), n_top);
+		}
+	}
+}
+
+// the surface nodes snow can fall on, terminated by CONTENT_IGNORE
+static const content_t snowfall_contents[] = {
+	CONTENT_STONE,
+	CONTENT_LIMESTONE,
+	CONTENT_SAND,
+	CONTENT_SANDSTONE,
+	CONTENT_GRAVEL,
+	CONTENT_CLAY,
+	CONTENT_COBBLE,
+	CONTENT_MOSSYCOBBLE,
+	CONTENT_ICE,
+	CONTENT_SNOW_BLOCK,
+	CONTENT_IGNORE
+};
+
+static struct {
+	ABMTrigger trigger;
+	float interval;
+	u32 chance;
+	// whether the trigger reads state.envticks
+	bool envticks;
+	// terminated by CONTENT_IGNORE
+	content_t contents[7];
+} abm_list[] = {
+	{abm_grass_footsteps, 10.0, 1, true, {CONTENT_GRASS_FOOTSTEPS, CONTENT_IGNORE}},
+	{abm_grass_footsteps_autumn, 10.0, 1, true, {CONTENT_GRASS_FOOTSTEPS_AUTUMN, CONTENT_IGNORE}},
+	{abm_mud, 10.0, 1, false, {CONTENT_MUD, CONTENT_IGNORE}},
+	{abm_growing_grass_autumn, 10.0, 1, false, {CONTENT_GROWING_GRASS_AUTUMN, CONTENT_IGNORE}},
+	{abm_growing_grass, 10.0, 1, false, {CONTENT_GROWING_GRASS, CONTENT_IGNORE}},
+	{abm_water, 10.0, 1, false, {CONTENT_WATER, CONTENT_WATERSOURCE, CONTENT_IGNORE}},
+	{abm_ice, 10.0, 1, false, {CONTENT_ICE, CONTENT_IGNORE}},
+	{abm_snow, 10.0, 1, false, {CONTENT_SNOW, CONTENT_IGNORE}},
+	{abm_snow_block, 10.0, 1, false, {CONTENT_SNOW_BLOCK, CONTENT_IGNORE}},
+	// with this plants take around 10 minutes to grow
+	{abm_farm_dirt, 40.0, 1, false, {CONTENT_FARM_DIRT, CONTENT_IGNORE}},
+	{abm_farm_grapevine, 30.0, 1, false, {CONTENT_FARM_GRAPEVINE, CONTENT_IGNORE}},
+	{abm_farm_trellis_grape, 30.0, 1, false, {CONTENT_FARM_TRELLIS_GRAPE, CONTENT_IGNORE}},
+	{abm_grass, 10.0, 1, true, {CONTENT_GRASS, CONTENT_IGNORE}},
+	{abm_mudsnow, 10.0, 1, false, {CONTENT_MUDSNOW, CONTENT_IGNORE}},
+	{abm_grass_autumn, 10.0, 1, false, {CONTENT_GRASS_AUTUMN, CONTENT_IGNORE}},
+	{abm_wildgrass_short, 10.0, 1, true, {CONTENT_WILDGRASS_SHORT, CONTENT_IGNORE}},
+	{abm_wildgrass_long, 10.0, 1, false, {CONTENT_WILDGRASS_LONG, CONTENT_IGNORE}},
+	{abm_flower_stem, 10.0, 1, true, {CONTENT_FLOWER_STEM, CONTENT_IGNORE}},
+	{abm_deadgrass, 10.0, 1, true, {CONTENT_DEADGRASS, CONTENT_IGNORE}},
+	{abm_flower, 10.0, 1, false, {CONTENT_FLOWER_ROSE, CONTENT_FLOWER_DAFFODIL, CONTENT_FLOWER_TULIP, CONTENT_IGNORE}},
+	{abm_cactus, 10.0, 1, true, {CONTENT_CACTUS, CONTENT_IGNORE}},
+	{abm_cactus_blossom, 10.0, 1, true, {CONTENT_CACTUS_BLOSSOM, CONTENT_IGNORE}},
+	{abm_cactus_flower, 10.0, 1, true, {CONTENT_CACTUS_FLOWER, CONTENT_IGNORE}},
+	{abm_cactus_fruit, 10.0, 1, true, {CONTENT_CACTUS_FRUIT, CONTENT_IGNORE}},
+	{abm_leaves, 10.0, 4, false, {CONTENT_LEAVES, CONTENT_LEAVES_AUTUMN, CONTENT_LEAVES_WINTER, CONTENT_LEAVES_SNOWY, CONTENT_JUNGLELEAVES, CONTENT_CONIFER_LEAVES, CONTENT_IGNORE}},
+	{abm_apple_leaves, 10.0, 1, true, {CONTENT_APPLE_LEAVES, CONTENT_IGNORE}},
+	{abm_apple_blossom, 10.0, 1, true, {CONTENT_APPLE_BLOSSOM, CONTENT_IGNORE}},
+	{abm_fire_shortterm, 10.0, 1, true, {CONTENT_FIRE_SHORTTERM, CONTENT_IGNORE}},
+	{abm_fire, 10.0, 1, false, {CONTENT_FIRE, CONTENT_IGNORE}},
+	{abm_flash, 10.0, 1, false, {CONTENT_FLASH, CONTENT_IGNORE}},
+	{abm_tnt, 10.0, 1, false, {CONTENT_TNT, CONTENT_IGNORE}},
+	{abm_mese, 10.0, 1, false, {CONTENT_MESE, CONTENT_IGNORE}},
+	{abm_cobble, 10.0, 1, true, {CONTENT_COBBLE, CONTENT_IGNORE}},
+	{abm_sapling, 10.0, 1, true, {CONTENT_SAPLING, CONTENT_IGNORE}},
+	{abm_young_tree, 10.0, 1, true, {CONTENT_YOUNG_TREE, CONTENT_IGNORE}},
+	{abm_apple_sapling, 10.0, 1, true, {CONTENT_APPLE_SAPLING, CONTENT_IGNORE}},
+	{abm_young_apple_tree, 10.0, 1, true, {CONTENT_YOUNG_APPLE_TREE, CONTENT_IGNORE}},
+	{abm_junglesapling, 10.0, 1, true, {CONTENT_JUNGLESAPLING, CONTENT_IGNORE}},
+	{abm_young_jungletree, 10.0, 1, true, {CONTENT_YOUNG_JUNGLETREE, CONTENT_IGNORE}},
+	{abm_conifer_sapling, 10.0, 1, true, {CONTENT_CONIFER_SAPLING, CONTENT_IGNORE}},
+	{abm_young_conifer_tree, 10.0, 1, true, {CONTENT_YOUNG_CONIFER_TREE, CONTENT_IGNORE}},
+	{abm_apple, 10.0, 1, true, {CONTENT_APPLE, CONTENT_IGNORE}},
+	{abm_sand, 300.0, 200, false, {CONTENT_SAND, CONTENT_IGNORE}},
+	{abm_sponge, 10.0, 1, false, {CONTENT_SPONGE, CONTENT_IGNORE}},
+	{abm_papyrus, 100.0, 1, false, {CONTENT_PAPYRUS, CONTENT_IGNORE}},
+	{abm_steam, 10.0, 1, false, {CONTENT_STEAM, CONTENT_IGNORE}},
+	{abm_lava, 10.0, 1, false, {CONTENT_LAVASOURCE, CONTENT_LAVA, CONTENT_IGNORE}},
+	{abm_vacuum, 10.0, 1, false, {CONTENT_VACUUM, CONTENT_IGNORE}},
+	{abm_life_support, 10.0, 1, false, {CONTENT_LIFE_SUPPORT, CONTENT_IGNORE}},
+	{NULL, 0, 0, false, {CONTENT_IGNORE}}
+};
+
+void content_abm_init(ServerEnvironment *env)
+{
+	for (int i=0; abm_list[i].trigger != NULL; i++) {
+		ActiveBlockModifier abm;
+		abm.trigger = abm_list[i].trigger;
+		abm.trigger_interval = abm_list[i].interval;
+		abm.trigger_chance = abm_list[i].chance;
+		abm.needs_envticks = abm_list[i].envticks;
+		for (int k=0; abm_list[i].contents[k] != CONTENT_IGNORE; k++) {
+			abm.trigger_contents.push_back(abm_list[i].contents[k]);
+		}
+		env->addActiveBlockModifier(abm);
+	}
+
+	{
+		ActiveBlockModifier abm;
+		abm.trigger = abm_air;
+		abm.needs_envticks = true;
+		abm.trigger_contents.push_back(CONTENT_AIR);
+		abm.min_y = 1024;
+		env->addActiveBlockModifier(abm);
+	}
+
+	abm_fix_light_bug = g_settings->exists("fix_light_bug") && g_settings->getBool("fix_light_bug");
+
+	// below space, air is only looked at when fixing lighting
+	if (abm_fix_light_bug) {
+		ActiveBlockModifier abm;
+		abm.trigger = abm_air_light;
+		abm.trigger_contents.push_back(CONTENT_AIR);
+		abm.max_y = 1023;
+		env->addActiveBlockModifier(abm);
+	}
+
+	// snow falls on the natural surfaces above the lowest cold zone,
+	// which is in winter, grass and mud turn to mudsnow on their own
+	{
+		ActiveBlockModifier abm;
+		abm.trigger = abm_snowfall;
+		abm.trigger_chance = 20;
+		abm.min_y = 5+5+1;
+		abm.max_y = 1023;
+		for (int k=0; snowfall_contents[k] != CONTENT_IGNORE; k++) {
+			abm.trigger_contents.push_back(snowfall_contents[k]);
+		}
+		env->addActiveBlockModifier(abm);
+	}
+}
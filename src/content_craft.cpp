@@ -36,62 +36,203 @@
 
 #include <algorithm>
 #include <set>
+#include <map>
 
 namespace crafting {
 
 std::vector<CraftDef> shaped_recipes;
 std::vector<CraftDefShapeless> shapeless_recipes;
 
-void initCrafting()
+/*
+	Recipes are found through a hash of their normalised grid: a shaped
+	recipe is moved to the top left corner and cut down to the box around
+	its items, a shapeless one is its items sorted. Only the first recipe
+	added for a grid goes in the index, as only it would ever be found by
+	going through the lists in order.
+*/
+struct RecipeKey {
+	u8 w;
+	u8 h;
+	content_t items[9];
+
+	u32 hash() const
+	{
+		u32 h = 2166136261u;
+		h = (h^w)*16777619u;
+		h = (h^this->h)*16777619u;
+		for (int i=0; i<w*this->h; i++) {
+			h = (h^(items[i]&0xFF))*16777619u;
+			h = (h^(items[i]>>8))*16777619u;
+		}
+		return h;
+	}
+
+	bool operator==(const RecipeKey &k) const
+	{
+		if (w != k.w || h != k.h)
+			return false;
+		for (int i=0; i<w*h; i++) {
+			if (items[i] != k.items[i])
+				return false;
+		}
+		return true;
+	}
+};
+
+typedef std::map<u32, std::vector<u32> > RecipeIndex;
+typedef std::map<content_t, std::vector<u32> > RecipeContentIndex;
+
+// grid hash to recipes
+static RecipeIndex shaped_index;
+static RecipeIndex shapeless_index;
+// result to the recipes that make it, in the order they were added
+static RecipeContentIndex shaped_results;
+static RecipeContentIndex shapeless_results;
+// ingredient to the recipes that use it, in the order they were added
+static RecipeContentIndex shaped_uses;
+static RecipeContentIndex shapeless_uses;
+
+// returns false if there's nothing in the grid
+static bool getShapedKey(const content_t grid[9], RecipeKey &key)
+{
+	u16 min_x = 3;
+	u16 max_x = 0;
+	u16 min_y = 3;
+	u16 max_y = 0;
+	for (u16 y=0; y<3; y++)
+	for (u16 x=0; x<3; x++) {
+		if (grid[y*3 + x] == CONTENT_IGNORE)
+			continue;
+		if (x < min_x)
+			min_x = x;
+		if (x > max_x)
+			max_x = x;
+		if (y < min_y)
+			min_y = y;
+		if (y > max_y)
+			max_y = y;
+	}
+	if (min_x == 3)
+		return false;
+
+	key.w = max_x - min_x + 1;
+	key.h = max_y - min_y + 1;
+	for (u16 y=0; y<key.h; y++)
+	for (u16 x=0; x<key.w; x++) {
+		key.items[y*key.w + x] = grid[(min_y + y)*3 + min_x + x];
+	}
+	return true;
+}
+
+static bool getShapelessKey(const content_t grid[9], RecipeKey &key)
 {
-	shaped_recipes.clear();
-	shapeless_recipes.clear();
+	key.w = 0;
+	key.h = 1;
+	for (int i=0; i<9; i++) {
+		if (grid[i] != CONTENT_IGNORE)
+			key.items[key.w++] = grid[i];
+	}
+	if (!key.w)
+		return false;
+	std::sort(key.items, key.items + key.w);
+	return true;
 }
 
-static bool checkRecipe(content_t recipe[9], content_t result)
+// adds recipe i to the index, unless a recipe for the same grid is there
+template <typename CD>
+static void indexRecipe(const std::vector<CD> &recipes, u32 i, const RecipeKey &key, RecipeIndex &index, bool (*getKey)(const content_t[9], RecipeKey&))
+{
+	std::vector<u32> &bucket = index[key.hash()];
+	for (std::vector<u32>::iterator it=bucket.begin(); it!=bucket.end(); it++) {
+		RecipeKey k;
+		getKey(recipes[*it].recipe,k);
+		if (k == key)
+			return;
+	}
+	bucket.push_back(i);
+}
+
+template <typename CD>
+static const CD *findRecipe(const std::vector<CD> &recipes, const RecipeKey &key, RecipeIndex &index, bool (*getKey)(const content_t[9], RecipeKey&))
 {
-	for (std::vector<CraftDef>::iterator i=shaped_recipes.begin(); i!=shaped_recipes.end(); i++) {
-		CraftDef d = *i;
-		if (d.result == result && d == recipe)
-			return true;
+	RecipeIndex::iterator n = index.find(key.hash());
+	if (n == index.end())
+		return NULL;
+	std::vector<u32> &bucket = n->second;
+	for (std::vector<u32>::iterator it=bucket.begin(); it!=bucket.end(); it++) {
+		RecipeKey k;
+		getKey(recipes[*it].recipe,k);
+		if (k == key)
+			return &recipes[*it];
 	}
-	return false;
+	return NULL;
 }
 
-static bool checkShapelessRecipe(content_t recipe[9], content_t result)
+// whether the same recipe is already there for result
+template <typename CD>
+static bool checkRecipe(std::vector<CD> &recipes, RecipeContentIndex &results, content_t recipe[9], content_t result)
 {
-	for (std::vector<CraftDefShapeless>::iterator i=shapeless_recipes.begin(); i!=shapeless_recipes.end(); i++) {
-		CraftDefShapeless d = *i;
-		if (d.result == result && d == recipe)
+	RecipeContentIndex::iterator n = results.find(result);
+	if (n == results.end())
+		return false;
+	for (std::vector<u32>::iterator it=n->second.begin(); it!=n->second.end(); it++) {
+		if (recipes[*it] == recipe)
 			return true;
 	}
 	return false;
 }
 
-void setRecipe(content_t recipe[9], content_t result, u16 count)
+template <typename CD>
+static void addRecipe(std::vector<CD> &recipes, RecipeContentIndex &results, RecipeContentIndex &uses, content_t recipe[9], content_t result, u16 count)
 {
-	if (checkRecipe(recipe,result))
-		return;
-	CraftDef d;
+	CD d;
 	for (int i=0; i<9; i++) {
 		d.recipe[i] = recipe[i];
 	}
 	d.result = result;
 	d.result_count = count;
-	shaped_recipes.push_back(d);
+	u32 i = recipes.size();
+	recipes.push_back(d);
+
+	results[result].push_back(i);
+	for (int j=0; j<9; j++) {
+		if (std::find(recipe, recipe+j, recipe[j]) == recipe+j)
+			uses[recipe[j]].push_back(i);
+	}
+}
+
+void initCrafting()
+{
+	shaped_recipes.clear();
+	shapeless_recipes.clear();
+	shaped_index.clear();
+	shapeless_index.clear();
+	shaped_results.clear();
+	shapeless_results.clear();
+	shaped_uses.clear();
+	shapeless_uses.clear();
+}
+
+void setRecipe(content_t recipe[9], content_t result, u16 count)
+{
+	if (checkRecipe(shaped_recipes,shaped_results,recipe,result))
+		return;
+	addRecipe(shaped_recipes,shaped_results,shaped_uses,recipe,result,count);
+
+	RecipeKey key;
+	if (getShapedKey(recipe,key))
+		indexRecipe(shaped_recipes,shaped_recipes.size()-1,key,shaped_index,getShapedKey);
 }
 
 void setShapelessRecipe(content_t recipe[9], content_t result, u16 count)
 {
-	if (checkShapelessRecipe(recipe,result))
+	if (checkRecipe(shapeless_recipes,shapeless_results,recipe,result))
 		return;
-	CraftDefShapeless d;
-	for (int i=0; i<9; i++) {
-		d.recipe[i] = recipe[i];
-	}
-	d.result = result;
-	d.result_count = count;
-	shapeless_recipes.push_back(d);
+	addRecipe(shapeless_recipes,shapeless_results,shapeless_uses,recipe,result,count);
+
+	RecipeKey key;
+	if (getShapelessKey(recipe,key))
+		indexRecipe(shapeless_recipes,shapeless_recipes.size()-1,key,shapeless_index,getShapelessKey);
 }
 
 // one input yields one result
@@ -679,135 +820,102 @@ void setShortsRecipe(u16 input, u16 result)
 
 InventoryItem *getResult(InventoryItem **items)
 {
-	for (std::vector<CraftDef>::iterator i=shaped_recipes.begin(); i!=shaped_recipes.end(); i++) {
-		CraftDef d = *i;
-		if (d == items)
-			return InventoryItem::create(d.result,d.result_count);
+	content_t grid[9];
+	for (int i=0; i<9; i++) {
+		grid[i] = items[i] ? items[i]->getContent() : CONTENT_IGNORE;
+	}
+
+	RecipeKey key;
+	if (getShapedKey(grid,key)) {
+		const CraftDef *d = findRecipe(shaped_recipes,key,shaped_index,getShapedKey);
+		if (d)
+			return InventoryItem::create(d->result,d->result_count);
 	}
-	for (std::vector<CraftDefShapeless>::iterator i=shapeless_recipes.begin(); i!=shapeless_recipes.end(); i++) {
-		CraftDefShapeless d = *i;
-		if (d == items)
-			return InventoryItem::create(d.result,d.result_count);
+	if (getShapelessKey(grid,key)) {
+		const CraftDefShapeless *d = findRecipe(shapeless_recipes,key,shapeless_index,getShapelessKey);
+		if (d)
+			return InventoryItem::create(d->result,d->result_count);
 	}
 
 	return NULL;
 }
 
-content_t *getRecipe(InventoryItem *item)
-{
-	content_t r = item->getContent();
-	content_t *recipe;
-	for (std::vector<CraftDef>::iterator i=shaped_recipes.begin(); i!=shaped_recipes.end(); i++) {
-		CraftDef d = *i;
-		if (d.result == r) {
-			recipe = new content_t[9];
-			for (int j=0; j<9; j++) {
-				recipe[j] = d.recipe[j];
-			}
-			return recipe;
+/*
+	Finds the index'th recipe in a shaped then shapeless list, as if they
+	were one list. Sets shaped or shapeless to the recipe found.
+*/
+static bool findIndexed(RecipeContentIndex &shaped_list, RecipeContentIndex &shapeless_list, content_t c, int index, const CraftDef **shaped, const CraftDefShapeless **shapeless)
+{
+	*shaped = NULL;
+	*shapeless = NULL;
+	if (index < 0)
+		return false;
+
+	RecipeContentIndex::iterator n = shaped_list.find(c);
+	if (n != shaped_list.end()) {
+		if ((u32)index < n->second.size()) {
+			*shaped = &shaped_recipes[n->second[index]];
+			return true;
 		}
+		index -= n->second.size();
 	}
-	for (std::vector<CraftDefShapeless>::iterator i=shapeless_recipes.begin(); i!=shapeless_recipes.end(); i++) {
-		CraftDefShapeless d = *i;
-		if (d.result == r) {
-			recipe = new content_t[9];
-			for (int j=0; j<9; j++) {
-				recipe[j] = d.recipe[j];
-			}
-			return recipe;
-		}
+	n = shapeless_list.find(c);
+	if (n != shapeless_list.end() && (u32)index < n->second.size()) {
+		*shapeless = &shapeless_recipes[n->second[index]];
+		return true;
 	}
-	return NULL;
+	return false;
 }
 
-content_t *getRecipe(InventoryItem *item, int index)
+static int countIndexed(RecipeContentIndex &shaped_list, RecipeContentIndex &shapeless_list, content_t c)
 {
-	content_t r = item->getContent();
-	content_t *recipe;
 	int count = 0;
-	if (index < 0)
+	RecipeContentIndex::iterator n = shaped_list.find(c);
+	if (n != shaped_list.end())
+		count += n->second.size();
+	n = shapeless_list.find(c);
+	if (n != shapeless_list.end())
+		count += n->second.size();
+	return count;
+}
+
+content_t *getRecipe(InventoryItem *item)
+{
+	return getRecipe(item,0);
+}
+
+content_t *getRecipe(InventoryItem *item, int index)
+{
+	const CraftDef *shaped;
+	const CraftDefShapeless *shapeless;
+	if (!findIndexed(shaped_results,shapeless_results,item->getContent(),index,&shaped,&shapeless))
 		return NULL;
-	for (std::vector<CraftDef>::iterator i=shaped_recipes.begin(); i!=shaped_recipes.end(); i++) {
-		CraftDef d = *i;
-		if (d.result == r) {
-			if (index != count++)
-				continue;
-			recipe = new content_t[9];
-			for (int j=0; j<9; j++) {
-				recipe[j] = d.recipe[j];
-			}
-			return recipe;
-		}
-	}
-	for (std::vector<CraftDefShapeless>::iterator i=shapeless_recipes.begin(); i!=shapeless_recipes.end(); i++) {
-		CraftDefShapeless d = *i;
-		if (d.result == r) {
-			if (index != count++)
-				continue;
-			recipe = new content_t[9];
-			for (int j=0; j<9; j++) {
-				recipe[j] = d.recipe[j];
-			}
-			return recipe;
-		}
+
+	const content_t *from = shaped ? shaped->recipe : shapeless->recipe;
+	content_t *recipe = new content_t[9];
+	for (int j=0; j<9; j++) {
+		recipe[j] = from[j];
 	}
-	return NULL;
+	return recipe;
 }
 
 int getResultCount(InventoryItem *item)
 {
-	content_t r = item->getContent();
-	for (std::vector<CraftDef>::iterator i=shaped_recipes.begin(); i!=shaped_recipes.end(); i++) {
-		CraftDef d = *i;
-		if (d.result == r)
-			return d.result_count;
-	}
-	for (std::vector<CraftDefShapeless>::iterator i=shapeless_recipes.begin(); i!=shapeless_recipes.end(); i++) {
-		CraftDefShapeless d = *i;
-		if (d.result == r)
-			return d.result_count;
-	}
-	return 0;
+	const CraftDef *shaped;
+	const CraftDefShapeless *shapeless;
+	if (!findIndexed(shaped_results,shapeless_results,item->getContent(),0,&shaped,&shapeless))
+		return 0;
+	return shaped ? shaped->result_count : shapeless->result_count;
 }
 
 int getRecipeCount(InventoryItem *item)
 {
-	content_t r = item->getContent();
-	int count = 0;
-	for (std::vector<CraftDef>::iterator i=shaped_recipes.begin(); i!=shaped_recipes.end(); i++) {
-		CraftDef d = *i;
-		if (d.result == r)
-			count++;
-	}
-	for (std::vector<CraftDefShapeless>::iterator i=shapeless_recipes.begin(); i!=shapeless_recipes.end(); i++) {
-		CraftDefShapeless d = *i;
-		if (d.result == r)
-			count++;
-	}
-	return count;
+	return countIndexed(shaped_results,shapeless_results,item->getContent());
 }
 
-//a little predicate type for determining whether a recipe contains a certain item
-struct CraftDefContains {
-	content_t item;
-	explicit CraftDefContains(content_t item_in) : item(item_in) {}
-	template <typename CD>
-	bool operator()(const CD& def) const
-	{
-		return std::find(def.recipe, def.recipe + 9, item) != def.recipe + 9;
-	}
-};
-
 int getReverseRecipeCount(InventoryItem *item)
 {
-	using namespace std;
-
-	//make a predicate object to look for recipes containing the right item
-	CraftDefContains contains_item (item->getContent());
-
-	//count up the matching recipes
-	return count_if(shaped_recipes.begin(), shaped_recipes.end(), contains_item)
-	     + count_if(shapeless_recipes.begin(), shapeless_recipes.end(), contains_item);
+	return countIndexed(shaped_uses,shapeless_uses,item->getContent());
 }
 
 //how to create a FoundReverseRecipe from a CraftDef
@@ -822,56 +930,15 @@ FoundReverseRecipe FRRFromCD(const CD& def)
 	return recipe;
 }
 
-//a helper function for reverse recipe lookup
-//count is used to count down to the correct recipe:
-//it is decremented by the function each time that it finds a viable recipe
-//this makes it possible to use this function for searches through multiple ranges
-template <typename It>
-FoundReverseRecipe reverseRecipeHelper(It cd_begin, It cd_end, content_t item, int &count)
-{
-	using namespace std;
-
-	//make a predicate object to aid with the search for recipes containing the item
-	CraftDefContains contains_item (item);
-
-	//look through each of the recipes, finding the ones which contain item
-	for (It it = cd_begin; it != cd_end; ++it) if (contains_item(*it)) {
-
-		//continue on if the target recipe hasn't been reached yet
-		if (count--) continue;
-
-		//if it is the right recipe, make a copy and return it
-		return FRRFromCD(*it);
-	}
-
-	//if nothing was found yet, return a default FoundReverseRecipe
-	return FoundReverseRecipe();
-}
-
 FoundReverseRecipe getReverseRecipe(InventoryItem *iitem, int index)
 {
-	//ignore negative indeces
-	if (index < 0)
+	const CraftDef *shaped;
+	const CraftDefShapeless *shapeless;
+	if (!findIndexed(shaped_uses,shapeless_uses,iitem->getContent(),index,&shaped,&shapeless))
 		return FoundReverseRecipe();
-
-	//find the content id for the item
-	content_t item = iitem->getContent();
-
-	//where to store the recipe when found
-	FoundReverseRecipe recipe;
-
-	//the recipe counter (counting down)
-	int count = index;
-
-	//look in the shaped recipes
-	recipe = reverseRecipeHelper(shaped_recipes.begin(), shaped_recipes.end(), item, count);
-
-	//if that fails, look in the shapeless recipes
-	if (!recipe)
-		recipe = reverseRecipeHelper(shapeless_recipes.begin(), shapeless_recipes.end(), item, count);
-
-	//return the located recipe, if one was found
-	return recipe;
+	if (shaped)
+		return FRRFromCD(*shaped);
+	return FRRFromCD(*shapeless);
 }
 
 //how to update an ingredient list given a range of new craft items
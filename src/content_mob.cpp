@@ -109,7 +109,8 @@ void MobFeatures::setAnimationFrames(MobAnimation type, int start, int end)
 
 bool content_mob_spawn(ServerEnvironment *env, v3s16 pos, u32 active_object_count)
 {
-	ScopeProfiler sp(g_profiler, "SEnv: content_mob_spawn");
+	static u32 prof_spawn = g_profiler->getId("SEnv: content_mob_spawn");
+	ScopeProfiler sp(g_profiler, prof_spawn);
 	if (active_object_count > 20)
 		return false;
 	int rand = myrand();
@@ -122,7 +122,8 @@ ServerActiveObject* ItemSAO::create(ServerEnvironment *env, u16 id, v3f pos,
 
 void ItemSAO::step(float dtime, bool send_recommended)
 {
-	ScopeProfiler sp2(g_profiler, "ItemSAO::step avg", SPT_AVG);
+	static u32 prof_step = g_profiler->getId("ItemSAO::step avg");
+	ScopeProfiler sp2(g_profiler, prof_step, SPT_AVG);
 
 	assert(m_env);
 
@@ -980,6 +981,16 @@ void MobSAO::stepMotionSeeker(float dtime)
 			}
 		}
 
+		/* Follow a path to the player if one has been found */
+		if (m_walk_around && !m_next_pos_exists) {
+			v3s16 next;
+			v3s16 goal = floatToInt(player_pos, BS);
+			if (m_env->getPathFinder().getNextStep(m_id, pos_i, goal, m.getSizeBlocks(), next)) {
+				m_next_pos_i = next;
+				m_next_pos_exists = true;
+			}
+		}
+
 		if (m_walk_around && !m_next_pos_exists) {
 			/* Find some position where to go next */
 			v3s16 dps[3*3*3];
@@ -1313,46 +1324,13 @@ void MobSAO::stepMotionConstant(float dtime)
 bool MobSAO::checkFreePosition(v3s16 p0)
 {
 	assert(m_env);
-	Map *map = &m_env->getMap();
-	v3s16 size = content_mob_features(m_content).getSizeBlocks();
-	if (content_mob_features(m_content).motion_type == MMT_SWIM) {
-		for (int dx=0; dx<size.X; dx++)
-		for (int dy=0; dy<size.Y; dy++)
-		for (int dz=0; dz<size.Z; dz++) {
-			v3s16 dp(dx, dy, dz);
-			v3s16 p = p0 + dp;
-			MapNode n = map->getNodeNoEx(p);
-			if (n.getContent() != CONTENT_WATERSOURCE)
-				return false;
-		}
-	}else{
-		for (int dx=0; dx<size.X; dx++)
-		for (int dy=0; dy<size.Y; dy++)
-		for (int dz=0; dz<size.Z; dz++) {
-			v3s16 dp(dx, dy, dz);
-			v3s16 p = p0 + dp;
-			MapNode n = map->getNodeNoEx(p);
-			if (n.getContent() != CONTENT_AIR && content_features(n).walkable)
-				return false;
-			if (content_features(n).liquid_type == LIQUID_SOURCE)
-				return false;
-		}
-	}
-	MapNode n = map->getNodeNoEx(p0+v3s16(0,-1,0));
-	if (!content_features(n).jumpable)
-		return false;
-	return true;
+	MobFeatures &m = content_mob_features(m_content);
+	return m_env->getPathFinder().isFree(p0, m.getSizeBlocks(), m.motion_type == MMT_SWIM);
 }
 bool MobSAO::checkWalkablePosition(v3s16 p0)
 {
 	assert(m_env);
-	v3s16 p = p0 + v3s16(0,-1,0);
-	MapNode n = m_env->getMap().getNodeNoEx(p);
-	if (n.getContent() != CONTENT_AIR) {
-		if (content_features(n).liquid_type == LIQUID_NONE && content_features(n).walkable)
-			return true;
-	}
-	return false;
+	return m_env->getPathFinder().isWalkable(p0);
 }
 bool MobSAO::checkFreeAndWalkablePosition(v3s16 p0)
 {
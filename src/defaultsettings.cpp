@@ -137,9 +137,13 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("enable_http","true");
 #endif
 	settings->setDefault("profiler_print_interval", "0");
+	settings->setDefault("profiler_dump_interval", "0");
+	settings->setDefault("profiler_dump_file", "");
 	settings->setDefault("enable_mapgen_debug_info", "false");
 	settings->setDefault("objectdata_interval", "0.2");
 	settings->setDefault("active_object_send_range_blocks", "3");
+	settings->setDefault("active_object_near_range_blocks", "1");
+	settings->setDefault("mob_pathfind_budget", "2000");
 	settings->setDefault("active_block_range", "2");
 	//settings->setDefault("max_simultaneous_block_sends_per_client", "1");
 	// This causes frametime jitter on client side, or does it?
@@ -147,6 +151,12 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("max_simultaneous_block_sends_server_total", "20");
 	settings->setDefault("max_block_send_distance", "7");
 	settings->setDefault("max_block_generate_distance", "5");
+	settings->setDefault("block_send_cache_size", "32");
+	settings->setDefault("num_emerge_threads", "2");
+	settings->setDefault("liquid_update_time_budget", "50000");
+	settings->setDefault("server_ingest_batch", "true");
+	settings->setDefault("server_ingest_time_budget", "10000");
+	settings->setDefault("server_tick_rate", "30");
 	settings->setDefault("time_send_interval", "5");
 	settings->setDefault("time_speed", "96");
 	settings->setDefault("server_unload_unused_data_timeout", "19");
@@ -24,6 +24,8 @@
 ************************************************************************/
 
 #include "environment.h"
+#include <bitset>
+#include <stdio.h>
 #include "filesys.h"
 #include "porting.h"
 #include "collision.h"
@@ -34,7 +36,7 @@
 #include "serverobject.h"
 #include "content_sao.h"
 #include "content_mob.h"
-#include "plantgrowth.h"
+#include "content_abm.h"
 #include "settings.h"
 #include "log.h"
 #include "profiler.h"
@@ -43,6 +45,158 @@
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
 
+/*
+	The blocks covered by a searchNear() or searchNearInv() call. Each
+	block is looked up once per search rather than once per node, and the
+	block's content counts tell whether it can contain a match at all, so
+	most blocks are never walked node by node.
+*/
+class NodeSearchArea
+{
+public:
+	NodeSearchArea(Map *map, v3s16 pos, v3s16 radius_min, v3s16 radius_max, std::vector<content_t> &c):
+		m_ignore_in_set(false),
+		m_any_has(false),
+		m_any_lacks(false)
+	{
+		for (std::vector<content_t>::iterator i=c.begin(); i != c.end(); i++) {
+			if (*i <= MAX_CONTENT)
+				m_set.set(*i);
+		}
+		m_ignore_in_set = m_set.test(CONTENT_IGNORE);
+
+		m_bp_min = getNodeBlockPos(pos+radius_min);
+		v3s16 bp_max = getNodeBlockPos(pos+radius_max);
+		m_size = bp_max-m_bp_min+v3s16(1,1,1);
+		u32 count = m_size.X*m_size.Y*m_size.Z;
+		m_blocks.resize(count,NULL);
+		m_has.resize(count,false);
+		m_lacks.resize(count,false);
+
+		v3s16 bp;
+		u32 i = 0;
+		for (bp.Z=m_bp_min.Z; bp.Z<=bp_max.Z; bp.Z++)
+		for (bp.Y=m_bp_min.Y; bp.Y<=bp_max.Y; bp.Y++)
+		for (bp.X=m_bp_min.X; bp.X<=bp_max.X; bp.X++,i++) {
+			MapBlock *block = map->getBlockNoCreateNoEx(bp);
+			if (block == NULL || block->isDummy()) {
+				// a missing block reads as CONTENT_IGNORE
+				m_has[i] = m_ignore_in_set;
+				m_lacks[i] = !m_ignore_in_set;
+			}else{
+				m_blocks[i] = block;
+				const std::map<content_t,u16> &counts = block->getContentCounts();
+				for (std::map<content_t,u16>::const_iterator ci = counts.begin(); ci != counts.end(); ci++) {
+					if (contains(ci->first)) {
+						m_has[i] = true;
+					}else{
+						m_lacks[i] = true;
+					}
+				}
+			}
+			m_any_has |= m_has[i];
+			m_any_lacks |= m_lacks[i];
+		}
+	}
+
+	bool contains(content_t c)
+	{
+		return (c <= MAX_CONTENT && m_set.test(c));
+	}
+
+	// whether any node in the area can be one of the searched contents
+	bool anyHas() {return m_any_has;}
+	// whether any node in the area can be something else
+	bool anyLacks() {return m_any_lacks;}
+
+	// returns the block index of p
+	u32 index(v3s16 p)
+	{
+		v3s16 bp = getNodeBlockPos(p)-m_bp_min;
+		return bp.Z*m_size.Y*m_size.X + bp.Y*m_size.X + bp.X;
+	}
+	bool blockHas(u32 i) {return m_has[i];}
+	bool blockLacks(u32 i) {return m_lacks[i];}
+
+	content_t getContent(u32 i, v3s16 p)
+	{
+		MapBlock *block = m_blocks[i];
+		if (block == NULL)
+			return CONTENT_IGNORE;
+		bool pos_ok;
+		return block->getNodeNoCheck(p-block->getPosRelative(),&pos_ok).getContent();
+	}
+
+private:
+	std::bitset<MAX_CONTENT+1> m_set;
+	bool m_ignore_in_set;
+	v3s16 m_bp_min;
+	v3s16 m_size;
+	std::vector<MapBlock*> m_blocks;
+	std::vector<bool> m_has;
+	std::vector<bool> m_lacks;
+	bool m_any_has;
+	bool m_any_lacks;
+};
+
+static bool search_near(Map *map, v3s16 pos, v3s16 radius_min, v3s16 radius_max, std::vector<content_t> &c, v3s16 *found)
+{
+	if (map->getBlockNoCreateNoEx(getNodeBlockPos(pos)) == NULL)
+		return false;
+	NodeSearchArea area(map,pos,radius_min,radius_max,c);
+	if (!area.anyHas())
+		return false;
+	v3s16 p;
+
+	for(s16 x=radius_min.X; x<=radius_max.X; x++) {
+		for(s16 y=radius_min.Y; y<=radius_max.Y; y++) {
+			for(s16 z=radius_min.Z; z<=radius_max.Z; z++) {
+				if (!x && !y && !z)
+					continue;
+				p = pos+v3s16(x,y,z);
+				u32 i = area.index(p);
+				if (!area.blockHas(i))
+					continue;
+				if (area.contains(area.getContent(i,p))) {
+					if (found != NULL)
+						*found = p;
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+static bool search_near_inv(Map *map, v3s16 pos, v3s16 radius_min, v3s16 radius_max, std::vector<content_t> &c, v3s16 *found)
+{
+	if (map->getBlockNoCreateNoEx(getNodeBlockPos(pos)) == NULL)
+		return false;
+	NodeSearchArea area(map,pos,radius_min,radius_max,c);
+	if (!area.anyLacks())
+		return false;
+	v3s16 p;
+
+	for(s16 x=radius_min.X; x<=radius_max.X; x++) {
+		for(s16 y=radius_min.Y; y<=radius_max.Y; y++) {
+			for(s16 z=radius_min.Z; z<=radius_max.Z; z++) {
+				if (!x && !y && !z)
+					continue;
+				p = pos+v3s16(x,y,z);
+				u32 i = area.index(p);
+				if (!area.blockLacks(i))
+					continue;
+				if (!area.contains(area.getContent(i,p))) {
+					if (found != NULL)
+						*found = p;
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
 Environment::Environment():
 	m_time(0),
 	m_time_of_day(9000),
@@ -303,11 +457,13 @@ void ActiveBlockList::update(std::list<v3s16> &active_positions,
 ServerEnvironment::ServerEnvironment(ServerMap *map, Server *server):
 	m_map(map),
 	m_server(server),
+	m_pathfinder(map),
 	m_send_recommended_timer(0),
 	m_game_time(0),
 	m_game_time_fraction_counter(0),
 	m_players_sleeping(false)
 {
+	content_abm_init(this);
 }
 
 ServerEnvironment::~ServerEnvironment()
@@ -325,105 +481,50 @@ ServerEnvironment::~ServerEnvironment()
 
 void ServerEnvironment::serializePlayers(const std::string &savedir)
 {
-	std::string players_path = savedir + "/players";
-	fs::CreateDir(players_path);
-
-	core::map<Player*, bool> saved_players;
-
-	std::vector<fs::DirListNode> player_files = fs::GetDirListing(players_path);
-	for (u32 i=0; i<player_files.size(); i++) {
-		if (player_files[i].dir)
-			continue;
-
-		// Full path to this file
-		std::string path = players_path + "/" + player_files[i].name;
-
-		// Load player to see what is its name
-		ServerRemotePlayer testplayer;
-		{
-			// Open file and deserialize
-			std::ifstream is(path.c_str(), std::ios_base::binary);
-			if (is.good() == false) {
-				infostream<<"Failed to read "<<path<<std::endl;
-				continue;
-			}
-			testplayer.deSerialize(is);
-		}
-
-		//infostream<<"Loaded test player with name "<<testplayer.getName()<<std::endl;
-
-		// Search for the player
-		std::string playername = testplayer.getName();
-		Player *player = getPlayer(playername.c_str());
-		if (player == NULL) {
-			fs::RecursiveDelete(path);
-			continue;
-		}
-
-		//infostream<<"Found matching player, overwriting."<<std::endl;
-
-		// OK, found. Save player there.
-		{
-			// Open file and serialize
-			std::ofstream os(path.c_str(), std::ios_base::binary);
-			if (os.good() == false) {
-				infostream<<"Failed to overwrite "<<path<<std::endl;
-				continue;
-			}
-			player->serialize(os);
-			saved_players.insert(player, true);
-		}
-	}
+	std::map<std::string, std::string> changed;
 
 	for (core::list<Player*>::Iterator i = m_players.begin(); i != m_players.end(); i++) {
 		Player *player = *i;
-		if (saved_players.find(player) != NULL)
-			continue;
 		std::string playername = player->getName();
 		// Don't save unnamed player
 		if (playername == "")
 			continue;
-		/*
-			Find a sane filename
-		*/
-		if (string_allowed(playername, PLAYERNAME_ALLOWED_CHARS) == false)
-			playername = "player";
-		std::string path = players_path + "/" + playername;
-		bool found = false;
-		for (u32 i=0; i<1000; i++) {
-			if (fs::PathExists(path) == false) {
-				found = true;
-				break;
-			}
-			path = players_path + "/" + playername + itos(i);
-		}
-		if (found == false) {
-			infostream<<"Didn't find free file for player"<<std::endl;
+
+		std::ostringstream os(std::ios_base::binary);
+		player->serialize(os);
+		std::string data = os.str();
+
+		// Players who haven't changed since they were last saved, such as
+		// those who have left, aren't written again
+		std::map<std::string, std::string>::iterator n = m_saved_players.find(playername);
+		if (n != m_saved_players.end() && n->second == data)
 			continue;
-		}
 
-		{
-			/*infostream<<"Saving player "<<player->getName()<<" to "
-					<<path<<std::endl;*/
-			// Open file and serialize
-			std::ofstream os(path.c_str(), std::ios_base::binary);
-			if (os.good() == false) {
-				infostream<<"Failed to overwrite "<<path<<std::endl;
-				continue;
-			}
-			player->serialize(os);
-			saved_players.insert(player, true);
-		}
+		changed[playername] = data;
+		m_saved_players[playername] = data;
 	}
 
-	//infostream<<"Saved "<<saved_players.size()<<" players."<<std::endl;
+	m_map->savePlayers(changed);
+
+	static u32 prof_saved = g_profiler->getId("SEnv: players saved");
+	g_profiler->avg(prof_saved, changed.size());
 }
 
+/*
+	Players are loaded from the map database when they join, this only
+	moves the players of a world that still has a players directory into
+	the database. The directory is then renamed so it's only done once.
+	If that fails the files are read again on the next start, so only
+	players who aren't in the database yet are taken from them.
+*/
 void ServerEnvironment::deSerializePlayers(const std::string &savedir)
 {
 	std::string players_path = savedir + "/players";
 
-	core::map<Player*, bool> saved_players;
+	if (!fs::PathExists(players_path))
+		return;
+
+	std::map<std::string, std::string> players;
 
 	std::vector<fs::DirListNode> player_files = fs::GetDirListing(players_path);
 	for (u32 i=0; i<player_files.size(); i++) {
@@ -435,52 +536,66 @@ void ServerEnvironment::deSerializePlayers(const std::string &savedir)
 
 		infostream<<"Checking player file "<<path<<std::endl;
 
-		// Load player to see what is its name
-		ServerRemotePlayer testplayer;
+		std::string data;
 		{
-			// Open file and deserialize
+			// Open file and read it all
 			std::ifstream is(path.c_str(), std::ios_base::binary);
 			if (is.good() == false) {
 				infostream<<"Failed to read "<<path<<std::endl;
 				continue;
 			}
+			std::ostringstream os(std::ios_base::binary);
+			os<<is.rdbuf();
+			data = os.str();
+		}
+
+		// Load player to see what is its name
+		ServerRemotePlayer testplayer;
+		{
+			std::istringstream is(data, std::ios_base::binary);
 			testplayer.deSerialize(is);
 		}
 
-		if (!string_allowed(testplayer.getName(), PLAYERNAME_ALLOWED_CHARS)) {
-			fs::RecursiveDelete(path);
+		if (!string_allowed(testplayer.getName(), PLAYERNAME_ALLOWED_CHARS))
 			continue;
-		}
 
-		infostream<<"Loaded test player with name "<<testplayer.getName()
-				<<std::endl;
+		infostream<<"Importing player "<<testplayer.getName()<<" from "
+				<<path<<std::endl;
 
-		// Search for the player
-		std::string playername = testplayer.getName();
-		Player *player = getPlayer(playername.c_str());
-		bool newplayer = false;
-		if (player == NULL) {
-			infostream<<"Is a new player"<<std::endl;
-			player = new ServerRemotePlayer();
-			newplayer = true;
-		}
+		players[testplayer.getName()] = data;
+	}
 
-		// Load player
-		{
-			infostream<<"Reading player "<<testplayer.getName()<<" from "
-					<<path<<std::endl;
-			// Open file and deserialize
-			std::ifstream is(path.c_str(), std::ios_base::binary);
-			if (is.good() == false) {
-				infostream<<"Failed to read "<<path<<std::endl;
-				continue;
-			}
-			player->deSerialize(is);
-		}
+	m_map->savePlayers(players, true);
+
+	std::string old_path = players_path + ".old";
+	if (rename(players_path.c_str(), old_path.c_str()) != 0) {
+		errorstream<<"Failed to rename "<<players_path<<" to "<<old_path
+				<<", players not in the database will be imported again"<<std::endl;
+		return;
+	}
+
+	infostream<<"Imported "<<players.size()<<" players, "<<players_path
+			<<" was renamed to "<<old_path<<std::endl;
+}
+
+Player *ServerEnvironment::loadPlayer(const std::string &name)
+{
+	std::string data;
+	if (!m_map->loadPlayer(name, data))
+		return NULL;
 
-		if (newplayer)
-			addPlayer(player);
+	Player *player = new ServerRemotePlayer();
+	{
+		std::istringstream is(data, std::ios_base::binary);
+		player->deSerialize(is);
 	}
+	// The database is keyed by name, trust that over the data
+	player->updateName(name.c_str());
+
+	m_saved_players[name] = data;
+	addPlayer(player);
+
+	return player;
 }
 
 void ServerEnvironment::saveMeta(const std::string &savedir)
@@ -616,6 +731,7 @@ void ServerEnvironment::clearAllObjects()
 	// Remove references from m_active_objects
 	for (std::vector<u16>::iterator i = objects_to_remove.begin(); i != objects_to_remove.end(); i++) {
 		m_active_objects.erase(*i);
+		unindexActiveObject(*i);
 	}
 
 	core::list<v3s16> loadable_blocks;
@@ -662,80 +778,12 @@ void ServerEnvironment::clearAllObjects()
 
 bool ServerEnvironment::searchNear(v3s16 pos, v3s16 radius_min, v3s16 radius_max, std::vector<content_t> c, v3s16 *found)
 {
-	v3s16 blockpos = getNodeBlockPos(pos);
-	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
-	if (block == NULL)
-		return false;
-	v3s16 relpos = blockpos*MAP_BLOCKSIZE;
-	v3s16 p;
-	v3s16 bp;
-
-	for(s16 x=radius_min.X; x<=radius_max.X; x++) {
-		for(s16 y=radius_min.Y; y<=radius_max.Y; y++) {
-			for(s16 z=radius_min.Z; z<=radius_max.Z; z++) {
-				if (!x && !y && !z)
-					continue;
-				p = pos+v3s16(x,y,z);
-				MapNode n_test;
-				bp = getNodeBlockPos(p);
-				if (bp == blockpos) {
-					bool pos_ok;
-					n_test = block->getNodeNoCheck(p-relpos,&pos_ok);
-				}else{
-					n_test = m_map->getNodeNoEx(p);
-				}
-				for (std::vector<content_t>::iterator i=c.begin(); i != c.end(); i++) {
-					if (n_test.getContent() == *i) {
-						if (found != NULL)
-							*found = p;
-						return true;
-					}
-				}
-			}
-		}
-	}
-	return false;
+	return search_near(m_map,pos,radius_min,radius_max,c,found);
 }
 
 bool ServerEnvironment::searchNearInv(v3s16 pos, v3s16 radius_min, v3s16 radius_max, std::vector<content_t> c, v3s16 *found)
 {
-	v3s16 blockpos = getNodeBlockPos(pos);
-	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
-	if (block == NULL)
-		return false;
-	v3s16 relpos = blockpos*MAP_BLOCKSIZE;
-	v3s16 p;
-	v3s16 bp;
-	for(s16 x=radius_min.X; x<=radius_max.X; x++) {
-		for(s16 y=radius_min.Y; y<=radius_max.Y; y++) {
-			for(s16 z=radius_min.Z; z<=radius_max.Z; z++) {
-				if (!x && !y && !z)
-					continue;
-				p = pos+v3s16(x,y,z);
-				MapNode n_test;
-				bp = getNodeBlockPos(p);
-				if (bp == blockpos) {
-					bool pos_ok;
-					n_test = block->getNodeNoCheck(p-relpos,&pos_ok);
-				}else{
-					n_test = m_map->getNodeNoEx(p);
-				}
-				bool s = false;
-				for (std::vector<content_t>::iterator i=c.begin(); i != c.end(); i++) {
-					if (n_test.getContent() == *i) {
-						s = true;
-						break;
-					}
-				}
-				if (!s) {
-					if (found != NULL)
-						*found = p;
-					return true;
-				}
-			}
-		}
-	}
-	return false;
+	return search_near_inv(m_map,pos,radius_min,radius_max,c,found);
 }
 
 void ServerEnvironment::step(float dtime)
@@ -748,7 +796,8 @@ void ServerEnvironment::step(float dtime)
 	time_diff *= 24000.0;
 
 	// Get some settings
-	bool footprints = g_settings->getBool("enable_footprints");
+	static SettingHandle<bool> footprints_h(g_settings, "enable_footprints");
+	bool footprints = footprints_h.get();
 
 	/*
 		Increment game time
@@ -770,7 +819,8 @@ void ServerEnvironment::step(float dtime)
 		Handle players
 	*/
 	{
-		ScopeProfiler sp(g_profiler, "SEnv: handle players avg", SPT_AVG);
+		static u32 prof_players = g_profiler->getId("SEnv: handle players avg");
+		ScopeProfiler sp(g_profiler, prof_players, SPT_AVG);
 		int pc = 0;
 		for (core::list<Player*>::Iterator i = m_players.begin(); i != m_players.end(); i++) {
 			Player *player = *i;
@@ -875,7 +925,8 @@ void ServerEnvironment::step(float dtime)
 			m_players_sleeping = false;
 		}
 
-		ScopeProfiler sp(g_profiler, "SEnv: manage act. block list avg /2s", SPT_AVG);
+		static u32 prof_blocks = g_profiler->getId("SEnv: manage act. block list avg /2s");
+		ScopeProfiler sp(g_profiler, prof_blocks, SPT_AVG);
 
 		/*
 			Update list of active blocks, collecting changes
@@ -941,7 +992,22 @@ void ServerEnvironment::step(float dtime)
 		s16 coldzone = 60;
 		if (season == ENV_SEASON_WINTER)
 			coldzone = 5;
-		bool unsafe_fire = g_settings->getBool("unsafe_fire");
+		static SettingHandle<bool> unsafe_fire_h(g_settings, "unsafe_fire");
+		bool unsafe_fire = unsafe_fire_h.get();
+
+		// Find the active block modifiers to run this time
+		std::vector<bool> abm_due(m_abms.size(), false);
+		if (nodestep) {
+			for (u32 k=0; k<m_abms.size(); k++) {
+				ActiveBlockModifier &abm = m_abms[k];
+				abm.timer += 10.0;
+				if (abm.timer < abm.trigger_interval)
+					continue;
+				abm.timer = 0.0;
+				abm_due[k] = true;
+			}
+		}
+
 		for (std::set<v3s16>::iterator i = m_active_blocks.m_list.begin(); i != m_active_blocks.m_list.end(); i++) {
 			v3s16 bp = *i;
 
@@ -998,1845 +1064,210 @@ void ServerEnvironment::step(float dtime)
 					MapNode n = i->second;
 					NodeMetadata *meta = NULL;
 					std::string n_owner = "";
-					std::string i_owner = "";
-					meta = m_map->getNodeMetadata(sp);
-					if (meta) {
-						n_owner = meta->getOwner();
-						i_owner = meta->getInventoryOwner();
-						meta = meta->clone();
-					}
-					m_map->addNodeWithEvent(sp, n);
-					if (meta) {
-						m_map->setNodeMetadata(sp,meta);
-						meta = m_map->getNodeMetadata(sp);
-						if (meta) {
-							if (n_owner != "")
-								meta->setOwner(n_owner);
-							if (i_owner != "")
-								meta->setInventoryOwner(i_owner);
-						}
-					}
-				}
-				m_poststep_nodeswaps.clear();
-			}
-
-			if (!nodestep)
-				continue;
-
-			bool has_steam_sound = false;
-
-			/*
-				Do stuff!
-
-				Note that map modifications should be done using the event-
-				making map methods so that the server gets information
-				about them.
-
-				Reading can be done quickly directly from the block.
-
-				Everything should bind to inside this single content
-				searching loop to keep things fast.
-			*/
-			u32 active_object_count_wider = 0;
-			for (s16 x=-1; x<=1; x++)
-			for (s16 y=-1; y<=1; y++)
-			for (s16 z=-1; z<=1; z++) {
-				MapBlock *wblock = m_map->getBlockNoCreateNoEx(bp+v3s16(x,y,z));
-				if (wblock == NULL)
-					continue;
-				active_object_count_wider += wblock->m_static_objects.m_objects.size();
-				active_object_count_wider += wblock->m_active_objects.size();
-			}
-
-			// TODO: don't spawn if there was a recent one nearby
-			if (
-				active_object_count_wider < 6
-				&& (
-					block->last_spawn < m_time_of_day-6000
-					|| block->last_spawn > m_time_of_day+6000
-				)
-			) {
-				MapNode n = block->getNodeNoEx(block->spawn_area);
-				MapNode n1 = block->getNodeNoEx(block->spawn_area+v3s16(0,1,0));
-				MapNode n2 = block->getNodeNoEx(block->spawn_area+v3s16(0,2,0));
-				u8 light = n1.getLightBlend(getDayNightRatio());
-				if (block->water_spawn) {
-					if (n1.getContent() != CONTENT_WATERSOURCE || n2.getContent() != CONTENT_WATERSOURCE)
-						block->has_spawn_area = false;
-				}else{
-					if (
-						!content_features(n1.getContent()).air_equivalent
-						|| !content_features(n2.getContent()).air_equivalent
-					)
-						block->has_spawn_area = false;
-				}
-
-				if (block->has_spawn_area) {
-					// dawn, passive mobs spawn
-					if (m_time_of_day > 7000 && m_time_of_day < 8000) {
-						if (!active_object_count_wider) {
-							if (block->water_spawn) {
-								if (n.getContent() == CONTENT_SAND)
-									mob_spawn_passive(block->spawn_area+block->getPosRelative(),block->water_spawn,this);
-							}else if (
-								(
-									n.getContent() == CONTENT_GRASS
-									|| n.getContent() == CONTENT_GRASS_AUTUMN
-									|| n.getContent() == CONTENT_GRASS_FOOTSTEPS
-									|| n.getContent() == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-									|| n.getContent() == CONTENT_MUDSNOW
-								) && (
-									light >= LIGHT_SPAWN_BRIGHT
-								)
-							) {
-								mob_spawn_passive(block->spawn_area+block->getPosRelative(),block->water_spawn,this);
-							}else if (n.getContent() == CONTENT_STONE && light <= LIGHT_SPAWN_DARK && block->getPosRelative().Y < -16) {
-								mob_spawn(block->spawn_area+block->getPosRelative(),CONTENT_MOB_RAT,this);
-							}
-						}
-						block->last_spawn = m_time_of_day;
-					// dusk, hostile mobs spawn, or fireflies
-					}else if (m_time_of_day > 19000 && m_time_of_day < 20000) {
-						if (light <= LIGHT_SPAWN_DARK) {
-							if (
-								(
-									n.getContent() == CONTENT_STONE
-									|| n.getContent() == CONTENT_SAND
-								) && (
-									block->water_spawn
-									|| (
-										block->getPos().Y > 0
-										|| myrand_range(0,5) == 0
-									)
-								)
-							) {
-								mob_spawn_hostile(block->spawn_area+block->getPosRelative(),block->water_spawn,this);
-							}else if (n1.getContent() == CONTENT_JUNGLEGRASS) {
-								mob_spawn(block->spawn_area+block->getPosRelative(),CONTENT_MOB_FIREFLY,this);
-							}
-						}
-						block->last_spawn = m_time_of_day;
-					}
-				}
-			}
-
-			v3s16 p0;
-			for (p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-			for (p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-			for (p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++) {
-				v3s16 p = p0 + block->getPosRelative();
-				block->incNodeTicks(p0);
-				MapNode n = block->getNodeNoEx(p0);
-				if (!block->has_spawn_area && content_features(n.getContent()).draw_type == CDT_CUBELIKE) {
-					MapNode n1 = block->getNodeNoEx(p0+v3s16(0,1,0));
-					MapNode n2 = block->getNodeNoEx(p0+v3s16(0,2,0));
-					if (
-						content_features(n1.getContent()).air_equivalent
-						&& content_features(n2.getContent()).air_equivalent
-						&& myrand_range(0,5) == 0
-					) {
-						block->spawn_area = p0;
-						block->has_spawn_area = true;
-						block->water_spawn = false;
-					}else if (
-						n.getContent() == CONTENT_SAND
-						&& n1.getContent() == CONTENT_WATERSOURCE
-						&& n2.getContent() == CONTENT_WATERSOURCE
-					) {
-						block->spawn_area = p0;
-						block->has_spawn_area = true;
-						block->water_spawn = true;
-					}
-				}
-
-				switch(n.getContent()) {
-				case CONTENT_GRASS_FOOTSTEPS:
-				{
-					if (n.envticks > 3) {
-						n.setContent(CONTENT_GRASS);
-						m_map->addNodeWithEvent(p, n);
-					}
-					break;
-				}
-				case CONTENT_GRASS_FOOTSTEPS_AUTUMN:
-				{
-					if (n.envticks > 3) {
-						n.setContent(CONTENT_GRASS_AUTUMN);
-						m_map->addNodeWithEvent(p, n);
-					}
-					break;
-				}
-				/*
-					Convert mud under proper lighting to grass
-				*/
-				case CONTENT_MUD:
-				{
-					MapNode n_top = m_map->getNodeNoEx(p+v3s16(0,1,0));
-					if (content_features(n_top).air_equivalent) {
-						if (p.Y > (coldzone+10) && p.Y < 1024) {
-							// should only change to snow if there's nothing above it
-							std::vector<content_t> search;
-							search.push_back(CONTENT_SNOW);
-							search.push_back(CONTENT_AIR);
-							if (!searchNearInv(p,v3s16(0,0,0),v3s16(0,32,0),search,NULL)) {
-								n.setContent(CONTENT_MUDSNOW);
-								m_map->addNodeWithEvent(p, n);
-							}
-						}else if (n_top.getLightBlend(getDayNightRatio()) >= 13) {
-							if (season == ENV_SEASON_AUTUMN || season == ENV_SEASON_WINTER) {
-								n.setContent(CONTENT_GROWING_GRASS_AUTUMN);
-							}else{
-								n.setContent(CONTENT_GROWING_GRASS);
-							}
-							n.param2 = 0;
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-
-				case CONTENT_GROWING_GRASS:
-					if (season == ENV_SEASON_WINTER || season == ENV_SEASON_AUTUMN) {
-						n.setContent(CONTENT_GROWING_GRASS_AUTUMN);
-						m_map->addNodeWithEvent(p,n);
-					}
-				case CONTENT_GROWING_GRASS_AUTUMN:
-				{
-					MapNode n_top = m_map->getNodeNoEx(p+v3s16(0,1,0));
-					if (content_features(n_top).air_equivalent) {
-						if (season != ENV_SEASON_WINTER)
-							plantgrowth_grass(this,p);
-					}else{
-						n.setContent(CONTENT_MUD);
-						m_map->addNodeWithEvent(p,n);
-					}
-					break;
-				}
-
-				case CONTENT_WATER:
-				case CONTENT_WATERSOURCE:
-				{
-					if (p.Y > coldzone && p.Y < 1024) {
-						s16 range = (p.Y > coldzone) ? 2 : 4;
-						std::vector<content_t> search;
-						search.push_back(CONTENT_LAVASOURCE);
-						search.push_back(CONTENT_LAVA);
-						search.push_back(CONTENT_FIRE);
-						if (searchNear(p,v3s16(range,1,range),search,NULL)) {
-							n.setContent(CONTENT_ICE);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-
-				case CONTENT_ICE:
-				{
-					bool found = false;
-					if (p.Y > 0) {
-						s16 range = (p.Y > coldzone) ? 2 : 4;
-						std::vector<content_t> search;
-						search.push_back(CONTENT_LAVASOURCE);
-						search.push_back(CONTENT_LAVA);
-						search.push_back(CONTENT_FIRE);
-						found = searchNear(p,v3s16(range,1,range),search,NULL);
-					}else{
-						found = true;
-					}
-					if (found) {
-						if (searchNear(p,v3s16(5,1,5),CONTENT_WATERSOURCE,NULL)) {
-							n.setContent(CONTENT_WATER);
-							m_map->addNodeWithEvent(p, n);
-						}else{
-							n.setContent(CONTENT_WATERSOURCE);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-
-				case CONTENT_SNOW:
-				{
-					MapNode n_test = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-					if (n_test.getContent() == CONTENT_AIR || p.Y < (coldzone-10))
-						m_map->removeNodeWithEvent(p);
-					break;
-				}
-
-				case CONTENT_SNOW_BLOCK:
-				{
-					if (p.Y < 1) {
-						if (searchNear(p,v3s16(3,1,3),CONTENT_WATERSOURCE,NULL)) {
-							n.setContent(CONTENT_WATER);
-							m_map->addNodeWithEvent(p, n);
-						}else{
-							n.setContent(CONTENT_WATERSOURCE);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}else{
-						std::vector<content_t> search;
-						search.push_back(CONTENT_LAVASOURCE);
-						search.push_back(CONTENT_LAVA);
-						search.push_back(CONTENT_FIRE);
-						if (searchNear(p,v3s16(3,1,3),search,NULL)) {
-							n.setContent(CONTENT_WATERSOURCE);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-
-				// Grow stuff on farm dirt
-				case CONTENT_FARM_DIRT:
-				{
-					if (n.envticks%4 == 0) { // with this plants take around 10 minutes to grow
-						s16 max_d = 3;
-						v3s16 temp_p = p;
-						v3s16 test_p;
-						MapNode testnode;
-						u8 water_found = 0; // 1 = flowing, 2 = source
-						bool ignore_found = false;
-						for(s16 z=-max_d; water_found < 2 && z<=max_d; z++) {
-						for(s16 x=-max_d; water_found < 2 && x<=max_d; x++) {
-							test_p = temp_p + v3s16(x,0,z);
-							testnode = m_map->getNodeNoEx(test_p);
-							if (testnode.getContent() == CONTENT_WATERSOURCE) {
-								water_found = 2;
-							}else if (testnode.getContent() == CONTENT_WATER) {
-								water_found = 1;
-							}else if (testnode.getContent() == CONTENT_IGNORE) {
-								ignore_found = true;
-							}
-						}
-						}
-
-						if (water_found) {
-							test_p = temp_p + v3s16(0,1,0);
-							testnode = m_map->getNodeNoEx(test_p);
-							if (content_features(testnode).draw_type == CDT_PLANTLIKE) {
-								if (content_features(testnode).param2_type == CPT_PLANTGROWTH) {
-									plantgrowth_plant(this,test_p);
-								}else if (content_features(testnode).special_alternate_node != CONTENT_IGNORE) {
-									plantgrowth_seed(this,test_p);
-								}
-							}else if (content_features(testnode).draw_type == CDT_MELONLIKE) {
-								if (content_features(testnode).param2_type == CPT_PLANTGROWTH)
-									plantgrowth_plant(this,test_p);
-							}else if (testnode.getContent() == CONTENT_CACTUS) {
-								plantgrowth_cactus(this,test_p);
-							}else if (testnode.getContent() == CONTENT_FERTILIZER) {
-								plantgrowth_fertilizer(this,test_p);
-							}else if (testnode.getContent() == CONTENT_AIR) {
-								int chance = 5;
-								if (water_found == 1)
-									chance = 2;
-								if (myrand()%chance == 0) {
-									// revert to mud
-									n.setContent(CONTENT_MUD);
-									m_map->addNodeWithEvent(p,n);
-								}else{
-									// grow flower
-									n.setContent(CONTENT_FLOWER_STEM);
-									m_map->addNodeWithEvent(test_p,n);
-								}
-							}
-						}else if (!ignore_found) {
-							// revert to mud
-							n.setContent(CONTENT_MUD);
-							m_map->addNodeWithEvent(p,n);
-						}
-					}
-					break;
-				}
-				/*
-					make vines die
-				 */
-				case CONTENT_FARM_GRAPEVINE:
-				{
-					if (n.envticks%3 == 0) {
-						MapNode n_btm = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-						if (
-							n_btm.getContent() != CONTENT_FARM_GRAPEVINE
-							&& n_btm.getContent() != CONTENT_FARM_DIRT
-							&& n_btm.getContent() != CONTENT_MUD
-						) {
-							n.setContent(CONTENT_DEAD_VINE);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-				case CONTENT_FARM_TRELLIS_GRAPE:
-				{
-					if (n.envticks%3 == 0) {
-						MapNode n_btm = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-						if (
-							n_btm.getContent() != CONTENT_FARM_TRELLIS_GRAPE
-							&& n_btm.getContent() != CONTENT_FARM_DIRT
-							&& n_btm.getContent() != CONTENT_MUD
-						) {
-							n.setContent(CONTENT_TRELLIS_DEAD_VINE);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-
-				/*
-					Convert grass and snow into mud if under something else than air
-				*/
-
-				case CONTENT_MUDSNOW:
-				{
-					{
-						MapNode n_top = m_map->getNodeNoEx(p+v3s16(0,1,0));
-						u32 ch = m_time%60;
-						if (n_top.getContent() == CONTENT_SNOW) {
-							break;
-						}else if (
-							p.Y < (coldzone-10)
-							&& (
-								ch > 10
-								|| (
-									n_top.getLightBlend(getDayNightRatio()) >= 13
-									&& myrand_range(0,5) == 0
-								) || myrand_range(0,10) == 0
-							)
-						) {
-							n.setContent(CONTENT_GRASS_AUTUMN);
-							m_map->addNodeWithEvent(p, n);
-						}else if (
-							content_features(n_top).air_equivalent == false
-							&& n_top.getContent() != CONTENT_IGNORE
-							&& content_features(n_top).draw_type != CDT_PLANTLIKE
-							&& content_features(n_top).draw_type != CDT_PLANTLIKE_SML
-							&& content_features(n_top).draw_type != CDT_PLANTLIKE_LGE
-							&& n_top.getContent() != CONTENT_SIGN
-							&& n_top.getContent() != CONTENT_SNOW
-						) {
-							n.setContent(CONTENT_MUD);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-				}
-				case CONTENT_GRASS:
-				{
-					MapNode n_top = m_map->getNodeNoEx(p+v3s16(0,1,0));
-					ContentFeatures &f = content_features(n_top);
-					if (f.air_equivalent) {
-						if (n.envticks > 2) {
-							if (
-								p.Y > (coldzone-10)
-								&& p.Y < 1024
-								&& (
-									m_time%60 > 10
-									|| myrand_range(0,10) == 0
-								)
-							) {
-								// should only change to snow if there's nothing above it
-								std::vector<content_t> search;
-								search.push_back(CONTENT_SNOW);
-								search.push_back(CONTENT_AIR);
-								if (!searchNearInv(p,v3s16(0,0,0),v3s16(0,32,0),search,NULL)) {
-									n.setContent(CONTENT_MUDSNOW);
-									m_map->addNodeWithEvent(p, n);
-								}
-							}else if (
-								(
-									season == ENV_SEASON_WINTER
-									|| season == ENV_SEASON_AUTUMN
-								) && (
-									m_time%60 > 10
-									|| myrand_range(0,10) == 0
-								)
-							) {
-								n.setContent(CONTENT_GRASS_AUTUMN);
-								m_map->addNodeWithEvent(p, n);
-							}
-						}
-						int f = (700-(p.Y*2))+10;
-						if (p.Y > 1 && myrand()%f == 0) {
-							if (n_top.getContent() == CONTENT_AIR && n_top.getLightBlend(getDayNightRatio()) >= 13) {
-								v3f pp = intToFloat(p,BS);
-								Player *nearest = getNearestConnectedPlayer(pp);
-								if (nearest == NULL || nearest->getPosition().getDistanceFrom(pp)/BS > 20.0) {
-									std::vector<content_t> search;
-									search.push_back(CONTENT_WILDGRASS_SHORT);
-									if (season != ENV_SEASON_SPRING)
-										search.push_back(CONTENT_WILDGRASS_LONG);
-									search.push_back(CONTENT_FLOWER_STEM);
-									search.push_back(CONTENT_FLOWER_ROSE);
-									search.push_back(CONTENT_FLOWER_TULIP);
-									search.push_back(CONTENT_FLOWER_DAFFODIL);
-									if (!searchNear(p,v3s16(1,1,1),search,NULL)) {
-										n_top.setContent(CONTENT_WILDGRASS_SHORT);
-										m_map->addNodeWithEvent(p+v3s16(0,1,0), n_top);
-									}
-								}
-							}
-						}
-					}else if (n_top.getContent() != CONTENT_IGNORE) {
-						n.setContent(CONTENT_GRASS_AUTUMN);
-						m_map->addNodeWithEvent(p,n);
-					}
-					break;
-				}
-				case CONTENT_GRASS_AUTUMN:
-				{
-					MapNode n_top = m_map->getNodeNoEx(p+v3s16(0,1,0));
-					ContentFeatures &f = content_features(n_top);
-					u32 ch = m_time%60;
-					if (n_top.getContent() == CONTENT_SNOW) {
-						n.setContent(CONTENT_MUDSNOW);
-						m_map->addNodeWithEvent(p,n);
-					}else if (f.air_equivalent) {
-						if ((season == ENV_SEASON_SPRING && myrand_range(0,10) == 0) || season == ENV_SEASON_SUMMER) {
-							n.setContent(CONTENT_GRASS);
-							m_map->addNodeWithEvent(p,n);
-						}else if (season == ENV_SEASON_WINTER && p.Y > (coldzone-5) && (ch > 10 || myrand_range(0,5) == 0)) {
-							// should only change to snow if there's nothing above it
-							std::vector<content_t> search;
-							search.push_back(CONTENT_SNOW);
-							search.push_back(CONTENT_AIR);
-							if (!searchNearInv(p,v3s16(0,0,0),v3s16(0,32,0),search,NULL)) {
-								n.setContent(CONTENT_MUDSNOW);
-								m_map->addNodeWithEvent(p, n);
-							}
-						}else{
-							int f = (700-(p.Y*2))+10;
-							if (p.Y > 1 && myrand()%f == 0) {
-								if (n_top.getContent() == CONTENT_AIR && n_top.getLightBlend(getDayNightRatio()) >= 13) {
-									v3f pp = intToFloat(p,BS);
-									Player *nearest = getNearestConnectedPlayer(pp);
-									if (nearest == NULL || nearest->getPosition().getDistanceFrom(pp)/BS > 20.0) {
-										std::vector<content_t> search;
-										search.push_back(CONTENT_WILDGRASS_SHORT);
-										search.push_back(CONTENT_WILDGRASS_LONG);
-										search.push_back(CONTENT_FLOWER_STEM);
-										search.push_back(CONTENT_FLOWER_ROSE);
-										search.push_back(CONTENT_FLOWER_TULIP);
-										search.push_back(CONTENT_FLOWER_DAFFODIL);
-										if (!searchNear(p,v3s16(1,1,1),search,NULL)) {
-											n_top.setContent(CONTENT_WILDGRASS_SHORT);
-											m_map->addNodeWithEvent(p+v3s16(0,1,0), n_top);
-										}
-									}
-								}
-							}
-						}
-					}else{
-						n.setContent(CONTENT_MUD);
-						m_map->addNodeWithEvent(p,n);
-					}
-					break;
-				}
-
-				case CONTENT_WILDGRASS_SHORT:
-				{
-					MapNode n_btm = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-					if (
-						n_btm.getContent() == CONTENT_GRASS
-						|| n_btm.getContent() == CONTENT_GRASS_AUTUMN
-						|| n_btm.getContent() == CONTENT_MUDSNOW
-						|| n_btm.getContent() == CONTENT_MUD
-					) {
-						if (p.Y > -1 && n.envticks > 10) {
-							MapNode n_top = m_map->getNodeNoEx(p+v3s16(0,1,0));
-							if (n_btm.getContent() != CONTENT_MUD) {
-								if (n_top.getLightBlend(getDayNightRatio()) >= 13) {
-									u32 chance = 20;
-									switch (season) {
-									case ENV_SEASON_SUMMER:
-										chance = 10;
-										break;
-									case ENV_SEASON_AUTUMN:
-										chance = 15;
-										break;
-									case ENV_SEASON_SPRING:
-										chance = 5;
-										break;
-									default:;
-									}
-									if (myrand_range(0,chance) == 0) {
-										n.setContent(CONTENT_FLOWER_STEM);
-										m_map->addNodeWithEvent(p, n);
-									}else{
-										n.setContent(CONTENT_WILDGRASS_LONG);
-										m_map->addNodeWithEvent(p, n);
-									}
-								}
-							}
-						}
-					}else{
-						n.setContent(CONTENT_DEADGRASS);
-						m_map->addNodeWithEvent(p, n);
-					}
-					break;
-				}
-
-				case CONTENT_WILDGRASS_LONG:
-				{
-					if (p.Y > -1) {
-						u32 chance = 50;
-						switch (season) {
-						case ENV_SEASON_SUMMER:
-							chance = 25;
-							break;
-						case ENV_SEASON_AUTUMN:
-							chance = 10;
-							break;
-						case ENV_SEASON_WINTER:
-							chance = 5;
-							break;
-						default:;
-						}
-						if (myrand_range(0,chance) == 0) {
-							n.setContent(CONTENT_DEADGRASS);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-
-				case CONTENT_FLOWER_STEM:
-				{
-					MapNode n_btm = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-					int ch = 0;
-					if (
-						n_btm.getContent() == CONTENT_GRASS
-						|| n_btm.getContent() == CONTENT_GRASS_AUTUMN
-						|| n_btm.getContent() == CONTENT_MUD
-					)
-						ch = 100;
-					if (n_btm.getContent() == CONTENT_FARM_DIRT)
-						ch = 50;
-					if (ch) {
-						if (season == ENV_SEASON_SPRING)
-							break;
-						if ((ch == 50 || p.Y > -1) && n.envticks > 20) {
-							MapNode n_top = m_map->getNodeNoEx(p+v3s16(0,1,0));
-							if (n_top.getLightBlend(getDayNightRatio()) >= 13) {
-								switch (myrand()%3) {
-								case 0:
-									n.setContent(CONTENT_FLOWER_ROSE);
-									m_map->addNodeWithEvent(p, n);
-									break;
-								case 1:
-									n.setContent(CONTENT_FLOWER_DAFFODIL);
-									m_map->addNodeWithEvent(p, n);
-									break;
-								case 2:
-									n.setContent(CONTENT_FLOWER_TULIP);
-									m_map->addNodeWithEvent(p, n);
-									break;
-								}
-							}
-						}
-					}else{
-						n.setContent(CONTENT_DEADGRASS);
-						m_map->addNodeWithEvent(p, n);
-					}
-					break;
-				}
-
-				case CONTENT_DEADGRASS:
-				{
-					MapNode n_btm = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-					content_t c = n_btm.getContent();
-					if (
-						(
-							c != CONTENT_MUD
-							&& c != CONTENT_GRASS
-							&& c != CONTENT_GRASS_AUTUMN
-							&& c != CONTENT_MUDSNOW
-						)
-						|| n.envticks > 20
-					) {
-						m_map->removeNodeWithEvent(p);
-					}
-					break;
-				}
-
-				case CONTENT_FLOWER_ROSE:
-				case CONTENT_FLOWER_DAFFODIL:
-				case CONTENT_FLOWER_TULIP:
-				{
-					MapNode n_under = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-					if (n_under.getContent() == CONTENT_GRASS || n_under.getContent() == CONTENT_GRASS_AUTUMN) {
-						u32 chance = 0;
-						switch (season) {
-						case ENV_SEASON_AUTUMN:
-							chance = 10;
-							break;
-						case ENV_SEASON_WINTER:
-							chance = 5;
-							break;
-						default:;
-						}
-						if (chance && myrand_range(0,chance) == 0) {
-							n.setContent(CONTENT_WILDGRASS_SHORT);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}else if (n_under.getContent() != CONTENT_FLOWER_POT && n_under.getContent() != CONTENT_FARM_DIRT) {
-						n.setContent(CONTENT_WILDGRASS_SHORT);
-						m_map->addNodeWithEvent(p, n);
-					}
-					break;
-				}
-
-				// cactus flowers and fruit
-				case CONTENT_CACTUS:
-				{
-					if (n.envticks > 30) {
-						bool fully_grown = false;
-						int found = 1;
-						v3s16 p_test = p;
-						MapNode n_test = m_map->getNodeNoEx(v3s16(p.X, p.Y+1, p.Z));
-
-						// can't grow anything if there's something above the cactus
-						if (n_test.getContent() != CONTENT_AIR)
-							break;
-
-						while (fully_grown == false) {
-							p_test.Y--;
-							n_test = m_map->getNodeNoEx(p_test);
-
-							// look down the cactus counting the number of cactus nodes
-							if (n_test.getContent() == CONTENT_CACTUS) {
-								found++;
-
-								// cacti don't grow above 4 naturally, don't grow flowers on tall cactus-pillars
-								if (found > 4) {
-									break;
-								}
-							}else{
-								// cacti grow to 3 nodes on sand
-								// and 4 nodes on farm dirt
-								if (n_test.getContent() == CONTENT_SAND) {
-									if (found == 3) {
-										fully_grown = true;
-										break;
-									}else{
-										break;
-									}
-								}else if (n_test.getContent() == CONTENT_FARM_DIRT) {
-									if (found == 4) {
-										fully_grown = true;
-										break;
-									}else{
-										break;
-									}
-								}
-							}
-						}
-
-						if (fully_grown == true) {
-							n.setContent(CONTENT_CACTUS_BLOSSOM);
-							m_map->addNodeWithEvent(v3s16(p.X, p.Y+1, p.Z), n);
-						}
-					}
-					break;
-				}
-
-				case CONTENT_CACTUS_BLOSSOM:
-				{
-					if (n.envticks > 30) {
-						MapNode n_test=m_map->getNodeNoEx(v3s16(p.X, p.Y-1, p.Z));
-						if (n_test.getContent() == CONTENT_CACTUS) {
-							n.setContent(CONTENT_CACTUS_FLOWER);
-							m_map->addNodeWithEvent(p, n);
-						}
-					}
-					break;
-				}
-
-				case CONTENT_CACTUS_FLOWER:
-				{
-					if (n.envticks > 30) {
-						MapNode n_test=m_map->getNodeNoEx(v3s16(p.X, p.Y-1, p.Z));
-						// sometimes fruit, sometimes the flower dies
-						if (n_test.getContent() == CONTENT_CACTUS && myrand()%10 < 6) {
-							n.setContent(CONTENT_CACTUS_FRUIT);
-							m_map->addNodeWithEvent(p, n);
-						}else{
-							m_map->removeNodeWithEvent(p);
-						}
-					}
-					break;
-				}
-
-				case CONTENT_CACTUS_FRUIT:
-				{
-					if (n.envticks > 60) {
-						MapNode n_test=m_map->getNodeNoEx(v3s16(p.X, p.Y-1, p.Z));
-						// when the fruit dies, sometimes a new blossom appears
-						if (n_test.getContent() == CONTENT_CACTUS && myrand()%10 == 0) {
-							n.setContent(CONTENT_CACTUS_BLOSSOM);
-							m_map->addNodeWithEvent(p, n);
-						}else{
-							m_map->removeNodeWithEvent(p);
-							if (active_object_count_wider < 10) {
-								v3f rot_pos = intToFloat(p, BS);
-								rot_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
-								ServerActiveObject *obj = new ItemSAO(this, 0, rot_pos, "CraftItem mush 1");
-								addActiveObject(obj);
-							}
-						}
-					}
-					break;
-				}
-
-				// growing apples!
-				case CONTENT_APPLE_LEAVES:
-				{
-					if (n.envticks%30 == 0 && season == ENV_SEASON_SPRING) {
-						if (searchNear(p,v3s16(3,3,3),CONTENT_APPLE_TREE,NULL)) {
-							if (!searchNear(p,v3s16(1,1,1),CONTENT_APPLE_BLOSSOM,NULL)) {
-								n.setContent(CONTENT_APPLE_BLOSSOM);
-								m_map->addNodeWithEvent(p, n);
-							}
-							break;
-						}
-					}
-					// no break, let it fall through to leaf decay
-				}
-
-				// leaf decay
-				case CONTENT_LEAVES:
-				case CONTENT_LEAVES_AUTUMN:
-				case CONTENT_LEAVES_WINTER:
-				case CONTENT_LEAVES_SNOWY:
-				case CONTENT_JUNGLELEAVES:
-				case CONTENT_CONIFER_LEAVES:
-				{
-					if (myrand()%4 == 0) {
-						v3s16 leaf_p = p;
-						std::vector<content_t> search;
-						search.push_back(CONTENT_TREE);
-						search.push_back(CONTENT_YOUNG_TREE);
-						search.push_back(CONTENT_APPLE_TREE);
-						search.push_back(CONTENT_YOUNG_APPLE_TREE);
-						search.push_back(CONTENT_JUNGLETREE);
-						search.push_back(CONTENT_YOUNG_JUNGLETREE);
-						search.push_back(CONTENT_CONIFER_TREE);
-						search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-						search.push_back(CONTENT_IGNORE);
-						if (!searchNear(p,v3s16(3,3,3),search,NULL)) {
-							m_map->removeNodeWithEvent(leaf_p);
-							if (myrand()%10 == 0) {
-								v3f sapling_pos = intToFloat(leaf_p, BS);
-								sapling_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
-								ServerActiveObject *obj = new ItemSAO(this, 0, sapling_pos, "MaterialItem2 " + itos(n.getContent()) + " 1");
-								addActiveObject(obj);
-							}
-						}else if (n.getContent() == CONTENT_LEAVES) {
-							if (season == ENV_SEASON_AUTUMN) {
-								n.setContent(CONTENT_LEAVES_AUTUMN);
-								m_map->addNodeWithEvent(p,n);
-							}else if (season == ENV_SEASON_WINTER) {
-								n.setContent(CONTENT_LEAVES_WINTER);
-								m_map->addNodeWithEvent(p,n);
-							}
-						}else if (n.getContent() == CONTENT_LEAVES_AUTUMN) {
-							if (season == ENV_SEASON_WINTER) {
-								n.setContent(CONTENT_LEAVES_WINTER);
-								m_map->addNodeWithEvent(p,n);
-							}else if (season != ENV_SEASON_AUTUMN) {
-								n.setContent(CONTENT_LEAVES);
-								m_map->addNodeWithEvent(p,n);
-							}
-						}else if (n.getContent() == CONTENT_LEAVES_WINTER) {
-							if (season == ENV_SEASON_AUTUMN) {
-								n.setContent(CONTENT_LEAVES_AUTUMN);
-								m_map->addNodeWithEvent(p,n);
-							}else if (season == ENV_SEASON_WINTER) {
-								if (myrand_range(0,5) && p.Y > 0) {
-									n.setContent(CONTENT_LEAVES_SNOWY);
-									m_map->addNodeWithEvent(p,n);
-								}
-							}else{
-								n.setContent(CONTENT_LEAVES);
-								m_map->addNodeWithEvent(p,n);
-							}
-						}else if (n.getContent() == CONTENT_LEAVES_SNOWY) {
-							if (season != ENV_SEASON_WINTER) {
-								n.setContent(CONTENT_LEAVES_WINTER);
-								m_map->addNodeWithEvent(p,n);
-							}
-						}
-					}
-					break;
-				}
-
-				case CONTENT_APPLE_BLOSSOM:
-				{
-					if (n.envticks > 30) {
-						// don't turn all blossoms to apples
-						// blossoms look nice
-						if (searchNear(p,v3s16(3,3,3),CONTENT_APPLE_TREE,NULL)) {
-							int found_apple = 0;
-
-							for(s16 x=-2; x<=2; x++)
-							for(s16 y=-2; y<=2; y++)
-							for(s16 z=-2; z<=2; z++)
-							{
-								MapNode n_test = m_map->getNodeNoEx(p+v3s16(x,y,z));
-								if (n_test.getContent() == CONTENT_APPLE) {
-									++found_apple;
-								}
-							}
-							if (found_apple < season) {
-								n.setContent(CONTENT_APPLE);
-								m_map->addNodeWithEvent(p, n);
-							}
-						}else{
-							m_map->removeNodeWithEvent(p);
-							if (myrand()%5 == 0) {
-								n.setContent(CONTENT_APPLE_LEAVES);
-								m_map->addNodeWithEvent(p, n);
-								v3f blossom_pos = intToFloat(p, BS);
-								blossom_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
-								ServerActiveObject *obj = new ItemSAO(this, 0, blossom_pos, "CraftItem apple_blossom 1");
-								addActiveObject(obj);
-							}
-						}
-					}
-					break;
-				}
-
-				// fire that goes out
-				case CONTENT_FIRE_SHORTTERM:
-				{
-					if (unsafe_fire) {
-						if (n.envticks > 2) {
-							s16 bs_rad = g_settings->getS16("borderstone_radius");
-							bs_rad += 2;
-							// if any node is border stone protected, don't spread
-							if (!searchNear(p,v3s16(bs_rad,bs_rad,bs_rad),CONTENT_BORDERSTONE,NULL)) {
-								for(s16 x=-1; x<=1; x++)
-								for(s16 y=-1; y<=1; y++)
-								for(s16 z=-1; z<=1; z++)
-								{
-									MapNode n_test = m_map->getNodeNoEx(p+v3s16(x,y,z));
-									if (n_test.getContent() == CONTENT_FIRE || n_test.getContent() == CONTENT_FIRE_SHORTTERM)
-										continue;
-									if (content_features(n_test).flammable > 0) {
-										content_t c = n_test.getContent();
-										if (content_features(c).onact_also_affects != v3s16(0,0,0)) {
-											v3s16 p_other = p+v3s16(x,y,z)+n_test.getEffectedRotation();
-											n_test.setContent(CONTENT_FIRE_SHORTTERM);
-											m_map->addNodeWithEvent(p_other, n_test);
-										}
-										n_test.setContent(CONTENT_FIRE_SHORTTERM);
-										m_map->addNodeWithEvent(p+v3s16(x,y,z), n_test);
-									}
-								}
-							}
-						}
-						if (n.envticks > 10) {
-							m_map->removeNodeWithEvent(p);
-							v3f ash_pos = intToFloat(p, BS);
-							ash_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
-							ServerActiveObject *obj = new ItemSAO(this, 0, ash_pos, "CraftItem lump_of_ash 1");
-							addActiveObject(obj);
-						}
-					}else if (n.envticks > 2) {
-						m_map->removeNodeWithEvent(p);
-						v3f ash_pos = intToFloat(p, BS);
-						ash_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
-						ServerActiveObject *obj = new ItemSAO(this, 0, ash_pos, "CraftItem lump_of_ash 1");
-						addActiveObject(obj);
-					}
-					break;
-				}
-
-				// fire that spreads just a little
-				case CONTENT_FIRE:
-				{
-					MapNode n_below = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-					if (!content_features(n_below).flammable) {
-						m_map->removeNodeWithEvent(p);
-					}else{
-						s16 bs_rad = g_settings->getS16("borderstone_radius");
-						bs_rad += 2;
-						// if any node is border stone protected, don't spread
-						if (!searchNear(p,v3s16(bs_rad,bs_rad,bs_rad),CONTENT_BORDERSTONE,NULL)) {
-							for(s16 x=-1; x<=1; x++)
-							for(s16 y=0; y<=1; y++)
-							for(s16 z=-1; z<=1; z++)
-							{
-								MapNode n_test = m_map->getNodeNoEx(p+v3s16(x,y,z));
-								if (n_test.getContent() == CONTENT_FIRE || n_test.getContent() == CONTENT_FIRE_SHORTTERM)
-									continue;
-								if (content_features(n_test).flammable > 0) {
-									content_t c = n_test.getContent();
-									if (content_features(c).onact_also_affects != v3s16(0,0,0)) {
-										v3s16 p_other = p+v3s16(x,y,z)+n_test.getEffectedRotation();
-										n_test.setContent(CONTENT_FIRE_SHORTTERM);
-										m_map->addNodeWithEvent(p_other, n_test);
-									}
-									n_test.setContent(CONTENT_FIRE_SHORTTERM);
-									m_map->addNodeWithEvent(p+v3s16(x,y,z), n_test);
-								}
-							}
-						}
-					}
-					break;
-				}
-
-				// boom
-				case CONTENT_FLASH:
-					m_map->removeNodeWithEvent(p);
-					break;
-
-				// boom
-				case CONTENT_TNT:
-				{
-					NodeMetadata *meta = m_map->getNodeMetadata(p);
-					if (meta && meta->getEnergy() == ENERGY_MAX) {
-						if (g_settings->getBool("enable_tnt")) {
-							s16 bs_rad = g_settings->getS16("borderstone_radius");
-							bs_rad += 3;
-							// if any node is border stone protected, don't destroy anything
-							if (!searchNear(p,v3s16(bs_rad,bs_rad,bs_rad),CONTENT_BORDERSTONE,NULL)) {
-								for(s16 x=-2; x<=2; x++)
-								for(s16 y=-2; y<=2; y++)
-								for(s16 z=-2; z<=2; z++)
-								{
-									MapNode n_test = m_map->getNodeNoEx(p+v3s16(x,y,z));
-									if (n_test.getContent() == CONTENT_AIR)
-										continue;
-									if (n_test.getContent() == CONTENT_TNT) {
-										meta = m_map->getNodeMetadata(p+v3s16(x,y,z));
-										if (meta && !meta->getEnergy())
-											meta->energise(ENERGY_MAX,p,p,p+v3s16(x,y,z));
-										continue;
-									}
-									if (
-										(x == -2 && y == -2)
-										|| (x == 2 && y == -2)
-										|| (x == -2 && y == 2)
-										|| (x == 2 && y == 2)
-										|| (z == -2 && y == -2)
-										|| (z == 2 && y == -2)
-										|| (z == -2 && y == 2)
-										|| (z == 2 && y == 2)
-										|| (x == -2 && z == -2)
-										|| (x == 2 && z == -2)
-										|| (x == -2 && z == 2)
-										|| (x == 2 && z == 2)
-									) {
-										if (myrand()%3 == 0)
-											continue;
-									}
-									n_test.setContent(CONTENT_FLASH);
-									m_delayed_node_changes[p+v3s16(x,y,z)] = n_test;
-								}
-							}
-						}
-						// but still blow up
-						m_map->removeNodeWithEvent(p);
-						addEnvEvent(ENV_EVENT_SOUND,intToFloat(p,BS),"env-tnt");
-					}
-					break;
-				}
-
-				// MESE is dead
-				case CONTENT_MESE:
-				{
-					if (p.Y > 0) {
-						n.setContent(CONTENT_MITHRIL_BLOCK);
-						m_map->addNodeWithEvent(p, n);
-					}else{
-						n.setContent(CONTENT_STONE);
-						n.param1 = MINERAL_MITHRIL;
-						m_map->addNodeWithEvent(p, n);
-					}
-					break;
-				}
-
-				// cobble becomes mossy underwater
-				case CONTENT_COBBLE:
-				{
-					if (n.envticks > 30 && n.envticks%4 == 0) {
-						MapNode a = m_map->getNodeNoEx(p+v3s16(0,1,0));
-						if (a.getContent() == CONTENT_WATERSOURCE) {
-							n.setContent(CONTENT_MOSSYCOBBLE);
-							m_map->addNodeWithEvent(p,n);
-						}else{
-							bool found = false;
-							/* moss also grows */
-							for (s16 i=0; !found && i<6; i++) {
-								a = m_map->getNodeNoEx(p+g_6dirs[i]);
-								if (a.getContent() == CONTENT_MOSSYCOBBLE) {
-									n.setContent(CONTENT_MOSSYCOBBLE);
-									m_map->addNodeWithEvent(p,n);
-									found = true;
-								}
-							}
-						}
-					}
-					break;
-				}
-
-				// Make trees from saplings!
-				case CONTENT_SAPLING:
-				{
-					if (n.envticks > 1000) {
-						// full grown tree
-						actionstream<<"A sapling grows into a tree at "<<PP(p)<<std::endl;
-						std::vector<content_t> search;
-						search.push_back(CONTENT_AIR);
-						search.push_back(CONTENT_TREE);
-						search.push_back(CONTENT_YOUNG_TREE);
-						search.push_back(CONTENT_APPLE_TREE);
-						search.push_back(CONTENT_YOUNG_APPLE_TREE);
-						search.push_back(CONTENT_JUNGLETREE);
-						search.push_back(CONTENT_YOUNG_JUNGLETREE);
-						search.push_back(CONTENT_CONIFER_TREE);
-						search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-						search.push_back(CONTENT_LEAVES);
-						search.push_back(CONTENT_LEAVES_AUTUMN);
-						search.push_back(CONTENT_LEAVES_WINTER);
-						search.push_back(CONTENT_LEAVES_SNOWY);
-						search.push_back(CONTENT_JUNGLELEAVES);
-						search.push_back(CONTENT_CONIFER_LEAVES);
-						search.push_back(CONTENT_APPLE_LEAVES);
-						search.push_back(CONTENT_APPLE_BLOSSOM);
-						search.push_back(CONTENT_APPLE);
-						search.push_back(CONTENT_IGNORE);
-
-						core::map<v3s16, MapBlock*> modified_blocks;
-						if (!searchNearInv(p,v3s16(-10,2,-10),v3s16(10,12,10),search,NULL)) {
-							plantgrowth_largetree(this,p);
-						}else{
-							plantgrowth_tree(this,p);
-						}
-					}else if (n.envticks > 15) {
-						std::vector<content_t> search;
-						search.push_back(CONTENT_AIR);
-						search.push_back(CONTENT_TREE);
-						search.push_back(CONTENT_YOUNG_TREE);
-						search.push_back(CONTENT_APPLE_TREE);
-						search.push_back(CONTENT_YOUNG_APPLE_TREE);
-						search.push_back(CONTENT_JUNGLETREE);
-						search.push_back(CONTENT_YOUNG_JUNGLETREE);
-						search.push_back(CONTENT_CONIFER_TREE);
-						search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-						search.push_back(CONTENT_LEAVES);
-						search.push_back(CONTENT_LEAVES_AUTUMN);
-						search.push_back(CONTENT_LEAVES_WINTER);
-						search.push_back(CONTENT_LEAVES_SNOWY);
-						search.push_back(CONTENT_JUNGLELEAVES);
-						search.push_back(CONTENT_CONIFER_LEAVES);
-						search.push_back(CONTENT_APPLE_LEAVES);
-						search.push_back(CONTENT_APPLE_BLOSSOM);
-						search.push_back(CONTENT_APPLE);
-						search.push_back(CONTENT_IGNORE);
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							v3s16 h;
-							if (!searchNearInv(p,v3s16(-2,2,-2),v3s16(2,7,2),search,&h)) {
-								// young tree 1
-								MapNode nn(CONTENT_YOUNG_TREE);
-								m_map->addNodeWithEvent(p,nn);
-								nn.setContent(CONTENT_LEAVES);
-								m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-							}
-						}
-					}
-				}
-				break;
-				case CONTENT_YOUNG_TREE:
-				{
-					if (n.envticks > 15) {
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							content_t above = m_map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
-							std::vector<content_t> search;
-							search.push_back(CONTENT_AIR);
-							search.push_back(CONTENT_TREE);
-							search.push_back(CONTENT_YOUNG_TREE);
-							search.push_back(CONTENT_APPLE_TREE);
-							search.push_back(CONTENT_YOUNG_APPLE_TREE);
-							search.push_back(CONTENT_JUNGLETREE);
-							search.push_back(CONTENT_YOUNG_JUNGLETREE);
-							search.push_back(CONTENT_CONIFER_TREE);
-							search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-							search.push_back(CONTENT_LEAVES);
-							search.push_back(CONTENT_LEAVES_AUTUMN);
-							search.push_back(CONTENT_LEAVES_WINTER);
-							search.push_back(CONTENT_LEAVES_SNOWY);
-							search.push_back(CONTENT_JUNGLELEAVES);
-							search.push_back(CONTENT_CONIFER_LEAVES);
-							search.push_back(CONTENT_APPLE_LEAVES);
-							search.push_back(CONTENT_APPLE_BLOSSOM);
-							search.push_back(CONTENT_APPLE);
-							search.push_back(CONTENT_IGNORE);
-							if (above == CONTENT_LEAVES) {
-								// young tree 2
-								v3s16 h;
-								if (!searchNearInv(p,v3s16(-1,2,-1),v3s16(1,4,1),search,&h)) {
-									MapNode nn(CONTENT_YOUNG_TREE);
-									m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,0),nn);
-									nn.setContent(CONTENT_LEAVES);
-									m_map->addNodeWithEvent(p+v3s16(0,3,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(1,2,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(-1,2,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,1),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,-1),nn);
-								}
-							}else if (above == CONTENT_YOUNG_TREE && n.envticks > 40) {
-								content_t abv = m_map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
-								content_t top = m_map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
-								if (abv == CONTENT_YOUNG_TREE && top == CONTENT_LEAVES) {
-									if (m_map->getNodeNoEx(p+v3s16(1,2,0)).getContent() == CONTENT_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(1,2,0));
-									if (m_map->getNodeNoEx(p+v3s16(-1,2,0)).getContent() == CONTENT_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(-1,2,0));
-									if (m_map->getNodeNoEx(p+v3s16(0,2,1)).getContent() == CONTENT_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,2,1));
-									if (m_map->getNodeNoEx(p+v3s16(0,2,-1)).getContent() == CONTENT_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,2,-1));
-									// full grown tree
-									actionstream<<"A sapling grows into a tree at "
-										<<PP(p)<<std::endl;
-
-									if (!searchNearInv(p,v3s16(-10,2,-10),v3s16(10,12,10),search,NULL)) {
-										plantgrowth_largetree(this,p);
-									}else{
-										plantgrowth_tree(this,p);
-									}
-								}
-							}
-						}
-					}
-					break;
-				}
-
-				case CONTENT_APPLE_SAPLING:
-				{
-					if (n.envticks > 1000) {
-						actionstream<<"A sapling grows into a tree at "<<PP(p)<<std::endl;
-
-						plantgrowth_appletree(this,p);
-					}else if (n.envticks > 15) {
-						std::vector<content_t> search;
-						search.push_back(CONTENT_AIR);
-						search.push_back(CONTENT_TREE);
-						search.push_back(CONTENT_YOUNG_TREE);
-						search.push_back(CONTENT_APPLE_TREE);
-						search.push_back(CONTENT_YOUNG_APPLE_TREE);
-						search.push_back(CONTENT_JUNGLETREE);
-						search.push_back(CONTENT_YOUNG_JUNGLETREE);
-						search.push_back(CONTENT_CONIFER_TREE);
-						search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-						search.push_back(CONTENT_LEAVES);
-						search.push_back(CONTENT_LEAVES_AUTUMN);
-						search.push_back(CONTENT_LEAVES_WINTER);
-						search.push_back(CONTENT_LEAVES_SNOWY);
-						search.push_back(CONTENT_JUNGLELEAVES);
-						search.push_back(CONTENT_CONIFER_LEAVES);
-						search.push_back(CONTENT_APPLE_LEAVES);
-						search.push_back(CONTENT_APPLE_BLOSSOM);
-						search.push_back(CONTENT_APPLE);
-						search.push_back(CONTENT_IGNORE);
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							v3s16 h;
-							if (!searchNearInv(p,v3s16(-2,2,-2),v3s16(2,7,2),search,&h)) {
-								// young tree 1
-								MapNode nn(CONTENT_YOUNG_APPLE_TREE);
-								m_map->addNodeWithEvent(p,nn);
-								nn.setContent(CONTENT_APPLE_LEAVES);
-								m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-							}
-						}
-					}
-				}
-				break;
-				case CONTENT_YOUNG_APPLE_TREE:
-				{
-					if (n.envticks > 15) {
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							content_t above = m_map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
-							std::vector<content_t> search;
-							search.push_back(CONTENT_AIR);
-							search.push_back(CONTENT_TREE);
-							search.push_back(CONTENT_YOUNG_TREE);
-							search.push_back(CONTENT_APPLE_TREE);
-							search.push_back(CONTENT_YOUNG_APPLE_TREE);
-							search.push_back(CONTENT_JUNGLETREE);
-							search.push_back(CONTENT_YOUNG_JUNGLETREE);
-							search.push_back(CONTENT_CONIFER_TREE);
-							search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-							search.push_back(CONTENT_LEAVES);
-							search.push_back(CONTENT_LEAVES_AUTUMN);
-							search.push_back(CONTENT_LEAVES_WINTER);
-							search.push_back(CONTENT_LEAVES_SNOWY);
-							search.push_back(CONTENT_JUNGLELEAVES);
-							search.push_back(CONTENT_CONIFER_LEAVES);
-							search.push_back(CONTENT_APPLE_LEAVES);
-							search.push_back(CONTENT_APPLE_BLOSSOM);
-							search.push_back(CONTENT_APPLE);
-							search.push_back(CONTENT_IGNORE);
-							if (above == CONTENT_APPLE_LEAVES) {
-								// young tree 2
-								v3s16 h;
-								if (!searchNearInv(p,v3s16(-1,2,-1),v3s16(1,4,1),search,&h)) {
-									MapNode nn(CONTENT_YOUNG_APPLE_TREE);
-									m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,0),nn);
-									nn.setContent(CONTENT_APPLE_LEAVES);
-									m_map->addNodeWithEvent(p+v3s16(0,3,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(1,2,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(-1,2,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,1),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,-1),nn);
-								}
-							}else if (above == CONTENT_YOUNG_APPLE_TREE && n.envticks > 40) {
-								content_t abv = m_map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
-								content_t top = m_map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
-								if (abv == CONTENT_YOUNG_APPLE_TREE && top == CONTENT_APPLE_LEAVES) {
-									if (m_map->getNodeNoEx(p+v3s16(1,2,0)).getContent() == CONTENT_APPLE_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(1,2,0));
-									if (m_map->getNodeNoEx(p+v3s16(-1,2,0)).getContent() == CONTENT_APPLE_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(-1,2,0));
-									if (m_map->getNodeNoEx(p+v3s16(0,2,1)).getContent() == CONTENT_APPLE_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,2,1));
-									if (m_map->getNodeNoEx(p+v3s16(0,2,-1)).getContent() == CONTENT_APPLE_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,2,-1));
-									actionstream<<"A sapling grows into a tree at "
-										<<PP(p)<<std::endl;
-
-									plantgrowth_appletree(this,p);
-								}
-							}
-						}
-					}
-					break;
-				}
-
-				case CONTENT_JUNGLESAPLING:
-				{
-					if (n.envticks > 1000) {
-						actionstream<<"A sapling grows into a jungle tree at "<<PP(p)<<std::endl;
-
-						plantgrowth_jungletree(this,p);
-					}else if (n.envticks > 15) {
-						std::vector<content_t> search;
-						search.push_back(CONTENT_AIR);
-						search.push_back(CONTENT_TREE);
-						search.push_back(CONTENT_YOUNG_TREE);
-						search.push_back(CONTENT_APPLE_TREE);
-						search.push_back(CONTENT_YOUNG_APPLE_TREE);
-						search.push_back(CONTENT_JUNGLETREE);
-						search.push_back(CONTENT_YOUNG_JUNGLETREE);
-						search.push_back(CONTENT_CONIFER_TREE);
-						search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-						search.push_back(CONTENT_LEAVES);
-						search.push_back(CONTENT_LEAVES_AUTUMN);
-						search.push_back(CONTENT_LEAVES_WINTER);
-						search.push_back(CONTENT_LEAVES_SNOWY);
-						search.push_back(CONTENT_JUNGLELEAVES);
-						search.push_back(CONTENT_CONIFER_LEAVES);
-						search.push_back(CONTENT_APPLE_LEAVES);
-						search.push_back(CONTENT_APPLE_BLOSSOM);
-						search.push_back(CONTENT_APPLE);
-						search.push_back(CONTENT_IGNORE);
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							v3s16 h;
-							if (!searchNearInv(p,v3s16(-2,2,-2),v3s16(2,10,2),search,&h)) {
-								// young tree 1
-								MapNode nn(CONTENT_YOUNG_JUNGLETREE);
-								m_map->addNodeWithEvent(p,nn);
-								nn.setContent(CONTENT_JUNGLELEAVES);
-								m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-							}
-						}
+					std::string i_owner = "";
+					meta = m_map->getNodeMetadata(sp);
+					if (meta) {
+						n_owner = meta->getOwner();
+						i_owner = meta->getInventoryOwner();
+						meta = meta->clone();
 					}
-				}
-				break;
-				case CONTENT_YOUNG_JUNGLETREE:
-				{
-					if (n.envticks > 15) {
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							content_t above = m_map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
-							std::vector<content_t> search;
-							search.push_back(CONTENT_AIR);
-							search.push_back(CONTENT_TREE);
-							search.push_back(CONTENT_YOUNG_TREE);
-							search.push_back(CONTENT_APPLE_TREE);
-							search.push_back(CONTENT_YOUNG_APPLE_TREE);
-							search.push_back(CONTENT_JUNGLETREE);
-							search.push_back(CONTENT_YOUNG_JUNGLETREE);
-							search.push_back(CONTENT_CONIFER_TREE);
-							search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-							search.push_back(CONTENT_LEAVES);
-							search.push_back(CONTENT_LEAVES_AUTUMN);
-							search.push_back(CONTENT_LEAVES_WINTER);
-							search.push_back(CONTENT_LEAVES_SNOWY);
-							search.push_back(CONTENT_JUNGLELEAVES);
-							search.push_back(CONTENT_CONIFER_LEAVES);
-							search.push_back(CONTENT_APPLE_LEAVES);
-							search.push_back(CONTENT_APPLE_BLOSSOM);
-							search.push_back(CONTENT_APPLE);
-							search.push_back(CONTENT_IGNORE);
-							if (above == CONTENT_JUNGLELEAVES) {
-								// young tree 2
-								v3s16 h;
-								if (!searchNearInv(p,v3s16(-1,2,-1),v3s16(1,5,1),search,&h)) {
-									MapNode nn(CONTENT_YOUNG_JUNGLETREE);
-									m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,3,0),nn);
-									nn.setContent(CONTENT_JUNGLELEAVES);
-									m_map->addNodeWithEvent(p+v3s16(0,4,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(1,3,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(-1,3,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,3,1),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,3,-1),nn);
-								}
-							}else if (above == CONTENT_YOUNG_JUNGLETREE && n.envticks > 40) {
-								content_t abv = m_map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
-								content_t abv1 = m_map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
-								content_t top = m_map->getNodeNoEx(p+v3s16(0,4,0)).getContent();
-								if (abv == CONTENT_YOUNG_JUNGLETREE && abv1 == CONTENT_YOUNG_JUNGLETREE && top == CONTENT_JUNGLELEAVES) {
-									if (m_map->getNodeNoEx(p+v3s16(1,3,0)).getContent() == CONTENT_JUNGLELEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(1,3,0));
-									if (m_map->getNodeNoEx(p+v3s16(-1,3,0)).getContent() == CONTENT_JUNGLELEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(-1,3,0));
-									if (m_map->getNodeNoEx(p+v3s16(0,3,1)).getContent() == CONTENT_JUNGLELEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,3,1));
-									if (m_map->getNodeNoEx(p+v3s16(0,3,-1)).getContent() == CONTENT_JUNGLELEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,3,-1));
-									actionstream<<"A sapling grows into a jungle tree at "
-										<<PP(p)<<std::endl;
-
-									plantgrowth_jungletree(this,p);
-								}
-							}
+					m_map->addNodeWithEvent(sp, n);
+					if (meta) {
+						m_map->setNodeMetadata(sp,meta);
+						meta = m_map->getNodeMetadata(sp);
+						if (meta) {
+							if (n_owner != "")
+								meta->setOwner(n_owner);
+							if (i_owner != "")
+								meta->setInventoryOwner(i_owner);
 						}
 					}
-					break;
 				}
+				m_poststep_nodeswaps.clear();
+			}
 
-				case CONTENT_CONIFER_SAPLING:
-				{
-					if (n.envticks > 1000) {
-						actionstream<<"A sapling grows into a conifer tree at "<<PP(p)<<std::endl;
-
-						plantgrowth_conifertree(this,p);
-					}else if (n.envticks > 15) {
-						std::vector<content_t> search;
-						search.push_back(CONTENT_AIR);
-						search.push_back(CONTENT_TREE);
-						search.push_back(CONTENT_YOUNG_TREE);
-						search.push_back(CONTENT_APPLE_TREE);
-						search.push_back(CONTENT_YOUNG_APPLE_TREE);
-						search.push_back(CONTENT_JUNGLETREE);
-						search.push_back(CONTENT_YOUNG_JUNGLETREE);
-						search.push_back(CONTENT_CONIFER_TREE);
-						search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-						search.push_back(CONTENT_LEAVES);
-						search.push_back(CONTENT_LEAVES_AUTUMN);
-						search.push_back(CONTENT_LEAVES_WINTER);
-						search.push_back(CONTENT_LEAVES_SNOWY);
-						search.push_back(CONTENT_JUNGLELEAVES);
-						search.push_back(CONTENT_CONIFER_LEAVES);
-						search.push_back(CONTENT_APPLE_LEAVES);
-						search.push_back(CONTENT_APPLE_BLOSSOM);
-						search.push_back(CONTENT_APPLE);
-						search.push_back(CONTENT_IGNORE);
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							v3s16 h;
-							if (!searchNearInv(p,v3s16(-2,2,-2),v3s16(2,12,2),search,&h)) {
-								// young tree 1
-								MapNode nn(CONTENT_YOUNG_CONIFER_TREE);
-								m_map->addNodeWithEvent(p,nn);
-								nn.setContent(CONTENT_CONIFER_LEAVES);
-								m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-							}
-						}
-					}
-				}
-				break;
-				case CONTENT_YOUNG_CONIFER_TREE:
-				{
-					if (n.envticks > 15) {
-						content_t below = m_map->getNodeNoEx(p+v3s16(0,-1,0)).getContent();
-						if (
-							below == CONTENT_MUD
-							|| below == CONTENT_GRASS
-							|| below == CONTENT_GRASS_FOOTSTEPS
-							|| below == CONTENT_GRASS_AUTUMN
-							|| below == CONTENT_GRASS_FOOTSTEPS_AUTUMN
-						) {
-							content_t above = m_map->getNodeNoEx(p+v3s16(0,1,0)).getContent();
-							std::vector<content_t> search;
-							search.push_back(CONTENT_AIR);
-							search.push_back(CONTENT_TREE);
-							search.push_back(CONTENT_YOUNG_TREE);
-							search.push_back(CONTENT_APPLE_TREE);
-							search.push_back(CONTENT_YOUNG_APPLE_TREE);
-							search.push_back(CONTENT_JUNGLETREE);
-							search.push_back(CONTENT_YOUNG_JUNGLETREE);
-							search.push_back(CONTENT_CONIFER_TREE);
-							search.push_back(CONTENT_YOUNG_CONIFER_TREE);
-							search.push_back(CONTENT_LEAVES);
-							search.push_back(CONTENT_LEAVES_AUTUMN);
-							search.push_back(CONTENT_LEAVES_WINTER);
-							search.push_back(CONTENT_LEAVES_SNOWY);
-							search.push_back(CONTENT_JUNGLELEAVES);
-							search.push_back(CONTENT_CONIFER_LEAVES);
-							search.push_back(CONTENT_APPLE_LEAVES);
-							search.push_back(CONTENT_APPLE_BLOSSOM);
-							search.push_back(CONTENT_APPLE);
-							search.push_back(CONTENT_IGNORE);
-							if (above == CONTENT_CONIFER_LEAVES) {
-								// young tree 2
-								v3s16 h;
-								if (!searchNearInv(p,v3s16(-1,2,-1),v3s16(1,5,1),search,&h)) {
-									MapNode nn(CONTENT_YOUNG_CONIFER_TREE);
-									m_map->addNodeWithEvent(p+v3s16(0,1,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,0),nn);
-									nn.setContent(CONTENT_CONIFER_LEAVES);
-									m_map->addNodeWithEvent(p+v3s16(0,3,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,4,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(1,2,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(-1,2,0),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,1),nn);
-									m_map->addNodeWithEvent(p+v3s16(0,2,-1),nn);
-								}
-							}else if (above == CONTENT_YOUNG_CONIFER_TREE && n.envticks > 40) {
-								content_t abv = m_map->getNodeNoEx(p+v3s16(0,2,0)).getContent();
-								content_t top = m_map->getNodeNoEx(p+v3s16(0,3,0)).getContent();
-								if (abv == CONTENT_YOUNG_CONIFER_TREE && top == CONTENT_CONIFER_LEAVES) {
-									if (m_map->getNodeNoEx(p+v3s16(1,2,0)).getContent() == CONTENT_CONIFER_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(1,2,0));
-									if (m_map->getNodeNoEx(p+v3s16(-1,2,0)).getContent() == CONTENT_CONIFER_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(-1,2,0));
-									if (m_map->getNodeNoEx(p+v3s16(0,2,1)).getContent() == CONTENT_CONIFER_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,2,1));
-									if (m_map->getNodeNoEx(p+v3s16(0,2,-1)).getContent() == CONTENT_CONIFER_LEAVES)
-										m_map->removeNodeWithEvent(p+v3s16(0,2,-1));
-									actionstream<<"A sapling grows into a conifer tree at "
-										<<PP(p)<<std::endl;
-
-									plantgrowth_conifertree(this,p);
-								}
-							}
-						}
-					}
-					break;
-				}
+			if (!nodestep)
+				continue;
 
-				// Apples should fall if there is no leaves block holding it
-				case CONTENT_APPLE:
-				{
-					v3s16 apple_p = p;
-					std::vector<content_t> search;
-					search.push_back(CONTENT_APPLE_LEAVES);
-					search.push_back(CONTENT_IGNORE);
-					if (!searchNear(p,v3s16(1,1,1),search,NULL)) {
-						m_map->removeNodeWithEvent(apple_p);
-						v3f apple_pos = intToFloat(apple_p, BS);
-						apple_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
-						ServerActiveObject *obj = new ItemSAO(this, 0, apple_pos, "CraftItem apple 1");
-						addActiveObject(obj);
-					}else if ((n.envticks > 600 || (n.envticks > 100 && season == ENV_SEASON_WINTER)) && active_object_count_wider < 10) {
-						n.setContent(CONTENT_APPLE_LEAVES);
-						m_map->addNodeWithEvent(p,n);
-						v3f rot_pos = intToFloat(p, BS);
-						rot_pos += v3f(myrand_range(-1500,1500)*1.0/1000, 0, myrand_range(-1500,1500)*1.0/1000);
-						ServerActiveObject *obj = new ItemSAO(this, 0, rot_pos, "CraftItem mush 1");
-						addActiveObject(obj);
-					}
-					break;
+			u32 active_object_count_wider = 0;
+			for (s16 x=-1; x<=1; x++)
+			for (s16 y=-1; y<=1; y++)
+			for (s16 z=-1; z<=1; z++) {
+				MapBlock *wblock = m_map->getBlockNoCreateNoEx(bp+v3s16(x,y,z));
+				if (wblock == NULL)
+					continue;
+				active_object_count_wider += wblock->m_static_objects.m_objects.size();
+				active_object_count_wider += wblock->m_active_objects.size();
+			}
+
+			// TODO: don't spawn if there was a recent one nearby
+			if (
+				active_object_count_wider < 6
+				&& (
+					block->last_spawn < m_time_of_day-6000
+					|| block->last_spawn > m_time_of_day+6000
+				)
+			) {
+				MapNode n = block->getNodeNoEx(block->spawn_area);
+				MapNode n1 = block->getNodeNoEx(block->spawn_area+v3s16(0,1,0));
+				MapNode n2 = block->getNodeNoEx(block->spawn_area+v3s16(0,2,0));
+				u8 light = n1.getLightBlend(getDayNightRatio());
+				if (block->water_spawn) {
+					if (n1.getContent() != CONTENT_WATERSOURCE || n2.getContent() != CONTENT_WATERSOURCE)
+						block->has_spawn_area = false;
+				}else{
+					if (
+						!content_features(n1.getContent()).air_equivalent
+						|| !content_features(n2.getContent()).air_equivalent
+					)
+						block->has_spawn_area = false;
 				}
 
-				// grow sponges on sand in water
-				case CONTENT_SAND:
-				{
-					if (n.envticks%30 == 0) {
-						MapNode n_top1 = m_map->getNodeNoEx(p+v3s16(0,1,0));
-						MapNode n_top2 = m_map->getNodeNoEx(p+v3s16(0,2,0));
-						if (
-							p.Y < -30
-							&& n_top1.getContent() == CONTENT_WATERSOURCE
-							&& n_top2.getContent() == CONTENT_WATERSOURCE
-							&& myrand()%200 == 0
-						) {
-							s16 max_d = 8;
-							v3s16 test_p;
-							MapNode testnode;
-							int found = 0;
-							for(s16 z=-max_d; found < 2 && z<=max_d; z++) {
-							for(s16 y=-max_d; found < 2 && y<=max_d; y++) {
-							for(s16 x=-max_d; found < 2 && x<=max_d; x++) {
-								test_p = p + v3s16(x,y,z);
-								testnode = m_map->getNodeNoEx(test_p);
-								if (testnode.getContent() == CONTENT_SPONGE_FULL)
-									found++;
-							}
-							}
-							}
-							if (found < 2) {
-								n_top1.setContent(CONTENT_SPONGE_FULL);
-								m_map->addNodeWithEvent(p+v3s16(0,1,0), n_top1);
+				if (block->has_spawn_area) {
+					// dawn, passive mobs spawn
+					if (m_time_of_day > 7000 && m_time_of_day < 8000) {
+						if (!active_object_count_wider) {
+							if (block->water_spawn) {
+								if (n.getContent() == CONTENT_SAND)
+									mob_spawn_passive(block->spawn_area+block->getPosRelative(),block->water_spawn,this);
+							}else if (
+								(
+									n.getContent() == CONTENT_GRASS
+									|| n.getContent() == CONTENT_GRASS_AUTUMN
+									|| n.getContent() == CONTENT_GRASS_FOOTSTEPS
+									|| n.getContent() == CONTENT_GRASS_FOOTSTEPS_AUTUMN
+									|| n.getContent() == CONTENT_MUDSNOW
+								) && (
+									light >= LIGHT_SPAWN_BRIGHT
+								)
+							) {
+								mob_spawn_passive(block->spawn_area+block->getPosRelative(),block->water_spawn,this);
+							}else if (n.getContent() == CONTENT_STONE && light <= LIGHT_SPAWN_DARK && block->getPosRelative().Y < -16) {
+								mob_spawn(block->spawn_area+block->getPosRelative(),CONTENT_MOB_RAT,this);
 							}
 						}
-					}
-					break;
-				}
-
-				// make sponge soak up water
-				case CONTENT_SPONGE:
-				{
-					v3s16 test_p;
-					MapNode testnode;
-					bool sponge_soaked = false;
-					s16 max_d = 2;
-					for(s16 z=-max_d; z<=max_d; z++) {
-					for(s16 y=-max_d; y<=max_d; y++) {
-					for(s16 x=-max_d; x<=max_d; x++) {
-						test_p = p + v3s16(x,y,z);
-						testnode = m_map->getNodeNoEx(test_p);
-						if (testnode.getContent() == CONTENT_WATERSOURCE) {
-							sponge_soaked = true;
-							testnode.setContent(CONTENT_AIR);
-							m_map->addNodeWithEvent(test_p, testnode);
+						block->last_spawn = m_time_of_day;
+					// dusk, hostile mobs spawn, or fireflies
+					}else if (m_time_of_day > 19000 && m_time_of_day < 20000) {
+						if (light <= LIGHT_SPAWN_DARK) {
+							if (
+								(
+									n.getContent() == CONTENT_STONE
+									|| n.getContent() == CONTENT_SAND
+								) && (
+									block->water_spawn
+									|| (
+										block->getPos().Y > 0
+										|| myrand_range(0,5) == 0
+									)
+								)
+							) {
+								mob_spawn_hostile(block->spawn_area+block->getPosRelative(),block->water_spawn,this);
+							}else if (n1.getContent() == CONTENT_JUNGLEGRASS) {
+								mob_spawn(block->spawn_area+block->getPosRelative(),CONTENT_MOB_FIREFLY,this);
+							}
 						}
+						block->last_spawn = m_time_of_day;
 					}
-					}
-					}
-					if (sponge_soaked) {
-						n.setContent(CONTENT_SPONGE_FULL);
-						m_map->addNodeWithEvent(p, n);
-					}
-					break;
 				}
+			}
 
-				// make papyrus grow near water
-				case CONTENT_PAPYRUS:
-				{
-					if (n.envticks%10 == 0) {
-						MapNode n_btm = m_map->getNodeNoEx(p+v3s16(0,-1,0));
-						if (n_btm.getContent() == CONTENT_MUD) {
-							if (searchNear(p,v3s16(2,2,2),CONTENT_WATERSOURCE,NULL))
-								plantgrowth_plant(this,p,3);
-						}
-					}
-					break;
+			/*
+				Find out whether any node needs to be looked at: either
+				there are nodes the due modifiers run on, or a spawn area
+				could be found.
+			*/
+			s16 block_min_y = block->getPosRelative().Y;
+			s16 block_max_y = block_min_y+MAP_BLOCKSIZE-1;
+			bool run_abms = false;
+			bool has_cubelike = false;
+			bool has_spawn_space = false;
+			const std::map<content_t,u16> &contents = block->getContentCounts();
+			for (std::map<content_t,u16>::const_iterator ci = contents.begin(); ci != contents.end(); ci++) {
+				content_t c = ci->first;
+				if (c > MAX_CONTENT)
+					continue;
+				ContentFeatures &f = content_features(c);
+				if (f.draw_type == CDT_CUBELIKE)
+					has_cubelike = true;
+				if (f.air_equivalent || c == CONTENT_WATERSOURCE)
+					has_spawn_space = true;
+				std::vector<u16> &abms = m_abm_index[c];
+				for (std::vector<u16>::iterator ai = abms.begin(); !run_abms && ai != abms.end(); ai++) {
+					ActiveBlockModifier &abm = m_abms[*ai];
+					if (abm_due[*ai] && abm.min_y <= block_max_y && abm.max_y >= block_min_y)
+						run_abms = true;
 				}
+			}
+			bool find_spawn_area = (!block->has_spawn_area && has_cubelike && has_spawn_space);
 
-				// steam dissipates
-				case CONTENT_STEAM:
-					m_map->removeNodeWithEvent(p);
-					break;
-
-				// make lava cool near water
-				case CONTENT_LAVASOURCE:
-				case CONTENT_LAVA:
-				{
-					MapNode testnode;
-					v3s16 test_p;
-					std::vector<content_t> search;
-					bool found = false;
-					search.push_back(CONTENT_WATER);
-					search.push_back(CONTENT_WATERSOURCE);
-					if (p.Y > 60 && p.Y < 1024) {
-						found = true;
-					}else if (searchNear(p,v3s16(1,1,1),search,&test_p)) {
-						testnode = m_map->getNodeNoEx(test_p);
-						found = true;
-						testnode.setContent(CONTENT_STEAM);
-						m_delayed_node_changes[test_p] = testnode;
-						if (!has_steam_sound) {
-							addEnvEvent(ENV_EVENT_SOUND,intToFloat(p,BS),"env-steam");
-							has_steam_sound = true;
-						}
-					}
+			if (!run_abms && !find_spawn_area)
+				continue;
 
-					if (found == true && n.getContent() == CONTENT_LAVASOURCE) {
-						int material = myrand()%50;
-						switch(material) {
-						case 0:
-						case 1:
-						case 2:
-						case 3:
-						case 4:
-						case 5:
-						case 6:
-						case 7:
-							n = MapNode(CONTENT_STONE, MINERAL_COAL);
-							break;
-						case 8:
-						case 9:
-						case 10:
-						case 11:
-							n = MapNode(CONTENT_STONE, MINERAL_IRON);
-							break;
-						case 12:
-						case 13:
-						case 14:
-						case 15:
-							n = MapNode(CONTENT_STONE, MINERAL_TIN);
-							break;
-						case 16:
-						case 17:
-						case 18:
-						case 19:
-							n = MapNode(CONTENT_STONE, MINERAL_QUARTZ);
-							break;
-						case 20:
-						case 21:
-						case 22:
-						case 23:
-							n = MapNode(CONTENT_STONE, MINERAL_COPPER);
-							break;
-						case 24:
-							n = MapNode(CONTENT_STONE, MINERAL_SILVER);
-							break;
-						case 25:
-							n = MapNode(CONTENT_STONE, MINERAL_GOLD);
-							break;
-						default:
-							n.setContent(CONTENT_ROUGHSTONE);
-							break;
-						}
-						m_map->addNodeWithEvent(p, n);
-					}else if (found == true) {
-						n.setContent(CONTENT_ROUGHSTONE);
-						m_map->addNodeWithEvent(p, n);
-					}
+			ABMState state;
+			state.block = block;
+			state.envticks = 0;
+			state.season = season;
+			state.coldzone = coldzone;
+			state.daylight = daylight;
+			state.unsafe_fire = unsafe_fire;
+			state.active_object_count_wider = active_object_count_wider;
+			state.has_steam_sound = false;
 
-					break;
-				}
-				case CONTENT_AIR:
-				{
-					if (p.Y >= 1024 && n.envticks > 1 && !searchNear(p,v3s16(5,5,5),CONTENT_LIFE_SUPPORT,NULL)) {
-						n.setContent(CONTENT_VACUUM);
-						m_map->addNodeWithEvent(p,n);
+			v3s16 p0;
+			for (p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
+			for (p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
+			for (p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++) {
+				MapNode n = block->getNodeNoEx(p0);
+				content_t c = n.getContent();
+				if (find_spawn_area && !block->has_spawn_area && content_features(c).draw_type == CDT_CUBELIKE) {
+					MapNode n1 = block->getNodeNoEx(p0+v3s16(0,1,0));
+					MapNode n2 = block->getNodeNoEx(p0+v3s16(0,2,0));
+					if (
+						content_features(n1.getContent()).air_equivalent
+						&& content_features(n2.getContent()).air_equivalent
+						&& myrand_range(0,5) == 0
+					) {
+						block->spawn_area = p0;
+						block->has_spawn_area = true;
+						block->water_spawn = false;
 					}else if (
-						daylight
-						&& p0.Y > 8
-						&& g_settings->exists("fix_light_bug")
-						&& g_settings->getBool("fix_light_bug") == true
-						&& n.getLightBlend(getDayNightRatio()) < 10
+						c == CONTENT_SAND
+						&& n1.getContent() == CONTENT_WATERSOURCE
+						&& n2.getContent() == CONTENT_WATERSOURCE
 					) {
-						// CHECK AND FIX!
-						core::map<v3s16, MapBlock*> modified_blocks;
-						m_map->propagateSunlight(p,modified_blocks);
-						// Send a MEET_OTHER event
-						MapEditEvent event;
-						event.type = MEET_OTHER;
-						for(core::map<v3s16, MapBlock*>::Iterator
-							i = modified_blocks.getIterator();
-							i.atEnd() == false; i++)
-						{
-							v3s16 p = i.getNode()->getKey();
-							event.modified_blocks.insert(p, true);
-						}
-						m_map->dispatchEvent(&event);
-					}
-					break;
-				}
-				case CONTENT_VACUUM:
-				{
-					if (p.Y < 1024) {
-						n.setContent(CONTENT_AIR);
-						m_map->addNodeWithEvent(p,n);
-					}
-					break;
-				}
-				case CONTENT_LIFE_SUPPORT:
-				{
-					MapNode testnode;
-					v3s16 testpos;
-					for (s16 x=-5; x<5; x++)
-					for (s16 y=-5; y<5; y++)
-					for (s16 z=-5; z<5; z++) {
-						testpos = p+v3s16(x,y,z);
-						testnode = m_map->getNodeNoEx(testpos);
-						if (testnode.getContent() != CONTENT_VACUUM)
-							continue;
-						testnode.setContent(CONTENT_AIR);
-						m_map->addNodeWithEvent(testpos,testnode);
+						block->spawn_area = p0;
+						block->has_spawn_area = true;
+						block->water_spawn = true;
 					}
-					break;
-				}
 				}
 
-				if (
-					n.getContent() != CONTENT_GRASS
-					&& n.getContent() != CONTENT_MUD
-					&& p.Y >(coldzone+5) && p.Y < 1024
-					&& (
-						content_features(n).draw_type == CDT_CUBELIKE
-						|| content_features(n).draw_type == CDT_GLASSLIKE
-					)
-				) {
-					if (myrand()%20 == 0) {
-						std::vector<content_t> search;
-						search.push_back(CONTENT_AIR);
-						// check that it's on top, and somewhere snow could fall
-						// not 100% because torches
-						if (
-							!searchNearInv(p,v3s16(0,1,0),v3s16(0,16,0),search,NULL)
-							&& !searchNear(p,v3s16(3,3,3),CONTENT_FIRE,NULL)
-						) {
-							MapNode n_top(CONTENT_SNOW);
-							m_map->addNodeWithEvent(p+v3s16(0,1,0), n_top);
-						}
+				if (!run_abms || c > MAX_CONTENT)
+					continue;
+				std::vector<u16> &abms = m_abm_index[c];
+				if (abms.size() == 0)
+					continue;
+
+				v3s16 p = p0 + block->getPosRelative();
+				// the ticks are counted once, when the first modifier that
+				// reads them runs
+				bool ticked = false;
+				state.envticks = 0;
+				for (std::vector<u16>::iterator ai = abms.begin(); ai != abms.end(); ai++) {
+					ActiveBlockModifier &abm = m_abms[*ai];
+					if (!abm_due[*ai] || p.Y < abm.min_y || p.Y > abm.max_y)
+						continue;
+					if (abm.trigger_chance > 1 && myrand()%abm.trigger_chance != 0)
+						continue;
+					// an earlier modifier may have changed the node
+					n = block->getNodeNoEx(p0);
+					if (n.getContent() != c)
+						break;
+					if (abm.needs_envticks && !ticked) {
+						state.envticks = block->incNodeTicks(p0);
+						ticked = true;
 					}
+					abm.trigger(this, state, p, n);
 				}
 			}
 
@@ -2847,14 +1278,25 @@ void ServerEnvironment::step(float dtime)
 		}
 	}
 
+	/*
+		Run mob path searches
+	*/
+	{
+		static u32 prof_paths = g_profiler->getId("SEnv: path searches avg");
+		ScopeProfiler sp(g_profiler, prof_paths, SPT_AVG);
+		m_pathfinder.step(dtime);
+	}
+
 	/*
 		Step active objects
 	*/
 	{
-		ScopeProfiler sp(g_profiler, "SEnv: step act. objs avg", SPT_AVG);
+		static u32 prof_objects = g_profiler->getId("SEnv: step act. objs avg");
+		ScopeProfiler sp(g_profiler, prof_objects, SPT_AVG);
 		//TimeTaker timer("Step active objects");
 
-		g_profiler->avg("SEnv: num of objects", m_active_objects.size());
+		static u32 prof_num_objects = g_profiler->getId("SEnv: num of objects");
+		g_profiler->avg(prof_num_objects, m_active_objects.size());
 
 		// This helps the objects to send data at the same time
 		bool send_recommended = false;
@@ -2882,6 +1324,7 @@ void ServerEnvironment::step(float dtime)
 			}
 			// Step object
 			obj->step(dtime, send_recommended);
+			indexActiveObject(obj);
 			// Read messages from object
 			while (obj->m_messages_out.size() > 0) {
 				m_active_object_messages.push_back(obj->m_messages_out.pop_front());
@@ -2893,7 +1336,8 @@ void ServerEnvironment::step(float dtime)
 		Manage active objects
 	*/
 	if (m_object_management_interval.step(dtime, 0.5)) {
-		ScopeProfiler sp(g_profiler, "SEnv: remove removed objs avg /.5s", SPT_AVG);
+		static u32 prof_remove = g_profiler->getId("SEnv: remove removed objs avg /.5s");
+		ScopeProfiler sp(g_profiler, prof_remove, SPT_AVG);
 		/*
 			Remove objects that satisfy (m_removed && m_known_by_count==0)
 		*/
@@ -2901,6 +1345,17 @@ void ServerEnvironment::step(float dtime)
 	}
 }
 
+void ServerEnvironment::addActiveBlockModifier(const ActiveBlockModifier &abm)
+{
+	u16 index = m_abms.size();
+	m_abms.push_back(abm);
+	for (std::vector<content_t>::const_iterator i = abm.trigger_contents.begin(); i != abm.trigger_contents.end(); i++) {
+		if (*i > MAX_CONTENT)
+			continue;
+		m_abm_index[*i].push_back(index);
+	}
+}
+
 ServerActiveObject* ServerEnvironment::getActiveObject(u16 id)
 {
 	std::map<u16, ServerActiveObject*>::iterator i = m_active_objects.find(id);
@@ -2911,8 +1366,12 @@ ServerActiveObject* ServerEnvironment::getActiveObject(u16 id)
 
 void ServerEnvironment::getActiveObjects(v3f origin, f32 max_d, core::array<DistanceSortedActiveObject> &dest)
 {
-	for (std::map<u16, ServerActiveObject*>::iterator i = m_active_objects.begin(); i != m_active_objects.end(); i++) {
-		ServerActiveObject* obj = i->second;
+	std::vector<u16> ids;
+	getActiveObjectsNear(origin, max_d, ids);
+	for (std::vector<u16>::iterator i = ids.begin(); i != ids.end(); i++) {
+		ServerActiveObject* obj = getActiveObject(*i);
+		if (obj == NULL)
+			continue;
 
 		f32 d = (obj->getBasePosition() - origin).getLength();
 
@@ -3250,10 +1709,12 @@ void ServerEnvironment::getAddedActiveObjects(v3s16 pos, s16 radius,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (std::map<u16, ServerActiveObject*>::iterator i = m_active_objects.begin(); i != m_active_objects.end(); i++) {
-		u16 id = i->first;
+	std::vector<u16> ids;
+	getActiveObjectsNear(pos_f, radius_f, ids);
+	for (std::vector<u16>::iterator i = ids.begin(); i != ids.end(); i++) {
+		u16 id = *i;
 		// Get object
-		ServerActiveObject *object = i->second;
+		ServerActiveObject *object = getActiveObject(id);
 		if (object == NULL)
 			continue;
 		// Discard if removed
@@ -3361,6 +1822,7 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object, bool set_c
 	}
 
 	m_active_objects[object->getId()] = object;
+	indexActiveObject(object);
 
 	verbosestream<<"ServerEnvironment::addActiveObjectRaw(): "
 			<<"Added id="<<object->getId()<<"; there are now "
@@ -3457,6 +1919,68 @@ void ServerEnvironment::removeRemovedObjects()
 	// Remove references from m_active_objects
 	for (std::list<u16>::iterator i = objects_to_remove.begin(); i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		unindexActiveObject(*i);
+	}
+}
+
+void ServerEnvironment::indexActiveObject(ServerActiveObject *object)
+{
+	u16 id = object->getId();
+	v3s16 cell = getNodeBlockPos(floatToInt(object->getBasePosition(), BS));
+	std::map<u16, v3s16>::iterator i = m_active_object_cells.find(id);
+	if (i != m_active_object_cells.end()) {
+		if (i->second == cell)
+			return;
+		unindexActiveObject(id);
+	}
+	m_active_object_cells[id] = cell;
+	m_active_object_grid[cell].insert(id);
+}
+
+void ServerEnvironment::unindexActiveObject(u16 id)
+{
+	std::map<u16, v3s16>::iterator i = m_active_object_cells.find(id);
+	if (i == m_active_object_cells.end())
+		return;
+	std::map<v3s16, std::set<u16> >::iterator c = m_active_object_grid.find(i->second);
+	if (c != m_active_object_grid.end()) {
+		c->second.erase(id);
+		if (c->second.empty())
+			m_active_object_grid.erase(c);
+	}
+	m_active_object_cells.erase(i);
+}
+
+void ServerEnvironment::getActiveObjectsNear(v3f origin, f32 max_d, std::vector<u16> &ids)
+{
+	v3s16 pmin = getNodeBlockPos(floatToInt(origin - v3f(max_d,max_d,max_d), BS));
+	v3s16 pmax = getNodeBlockPos(floatToInt(origin + v3f(max_d,max_d,max_d), BS));
+	v3s16 size = pmax - pmin + v3s16(1,1,1);
+	u32 volume = (u32)size.X * (u32)size.Y * (u32)size.Z;
+
+	// For large ranges it's cheaper to go through the occupied cells
+	if (volume > m_active_object_grid.size()) {
+		for (std::map<v3s16, std::set<u16> >::iterator c = m_active_object_grid.begin(); c != m_active_object_grid.end(); c++) {
+			v3s16 p = c->first;
+			if (
+				p.X < pmin.X || p.X > pmax.X
+				|| p.Y < pmin.Y || p.Y > pmax.Y
+				|| p.Z < pmin.Z || p.Z > pmax.Z
+			)
+				continue;
+			ids.insert(ids.end(), c->second.begin(), c->second.end());
+		}
+		return;
+	}
+
+	v3s16 p;
+	for (p.X=pmin.X; p.X<=pmax.X; p.X++)
+	for (p.Y=pmin.Y; p.Y<=pmax.Y; p.Y++)
+	for (p.Z=pmin.Z; p.Z<=pmax.Z; p.Z++) {
+		std::map<v3s16, std::set<u16> >::iterator c = m_active_object_grid.find(p);
+		if (c == m_active_object_grid.end())
+			continue;
+		ids.insert(ids.end(), c->second.begin(), c->second.end());
 	}
 }
 
@@ -3704,6 +2228,7 @@ void ServerEnvironment::deactivateFarObjects(bool force_delete)
 	// Remove references from m_active_objects
 	for (std::vector<u16>::iterator i = objects_to_remove.begin(); i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		unindexActiveObject(*i);
 	}
 }
 
@@ -3762,7 +2287,8 @@ void ClientEnvironment::step(float dtime)
 	stepTimeOfDay(dtime);
 
 	// Get some settings
-	bool footprints = g_settings->getBool("enable_footprints");
+	static SettingHandle<bool> footprints_h(g_settings, "enable_footprints");
+	bool footprints = footprints_h.get();
 
 	// Get local player
 	LocalPlayer *lplayer = getLocalPlayer();
@@ -4186,6 +2712,48 @@ void ClientEnvironment::processActiveObjectMessage(u16 id,
 				<<std::endl;
 		return;
 	}
+
+	/*
+		Turn position bases and deltas back into plain position updates
+	*/
+	if (data.size() >= 2 && ((u8)data[0] == AO_CMD_POSITION_BASE
+			|| (u8)data[0] == AO_CMD_POSITION_DELTA)) {
+		u8 cmd = (u8)data[0];
+		u8 seq = (u8)data[1];
+		v3s32 p;
+		size_t rest;
+		if (cmd == AO_CMD_POSITION_BASE) {
+			if (data.size() < 14)
+				return;
+			p.X = readS32((u8*)&data[2]);
+			p.Y = readS32((u8*)&data[6]);
+			p.Z = readS32((u8*)&data[10]);
+			obj->m_net_base_position = p;
+			obj->m_net_base_seq = seq;
+			obj->m_net_has_base = true;
+			rest = 14;
+		}else{
+			if (data.size() < 8)
+				return;
+			// Its base hasn't arrived yet or has been replaced already
+			if (!obj->m_net_has_base || obj->m_net_base_seq != seq)
+				return;
+			p = obj->m_net_base_position;
+			p.X += (s32)readS16((u8*)&data[2])*AO_DELTA_QUANTUM;
+			p.Y += (s32)readS16((u8*)&data[4])*AO_DELTA_QUANTUM;
+			p.Z += (s32)readS16((u8*)&data[6])*AO_DELTA_QUANTUM;
+			rest = 8;
+		}
+		std::string update(AO_POSITION_SIZE, '\0');
+		update[0] = AO_CMD_POSITION;
+		writeS32((u8*)&update[1], p.X);
+		writeS32((u8*)&update[5], p.Y);
+		writeS32((u8*)&update[9], p.Z);
+		update.append(data, rest, std::string::npos);
+		obj->processMessage(update);
+		return;
+	}
+
 	obj->processMessage(data);
 }
 
@@ -4389,80 +2957,12 @@ ClientEnvEvent ClientEnvironment::getClientEvent()
 
 bool ClientEnvironment::searchNear(v3s16 pos, v3s16 radius_min, v3s16 radius_max, std::vector<content_t> c, v3s16 *found)
 {
-	v3s16 blockpos = getNodeBlockPos(pos);
-	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
-	if (block == NULL)
-		return false;
-	v3s16 relpos = blockpos*MAP_BLOCKSIZE;
-	v3s16 p;
-	v3s16 bp;
-
-	for(s16 x=radius_min.X; x<=radius_max.X; x++) {
-		for(s16 y=radius_min.Y; y<=radius_max.Y; y++) {
-			for(s16 z=radius_min.Z; z<=radius_max.Z; z++) {
-				if (!x && !y && !z)
-					continue;
-				p = pos+v3s16(x,y,z);
-				MapNode n_test;
-				bp = getNodeBlockPos(p);
-				if (bp == blockpos) {
-					bool pos_ok;
-					n_test = block->getNodeNoCheck(p-relpos,&pos_ok);
-				}else{
-					n_test = m_map->getNodeNoEx(p);
-				}
-				for (std::vector<content_t>::iterator i=c.begin(); i != c.end(); i++) {
-					if (n_test.getContent() == *i) {
-						if (found != NULL)
-							*found = p;
-						return true;
-					}
-				}
-			}
-		}
-	}
-	return false;
+	return search_near(m_map,pos,radius_min,radius_max,c,found);
 }
 
 bool ClientEnvironment::searchNearInv(v3s16 pos, v3s16 radius_min, v3s16 radius_max, std::vector<content_t> c, v3s16 *found)
 {
-	v3s16 blockpos = getNodeBlockPos(pos);
-	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
-	if (block == NULL)
-		return false;
-	v3s16 relpos = blockpos*MAP_BLOCKSIZE;
-	v3s16 p;
-	v3s16 bp;
-	for(s16 x=radius_min.X; x<=radius_max.X; x++) {
-		for(s16 y=radius_min.Y; y<=radius_max.Y; y++) {
-			for(s16 z=radius_min.Z; z<=radius_max.Z; z++) {
-				if (!x && !y && !z)
-					continue;
-				p = pos+v3s16(x,y,z);
-				MapNode n_test;
-				bp = getNodeBlockPos(p);
-				if (bp == blockpos) {
-					bool pos_ok;
-					n_test = block->getNodeNoCheck(p-relpos,&pos_ok);
-				}else{
-					n_test = m_map->getNodeNoEx(p);
-				}
-				bool s = false;
-				for (std::vector<content_t>::iterator i=c.begin(); i != c.end(); i++) {
-					if (n_test.getContent() == *i) {
-						s = true;
-						break;
-					}
-				}
-				if (!s) {
-					if (found != NULL)
-						*found = p;
-					return true;
-				}
-			}
-		}
-	}
-	return false;
+	return search_near_inv(m_map,pos,radius_min,radius_max,c,found);
 }
 
 void ClientEnvironment::updateObjectsCameraOffset(v3s16 camera_offset)
@@ -47,6 +47,7 @@
 #include <ostream>
 #include "utility.h"
 #include "activeobject.h"
+#include "pathfinder.h"
 
 class Server;
 class ServerActiveObject;
@@ -244,6 +245,59 @@ public:
 private:
 };
 
+/*
+	Active block modifiers, the game's are in content_abm.cpp
+*/
+
+// Per block state shared by the modifiers run on an active block
+struct ABMState
+{
+	MapBlock *block;
+	// the node's environment ticks, see MapBlock::getNodeTicks(), only
+	// set for modifiers with needs_envticks
+	u32 envticks;
+	u32 season;
+	s16 coldzone;
+	// whether the block can be sunlit at this time of day
+	bool daylight;
+	bool unsafe_fire;
+	// static and active objects in and around the block
+	u32 active_object_count_wider;
+	// only play the sound of lava cooling once per block
+	bool has_steam_sound;
+};
+
+typedef void (*ABMTrigger)(ServerEnvironment *env, ABMState &state, v3s16 p, MapNode n);
+
+struct ActiveBlockModifier
+{
+	ActiveBlockModifier():
+		trigger_interval(10.0),
+		trigger_chance(1),
+		needs_envticks(false),
+		min_y(-MAP_GENERATION_LIMIT),
+		max_y(MAP_GENERATION_LIMIT),
+		trigger(NULL),
+		timer(0.0)
+	{}
+
+	// The contents of the nodes this is run on
+	std::vector<content_t> trigger_contents;
+	// Seconds between runs, in steps of the 10 second active block pass
+	float trigger_interval;
+	// A matching node is run with a 1 in trigger_chance chance
+	u32 trigger_chance;
+	// Whether the trigger reads ABMState::envticks, the ticks of a node
+	// are only counted when a modifier that does is run on it
+	bool needs_envticks;
+	// Only nodes with min_y <= Y <= max_y are run
+	s16 min_y;
+	s16 max_y;
+	ABMTrigger trigger;
+	// Time since the last run, used by ServerEnvironment
+	float timer;
+};
+
 /*
 	The server-side environment.
 
@@ -271,6 +325,11 @@ public:
 		return m_server;
 	}
 
+	PathFinder & getPathFinder()
+	{
+		return m_pathfinder;
+	}
+
 	void step(f32 dtime);
 
 	/*
@@ -278,6 +337,8 @@ public:
 	*/
 	void serializePlayers(const std::string &savedir);
 	void deSerializePlayers(const std::string &savedir);
+	// Loads a player and adds it, returns NULL if there's no such player
+	Player *loadPlayer(const std::string &name);
 
 	/*
 		Save and load time of day and game timer
@@ -376,6 +437,15 @@ public:
 	}
 
 	void setPostStepNodeSwap(v3s16 pos, MapNode n) {m_poststep_nodeswaps[pos] = n;}
+	// used by active block modifiers to change a node after all nodes of the block are run
+	void addDelayedNodeChange(v3s16 pos, MapNode n) {m_delayed_node_changes[pos] = n;}
+
+	/*
+		Add an active block modifier, run on matching nodes of active
+		blocks. Blocks that have no nodes of any of the trigger contents
+		are skipped.
+	*/
+	void addActiveBlockModifier(const ActiveBlockModifier &abm);
 
 private:
 
@@ -417,6 +487,18 @@ private:
 	*/
 	void deactivateFarObjects(bool force_delete);
 
+	/*
+		Spatial index of active objects.
+
+		Objects are indexed by the block position they are in, and
+		reindexed after they have been stepped, so range queries only
+		have to look at the cells near the origin.
+	*/
+	void indexActiveObject(ServerActiveObject *object);
+	void unindexActiveObject(u16 id);
+	// Get the ids of objects in cells that may be within max_d of origin
+	void getActiveObjectsNear(v3f origin, f32 max_d, std::vector<u16> &ids);
+
 	/*
 		Member variables
 	*/
@@ -425,10 +507,16 @@ private:
 	ServerMap *m_map;
 	// Pointer to server (which is handling this environment)
 	Server *m_server;
+	// Mob movement checks and path searches
+	PathFinder m_pathfinder;
 	// used by node/circuit step to swap a node after stepping is complete
 	std::map<v3s16,MapNode>m_poststep_nodeswaps;
 	// Active object list
 	std::map<u16, ServerActiveObject*> m_active_objects;
+	// Active object ids by block position, see indexActiveObject()
+	std::map<v3s16, std::set<u16> > m_active_object_grid;
+	// The block position each active object is indexed at
+	std::map<u16, v3s16> m_active_object_cells;
 	// Outgoing network message buffer for active objects
 	Queue<ActiveObjectMessage> m_active_object_messages;
 	// the env events for sending to clients
@@ -442,6 +530,10 @@ private:
 	IntervalLimiter m_active_blocks_test_interval;
 	IntervalLimiter m_active_blocks_nodemetadata_interval;
 	IntervalLimiter m_active_blocks_circuit_interval;
+	// Active block modifiers
+	std::vector<ActiveBlockModifier> m_abms;
+	// Indexes into m_abms for each content
+	std::vector<u16> m_abm_index[MAX_CONTENT+1];
 	// Time from the beginning of the game in seconds.
 	// Incremented in step().
 	u32 m_game_time;
@@ -449,6 +541,8 @@ private:
 	float m_game_time_fraction_counter;
 	// whether players are sleeping
 	int m_players_sleeping;
+	// What was last saved or loaded of each player
+	std::map<std::string, std::string> m_saved_players;
 };
 
 #ifndef SERVER
@@ -1019,8 +1019,10 @@ void the_game(
 
 		object_hit_delay_timer -= dtime;
 
-		g_profiler->add("Elapsed time", dtime);
-		g_profiler->avg("FPS", 1./dtime);
+		static u32 prof_elapsed = g_profiler->getId("Elapsed time");
+		static u32 prof_fps = g_profiler->getId("FPS");
+		g_profiler->add(prof_elapsed, dtime);
+		g_profiler->avg(prof_fps, 1./dtime);
 
 		/*
 			Log frametime for visualization
@@ -1912,7 +1914,8 @@ void the_game(
 			direct_brightness = time_brightness;
 			sunlight_seen = true;
 		}else{
-			ScopeProfiler sp(g_profiler, "Detecting background light", SPT_AVG);
+			static u32 prof_light = g_profiler->getId("Detecting background light");
+			ScopeProfiler sp(g_profiler, prof_light, SPT_AVG);
 			float old_brightness = sky->getBrightness();
 			direct_brightness = (float)client.getEnv().getClientMap().getBackgroundBrightness(
 				MYMIN(fog_range*1.2, 60*BS),
@@ -0,0 +1,81 @@
+/*
+
+    This file is a part of the JThread package, which contains some object-
+    oriented thread wrappers for different thread implementations.
+
+    Copyright (c) 2000-2011  Jori Liesenborgs (jori.liesenborgs@gmail.com)
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef JTHREAD_JSEMAPHORE_H
+
+#define JTHREAD_JSEMAPHORE_H
+
+#include "jthreadconfig.h"
+#ifdef JTHREAD_CONFIG_WIN32THREADS
+	#ifndef _WIN32_WCE
+		#include <process.h>
+	#endif // _WIN32_WCE
+	#include <winsock2.h>
+	#include <windows.h>
+#else // using pthread
+	#include <pthread.h>
+#endif // JTHREAD_CONFIG_WIN32THREADS
+
+#define ERR_JSEMAPHORE_ALREADYINIT					-1
+#define ERR_JSEMAPHORE_NOTINIT						-2
+#define ERR_JSEMAPHORE_CANTCREATESEMAPHORE				-3
+
+namespace jthread
+{
+
+/*
+	A counting semaphore. Post() increments the count and Wait()
+	blocks until it can decrement it.
+*/
+class JTHREAD_IMPORTEXPORT JSemaphore
+{
+public:
+	JSemaphore();
+	~JSemaphore();
+	int Init(int initial_count = 0);
+	int Post();
+	int Wait();
+	// Returns false if the count stayed zero for time_ms milliseconds
+	bool Wait(unsigned int time_ms);
+	// Decrements the count if it isn't zero, without waiting
+	bool TryWait();
+	bool IsInitialized() 						{ return initialized; }
+private:
+#ifdef JTHREAD_CONFIG_WIN32THREADS
+	HANDLE semaphore;
+#else // pthread mutex and condition
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int count;
+#endif // JTHREAD_CONFIG_WIN32THREADS
+	bool initialized;
+};
+
+} // end namespace
+
+#endif // JTHREAD_JSEMAPHORE_H
+
@@ -0,0 +1,126 @@
+/*
+
+    This file is a part of the JThread package, which contains some object-
+    oriented thread wrappers for different thread implementations.
+
+    Copyright (c) 2000-2011  Jori Liesenborgs (jori.liesenborgs@gmail.com)
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "jsemaphore.h"
+#include <sys/time.h>
+#include <errno.h>
+
+namespace jthread
+{
+
+JSemaphore::JSemaphore()
+{
+	initialized = false;
+}
+
+JSemaphore::~JSemaphore()
+{
+	if (initialized)
+	{
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+}
+
+int JSemaphore::Init(int initial_count)
+{
+	if (initialized)
+		return ERR_JSEMAPHORE_ALREADYINIT;
+
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&cond,NULL);
+	count = initial_count;
+	initialized = true;
+	return 0;
+}
+
+int JSemaphore::Post()
+{
+	if (!initialized)
+		return ERR_JSEMAPHORE_NOTINIT;
+
+	pthread_mutex_lock(&mutex);
+	count++;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+int JSemaphore::Wait()
+{
+	if (!initialized)
+		return ERR_JSEMAPHORE_NOTINIT;
+
+	pthread_mutex_lock(&mutex);
+	while (count == 0)
+		pthread_cond_wait(&cond,&mutex);
+	count--;
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+bool JSemaphore::Wait(unsigned int time_ms)
+{
+	if (!initialized)
+		return false;
+
+	// pthread_cond_timedwait() wants an absolute time
+	struct timeval now;
+	gettimeofday(&now,NULL);
+	struct timespec until;
+	long long nsec = (long long)now.tv_usec*1000 + (long long)(time_ms%1000)*1000000;
+	until.tv_sec = now.tv_sec + time_ms/1000 + (time_t)(nsec/1000000000);
+	until.tv_nsec = (long)(nsec%1000000000);
+
+	pthread_mutex_lock(&mutex);
+	while (count == 0)
+	{
+		if (pthread_cond_timedwait(&cond,&mutex,&until) == ETIMEDOUT)
+			break;
+	}
+	bool got = (count > 0);
+	if (got)
+		count--;
+	pthread_mutex_unlock(&mutex);
+	return got;
+}
+
+bool JSemaphore::TryWait()
+{
+	if (!initialized)
+		return false;
+
+	pthread_mutex_lock(&mutex);
+	bool got = (count > 0);
+	if (got)
+		count--;
+	pthread_mutex_unlock(&mutex);
+	return got;
+}
+
+} // end namespace
+
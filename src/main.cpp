@@ -67,6 +67,7 @@
 #include "settings.h"
 #include "profiler.h"
 #include "log.h"
+#include "noise.h"
 // for the init functions
 #include "content_craft.h"
 #include "content_clothesitem.h"
@@ -665,6 +666,45 @@ void SpeedTests()
 		dstream<<"Done. "<<dtime<<"ms, "
 				<<per_ms<<"/ms"<<std::endl;
 	}
+
+	{
+		dstream<<"Testing noise speed, single points against a grid."
+				<<std::endl;
+
+		// Like the ground noise of a mapgen block, many times over
+		NoiseParams param(NOISE_PERLIN, 983240, 4, 0.55, 80.0, 40.0);
+		const s32 size = 40;
+		const u32 count = size*size*size;
+		double coords[size];
+		for(s32 i=0; i<size; i++)
+			coords[i] = -80.0 + i*4.0;
+		double *single = new double[count];
+		double *grid = new double[count];
+
+		u64 t0 = porting::getTimeUs();
+		for(s32 z=0; z<size; z++)
+		for(s32 y=0; y<size; y++)
+		for(s32 x=0; x<size; x++)
+			single[(z*size+y)*size+x] = noise3d_param(param,
+					coords[x], coords[y], coords[z]);
+		u64 t1 = porting::getTimeUs();
+		noise3d_param_grid(param, coords, size, coords, size,
+				coords, size, grid);
+		u64 t2 = porting::getTimeUs();
+
+		u32 mismatches = 0;
+		for(u32 i=0; i<count; i++)
+		{
+			if(single[i] != grid[i])
+				mismatches++;
+		}
+		delete[] single;
+		delete[] grid;
+
+		dstream<<"Single: "<<((t1-t0)*1000/count)<<"ns per point, "
+				<<"grid: "<<((t2-t1)*1000/count)<<"ns per point, "
+				<<mismatches<<" mismatches"<<std::endl;
+	}
 }
 
 void drawMenuBackground(video::IVideoDriver* driver)
@@ -66,9 +66,102 @@
 	Map
 */
 
+/*
+	MapBlockIndex
+*/
+
+MapBlockIndex::MapBlockIndex():
+	m_slots(NULL),
+	m_mask(0),
+	m_count(0)
+{
+	resize(1024);
+}
+
+MapBlockIndex::~MapBlockIndex()
+{
+	delete[] m_slots;
+}
+
+void MapBlockIndex::set(v3s16 p, MapBlock *block)
+{
+	assert(block != NULL);
+
+	// Keep at least half of the slots empty
+	if ((m_count+1)*2 > m_mask+1)
+		resize((m_mask+1)*2);
+
+	u32 i = hash(p) & m_mask;
+	while (m_slots[i].block != NULL) {
+		if (m_slots[i].pos == p) {
+			m_slots[i].block = block;
+			return;
+		}
+		i = (i+1) & m_mask;
+	}
+	m_slots[i].pos = p;
+	m_slots[i].block = block;
+	m_count++;
+}
+
+void MapBlockIndex::remove(v3s16 p)
+{
+	u32 i = hash(p) & m_mask;
+	while (m_slots[i].block != NULL && m_slots[i].pos != p) {
+		i = (i+1) & m_mask;
+	}
+	if (m_slots[i].block == NULL)
+		return;
+
+	/*
+		Move later entries of the probe sequence back into the hole so
+		that no lookup stops short at it
+	*/
+	u32 j = i;
+	for (;;) {
+		j = (j+1) & m_mask;
+		if (m_slots[j].block == NULL)
+			break;
+		u32 k = hash(m_slots[j].pos) & m_mask;
+		// Entry j may move to i if its home slot k isn't in (i,j]
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			m_slots[i] = m_slots[j];
+			i = j;
+		}
+	}
+	m_slots[i].block = NULL;
+	m_count--;
+}
+
+void MapBlockIndex::resize(u32 size)
+{
+	Slot *old_slots = m_slots;
+	u32 old_size = m_slots ? m_mask+1 : 0;
+
+	m_slots = new Slot[size];
+	for (u32 i=0; i<size; i++) {
+		m_slots[i].block = NULL;
+	}
+	m_mask = size-1;
+	m_count = 0;
+
+	for (u32 i=0; i<old_size; i++) {
+		if (old_slots[i].block != NULL)
+			set(old_slots[i].pos, old_slots[i].block);
+	}
+	delete[] old_slots;
+}
+
+/*
+	Map
+*/
+
 Map::Map(std::ostream &dout):
 	m_dout(dout),
-	m_sector_cache(NULL)
+	m_sector_cache(NULL),
+	m_block_cache(NULL),
+	m_usage_time(0),
+	m_usage_serial(0)
 {
 	/*m_sector_mutex.Init();
 	assert(m_sector_mutex.IsInitialized());*/
@@ -147,14 +240,52 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 
 MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerateNoEx(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
+	if(m_block_cache != NULL && p3d == m_block_cache_p)
+		return m_block_cache;
+
+	MapBlock *block = m_block_index.get(p3d);
+
+	// Cache the last result
+	if(block != NULL)
+	{
+		m_block_cache_p = p3d;
+		m_block_cache = block;
+	}
+
 	return block;
 }
 
+void Map::indexBlock(MapBlock *block)
+{
+	m_block_index.set(block->getPos(), block);
+
+	block->resetUsageTimer();
+	UsageEntry e;
+	e.time = m_usage_time;
+	e.pos = block->getPos();
+	e.serial = ++m_usage_serial;
+	block->setUsageSerial(e.serial);
+	m_unload_queue.push(e);
+
+	if (block->getModified() >= MOD_STATE_WRITE_NEEDED)
+		setBlockDirty(block);
+}
+
+void Map::unindexBlock(MapBlock *block)
+{
+	if(m_block_cache == block)
+		m_block_cache = NULL;
+	m_block_index.remove(block->getPos());
+	m_dirty_blocks.erase(block->getPos());
+}
+
+void Map::setBlockDirty(MapBlock *block)
+{
+	if (mapType() != MAPTYPE_SERVER)
+		return;
+	m_dirty_blocks.insert(block->getPos());
+}
+
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -201,6 +332,24 @@ MapNode Map::getNodeNoEx(v3s16 p, bool *is_valid_position)
 	return node;
 }
 
+u32 Map::getNodeTicks(v3s16 p)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	MapBlock *block = getBlockNoCreateNoEx(blockpos);
+	if (block == NULL)
+		return 0;
+	return block->getNodeTicks(p - blockpos*MAP_BLOCKSIZE);
+}
+
+void Map::setNodeTicks(v3s16 p, u32 ticks)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	MapBlock *block = getBlockNoCreateNoEx(blockpos);
+	if (block == NULL)
+		return;
+	block->setNodeTicks(p - blockpos*MAP_BLOCKSIZE, ticks);
+}
+
 // throws InvalidPositionException if not found
 MapNode Map::getNode(v3s16 p)
 {
@@ -1201,7 +1350,8 @@ bool Map::dayNightDiffed(v3s16 blockpos)
 }
 
 /*
-	Updates usage timers
+	Advances the usage clock and unloads the blocks that haven't been
+	used for unload_timeout
 */
 void Map::timerUpdate(float dtime, float unload_timeout,
 		core::list<v3s16> *unloaded_blocks)
@@ -1212,60 +1362,74 @@ void Map::timerUpdate(float dtime, float unload_timeout,
 	u32 deleted_blocks_count = 0;
 	u32 saved_blocks_count = 0;
 
-	core::map<v2s16, MapSector*>::Iterator si;
+	m_usage_time += dtime;
 
 	beginSave();
-	si = m_sectors.getIterator();
-	for(; si.atEnd() == false; si++)
-	{
-		MapSector *sector = si.getNode()->getValue();
+	while (m_unload_queue.empty() == false && deleted_blocks_count < MAP_UNLOAD_BATCH) {
+		UsageEntry e = m_unload_queue.top();
+		if (m_usage_time - e.time <= unload_timeout)
+			break;
+		m_unload_queue.pop();
 
-		bool all_blocks_deleted = true;
+		MapBlock *block = m_block_index.get(e.pos);
+		// The block is gone, or this is the entry of an earlier one
+		if (block == NULL || block->getUsageSerial() != e.serial)
+			continue;
 
-		core::list<MapBlock*> blocks;
-		sector->getBlocks(blocks);
+		// Used since, check again when it may have become unused
+		if (block->getUsageTimer() <= unload_timeout) {
+			e.time = block->getUsageTime();
+			m_unload_queue.push(e);
+			continue;
+		}
 
-		for(core::list<MapBlock*>::Iterator i = blocks.begin();
-				i != blocks.end(); i++)
-		{
-			MapBlock *block = (*i);
+		// Save if modified
+		if (block->getModified() != MOD_STATE_CLEAN && save_before_unloading) {
+			saveBlock(block);
+			saved_blocks_count++;
+		}
 
-			block->incrementUsageTimer(dtime);
+		// Delete from memory
+		v2s16 p2d(e.pos.X, e.pos.Z);
+		MapSector *sector = getSectorNoGenerateNoEx(p2d);
+		assert(sector != NULL);
+		sector->deleteBlock(block);
 
-			if(block->getUsageTimer() > unload_timeout)
-			{
-				v3s16 p = block->getPos();
+		if (sector->getBlockCount() == 0)
+			sector_deletion_queue.push_back(p2d);
 
-				// Save if modified
-				if(block->getModified() != MOD_STATE_CLEAN
-						&& save_before_unloading)
-				{
-					saveBlock(block);
-					saved_blocks_count++;
-				}
+		if (unloaded_blocks)
+			unloaded_blocks->push_back(e.pos);
 
-				// Delete from memory
-				sector->deleteBlock(block);
+		deleted_blocks_count++;
+	}
+	endSave();
 
-				if(unloaded_blocks)
-					unloaded_blocks->push_back(p);
+	// Finally delete the empty sectors
+	deleteSectors(sector_deletion_queue);
 
-				deleted_blocks_count++;
-			}
-			else
-			{
-				all_blocks_deleted = false;
-			}
-		}
+	/*
+		Delete the sectors that have had no blocks for a timeout, each
+		sector is looked at about once per timeout
+	*/
+	sector_deletion_queue.clear();
+	u32 checked_sectors_count = 0;
+	while (m_sector_checks.empty() == false && checked_sectors_count < MAP_UNLOAD_BATCH) {
+		SectorCheck c = m_sector_checks.front();
+		if (m_usage_time - c.time <= unload_timeout)
+			break;
+		m_sector_checks.pop();
+		checked_sectors_count++;
 
-		if(all_blocks_deleted)
-		{
-			sector_deletion_queue.push_back(si.getNode()->getKey());
+		MapSector *sector = getSectorNoGenerateNoEx(c.pos);
+		if (sector == NULL)
+			continue;
+		if (sector->getBlockCount() == 0) {
+			sector_deletion_queue.push_back(c.pos);
+			continue;
 		}
+		queueSectorCheck(c.pos);
 	}
-	endSave();
-
-	// Finally delete the empty sectors
 	deleteSectors(sector_deletion_queue);
 
 	if(deleted_blocks_count != 0)
@@ -1279,6 +1443,14 @@ void Map::timerUpdate(float dtime, float unload_timeout,
 	}
 }
 
+void Map::queueSectorCheck(v2s16 p)
+{
+	SectorCheck c;
+	c.time = m_usage_time;
+	c.pos = p;
+	m_sector_checks.push(c);
+}
+
 void Map::deleteSectors(core::list<v2s16> &list)
 {
 	core::list<v2s16>::Iterator j;
@@ -1369,13 +1541,69 @@ struct NodeNeighbor {
 	v3s16 p;
 };
 
-void Map::transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks)
+/*
+	Node access through a cache of block pointers, for passes over many
+	nodes close to each other where the map doesn't gain or lose blocks
+	meanwhile.
+*/
+class CachedNodeAccess
+{
+public:
+	CachedNodeAccess(Map *map):
+		m_map(map),
+		m_last_block(NULL),
+		m_last_blockpos(0,0,0),
+		m_have_last(false)
+	{
+	}
+
+	MapBlock *getBlock(v3s16 blockpos)
+	{
+		if (m_have_last && blockpos == m_last_blockpos)
+			return m_last_block;
+		MapBlock *block;
+		std::map<v3s16, MapBlock*>::iterator i = m_blocks.find(blockpos);
+		if (i != m_blocks.end()) {
+			block = i->second;
+		}else{
+			block = m_map->getBlockNoCreateNoEx(blockpos);
+			m_blocks[blockpos] = block;
+		}
+		m_last_block = block;
+		m_last_blockpos = blockpos;
+		m_have_last = true;
+		return block;
+	}
+
+	// Returns a CONTENT_IGNORE node if not found, like Map::getNodeNoEx()
+	MapNode getNodeNoEx(v3s16 p)
+	{
+		v3s16 blockpos = getNodeBlockPos(p);
+		MapBlock *block = getBlock(blockpos);
+		if (block == NULL)
+			return MapNode(CONTENT_IGNORE);
+		bool is_valid_p;
+		return block->getNodeNoCheck(p - blockpos*MAP_BLOCKSIZE, &is_valid_p);
+	}
+
+private:
+	Map *m_map;
+	std::map<v3s16, MapBlock*> m_blocks;
+	MapBlock *m_last_block;
+	v3s16 m_last_blockpos;
+	bool m_have_last;
+};
+
+void Map::transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks, u32 time_budget)
 {
 	DSTACK(__FUNCTION_NAME);
 	//TimeTaker timer("transformLiquids()");
 
 	u32 loopcount = 0;
 	u32 initial_size = m_transforming_liquid.size();
+	u64 time_start = porting::getTimeUs();
+
+	CachedNodeAccess nodes(this);
 
 	/*if(initial_size != 0)
 		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
@@ -1388,9 +1616,17 @@ void Map::transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks)
 
 	while(m_transforming_liquid.size() != 0)
 	{
-		// This should be done here so that it is done when continue is used
+		/*
+			This should be done here so that it is done when continue is
+			used. The loop count limits how far liquids flow each time,
+			the time budget stops a big flood from holding up the server,
+			the rest of it is left for next time.
+		*/
 		if(loopcount >= initial_size * 3)
 			break;
+		if(time_budget != 0 && (loopcount & 0x0f) == 0 && loopcount != 0
+				&& porting::getTimeUs() - time_start >= time_budget)
+			break;
 		loopcount++;
 
 		/*
@@ -1398,7 +1634,7 @@ void Map::transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks)
 		*/
 		v3s16 p0 = m_transforming_liquid.pop_front();
 
-		MapNode n0 = getNodeNoEx(p0);
+		MapNode n0 = nodes.getNodeNoEx(p0);
 
 		/*
 			Collect information about current node
@@ -1448,7 +1684,7 @@ void Map::transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks)
 					break;
 			}
 			v3s16 npos = p0 + dirs[i];
-			NodeNeighbor nb = {getNodeNoEx(npos), nt, npos};
+			NodeNeighbor nb = {nodes.getNodeNoEx(npos), nt, npos};
 			switch (content_features(nb.n.getContent()).liquid_type) {
 				case LIQUID_NONE:
 					if (nb.n.getContent() == CONTENT_AIR) {
@@ -1579,10 +1815,11 @@ void Map::transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks)
 			n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
 		}
 		n0.setContent(new_node_content);
-		setNode(p0, n0);
 		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
+		MapBlock *block = nodes.getBlock(blockpos);
 		if(block != NULL) {
+			v3s16 relpos = p0 - blockpos*MAP_BLOCKSIZE;
+			block->setNodeNoCheck(relpos, n0);
 			modified_blocks.insert(blockpos, block);
 			// If node emits light, MapBlock requires lighting update
 			if(content_features(n0).light_source != 0)
@@ -1611,6 +1848,10 @@ void Map::transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks)
 		}
 	}
 	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
+	static u32 prof_transformed = g_profiler->getId("Map: liquid nodes transformed");
+	static u32 prof_queue_left = g_profiler->getId("Map: liquid queue left");
+	g_profiler->avg(prof_transformed, loopcount);
+	g_profiler->avg(prof_queue_left, m_transforming_liquid.size());
 	while (must_reflow.size() > 0)
 		m_transforming_liquid.push_back(must_reflow.pop_front());
 	updateLighting(lighting_modified_blocks, modified_blocks);
@@ -1671,6 +1912,7 @@ void Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->clearSendCache();
 }
 
 void Map::removeNodeMetadata(v3s16 p)
@@ -1685,6 +1927,7 @@ void Map::removeNodeMetadata(v3s16 p)
 		return;
 	}
 	block->m_node_metadata.remove(p_rel);
+	block->clearSendCache();
 }
 
 void Map::nodeMetadataStep(float dtime, core::map<v3s16, MapBlock*> &changed_blocks, ServerEnvironment *env)
@@ -1725,10 +1968,23 @@ ServerMap::ServerMap(std::string savedir):
 	m_map_metadata_changed(true),
 	m_database(NULL),
 	m_database_read(NULL),
-	m_database_write(NULL)
+	m_database_list(NULL),
+	m_database_player_read(NULL),
+	m_database_player_write(NULL),
+	m_save_thread(this),
+	m_save_database(NULL),
+	m_save_database_write(NULL),
+	m_read_ahead_database(NULL),
+	m_read_ahead_database_read(NULL)
 {
 	infostream<<__FUNCTION_NAME<<std::endl;
 
+	m_save_queue_mutex.Init();
+	m_save_write_mutex.Init();
+	m_save_signal.Init();
+	m_read_ahead_mutex.Init();
+	m_read_ahead_database_mutex.Init();
+
 	//m_chunksize = 8; // Takes a few seconds
 
 	if (g_settings->get("fixed_map_seed").empty()) {
@@ -1869,15 +2125,47 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	/*
+		Write whatever the save thread hasn't got to yet
+	*/
+	m_save_thread.setRun(false);
+	m_save_signal.Post();
+	m_save_thread.stop();
+	try
+	{
+		writeQueuedBlocks();
+	}
+	catch(std::exception &e)
+	{
+		infostream<<"Server: Failed to write queued blocks to "<<m_savedir
+				<<", exception: "<<e.what()<<std::endl;
+	}
+
+	for(std::map<v3s16, ReadAheadBlock>::iterator i = m_read_ahead.begin();
+			i != m_read_ahead.end(); i++)
+	{
+		delete i->second.block;
+	}
+
 	/*
 		Close database if it was opened
 	*/
+	if(m_read_ahead_database_read)
+		sqlite3_finalize(m_read_ahead_database_read);
+	if(m_read_ahead_database)
+		sqlite3_close(m_read_ahead_database);
+	if(m_save_database_write)
+		sqlite3_finalize(m_save_database_write);
+	if(m_save_database)
+		sqlite3_close(m_save_database);
 	if(m_database_read)
 		sqlite3_finalize(m_database_read);
-	if(m_database_write)
-		sqlite3_finalize(m_database_write);
 	if(m_database_list)
 		sqlite3_finalize(m_database_list);
+	if(m_database_player_read)
+		sqlite3_finalize(m_database_player_read);
+	if(m_database_player_write)
+		sqlite3_finalize(m_database_player_write);
 	if(m_database)
 		sqlite3_close(m_database);
 
@@ -1914,6 +2202,7 @@ void ServerMap::initBlockMake(mapgen::BlockMakeData *data, v3s16 blockpos)
 	data->seed = m_seed;
 	data->type = m_type;
 	data->blockpos = blockpos;
+	data->heightfields = &m_heightfields;
 
 	/*
 		Create the whole area of this and the neighboring blocks
@@ -2156,6 +2445,7 @@ ServerMapSector * ServerMap::createSector(v2s16 p2d)
 		Insert to container
 	*/
 	m_sectors.insert(p2d, sector);
+	queueSectorCheck(p2d);
 
 	return sector;
 }
@@ -2439,11 +2729,15 @@ void ServerMap::createDatabase() {
 			"`pos` INT NOT NULL PRIMARY KEY,"
 			"`data` BLOB"
 		");"
+		"CREATE TABLE IF NOT EXISTS `players` ("
+			"`name` TEXT NOT NULL PRIMARY KEY,"
+			"`data` BLOB"
+		");"
 	, NULL, NULL, NULL);
 	if(e == SQLITE_ABORT)
 		throw FileNotGoodException("Could not create database structure");
 	else
-		infostream<<"Server: Database structure was created";
+		infostream<<"Server: Database structure is ready"<<std::endl;
 }
 
 void ServerMap::verifyDatabase() {
@@ -2452,7 +2746,6 @@ void ServerMap::verifyDatabase() {
 
 	{
 		std::string dbp = m_savedir + DIR_DELIM + "map.sqlite";
-		bool needs_create = false;
 		int d;
 
 		/*
@@ -2461,17 +2754,26 @@ void ServerMap::verifyDatabase() {
 
 		createDirs(m_savedir);
 
-		if(!fs::PathExists(dbp))
-			needs_create = true;
-
 		d = sqlite3_open_v2(dbp.c_str(), &m_database, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
 		if(d != SQLITE_OK) {
 			infostream<<"WARNING: Database failed to open: "<<sqlite3_errmsg(m_database)<<std::endl;
 			throw FileNotGoodException("map.sqlite: Cannot open database file");
 		}
 
-		if(needs_create)
-			createDatabase();
+		// Wait for the save thread's writes instead of failing
+		sqlite3_busy_timeout(m_database, 30000);
+
+		/*
+			With a write-ahead log, reading blocks and players doesn't
+			wait for the save thread's commits. It's kept in the file,
+			the other connections get it from there.
+		*/
+		if (sqlite3_exec(m_database, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL) != SQLITE_OK)
+			infostream<<"WARNING: Database journal mode failed to set: "<<sqlite3_errmsg(m_database)<<std::endl;
+		sqlite3_exec(m_database, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+
+		// Also adds tables missing from older databases
+		createDatabase();
 
 		d = sqlite3_prepare(m_database, "SELECT `data` FROM `blocks` WHERE `pos`=? LIMIT 1", -1, &m_database_read, NULL);
 		if(d != SQLITE_OK) {
@@ -2479,18 +2781,24 @@ void ServerMap::verifyDatabase() {
 			throw FileNotGoodException("map.sqlite: Cannot prepare read statement");
 		}
 
-		d = sqlite3_prepare(m_database, "REPLACE INTO `blocks` VALUES(?, ?)", -1, &m_database_write, NULL);
-		if(d != SQLITE_OK) {
-			infostream<<"WARNING: Database write statment failed to prepare: "<<sqlite3_errmsg(m_database)<<std::endl;
-			throw FileNotGoodException("map.sqlite: Cannot prepare write statement");
-		}
-
 		d = sqlite3_prepare(m_database, "SELECT `pos` FROM `blocks`", -1, &m_database_list, NULL);
 		if(d != SQLITE_OK) {
 			infostream<<"WARNING: Database list statment failed to prepare: "<<sqlite3_errmsg(m_database)<<std::endl;
 			throw FileNotGoodException("map.sqlite: Cannot prepare read statement");
 		}
 
+		d = sqlite3_prepare(m_database, "SELECT `data` FROM `players` WHERE `name`=? LIMIT 1", -1, &m_database_player_read, NULL);
+		if(d != SQLITE_OK) {
+			infostream<<"WARNING: Database player read statment failed to prepare: "<<sqlite3_errmsg(m_database)<<std::endl;
+			throw FileNotGoodException("map.sqlite: Cannot prepare player read statement");
+		}
+
+		d = sqlite3_prepare(m_database, "REPLACE INTO `players` VALUES(?, ?)", -1, &m_database_player_write, NULL);
+		if(d != SQLITE_OK) {
+			infostream<<"WARNING: Database player write statment failed to prepare: "<<sqlite3_errmsg(m_database)<<std::endl;
+			throw FileNotGoodException("map.sqlite: Cannot prepare player write statement");
+		}
+
 		infostream<<"Server: Database opened"<<std::endl;
 	}
 }
@@ -2597,40 +2905,36 @@ void ServerMap::save(bool only_changed)
 		saveMapMeta();
 
 	u32 block_count = 0;
-	u32 block_count_all = 0; // Number of blocks in memory
-
-	// Don't do anything with sqlite unless something is really saved
-	bool save_started = false;
-
-	for (core::map<v2s16, MapSector*>::Iterator i = m_sectors.getIterator(); i.atEnd() == false; i++) {
-		ServerMapSector *sector = (ServerMapSector*)i.getNode()->getValue();
-		assert(sector->getId() == MAPSECTOR_SERVER);
-		core::list<MapBlock*> blocks;
-		sector->getBlocks(blocks);
-		core::list<MapBlock*>::Iterator j;
-
-		for (j=blocks.begin(); j!=blocks.end(); j++) {
-			MapBlock *block = *j;
-
-			block_count_all++;
-
-			if (
-				block->getModified() >= MOD_STATE_WRITE_NEEDED
-				|| only_changed == false
-			) {
-				// Lazy beginSave()
-				if (!save_started) {
-					beginSave();
-					save_started = true;
-				}
+	u32 block_count_all = m_block_index.size(); // Number of blocks in memory
 
+	if (only_changed) {
+		/*
+			Only the dirty blocks can need writing. Blocks that are
+			written or clean, or gone, are dropped from the set.
+		*/
+		for (std::set<v3s16>::iterator i = m_dirty_blocks.begin(); i != m_dirty_blocks.end(); ) {
+			MapBlock *block = m_block_index.get(*i);
+			if (block != NULL && block->getModified() >= MOD_STATE_WRITE_NEEDED) {
 				saveBlock(block);
 				block_count++;
 			}
+			m_dirty_blocks.erase(i++);
 		}
+	}else{
+		for (core::map<v2s16, MapSector*>::Iterator i = m_sectors.getIterator(); i.atEnd() == false; i++) {
+			ServerMapSector *sector = (ServerMapSector*)i.getNode()->getValue();
+			assert(sector->getId() == MAPSECTOR_SERVER);
+			core::list<MapBlock*> blocks;
+			sector->getBlocks(blocks);
+			core::list<MapBlock*>::Iterator j;
+
+			for (j=blocks.begin(); j!=blocks.end(); j++) {
+				saveBlock(*j);
+				block_count++;
+			}
+		}
+		m_dirty_blocks.clear();
 	}
-	if (save_started)
-		endSave();
 
 	/*
 		Only print if something happened or saved whole map
@@ -2672,11 +2976,86 @@ void ServerMap::listAllLoadableBlocks(core::list<v3s16> &dst)
 {
 	verifyDatabase();
 
+	std::map<v3s16, bool> queued;
+	{
+		JMutexAutoLock lock(m_save_queue_mutex);
+		for (std::map<v3s16, std::string>::iterator i = m_save_queue.begin(); i != m_save_queue.end(); i++) {
+			queued[i->first] = true;
+		}
+		for (std::map<v3s16, std::string>::iterator i = m_save_writing.begin(); i != m_save_writing.end(); i++) {
+			queued[i->first] = true;
+		}
+	}
+
 	while (sqlite3_step(m_database_list) == SQLITE_ROW) {
 		sqlite3_int64 block_i = sqlite3_column_int64(m_database_list, 0);
 		v3s16 p = getIntegerAsBlock(block_i);
-		dst.push_back(p);
+		if (queued.find(p) == queued.end())
+			dst.push_back(p);
+	}
+
+	for (std::map<v3s16, bool>::iterator i = queued.begin(); i != queued.end(); i++) {
+		dst.push_back(i->first);
+	}
+}
+
+bool ServerMap::loadPlayer(const std::string &name, std::string &data)
+{
+	verifyDatabase();
+
+	if (sqlite3_bind_text(m_database_player_read, 1, name.c_str(), name.size(), NULL) != SQLITE_OK)
+		infostream<<"WARNING: Could not bind player name for load: "<<sqlite3_errmsg(m_database)<<std::endl;
+
+	bool found = false;
+	if (sqlite3_step(m_database_player_read) == SQLITE_ROW) {
+		const char *d = (const char*)sqlite3_column_blob(m_database_player_read, 0);
+		size_t len = sqlite3_column_bytes(m_database_player_read, 0);
+		data = std::string(d, len);
+		found = true;
+	}
+
+	sqlite3_reset(m_database_player_read);
+
+	return found;
+}
+
+void ServerMap::savePlayers(const std::map<std::string, std::string> &players,
+		bool only_new)
+{
+	if (players.size() == 0)
+		return;
+
+	verifyDatabase();
+
+	sqlite3_stmt *write = m_database_player_write;
+	if (only_new) {
+		if (sqlite3_prepare(m_database, "INSERT OR IGNORE INTO `players` VALUES(?, ?)", -1, &write, NULL) != SQLITE_OK) {
+			infostream<<"WARNING: Database player insert statment failed to prepare: "<<sqlite3_errmsg(m_database)<<std::endl;
+			throw FileNotGoodException("map.sqlite: Cannot prepare player insert statement");
+		}
+	}
+
+	if (sqlite3_exec(m_database, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK)
+		infostream<<"WARNING: savePlayers() failed to begin, saving might be slow."<<std::endl;
+
+	for (std::map<std::string, std::string>::const_iterator i = players.begin(); i != players.end(); i++) {
+		const std::string &name = i->first;
+		const std::string &data = i->second;
+
+		if (sqlite3_bind_text(write, 1, name.c_str(), name.size(), NULL) != SQLITE_OK)
+			infostream<<"WARNING: Player name failed to bind: "<<sqlite3_errmsg(m_database)<<std::endl;
+		if (sqlite3_bind_blob(write, 2, (void*)data.c_str(), data.size(), NULL) != SQLITE_OK)
+			infostream<<"WARNING: Player data failed to bind: "<<sqlite3_errmsg(m_database)<<std::endl;
+		if (sqlite3_step(write) != SQLITE_DONE)
+			infostream<<"WARNING: Player failed to save ("<<name<<") "<<sqlite3_errmsg(m_database)<<std::endl;
+		sqlite3_reset(write);
 	}
+
+	if (sqlite3_exec(m_database, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+		infostream<<"WARNING: savePlayers() failed to commit, players might not have saved."<<std::endl;
+
+	if (only_new)
+		sqlite3_finalize(write);
 }
 
 void ServerMap::saveMapMeta()
@@ -2786,18 +3165,6 @@ void ServerMap::loadMapMeta()
 	infostream<<"ServerMap::loadMapMeta(): "<<"seed="<<m_seed<<std::endl;
 }
 
-void ServerMap::beginSave() {
-	verifyDatabase();
-	if(sqlite3_exec(m_database, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK)
-		infostream<<"WARNING: beginSave() failed, saving might be slow.";
-}
-
-void ServerMap::endSave() {
-	verifyDatabase();
-	if(sqlite3_exec(m_database, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
-		infostream<<"WARNING: endSave() failed, map might not have saved.";
-}
-
 void ServerMap::saveBlock(MapBlock *block)
 {
 	DSTACK(__FUNCTION_NAME);
@@ -2846,26 +3213,152 @@ void ServerMap::saveBlock(MapBlock *block)
 	// Write extra data stored on disk
 	block->serializeDiskExtra(o, version);
 
-	// Write block to database
-
-	std::string tmp = o.str();
-	const char *bytes = tmp.c_str();
+	/*
+		Anything read ahead of the block is out of date now. The block
+		is queued with the read ahead lock held, so that readAhead()
+		either sees it in the queue or has it marked stale.
+	*/
+	{
+		JMutexAutoLock lock(m_read_ahead_mutex);
+		std::map<v3s16, ReadAheadBlock>::iterator i = m_read_ahead.find(p3d);
+		if (i != m_read_ahead.end()) {
+			delete i->second.block;
+			m_read_ahead.erase(i);
+		}
+		if (m_read_ahead_reading.find(p3d) != m_read_ahead_reading.end())
+			m_read_ahead_stale.insert(p3d);
 
-	if(sqlite3_bind_int64(m_database_write, 1, getBlockAsInteger(p3d)) != SQLITE_OK)
-		infostream<<"WARNING: Block position failed to bind: "<<sqlite3_errmsg(m_database)<<std::endl;
-	if(sqlite3_bind_blob(m_database_write, 2, (void *)bytes, o.tellp(), NULL) != SQLITE_OK) // TODO this mught not be the right length
-		infostream<<"WARNING: Block data failed to bind: "<<sqlite3_errmsg(m_database)<<std::endl;
-	int written = sqlite3_step(m_database_write);
-	if(written != SQLITE_DONE)
-		infostream<<"WARNING: Block failed to save ("<<p3d.X<<", "<<p3d.Y<<", "<<p3d.Z<<") "
-		<<sqlite3_errmsg(m_database)<<std::endl;
-	// Make ready for later reuse
-	sqlite3_reset(m_database_write);
+		// Queue block for the save thread
+		JMutexAutoLock queuelock(m_save_queue_mutex);
+		if (m_save_queue.empty())
+			m_save_signal.Post();
+		m_save_queue[p3d] = o.str();
+	}
+	m_save_thread.trigger();
 
-	// We just wrote it to the disk so clear modified flag
+	// It's as good as on the disk, so clear modified flag
 	block->resetModified();
 }
 
+void * MapSaveThread::Thread()
+{
+	ThreadStarted();
+
+	log_register_thread("MapSaveThread");
+
+	DSTACK(__FUNCTION_NAME);
+
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (getRun()) {
+		/*
+			Blocks queued while a batch is being written go in the
+			next one, so a busy save is still written in few commits
+		*/
+		if (m_map->m_save_signal.Wait(1000))
+			m_map->writeQueuedBlocks();
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER(errorstream)
+
+	return NULL;
+}
+
+void ServerMap::verifySaveDatabase()
+{
+	if (m_save_database)
+		return;
+
+	std::string dbp = m_savedir + DIR_DELIM + "map.sqlite";
+	int d;
+
+	d = sqlite3_open_v2(dbp.c_str(), &m_save_database, SQLITE_OPEN_READWRITE, NULL);
+	if (d != SQLITE_OK) {
+		infostream<<"WARNING: Database failed to open: "<<sqlite3_errmsg(m_save_database)<<std::endl;
+		sqlite3_close(m_save_database);
+		m_save_database = NULL;
+		throw FileNotGoodException("map.sqlite: Cannot open database file");
+	}
+
+	sqlite3_busy_timeout(m_save_database, 30000);
+	// Safe with the write-ahead log, see verifyDatabase()
+	sqlite3_exec(m_save_database, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+
+	d = sqlite3_prepare(m_save_database, "REPLACE INTO `blocks` VALUES(?, ?)", -1, &m_save_database_write, NULL);
+	if (d != SQLITE_OK) {
+		infostream<<"WARNING: Database write statment failed to prepare: "<<sqlite3_errmsg(m_save_database)<<std::endl;
+		throw FileNotGoodException("map.sqlite: Cannot prepare write statement");
+	}
+}
+
+u32 ServerMap::writeQueuedBlocks()
+{
+	DSTACK(__FUNCTION_NAME);
+	JMutexAutoLock writelock(m_save_write_mutex);
+
+	{
+		JMutexAutoLock lock(m_save_queue_mutex);
+		if (m_save_queue.size() == 0)
+			return 0;
+		m_save_writing.swap(m_save_queue);
+	}
+
+	u32 count = m_save_writing.size();
+	u32 time_start = porting::getTimeMs();
+
+	static u32 prof_save_depth = g_profiler->getId("ServerMap: save queue depth");
+	g_profiler->avg(prof_save_depth, count);
+
+	verifySaveDatabase();
+
+	if (sqlite3_exec(m_save_database, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK)
+		infostream<<"WARNING: writeQueuedBlocks() failed to begin, saving might be slow."<<std::endl;
+
+	for (std::map<v3s16, std::string>::iterator i = m_save_writing.begin(); i != m_save_writing.end(); i++) {
+		v3s16 p3d = i->first;
+		const std::string &data = i->second;
+
+		if (sqlite3_bind_int64(m_save_database_write, 1, getBlockAsInteger(p3d)) != SQLITE_OK)
+			infostream<<"WARNING: Block position failed to bind: "<<sqlite3_errmsg(m_save_database)<<std::endl;
+		if (sqlite3_bind_blob(m_save_database_write, 2, (void *)data.c_str(), data.size(), NULL) != SQLITE_OK)
+			infostream<<"WARNING: Block data failed to bind: "<<sqlite3_errmsg(m_save_database)<<std::endl;
+		int written = sqlite3_step(m_save_database_write);
+		if (written != SQLITE_DONE)
+			infostream<<"WARNING: Block failed to save ("<<p3d.X<<", "<<p3d.Y<<", "<<p3d.Z<<") "
+			<<sqlite3_errmsg(m_save_database)<<std::endl;
+		// Make ready for later reuse
+		sqlite3_reset(m_save_database_write);
+	}
+
+	if (sqlite3_exec(m_save_database, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+		infostream<<"WARNING: writeQueuedBlocks() failed to commit, map might not have saved."<<std::endl;
+
+	{
+		JMutexAutoLock lock(m_save_queue_mutex);
+		m_save_writing.clear();
+	}
+
+	static u32 prof_save_time = g_profiler->getId("ServerMap: save commit time ms");
+	g_profiler->avg(prof_save_time, porting::getTimeMs()-time_start);
+
+	return count;
+}
+
+bool ServerMap::getQueuedBlock(v3s16 p, std::string *data)
+{
+	JMutexAutoLock lock(m_save_queue_mutex);
+
+	// The newest data is in the queue
+	std::map<v3s16, std::string>::iterator i = m_save_queue.find(p);
+	if (i == m_save_queue.end()) {
+		i = m_save_writing.find(p);
+		if (i == m_save_writing.end())
+			return false;
+	}
+	*data = i->second;
+	return true;
+}
+
 void ServerMap::loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load)
 {
 	DSTACK(__FUNCTION_NAME);
@@ -3017,6 +3510,45 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
+	/*
+		A block that was unloaded after saving may not have reached the
+		database yet
+	*/
+	{
+		std::string datastr;
+		if (getQueuedBlock(blockpos, &datastr)) {
+			MapSector *sector = createSector(p2d);
+			loadBlock(&datastr, blockpos, sector, false);
+			return getBlockNoCreateNoEx(blockpos);
+		}
+	}
+
+	/*
+		Use the block from readAhead() if there is one. It was built
+		without the environment lock, so another thread may have put a
+		block at its position since. The map is checked again here, with
+		the lock held, and the read ahead block is only inserted if there
+		still is none. Otherwise it's discarded and the block in memory
+		is loaded over below, so a position never gets two blocks.
+	*/
+	{
+		ReadAheadBlock b;
+		if (takeReadAhead(blockpos, b)) {
+			if (b.block == NULL)
+				return getBlockNoCreateNoEx(blockpos);
+			if (getBlockNoCreateNoEx(blockpos) == NULL) {
+				MapSector *sector = createSector(p2d);
+				sector->insertBlock(b.block);
+				// Save blocks loaded in old format in new format
+				if (b.version < SER_FMT_VER_HIGHEST)
+					saveBlock(b.block);
+				b.block->resetModified();
+				return b.block;
+			}
+			delete b.block;
+		}
+	}
+
 	verifyDatabase();
 
 	if (sqlite3_bind_int64(m_database_read, 1, getBlockAsInteger(blockpos)) != SQLITE_OK)
@@ -3049,6 +3581,197 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	return getBlockNoCreateNoEx(blockpos);
 }
 
+bool ServerMap::verifyReadAheadDatabase()
+{
+	if (m_read_ahead_database_read)
+		return true;
+
+	/*
+		The database is created by verifyDatabase() when the map is
+		first saved to or loaded from, until then there's nothing to read
+	*/
+	std::string dbp = m_savedir + DIR_DELIM + "map.sqlite";
+	if (!fs::PathExists(dbp))
+		return false;
+
+	int d;
+
+	if (m_read_ahead_database == NULL) {
+		d = sqlite3_open_v2(dbp.c_str(), &m_read_ahead_database, SQLITE_OPEN_READONLY, NULL);
+		if (d != SQLITE_OK) {
+			infostream<<"WARNING: Database failed to open: "<<sqlite3_errmsg(m_read_ahead_database)<<std::endl;
+			sqlite3_close(m_read_ahead_database);
+			m_read_ahead_database = NULL;
+			return false;
+		}
+		sqlite3_busy_timeout(m_read_ahead_database, 30000);
+	}
+
+	std::string sql = "SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN (?";
+	for (u32 i=1; i<MAP_READ_AHEAD_BATCH; i++) {
+		sql += ",?";
+	}
+	sql += ")";
+
+	d = sqlite3_prepare(m_read_ahead_database, sql.c_str(), -1, &m_read_ahead_database_read, NULL);
+	if (d != SQLITE_OK) {
+		m_read_ahead_database_read = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+void ServerMap::readAhead(const std::vector<v3s16> &blocks)
+{
+	DSTACK(__FUNCTION_NAME);
+
+	std::vector<v3s16> wanted;
+	u32 now = porting::getTimeMs();
+
+	{
+		JMutexAutoLock lock(m_read_ahead_mutex);
+
+		// Forget blocks that haven't been loaded in a while
+		for (std::map<v3s16, ReadAheadBlock>::iterator i = m_read_ahead.begin(); i != m_read_ahead.end(); ) {
+			if (now - i->second.time > 30000) {
+				delete i->second.block;
+				m_read_ahead.erase(i++);
+			}else{
+				i++;
+			}
+		}
+
+		/*
+			Blocks waiting for the save thread would be read as they
+			were before, loadBlock() gets them from the queue anyway
+		*/
+		JMutexAutoLock queuelock(m_save_queue_mutex);
+
+		for (std::vector<v3s16>::const_iterator i = blocks.begin(); i != blocks.end() && wanted.size() < MAP_READ_AHEAD_BATCH; i++) {
+			v3s16 p = *i;
+			if (m_read_ahead.find(p) != m_read_ahead.end())
+				continue;
+			if (m_read_ahead_reading.find(p) != m_read_ahead_reading.end())
+				continue;
+			if (m_save_queue.find(p) != m_save_queue.end())
+				continue;
+			if (m_save_writing.find(p) != m_save_writing.end())
+				continue;
+			m_read_ahead_reading.insert(p);
+			wanted.push_back(p);
+		}
+	}
+
+	if (wanted.size() == 0)
+		return;
+
+	/*
+		Fetch the blocks that exist
+	*/
+	std::map<v3s16, std::string> found;
+	bool can_read;
+	{
+		JMutexAutoLock lock(m_read_ahead_database_mutex);
+
+		can_read = verifyReadAheadDatabase();
+	}
+	if (!can_read) {
+		JMutexAutoLock lock(m_read_ahead_mutex);
+		for (std::vector<v3s16>::iterator i = wanted.begin(); i != wanted.end(); i++) {
+			m_read_ahead_reading.erase(*i);
+			m_read_ahead_stale.erase(*i);
+		}
+		return;
+	}
+	{
+		JMutexAutoLock lock(m_read_ahead_database_mutex);
+
+		// Unused parameters repeat the first block
+		for (u32 i=0; i<MAP_READ_AHEAD_BATCH; i++) {
+			v3s16 p = wanted[i < wanted.size() ? i : 0];
+			if (sqlite3_bind_int64(m_read_ahead_database_read, i+1, getBlockAsInteger(p)) != SQLITE_OK)
+				infostream<<"WARNING: Could not bind block position for read ahead: "
+					<<sqlite3_errmsg(m_read_ahead_database)<<std::endl;
+		}
+		while (sqlite3_step(m_read_ahead_database_read) == SQLITE_ROW) {
+			v3s16 p = getIntegerAsBlock(sqlite3_column_int64(m_read_ahead_database_read, 0));
+			const char *data = (const char *)sqlite3_column_blob(m_read_ahead_database_read, 1);
+			size_t len = sqlite3_column_bytes(m_read_ahead_database_read, 1);
+			found[p] = std::string(data, len);
+		}
+		sqlite3_reset(m_read_ahead_database_read);
+	}
+
+	/*
+		Deserialize them, blocks with invalid data are left for
+		loadBlock() to deal with
+	*/
+	std::map<v3s16, ReadAheadBlock> result;
+	for (std::vector<v3s16>::iterator i = wanted.begin(); i != wanted.end(); i++) {
+		v3s16 p = *i;
+		ReadAheadBlock b;
+		b.block = NULL;
+		b.version = SER_FMT_VER_HIGHEST;
+		b.time = now;
+
+		std::map<v3s16, std::string>::iterator f = found.find(p);
+		if (f != found.end()) {
+			try {
+				std::istringstream is(f->second, std::ios_base::binary);
+
+				is.read((char*)&b.version, 1);
+				if (is.fail())
+					throw SerializationError("ServerMap::readAhead(): Failed"
+							" to read MapBlock version");
+
+				b.block = new MapBlock(this, p);
+				b.block->deSerialize(is, b.version);
+				b.block->deSerializeDiskExtra(is, b.version);
+			}
+			catch(SerializationError &)
+			{
+				delete b.block;
+				continue;
+			}
+		}
+		result[p] = b;
+	}
+
+	{
+		JMutexAutoLock lock(m_read_ahead_mutex);
+
+		for (std::vector<v3s16>::iterator i = wanted.begin(); i != wanted.end(); i++) {
+			v3s16 p = *i;
+			m_read_ahead_reading.erase(p);
+			std::map<v3s16, ReadAheadBlock>::iterator r = result.find(p);
+			if (m_read_ahead_stale.find(p) != m_read_ahead_stale.end()) {
+				m_read_ahead_stale.erase(p);
+				if (r != result.end())
+					delete r->second.block;
+				continue;
+			}
+			if (r != result.end())
+				m_read_ahead[p] = r->second;
+		}
+	}
+
+	static u32 prof_read_ahead = g_profiler->getId("ServerMap: read ahead blocks");
+	g_profiler->avg(prof_read_ahead, wanted.size());
+}
+
+bool ServerMap::takeReadAhead(v3s16 p, ReadAheadBlock &b)
+{
+	JMutexAutoLock lock(m_read_ahead_mutex);
+
+	std::map<v3s16, ReadAheadBlock>::iterator i = m_read_ahead.find(p);
+	if (i == m_read_ahead.end())
+		return false;
+	b = i->second;
+	m_read_ahead.erase(i);
+	return true;
+}
+
 void ServerMap::PrintInfo(std::ostream &out)
 {
 	out<<"ServerMap: ";
@@ -3108,6 +3831,7 @@ MapSector * ClientMap::emergeSector(v2s16 p2d)
 		//JMutexAutoLock lock(m_sector_mutex); // Bulk comment-out
 		m_sectors.insert(p2d, sector);
 	}
+	queueSectorCheck(p2d);
 
 	return sector;
 }
@@ -3187,12 +3911,20 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 
 	bool is_transparent_pass = pass == scene::ESNRP_TRANSPARENT;
 
-	std::string prefix;
-	if (pass == scene::ESNRP_SOLID) {
-		prefix = "CM: solid: ";
-	}else{
-		prefix = "CM: transparent: ";
-	}
+	// Counters of the solid and the transparent pass
+	struct PassProfilerIds {
+		u32 collect, draw, vertices, meshbufs, empty;
+		PassProfilerIds(const std::string &prefix):
+			collect(g_profiler->getId(prefix+"collecting blocks for drawing")),
+			draw(g_profiler->getId(prefix+"drawing blocks")),
+			vertices(g_profiler->getId(prefix+"vertices drawn")),
+			meshbufs(g_profiler->getId(prefix+"meshbuffers per block")),
+			empty(g_profiler->getId(prefix+"empty blocks (frac)"))
+		{}
+	};
+	static PassProfilerIds prof_solid("CM: solid: ");
+	static PassProfilerIds prof_transparent("CM: transparent: ");
+	PassProfilerIds &prof = pass == scene::ESNRP_SOLID ? prof_solid : prof_transparent;
 
 	/*
 		This is called two times per frame, reset on the non-transparent one
@@ -3267,7 +3999,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	core::map<v3s16, MapBlock*> drawset;
 
 	{
-	ScopeProfiler sp(g_profiler, prefix+"collecting blocks for drawing", SPT_AVG);
+	ScopeProfiler sp(g_profiler, prof.collect, SPT_AVG);
 
 	for(core::map<v2s16, MapSector*>::Iterator
 			si = m_sectors.getIterator();
@@ -3462,7 +4194,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 	*/
 
 	{
-	ScopeProfiler sp(g_profiler, prefix+"drawing blocks", SPT_AVG);
+	ScopeProfiler sp(g_profiler, prof.draw, SPT_AVG);
 
 	int timecheck_counter = 0;
 	for (core::map<v3s16, MapBlock*>::Iterator i = drawset.getIterator(); i.atEnd() == false; i++) {
@@ -3543,20 +4275,24 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 
 	// Log only on solid pass because values are the same
 	if(pass == scene::ESNRP_SOLID){
-		g_profiler->avg("CM: blocks in range", blocks_in_range);
-		g_profiler->avg("CM: blocks occlusion culled", blocks_occlusion_culled);
+		static u32 prof_in_range = g_profiler->getId("CM: blocks in range");
+		static u32 prof_culled = g_profiler->getId("CM: blocks occlusion culled");
+		static u32 prof_no_mesh = g_profiler->getId("CM: blocks in range without mesh (frac)");
+		static u32 prof_drawn = g_profiler->getId("CM: blocks drawn");
+		g_profiler->avg(prof_in_range, blocks_in_range);
+		g_profiler->avg(prof_culled, blocks_occlusion_culled);
 		if(blocks_in_range != 0)
-			g_profiler->avg("CM: blocks in range without mesh (frac)",
+			g_profiler->avg(prof_no_mesh,
 					(float)blocks_in_range_without_mesh/blocks_in_range);
-		g_profiler->avg("CM: blocks drawn", blocks_drawn);
+		g_profiler->avg(prof_drawn, blocks_drawn);
 	}
 
-	g_profiler->avg(prefix+"vertices drawn", vertex_count);
+	g_profiler->avg(prof.vertices, vertex_count);
 	if(blocks_had_pass_meshbuf != 0)
-		g_profiler->avg(prefix+"meshbuffers per block",
+		g_profiler->avg(prof.meshbufs,
 				(float)meshbuffer_count / (float)blocks_had_pass_meshbuf);
 	if(blocks_drawn != 0)
-		g_profiler->avg(prefix+"empty blocks (frac)",
+		g_profiler->avg(prof.empty,
 				(float)blocks_without_stuff / blocks_drawn);
 
 	m_control.blocks_drawn = blocks_drawn;
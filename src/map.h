@@ -31,6 +31,8 @@
 #include <jthread.h>
 #include <iostream>
 #include <sstream>
+#include <set>
+#include <queue>
 
 #include "common_irrlicht.h"
 #include "mapgen.h"
@@ -38,6 +40,7 @@
 #include "mapblock_nodemod.h"
 #include "constants.h"
 #include "voxel.h"
+#include "utility.h"
 
 extern "C" {
 	#include "sqlite3.h"
@@ -111,6 +114,59 @@ public:
 	virtual void onMapEditEvent(MapEditEvent *event) = 0;
 };
 
+/*
+	Open addressing hash table of blocks by position, so that finding a
+	block doesn't walk the sector and block trees.
+*/
+class MapBlockIndex
+{
+public:
+	MapBlockIndex();
+	~MapBlockIndex();
+
+	// Returns NULL if not found
+	MapBlock *get(v3s16 p)
+	{
+		u32 i = hash(p) & m_mask;
+		while (m_slots[i].block != NULL) {
+			if (m_slots[i].pos == p)
+				return m_slots[i].block;
+			i = (i+1) & m_mask;
+		}
+		return NULL;
+	}
+	void set(v3s16 p, MapBlock *block);
+	void remove(v3s16 p);
+
+	u32 size() {return m_count;}
+
+private:
+	struct Slot
+	{
+		v3s16 pos;
+		// NULL if the slot is empty
+		MapBlock *block;
+	};
+
+	static u32 hash(v3s16 p)
+	{
+		u32 h = (u32)(u16)p.X | ((u32)(u16)p.Y<<16);
+		h ^= (u32)(u16)p.Z * 0x9e3779b1;
+		h ^= h>>16;
+		h *= 0x85ebca6b;
+		h ^= h>>13;
+		return h;
+	}
+	void resize(u32 size);
+
+	Slot *m_slots;
+	u32 m_mask;
+	u32 m_count;
+};
+
+// The most blocks Map::timerUpdate() unloads at once, the rest wait
+#define MAP_UNLOAD_BATCH 1000
+
 class Map /*: public NodeContainer*/
 {
 public:
@@ -163,6 +219,14 @@ public:
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
 
+	// Called by MapSector when it gains or loses a block
+	void indexBlock(MapBlock *block);
+	void unindexBlock(MapBlock *block);
+	// Called by MapBlock when it first needs writing
+	void setBlockDirty(MapBlock *block);
+	// The clock of block usage, advanced by timerUpdate()
+	double getUsageTime() {return m_usage_time;}
+
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool allow_generate=true)
 	{ return getBlockNoCreateNoEx(p); }
@@ -181,6 +245,10 @@ public:
 	// Returns a CONTENT_IGNORE node if not found
 	MapNode getNodeNoEx(v3s16 p, bool *is_valid_position = NULL);
 
+	// See MapBlock::getNodeTicks(), 0 if not found
+	u32 getNodeTicks(v3s16 p);
+	void setNodeTicks(v3s16 p, u32 ticks);
+
 	void unspreadLight(enum LightBank bank,
 			core::map<v3s16, u8> & from_nodes,
 			core::map<v3s16, bool> & light_sources,
@@ -247,7 +315,8 @@ public:
 	virtual void saveBlock(MapBlock *block){};
 
 	/*
-		Updates usage timers and unloads unused blocks and sectors.
+		Advances the usage clock and unloads unused blocks and sectors,
+		at most MAP_UNLOAD_BATCH blocks at a time.
 		Saves modified blocks before unloading on MAPTYPE_SERVER.
 	*/
 	void timerUpdate(float dtime, float unload_timeout,
@@ -271,7 +340,8 @@ public:
 	// For debug printing. Prints "Map: ", "ServerMap: " or "ClientMap: "
 	virtual void PrintInfo(std::ostream &out);
 
-	void transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks);
+	// time_budget is in microseconds, 0 for no limit
+	void transformLiquids(core::map<v3s16, MapBlock*> & modified_blocks, u32 time_budget=0);
 
 	/*
 		Node metadata
@@ -306,8 +376,60 @@ protected:
 	MapSector *m_sector_cache;
 	v2s16 m_sector_cache_p;
 
+	// All blocks in the sectors, and the last one looked up
+	MapBlockIndex m_block_index;
+	MapBlock *m_block_cache;
+	v3s16 m_block_cache_p;
+
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
+
+	/*
+		Blocks that may need writing, so that ServerMap::save() doesn't
+		look at every block. Only kept on MAPTYPE_SERVER.
+	*/
+	std::set<v3s16> m_dirty_blocks;
+
+	/*
+		Blocks by when they were last used, the least recently used
+		first. Using a block only changes its usage time, so an entry
+		is checked when it comes up and put back if the block has been
+		used since. Entries of blocks that are gone are told apart by
+		their serial.
+	*/
+	struct UsageEntry
+	{
+		double time;
+		v3s16 pos;
+		u32 serial;
+
+		// Reversed, so that the earliest is on top of the queue
+		bool operator<(const UsageEntry &other) const
+		{
+			return time > other.time;
+		}
+	};
+	std::priority_queue<UsageEntry> m_unload_queue;
+	/*
+		Seconds, a double so that adding a step still counts after
+		months of uptime
+	*/
+	double m_usage_time;
+	u32 m_usage_serial;
+
+	/*
+		Sectors by when they were last checked for having no blocks.
+		Those emptied by unloading are deleted right away, this is for
+		the ones that never got a block. They are added at the current
+		usage time, so the earliest is always in front.
+	*/
+	struct SectorCheck
+	{
+		double time;
+		v2s16 pos;
+	};
+	std::queue<SectorCheck> m_sector_checks;
+	void queueSectorCheck(v2s16 p);
 };
 
 /*
@@ -316,6 +438,40 @@ protected:
 	This is the only map class that is able to generate map.
 */
 
+class ServerMap;
+
+// The most blocks ServerMap::readAhead() reads in one query
+#define MAP_READ_AHEAD_BATCH 32
+
+/*
+	Writes blocks queued by ServerMap::saveBlock() to the map database,
+	a batch at a time in one transaction, so that saving doesn't hold
+	up the server.
+*/
+class MapSaveThread : public SimpleThread
+{
+	ServerMap *m_map;
+
+public:
+
+	MapSaveThread(ServerMap *map):
+		SimpleThread(),
+		m_map(map)
+	{
+	}
+
+	void * Thread();
+
+	void trigger()
+	{
+		setRun(true);
+		if(IsRunning() == false)
+		{
+			Start();
+		}
+	}
+};
+
 class ServerMap : public Map
 {
 public:
@@ -392,9 +548,18 @@ public:
 	static sqlite3_int64 getBlockAsInteger(const v3s16 pos);
 	static v3s16 getIntegerAsBlock(sqlite3_int64 i);
 
-	// Call these before and after saving of blocks
-	void beginSave();
-	void endSave();
+	/*
+		Players are kept in the database by name, as serialized by
+		Player::serialize()
+	*/
+	// Returns false if there's no player by that name
+	bool loadPlayer(const std::string &name, std::string &data);
+	/*
+		Writes the players in one transaction. With only_new, players
+		who are already in the database are left as they are.
+	*/
+	void savePlayers(const std::map<std::string, std::string> &players,
+			bool only_new=false);
 
 	void save(bool only_changed);
 	//void loadAll();
@@ -405,13 +570,22 @@ public:
 	void saveMapMeta();
 	void loadMapMeta();
 
+	// Serializes the block and queues it for the save thread
 	void saveBlock(MapBlock *block);
 	// This will generate a sector with getSector if not found.
 	void loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load=false);
+	// Environment must be locked when called
 	MapBlock* loadBlock(v3s16 p);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
+	/*
+		Reads blocks from the database in one query and deserializes
+		them, without needing the environment lock, for loadBlock() to
+		pick up later. Can be called from any thread.
+	*/
+	void readAhead(const std::vector<v3s16> &blocks);
+
 	// For debug printing
 	virtual void PrintInfo(std::ostream &out);
 
@@ -424,6 +598,8 @@ private:
 	// Seed used for all kinds of randomness
 	uint64_t m_seed;
 	MapGenType m_type;
+	// 2d terrain of recently generated sectors
+	mapgen::HeightfieldCache m_heightfields;
 
 	std::string m_savedir;
 	bool m_map_saving_enabled;
@@ -447,8 +623,60 @@ private:
 	*/
 	sqlite3 *m_database;
 	sqlite3_stmt *m_database_read;
-	sqlite3_stmt *m_database_write;
 	sqlite3_stmt *m_database_list;
+	sqlite3_stmt *m_database_player_read;
+	sqlite3_stmt *m_database_player_write;
+
+	/*
+		Block saving, see MapSaveThread. The save thread has its own
+		database connection so that loading isn't blocked on it.
+	*/
+	friend class MapSaveThread;
+	// Opens the save thread's database connection
+	void verifySaveDatabase();
+	// Writes the queued blocks, returns the number written
+	u32 writeQueuedBlocks();
+	// Gets the data of a block that is saved but not yet in the database
+	bool getQueuedBlock(v3s16 p, std::string *data);
+
+	MapSaveThread m_save_thread;
+	// Serialized blocks waiting for the save thread
+	std::map<v3s16, std::string> m_save_queue;
+	// The blocks the save thread is writing
+	std::map<v3s16, std::string> m_save_writing;
+	// Locks the two above, m_save_writing is only changed with both locks
+	JMutex m_save_queue_mutex;
+	JMutex m_save_write_mutex;
+	// Posted when m_save_queue gets its first block
+	JSemaphore m_save_signal;
+	sqlite3 *m_save_database;
+	sqlite3_stmt *m_save_database_write;
+
+	/*
+		Block read-ahead, see readAhead(). Saving a block drops what has
+		been read of it, or marks it stale if it's being read.
+	*/
+	struct ReadAheadBlock
+	{
+		// NULL if the block isn't in the database
+		MapBlock *block;
+		u8 version;
+		u32 time;
+	};
+	// Opens the read-ahead database connection, false if it can't yet
+	bool verifyReadAheadDatabase();
+	// Takes the read-ahead data of a block, false if there is none
+	bool takeReadAhead(v3s16 p, ReadAheadBlock &b);
+
+	std::map<v3s16, ReadAheadBlock> m_read_ahead;
+	std::set<v3s16> m_read_ahead_reading;
+	std::set<v3s16> m_read_ahead_stale;
+	// Locks the three above, taken before m_save_queue_mutex if both are
+	JMutex m_read_ahead_mutex;
+	// Locks the read-ahead database connection
+	JMutex m_read_ahead_database_mutex;
+	sqlite3 *m_read_ahead_database;
+	sqlite3_stmt *m_read_ahead_database_read;
 };
 
 /*
@@ -49,8 +49,11 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, bool dummy):
 	m_lighting_expired(true),
 	m_day_night_differs(false),
 	m_generated(false),
+	m_content_counts_valid(false),
+	m_content_version(0),
 	m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
-	m_usage_timer(0)
+	m_usage_time(0),
+	m_usage_serial(0)
 {
 	data = NULL;
 	if (dummy == false)
@@ -145,6 +148,9 @@ bool MapBlock::propagateSunlight(core::map<v3s16, bool> & light_sources,
 
 	v3s16 pos_relative = getPosRelative();
 
+	// Light is written through getNodeRef(), which doesn't track changes
+	clearSendCache();
+
 	for (s16 x=0; x<MAP_BLOCKSIZE; x++) {
 		for (s16 z=0; z<MAP_BLOCKSIZE; z++) {
 			bool no_sunlight = false;
@@ -270,6 +276,40 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	m_content_counts_valid = false;
+	m_content_version++;
+	clearSendCache();
+}
+
+void MapBlock::countContents()
+{
+	m_content_counts.clear();
+	m_content_counts_valid = true;
+	if (data == NULL)
+		return;
+	for (u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++) {
+		m_content_counts[data[i].getContent()]++;
+	}
+}
+
+void MapBlock::setDirty()
+{
+	if (m_parent)
+		m_parent->setBlockDirty(this);
+}
+
+void MapBlock::resetUsageTimer()
+{
+	if (m_parent)
+		m_usage_time = m_parent->getUsageTime();
+}
+
+float MapBlock::getUsageTimer()
+{
+	if (m_parent == NULL)
+		return 0;
+	return m_parent->getUsageTime() - m_usage_time;
 }
 
 void MapBlock::updateDayNightDiff()
@@ -316,6 +356,8 @@ void MapBlock::updateDayNightDiff()
 	}
 
 	// Set member variable
+	if (differs != m_day_night_differs)
+		clearSendCache();
 	m_day_night_differs = differs;
 }
 
@@ -413,6 +455,11 @@ void MapBlock::deSerialize(std::istream &is, u8 version)
 	if (!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
+	clearSendCache();
+	m_content_counts_valid = false;
+	m_content_version++;
+	m_node_ticks.clear();
+
 	{
 		u32 nodecount = MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE;
 
@@ -30,6 +30,8 @@
 #include <jmutex.h>
 #include <jmutexautolock.h>
 #include <exception>
+#include <map>
+#include <vector>
 #include "debug.h"
 #include "common_irrlicht.h"
 #include "mapnode.h"
@@ -148,6 +150,9 @@ public:
 			//data[i] = MapNode();
 			data[i] = MapNode(CONTENT_IGNORE);
 		}
+		m_content_counts_valid = false;
+		m_content_version++;
+		m_node_ticks.clear();
 		raiseModified(MOD_STATE_WRITE_NEEDED);
 	}
 
@@ -195,7 +200,10 @@ public:
 	// m_modified methods
 	void raiseModified(u32 mod)
 	{
+		if (mod >= MOD_STATE_WRITE_NEEDED && m_modified < MOD_STATE_WRITE_NEEDED)
+			setDirty();
 		m_modified = MYMAX(m_modified, mod);
+		clearSendCache();
 	}
 	u32 getModified()
 	{
@@ -325,7 +333,9 @@ public:
 	{
 		if (!isValidPosition(x,y,z))
 			throw InvalidPositionException();
-		data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x] = n;
+		u32 i = z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x;
+		nodeChanged(i, data[i], n);
+		data[i] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED);
 	}
 
@@ -334,11 +344,43 @@ public:
 		setNode(p.X, p.Y, p.Z, n);
 	}
 
-	void incNodeTicks(v3s16 p)
+	/*
+		Environment ticks, the number of times the server environment
+		has run active block modifiers on a node since its content was
+		last changed. Only kept for the few nodes that have any.
+	*/
+
+	u32 getNodeTicks(v3s16 p)
+	{
+		if (!isValidPosition(p.X,p.Y,p.Z))
+			return 0;
+		u32 i = p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X;
+		u32 k = findNodeTicks(i);
+		if (k == m_node_ticks.size() || m_node_ticks[k].i != i)
+			return 0;
+		if (m_node_ticks[k].content != data[i].getContent())
+			return 0;
+		return m_node_ticks[k].ticks;
+	}
+
+	void setNodeTicks(v3s16 p, u32 ticks)
 	{
 		if (!isValidPosition(p.X,p.Y,p.Z))
 			return;
-		data[p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X].envticks++;
+		u32 i = p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X;
+		NodeTicks &t = getNodeTicksRef(i);
+		t.ticks = MYMIN(ticks, 0xFFFF);
+	}
+
+	u32 incNodeTicks(v3s16 p)
+	{
+		if (!isValidPosition(p.X,p.Y,p.Z))
+			return 0;
+		u32 i = p.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + p.Y*MAP_BLOCKSIZE + p.X;
+		NodeTicks &t = getNodeTicksRef(i);
+		if (t.ticks < 0xFFFF)
+			t.ticks++;
+		return t.ticks;
 	}
 
 	/*
@@ -362,7 +404,9 @@ public:
 	{
 		if(data == NULL)
 			throw InvalidPositionException();
-		data[z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x] = n;
+		u32 i = z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + y*MAP_BLOCKSIZE + x;
+		nodeChanged(i, data[i], n);
+		data[i] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED);
 	}
 
@@ -513,19 +557,23 @@ public:
 	}
 
 	/*
-		See m_usage_timer
+		See m_usage_time
 	*/
-	void resetUsageTimer()
+	void resetUsageTimer();
+	// Seconds since the block was last used
+	float getUsageTimer();
+	double getUsageTime()
 	{
-		m_usage_timer = 0;
+		return m_usage_time;
 	}
-	void incrementUsageTimer(float dtime)
+	// Identifies the entry of the block in the unload queue of the map
+	u32 getUsageSerial()
 	{
-		m_usage_timer += dtime;
+		return m_usage_serial;
 	}
-	u32 getUsageTimer()
+	void setUsageSerial(u32 serial)
 	{
-		return m_usage_timer;
+		m_usage_serial = serial;
 	}
 
 	/*
@@ -539,6 +587,56 @@ public:
 	void serializeDiskExtra(std::ostream &os, u8 version);
 	void deSerializeDiskExtra(std::istream &is, u8 version);
 
+	/*
+		Number of nodes of each content in the block, used by the server
+		environment to skip blocks that have nothing to run active block
+		modifiers on.
+	*/
+	const std::map<content_t,u16> &getContentCounts()
+	{
+		if (!m_content_counts_valid)
+			countContents();
+		return m_content_counts;
+	}
+
+	/*
+		Changes whenever the content or param2 of a node changes or the
+		block is loaded, so that caches of the block's nodes know to
+		update.
+	*/
+	u32 getContentVersion()
+	{
+		return m_content_version;
+	}
+
+	/*
+		Cache of the TOCLIENT_BLOCKDATA packet for each serialization
+		version, so that a block sent to many clients is only serialized
+		and compressed once. Any change to the block clears it, and
+		the server drops the least recently used ones to bound memory.
+	*/
+	bool getSendCache(u8 version, SharedBuffer<u8> &buf)
+	{
+		core::map<u8, SharedBuffer<u8> >::Node *n = m_send_cache.find(version);
+		if (n == NULL)
+			return false;
+		buf = n->getValue();
+		return true;
+	}
+	void setSendCache(u8 version, SharedBuffer<u8> buf)
+	{
+		m_send_cache.set(version, buf);
+	}
+	void clearSendCache()
+	{
+		if (m_send_cache.size() != 0)
+			m_send_cache.clear();
+	}
+	void clearSendCache(u8 version)
+	{
+		m_send_cache.remove(version);
+	}
+
 	// Used by the server env for mob spawning
 	bool has_spawn_area;
 	v3s16 spawn_area;
@@ -554,6 +652,79 @@ private:
 		Used only internally, because changes can't be tracked
 	*/
 
+	void countContents();
+
+	// Tells the map that the block needs writing
+	void setDirty();
+
+	/*
+		The environment ticks of a node. The content is kept so a
+		counter is dropped when something writes the node directly.
+	*/
+	struct NodeTicks
+	{
+		u16 i;
+		content_t content;
+		u16 ticks;
+	};
+
+	// The position in m_node_ticks of the ticks of node i, or of where they'd go
+	u32 findNodeTicks(u32 i)
+	{
+		u32 lo = 0;
+		u32 hi = m_node_ticks.size();
+		while (lo < hi) {
+			u32 mid = (lo+hi)/2;
+			if (m_node_ticks[mid].i < i) {
+				lo = mid+1;
+			}else{
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+	// The ticks of node i, added or restarted if they're for other content
+	NodeTicks &getNodeTicksRef(u32 i)
+	{
+		u32 k = findNodeTicks(i);
+		if (k == m_node_ticks.size() || m_node_ticks[k].i != i) {
+			NodeTicks t;
+			t.i = i;
+			t.content = data[i].getContent();
+			t.ticks = 0;
+			m_node_ticks.insert(m_node_ticks.begin()+k, t);
+		}else if (m_node_ticks[k].content != data[i].getContent()) {
+			m_node_ticks[k].content = data[i].getContent();
+			m_node_ticks[k].ticks = 0;
+		}
+		return m_node_ticks[k];
+	}
+
+	// Keeps the content version, counts and node ticks up to date when a node is replaced
+	void nodeChanged(u32 i, MapNode &from_node, MapNode &to_node)
+	{
+		content_t from = from_node.getContent();
+		content_t to = to_node.getContent();
+		if (from == to) {
+			// param2 holds liquid levels, facing and such
+			if (from_node.param2 != to_node.param2)
+				m_content_version++;
+			return;
+		}
+		m_content_version++;
+		if (m_node_ticks.size()) {
+			u32 k = findNodeTicks(i);
+			if (k < m_node_ticks.size() && m_node_ticks[k].i == i)
+				m_node_ticks.erase(m_node_ticks.begin()+k);
+		}
+		if (!m_content_counts_valid)
+			return;
+		std::map<content_t,u16>::iterator ci = m_content_counts.find(from);
+		if (ci != m_content_counts.end() && --ci->second == 0)
+			m_content_counts.erase(ci);
+		m_content_counts[to]++;
+	}
+
 	MapNode & getNodeRef(s16 x, s16 y, s16 z)
 	{
 		if(data == NULL)
@@ -629,8 +800,24 @@ private:
 	// Whether day and night lighting differs
 	bool m_day_night_differs;
 
+	// See getSendCache()
+	core::map<u8, SharedBuffer<u8> > m_send_cache;
+
 	bool m_generated;
 
+	// See getContentCounts(), recounted when not valid
+	std::map<content_t,u16> m_content_counts;
+	bool m_content_counts_valid;
+	// See getContentVersion()
+	u32 m_content_version;
+
+	/*
+		See getNodeTicks(), sorted by the index of the node in data.
+		Surface blocks can have a few hundred of these, so they're kept
+		small rather than in a map.
+	*/
+	std::vector<NodeTicks> m_node_ticks;
+
 #ifndef SERVER // Only on client
 	/*
 		Set to true if the mesh has been ordered to be updated
@@ -652,10 +839,12 @@ private:
 	u32 m_timestamp;
 
 	/*
-		When the block is accessed, this is set to 0.
-		Map will unload the block when this reaches a timeout.
+		When the block is accessed, this is set to the usage clock of
+		the map. Map will unload the block when the clock is a timeout
+		past it.
 	*/
-	float m_usage_timer;
+	double m_usage_time;
+	u32 m_usage_serial;
 };
 
 inline bool blockpos_over_limit(v3s16 p)
@@ -31,6 +31,7 @@
 #include "map.h"
 #include "mineral.h"
 #include "content_sao.h"
+#include <jmutexautolock.h>
 
 namespace mapgen
 {
@@ -39,12 +40,13 @@ namespace mapgen
 	Some helper functions for the map generator
 */
 
-static void make_tree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
+static void make_tree(ManualMapVoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode treenode(CONTENT_TREE);
 	MapNode leavesnode(CONTENT_LEAVES);
 
-	s16 trunk_h = myrand_range(5,6);
+	s16 trunk_h = random.range(5,6);
 	v3s16 p1 = p0;
 	for (s16 ii=0; ii<trunk_h; ii++) {
 		if (vmanip.m_area.contains(p1))
@@ -78,9 +80,9 @@ static void make_tree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 		s16 d = 1;
 
 		v3s16 p(
-			myrand_range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
-			myrand_range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
-			myrand_range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
+			random.range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
+			random.range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
+			random.range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
 		);
 
 		for (s16 z=0; z<=d; z++) {
@@ -112,13 +114,14 @@ static void make_tree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 	}
 }
 
-static void make_appletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
+static void make_appletree(ManualMapVoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode treenode(CONTENT_APPLE_TREE);
 	MapNode leavesnode(CONTENT_APPLE_LEAVES);
 	MapNode applenode(CONTENT_APPLE);
 
-	s16 trunk_h = myrand_range(4, 5);
+	s16 trunk_h = random.range(4, 5);
 	v3s16 p1 = p0;
 	for(s16 ii=0; ii<trunk_h; ii++)
 	{
@@ -152,9 +155,9 @@ static void make_appletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 		s16 d = 1;
 
 		v3s16 p(
-			myrand_range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
-			myrand_range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
-			myrand_range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
+			random.range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
+			random.range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
+			random.range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
 		);
 
 		for(s16 z=0; z<=d; z++)
@@ -166,7 +169,7 @@ static void make_appletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 	}
 
 	// not all apple trees have apples
-	bool have_fruit = (myrand_range(0,4) == 0);
+	bool have_fruit = (random.range(0,4) == 0);
 
 	// Blit leaves to vmanip
 	for(s16 z=leaves_a.MinEdge.Z; z<=leaves_a.MaxEdge.Z; z++)
@@ -182,7 +185,7 @@ static void make_appletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 			continue;
 		u32 i = leaves_a.index(x,y,z);
 		if (leaves_d[i] == 1) {
-			bool is_apple = myrand_range(0,99) < 10;
+			bool is_apple = random.range(0,99) < 10;
 			if (have_fruit && is_apple) {
 				vmanip.m_data[vi] = applenode;
 			}else{
@@ -192,12 +195,13 @@ static void make_appletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 	}
 }
 
-static void make_conifertree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
+static void make_conifertree(ManualMapVoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode treenode(CONTENT_CONIFER_TREE);
 	MapNode leavesnode(CONTENT_CONIFER_LEAVES);
 
-	s16 trunk_h = myrand_range(8, 11);
+	s16 trunk_h = random.range(8, 11);
 	v3s16 p1 = p0;
 	for (s16 ii=0; ii<trunk_h; ii++) {
 		if(vmanip.m_area.contains(p1))
@@ -229,12 +233,13 @@ static void make_conifertree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 
 }
 
-static void make_largetree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
+static void make_largetree(ManualMapVoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode treenode(CONTENT_TREE);
 	MapNode leavesnode(CONTENT_LEAVES);
 
-	s16 trunk_h = myrand_range(10, 12);
+	s16 trunk_h = random.range(10, 12);
 	v3s16 p1 = p0;
 	for(s16 ii=0; ii<trunk_h; ii++)
 	{
@@ -300,9 +305,9 @@ static void make_largetree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 				s16 d = 1;
 
 				v3s16 p(
-					myrand_range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
-					myrand_range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
-					myrand_range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
+					random.range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
+					random.range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
+					random.range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
 				);
 
 				for(s16 z=0; z<=d; z++)
@@ -334,7 +339,8 @@ static void make_largetree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 	}
 }
 
-static void make_jungletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
+static void make_jungletree(ManualMapVoxelManipulator &vmanip, v3s16 p0,
+		PseudoRandom &random)
 {
 	MapNode treenode(CONTENT_JUNGLETREE);
 	MapNode leavesnode(CONTENT_JUNGLELEAVES);
@@ -342,7 +348,7 @@ static void make_jungletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 	for(s16 x=-1; x<=1; x++)
 	for(s16 z=-1; z<=1; z++)
 	{
-		if(myrand_range(0, 2) == 0)
+		if(random.range(0, 2) == 0)
 			continue;
 		v3s16 p1 = p0 + v3s16(x,0,z);
 		v3s16 p2 = p0 + v3s16(x,-1,z);
@@ -353,7 +359,7 @@ static void make_jungletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 			vmanip.m_data[vmanip.m_area.index(p1)] = treenode;
 	}
 
-	s16 trunk_h = myrand_range(8, 12);
+	s16 trunk_h = random.range(8, 12);
 	v3s16 p1 = p0;
 	for(s16 ii=0; ii<trunk_h; ii++)
 	{
@@ -388,9 +394,9 @@ static void make_jungletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 		s16 d = 1;
 
 		v3s16 p(
-			myrand_range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
-			myrand_range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
-			myrand_range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
+			random.range(leaves_a.MinEdge.X, leaves_a.MaxEdge.X-d),
+			random.range(leaves_a.MinEdge.Y, leaves_a.MaxEdge.Y-d),
+			random.range(leaves_a.MinEdge.Z, leaves_a.MaxEdge.Z-d)
 		);
 
 		for(s16 z=0; z<=d; z++)
@@ -420,11 +426,11 @@ static void make_jungletree(ManualMapVoxelManipulator &vmanip, v3s16 p0)
 	}
 }
 
-static void make_papyrus(VoxelManipulator &vmanip, v3s16 p0)
+static void make_papyrus(VoxelManipulator &vmanip, v3s16 p0, PseudoRandom &random)
 {
 	MapNode papyrusnode(CONTENT_PAPYRUS);
 
-	s16 trunk_h = myrand_range(2, 3);
+	s16 trunk_h = random.range(2, 3);
 	v3s16 p1 = p0;
 	for (s16 ii=0; ii<trunk_h; ii++) {
 		if (vmanip.m_area.contains(p1))
@@ -433,12 +439,12 @@ static void make_papyrus(VoxelManipulator &vmanip, v3s16 p0)
 	}
 }
 
-static void make_cactus(VoxelManipulator &vmanip, v3s16 p0)
+static void make_cactus(VoxelManipulator &vmanip, v3s16 p0, PseudoRandom &random)
 {
 	MapNode cactusnode(CONTENT_CACTUS);
 
 	s16 trunk_h = 3;
-	if (myrand()%5000 == 0)
+	if (random.next()%5000 == 0)
 		trunk_h = 4;
 	v3s16 p1 = p0;
 	for (s16 ii=0; ii<trunk_h; ii++) {
@@ -1024,143 +1030,98 @@ bool is_cave(uint64_t seed, v3s16 p)
 /*
 	Ground density noise shall be interpreted by using this.
 
-	TODO: No perlin noises here, they should be outsourced
-	      and buffered
-		  NOTE: The speed of these actually isn't terrible
+	The ground shape has a 2d part, which only depends on X and Z, so
+	it is calculated once per node column: the ground is where
+	p.Y - height < ground_noise1_val * factor.
 */
-bool val_is_ground_flat(double ground_noise1_val, v3s16 p, uint64_t seed)
-{
-	return (p.Y < 2); // flat
-}
-bool val_is_ground_flatter(double ground_noise1_val, v3s16 p, uint64_t seed)
+static void get_ground_column_from_noise(MapGenType type, double factor_noise, double height_noise, double &factor, double &height)
 {
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
-	if (f < 0.01) {
-		f = 0.1;
-	}else if(f > 1.0) {
-		f = 1.0;
-	}
-	double h = WATER_LEVEL + 1 * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	return ((double)p.Y - h < ground_noise1_val * f);
-}
-bool val_is_ground_smoother(double ground_noise1_val, v3s16 p, uint64_t seed)
-{
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
-	//return (p.Y < 1); // flat
-	if (f < 0.01) {
-		f = 0.1;
-	}else if(f > 1.0) {
-		f = 1.0;
-	}
-	double h = WATER_LEVEL + 10 * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	return ((double)p.Y - h < ground_noise1_val * f);
-}
-bool val_is_ground_default(double ground_noise1_val, v3s16 p, uint64_t seed)
-{
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
-	//return (p.Y < 1); // flat
-	if (f < 0.01) {
-		f = 0.1;
-	}else if(f >= 1.0) {
-		f *= 1.6; // set to = 1.0 for less crazy maps
+	if (type == MGT_FLAT) {
+		// Same as p.Y < 2
+		factor = 0.0;
+		height = 2.0;
+		return;
 	}
+
+	double f = 0.55 + factor_noise;
 	double height_affect = 10; // set to 100 for awesome hills or 1 for flat maps
-	double h = WATER_LEVEL + height_affect * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	return ((double)p.Y - h < ground_noise1_val * f);
-}
-bool val_is_ground_hilly(double ground_noise1_val, v3s16 p, uint64_t seed)
-{
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
 	if (f < 0.01) {
 		f = 0.1;
-	}else if(f > 1.0) {
-		f = 1.0;
+	}else{
+		switch (type) {
+		case MGT_DEFAULT:
+			if (f >= 1.0)
+				f *= 1.6; // set to = 1.0 for less crazy maps
+			break;
+		case MGT_CRAZY:
+			if (f >= 1.0)
+				f = 6.0;
+			break;
+		case MGT_CRAZYHILLS:
+			if (f > 1.0)
+				f = 6.0;
+			break;
+		default:
+			if (f > 1.0)
+				f = 1.0;
+		}
 	}
-	double h = WATER_LEVEL + 30 * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	return ((double)p.Y - h < ground_noise1_val * f);
-}
-bool val_is_ground_mountains(double ground_noise1_val, v3s16 p, uint64_t seed)
-{
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
-	if (f < 0.01) {
-		f = 0.1;
-	}else if(f > 1.0) {
-		f = 1.0;
+
+	switch (type) {
+	case MGT_FLATTER:
+		height_affect = 1;
+		break;
+	case MGT_HILLY:
+		height_affect = 30;
+		break;
+	case MGT_MOUNTAINS:
+	case MGT_CRAZYHILLS:
+		height_affect = 100;
+		break;
+	default:;
 	}
-	double h = WATER_LEVEL + 100 * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	return ((double)p.Y - h < ground_noise1_val * f);
+
+	factor = f;
+	height = WATER_LEVEL + height_affect * height_noise;
 }
-bool val_is_ground_crazy(double ground_noise1_val, v3s16 p, uint64_t seed)
+
+static void get_ground_column(MapGenType type, uint64_t seed, v2s16 p, double &factor, double &height)
 {
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
-	if (f < 0.01) {
-		f = 0.1;
-	}else if(f >= 1.0) {
-		f = 6.0;
+	double factor_noise = 0;
+	double height_noise = 0;
+	if (type != MGT_FLAT) {
+		factor_noise = noise2d_perlin(
+				0.5+(float)p.X/250, 0.5+(float)p.Y/250,
+				seed+920381, 3, 0.45);
+		height_noise = noise2d_perlin(
+				0.5+(float)p.X/250, 0.5+(float)p.Y/250,
+				seed+84174, 4, 0.5);
 	}
-	double h = WATER_LEVEL + 10 * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	return ((double)p.Y - h < ground_noise1_val * f);
+	get_ground_column_from_noise(type, factor_noise, height_noise, factor, height);
 }
-bool val_is_ground_crazyhills(double ground_noise1_val, v3s16 p, uint64_t seed)
+
+static bool val_is_ground(double ground_noise1_val, s16 y, double factor, double height)
 {
-	double f = 0.55 + noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+920381, 3, 0.45);
-	if (f < 0.01) {
-		f = 0.1;
-	}else if(f > 1.0) {
-		f = 6.0;
-	}
-	double h = WATER_LEVEL + 100 * noise2d_perlin(
-			0.5+(float)p.X/250, 0.5+(float)p.Z/250,
-			seed+84174, 4, 0.5);
-	return ((double)p.Y - h < ground_noise1_val * f);
+	return ((double)y - height < ground_noise1_val * factor);
 }
 
-typedef bool (*val_is_ground_fn)(double,v3s16,uint64_t);
-
-static val_is_ground_fn val_is_ground[8] = {
-	val_is_ground_flat,
-	val_is_ground_flatter,
-	val_is_ground_smoother,
-	val_is_ground_default,
-	val_is_ground_hilly,
-	val_is_ground_mountains,
-	val_is_ground_crazy,
-	val_is_ground_crazyhills
-};
-
 /*
 	Queries whether a position is ground or not.
+	hf may be NULL, it's only used if it contains the position.
 */
-bool is_ground(BlockMakeData *data, v3s16 p)
+static bool is_ground(BlockMakeData *data, const SectorHeightfield *hf, v3s16 p)
 {
+	double factor;
+	double height;
+	if (hf != NULL && hf->contains(p.X, p.Z)) {
+		u32 i = hf->index(p.X, p.Z);
+		factor = hf->ground_factor[i];
+		height = hf->ground_height[i];
+	}else{
+		get_ground_column(data->type, data->seed, v2s16(p.X, p.Z), factor, height);
+	}
 	double val1 = noise3d_param(get_ground_noise1_params(data->seed), p.X,p.Y,p.Z);
-	return val_is_ground[data->type](val1, p, data->seed);
+	return val_is_ground(val1, p.Y, factor, height);
 }
 
 // Amount of trees per area in nodes
@@ -1204,11 +1165,12 @@ double largestone_amount_2d(uint64_t seed, v2s16 p)
 /*
 	Incrementally find ground level from 3d noise
 */
-s16 find_ground_level_from_noise(BlockMakeData *data, v2s16 p2d, s16 precision)
+static s16 find_ground_level(BlockMakeData *data, const SectorHeightfield *hf, v2s16 p2d, s16 precision)
 {
 	// Start a bit fuzzy to make averaging lower precision values
-	// more useful
-	s16 level = myrand_range(-precision/2, precision/2);
+	// more useful, the same for a column so that it's thread safe
+	PseudoRandom levelrandom((int)(data->seed%0x100000000ULL) + p2d.X*23 + p2d.Y*38134234);
+	s16 level = levelrandom.range(-precision/2, precision/2);
 	s16 dec[] = {31000, 100, 20, 4, 1, 0};
 	s16 i;
 	for (i = 1; dec[i] != 0 && precision <= dec[i]; i++) {
@@ -1218,7 +1180,7 @@ s16 find_ground_level_from_noise(BlockMakeData *data, v2s16 p2d, s16 precision)
 			s16 max = level+dec[i-1]*2;
 			v3s16 p(p2d.X, level, p2d.Y);
 			for (; p.Y < max; p.Y += dec[i]) {
-				if (!is_ground(data, p)) {
+				if (!is_ground(data, hf, p)) {
 					level = p.Y;
 					break;
 				}
@@ -1230,7 +1192,7 @@ s16 find_ground_level_from_noise(BlockMakeData *data, v2s16 p2d, s16 precision)
 			s16 min = level-dec[i-1]*2;
 			v3s16 p(p2d.X, level, p2d.Y);
 			for (; p.Y>min; p.Y-=dec[i]) {
-				bool ground = is_ground(data, p);
+				bool ground = is_ground(data, hf, p);
 				/*if(dec[i] == 1 && is_cave(seed, p))
 					ground = false;*/
 				if (ground) {
@@ -1247,69 +1209,188 @@ s16 find_ground_level_from_noise(BlockMakeData *data, v2s16 p2d, s16 precision)
 	return level;
 }
 
-double get_sector_average_ground_level(BlockMakeData *data, v2s16 sectorpos, double p=4);
+s16 find_ground_level_from_noise(BlockMakeData *data, v2s16 p2d, s16 precision)
+{
+	return find_ground_level(data, NULL, p2d, precision);
+}
 
-double get_sector_average_ground_level(BlockMakeData *data, v2s16 sectorpos, double p)
+static double get_sector_average_ground_level(BlockMakeData *data, const SectorHeightfield *hf, v2s16 sectorpos, double p=4)
 {
 	v2s16 node_min = sectorpos*MAP_BLOCKSIZE;
 	v2s16 node_max = (sectorpos+v2s16(1,1))*MAP_BLOCKSIZE-v2s16(1,1);
 	double a = 0;
-	a += find_ground_level_from_noise(data, v2s16(node_min.X, node_min.Y), p);
-	a += find_ground_level_from_noise(data, v2s16(node_min.X, node_max.Y), p);
-	a += find_ground_level_from_noise(data, v2s16(node_max.X, node_max.Y), p);
-	a += find_ground_level_from_noise(data, v2s16(node_max.X, node_min.Y), p);
-	a += find_ground_level_from_noise(data, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y+MAP_BLOCKSIZE/2), p);
+	a += find_ground_level(data, hf, v2s16(node_min.X, node_min.Y), p);
+	a += find_ground_level(data, hf, v2s16(node_min.X, node_max.Y), p);
+	a += find_ground_level(data, hf, v2s16(node_max.X, node_max.Y), p);
+	a += find_ground_level(data, hf, v2s16(node_max.X, node_min.Y), p);
+	a += find_ground_level(data, hf, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y+MAP_BLOCKSIZE/2), p);
 	a /= 5;
 	return a;
 }
 
-double get_sector_maximum_ground_level(BlockMakeData *data, v2s16 sectorpos, double p=4);
-
-double get_sector_maximum_ground_level(BlockMakeData *data, v2s16 sectorpos, double p)
+static double get_sector_maximum_ground_level(BlockMakeData *data, const SectorHeightfield *hf, v2s16 sectorpos, double p=4)
 {
 	v2s16 node_min = sectorpos*MAP_BLOCKSIZE;
 	v2s16 node_max = (sectorpos+v2s16(1,1))*MAP_BLOCKSIZE-v2s16(1,1);
 	double a = -31000;
 	// Corners
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_min.Y), p));
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_max.Y), p));
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_max.X, node_max.Y), p));
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_min.Y), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_min.X, node_min.Y), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_min.X, node_max.Y), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_max.X, node_max.Y), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_min.X, node_min.Y), p));
 	// Center
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y+MAP_BLOCKSIZE/2), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y+MAP_BLOCKSIZE/2), p));
 	// Side middle points
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y), p));
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_max.Y), p));
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_min.Y+MAP_BLOCKSIZE/2), p));
-	a = MYMAX(a, find_ground_level_from_noise(data, v2s16(node_max.X, node_min.Y+MAP_BLOCKSIZE/2), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_max.Y), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_min.X, node_min.Y+MAP_BLOCKSIZE/2), p));
+	a = MYMAX(a, find_ground_level(data, hf, v2s16(node_max.X, node_min.Y+MAP_BLOCKSIZE/2), p));
 	return a;
 }
 
-double get_sector_minimum_ground_level(BlockMakeData *data, v2s16 sectorpos, double p=4);
-
-double get_sector_minimum_ground_level(BlockMakeData *data, v2s16 sectorpos, double p)
+static double get_sector_minimum_ground_level(BlockMakeData *data, const SectorHeightfield *hf, v2s16 sectorpos, double p=4)
 {
 	v2s16 node_min = sectorpos*MAP_BLOCKSIZE;
 	v2s16 node_max = (sectorpos+v2s16(1,1))*MAP_BLOCKSIZE-v2s16(1,1);
 	double a = 31000;
 	// Corners
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_min.Y), p));
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_max.Y), p));
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_max.X, node_max.Y), p));
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_min.Y), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_min.X, node_min.Y), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_min.X, node_max.Y), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_max.X, node_max.Y), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_min.X, node_min.Y), p));
 	// Center
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y+MAP_BLOCKSIZE/2), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y+MAP_BLOCKSIZE/2), p));
 	// Side middle points
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y), p));
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_max.Y), p));
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_min.X, node_min.Y+MAP_BLOCKSIZE/2), p));
-	a = MYMIN(a, find_ground_level_from_noise(data, v2s16(node_max.X, node_min.Y+MAP_BLOCKSIZE/2), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_min.Y), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_min.X+MAP_BLOCKSIZE/2, node_max.Y), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_min.X, node_min.Y+MAP_BLOCKSIZE/2), p));
+	a = MYMIN(a, find_ground_level(data, hf, v2s16(node_max.X, node_min.Y+MAP_BLOCKSIZE/2), p));
 	return a;
 }
 
+bool get_have_sand(uint64_t seed, v2s16 p2d)
+{
+	// Determine whether to have sand here
+	double sandnoise = noise2d_perlin(
+			0.5+(float)p2d.X/500, 0.5+(float)p2d.Y/500,
+			seed+59420, 3, 0.50);
+
+	return (sandnoise > -0.15);
+}
+
+/*
+	Generates the 2d terrain values of a sector
+*/
+static void make_heightfield(BlockMakeData *data, v2s16 sectorpos, SectorHeightfield &hf)
+{
+	hf.sectorpos = sectorpos;
+	v2s16 node_min = sectorpos*MAP_BLOCKSIZE;
+
+	// The 2d noises of all the columns at once
+	double xs[MAP_BLOCKSIZE];
+	double zs[MAP_BLOCKSIZE];
+	double factor_noise[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+	double height_noise[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+	double sand_noise[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+	for (s16 i=0; i<MAP_BLOCKSIZE; i++) {
+		xs[i] = 0.5+(float)(node_min.X+i)/250;
+		zs[i] = 0.5+(float)(node_min.Y+i)/250;
+	}
+	if (data->type != MGT_FLAT) {
+		noise2d_perlin_grid(xs, MAP_BLOCKSIZE, zs, MAP_BLOCKSIZE,
+				data->seed+920381, 3, 0.45, factor_noise);
+		noise2d_perlin_grid(xs, MAP_BLOCKSIZE, zs, MAP_BLOCKSIZE,
+				data->seed+84174, 4, 0.5, height_noise);
+	}
+	for (s16 i=0; i<MAP_BLOCKSIZE; i++) {
+		xs[i] = 0.5+(float)(node_min.X+i)/500;
+		zs[i] = 0.5+(float)(node_min.Y+i)/500;
+	}
+	noise2d_perlin_grid(xs, MAP_BLOCKSIZE, zs, MAP_BLOCKSIZE,
+			data->seed+59420, 3, 0.50, sand_noise);
+
+	for (s16 z=0; z<MAP_BLOCKSIZE; z++)
+	for (s16 x=0; x<MAP_BLOCKSIZE; x++) {
+		u32 i = hf.index(node_min.X+x, node_min.Y+z);
+		get_ground_column_from_noise(data->type, factor_noise[i], height_noise[i],
+				hf.ground_factor[i], hf.ground_height[i]);
+		// Same as get_have_sand()
+		hf.have_sand[i] = (sand_noise[i] > -0.15);
+	}
+
+	v2s16 p2d_center(node_min.X+MAP_BLOCKSIZE/2, node_min.Y+MAP_BLOCKSIZE/2);
+	hf.surface_humidity = surface_humidity_2d(data->seed, p2d_center);
+	hf.tree_amount = tree_amount_2d(data->seed, p2d_center);
+
+	hf.average_ground_level = get_sector_average_ground_level(data, &hf, sectorpos);
+	hf.minimum_ground_level = get_sector_minimum_ground_level(data, &hf, sectorpos);
+	hf.maximum_ground_level = get_sector_maximum_ground_level(data, &hf, sectorpos, 1);
+}
+
+static void get_heightfield(BlockMakeData *data, v2s16 sectorpos, SectorHeightfield &hf)
+{
+	if (data->heightfields != NULL) {
+		data->heightfields->get(data, sectorpos, hf);
+		return;
+	}
+	make_heightfield(data, sectorpos, hf);
+}
+
+HeightfieldCache::HeightfieldCache(u32 max_sectors):
+	m_max_sectors(max_sectors)
+{
+	m_mutex.Init();
+}
+
+HeightfieldCache::~HeightfieldCache()
+{
+	clear();
+}
+
+void HeightfieldCache::get(BlockMakeData *data, v2s16 sectorpos, SectorHeightfield &hf)
+{
+	{
+		JMutexAutoLock lock(m_mutex);
+		std::map<v2s16, SectorHeightfield*>::iterator i = m_sectors.find(sectorpos);
+		if (i != m_sectors.end()) {
+			hf = *i->second;
+			return;
+		}
+	}
+
+	// Another thread may be making the same one, which is harmless
+	make_heightfield(data, sectorpos, hf);
+
+	JMutexAutoLock lock(m_mutex);
+	if (m_sectors.find(sectorpos) != m_sectors.end())
+		return;
+	m_sectors[sectorpos] = new SectorHeightfield(hf);
+	m_order.push_back(sectorpos);
+	while (m_order.size() > m_max_sectors) {
+		std::map<v2s16, SectorHeightfield*>::iterator i = m_sectors.find(m_order.front());
+		if (i != m_sectors.end()) {
+			delete i->second;
+			m_sectors.erase(i);
+		}
+		m_order.pop_front();
+	}
+}
+
+void HeightfieldCache::clear()
+{
+	JMutexAutoLock lock(m_mutex);
+	for (std::map<v2s16, SectorHeightfield*>::iterator i = m_sectors.begin(); i != m_sectors.end(); i++) {
+		delete i->second;
+	}
+	m_sectors.clear();
+	m_order.clear();
+}
+
 bool block_is_underground(BlockMakeData *data, v3s16 blockpos)
 {
-	s16 minimum_groundlevel = (s16)get_sector_minimum_ground_level(data, v2s16(blockpos.X, blockpos.Z));
+	SectorHeightfield hf;
+	get_heightfield(data, v2s16(blockpos.X, blockpos.Z), hf);
+	s16 minimum_groundlevel = (s16)hf.minimum_ground_level;
 
 	if(blockpos.Y*MAP_BLOCKSIZE + MAP_BLOCKSIZE <= minimum_groundlevel)
 		return true;
@@ -1317,14 +1398,16 @@ bool block_is_underground(BlockMakeData *data, v3s16 blockpos)
 		return false;
 }
 
-bool get_have_sand(uint64_t seed, v2s16 p2d)
+/*
+	Ground level of a node column of the block being made, found once
+	and reused by the tree and grass passes.
+*/
+static s16 get_column_ground_level(BlockMakeData *data, const SectorHeightfield &hf, s16 *levels, s16 x, s16 z)
 {
-	// Determine whether to have sand here
-	double sandnoise = noise2d_perlin(
-			0.5+(float)p2d.X/500, 0.5+(float)p2d.Y/500,
-			seed+59420, 3, 0.50);
-
-	return (sandnoise > -0.15);
+	u32 i = hf.index(x, z);
+	if (levels[i] == -32768)
+		levels[i] = find_ground_level(data, &hf, v2s16(x,z), 4);
+	return levels[i];
 }
 
 void make_block(BlockMakeData *data)
@@ -1344,21 +1427,22 @@ void make_block(BlockMakeData *data)
 	// Area of a block
 	double block_area_nodes = MAP_BLOCKSIZE*MAP_BLOCKSIZE;
 
-	v2s16 p2d_center(node_min.X+MAP_BLOCKSIZE/2, node_min.Z+MAP_BLOCKSIZE/2);
-
 	/*
-		Get average ground level from noise
+		Get the 2d terrain of this column, and the ground levels from it
 	*/
 
-	s16 approx_groundlevel = (s16)get_sector_average_ground_level(data, v2s16(blockpos.X, blockpos.Z));
+	SectorHeightfield hf;
+	get_heightfield(data, v2s16(blockpos.X, blockpos.Z), hf);
+
+	s16 approx_groundlevel = (s16)hf.average_ground_level;
 
 	s16 approx_ground_depth = approx_groundlevel - (node_min.Y+MAP_BLOCKSIZE/2);
 
-	s16 minimum_groundlevel = (s16)get_sector_minimum_ground_level(data, v2s16(blockpos.X, blockpos.Z));
+	s16 minimum_groundlevel = (s16)hf.minimum_ground_level;
 	// Minimum amount of ground above the top of the central block
 	s16 minimum_ground_depth = minimum_groundlevel - node_max.Y;
 
-	s16 maximum_groundlevel = (s16)get_sector_maximum_ground_level(data, v2s16(blockpos.X, blockpos.Z), 1);
+	s16 maximum_groundlevel = (s16)hf.maximum_ground_level;
 	// Maximum amount of ground above the bottom of the central block
 	s16 maximum_ground_depth = maximum_groundlevel - node_min.Y;
 
@@ -1448,6 +1532,9 @@ void make_block(BlockMakeData *data)
 		// Node position
 		v2s16 p2d(x,z);
 		{
+			u32 hi = hf.index(x, z);
+			double ground_factor = hf.ground_factor[hi];
+			double ground_height = hf.ground_height[hi];
 			// Use fast index incrementing
 			v3s16 em = vmanip.m_area.getExtent();
 			u32 i = vmanip.m_area.index(v3s16(p2d.X, node_min.Y, p2d.Y));
@@ -1458,7 +1545,7 @@ void make_block(BlockMakeData *data)
 					// This avoids caves inside water.
 					if (
 						all_is_ground_except_caves == false
-						&& val_is_ground[data->type](noisebuf_ground.get(x,y,z), v3s16(x,y,z), data->seed) == false
+						&& val_is_ground(noisebuf_ground.get(x,y,z), y, ground_factor, ground_height) == false
 					) {
 						if (y <= WATER_LEVEL) {
 							vmanip.m_data[i] = MapNode(CONTENT_WATERSOURCE);
@@ -1806,12 +1893,13 @@ void make_block(BlockMakeData *data)
 			Add grass and mud
 		*/
 
+		PseudoRandom surfacerandom(blockseed+1);
 		for (s16 x=node_min.X; x<=node_max.X; x++)
 		for (s16 z=node_min.Z; z<=node_max.Z; z++) {
 			// Node position
 			v2s16 p2d(x,z);
 			{
-				bool possibly_have_sand = get_have_sand(data->seed, p2d);
+				bool possibly_have_sand = hf.have_sand[hf.index(x, z)];
 				bool have_sand = false;
 				u32 current_depth = 0;
 				bool air_detected = false;
@@ -1861,7 +1949,7 @@ void make_block(BlockMakeData *data)
 							}else if (current_depth==0 && !water_detected && y >= WATER_LEVEL && air_detected) {
 								if (y > 50) {
 									vmanip.m_data[i] = MapNode(CONTENT_MUDSNOW);
-								}else if (y > 45 && myrand()%5 == 0) {
+								}else if (y > 45 && surfacerandom.next()%5 == 0) {
 									vmanip.m_data[i] = MapNode(CONTENT_MUDSNOW);
 								}else{
 									vmanip.m_data[i] = MapNode(CONTENT_GRASS);
@@ -1892,10 +1980,15 @@ void make_block(BlockMakeData *data)
 			Calculate some stuff
 		*/
 
-		float surface_humidity = surface_humidity_2d(data->seed, p2d_center);
+		float surface_humidity = hf.surface_humidity;
 		bool is_jungle = surface_humidity > 0.75;
 		// Amount of trees
-		u32 tree_count = block_area_nodes * tree_amount_2d(data->seed, p2d_center);
+		u32 tree_count = block_area_nodes * hf.tree_amount;
+		// Ground levels of the columns, found when first needed
+		s16 ground_levels[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+		for (u32 i=0; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++) {
+			ground_levels[i] = -32768;
+		}
 		if (is_jungle)
 			tree_count *= 5;
 
@@ -1907,7 +2000,7 @@ void make_block(BlockMakeData *data)
 		for (u32 i=0; i<tree_count; i++) {
 			s16 x = treerandom.range(node_min.X, node_max.X);
 			s16 z = treerandom.range(node_min.Z, node_max.Z);
-			s16 y = find_ground_level_from_noise(data, v2s16(x,z), 4);
+			s16 y = get_column_ground_level(data, hf, ground_levels, x, z);
 			// Don't make a tree under water level
 			if (y < WATER_LEVEL)
 				continue;
@@ -1947,7 +2040,7 @@ void make_block(BlockMakeData *data)
 				// Papyrus grows only on mud and in water
 				if (n->getContent() == CONTENT_MUD && y <= WATER_LEVEL) {
 					p.Y++;
-					make_papyrus(vmanip, p);
+					make_papyrus(vmanip, p, treerandom);
 				}
 				// Trees grow only on mud and grass, on land
 				else if ((n->getContent() == CONTENT_MUD || n->getContent() == CONTENT_GRASS) && y > WATER_LEVEL + 2) {
@@ -1955,10 +2048,10 @@ void make_block(BlockMakeData *data)
 					if (is_jungle == false || y > 30) {
 						// connifers
 						if (y > 45) {
-							make_conifertree(vmanip, p);
+							make_conifertree(vmanip, p, treerandom);
 						// regular trees
 						}else{
-							if (myrand_range(0,10) != 0) {
+							if (treerandom.range(0,10) != 0) {
 								if (
 									noise2d_perlin(
 										0.5+(float)p.X/100,
@@ -1968,27 +2061,27 @@ void make_block(BlockMakeData *data)
 										0.45
 									) > 0.2
 								) {
-									make_appletree(vmanip, p);
+									make_appletree(vmanip, p, treerandom);
 								}else{
-									make_tree(vmanip, p);
+									make_tree(vmanip, p, treerandom);
 								}
 							}else{
-								make_largetree(vmanip, p);
+								make_largetree(vmanip, p, treerandom);
 							}
 						}
 					}else{
-						make_jungletree(vmanip, p);
+						make_jungletree(vmanip, p, treerandom);
 					}
 				}
 				// connifers
 				else if (n->getContent() == CONTENT_MUDSNOW) {
 					p.Y++;
-					make_conifertree(vmanip, p);
+					make_conifertree(vmanip, p, treerandom);
 				}
 				// Cactii grow only on sand, on land
 				else if (n->getContent() == CONTENT_SAND && y > WATER_LEVEL + 2) {
 					p.Y++;
-					make_cactus(vmanip, p);
+					make_cactus(vmanip, p, treerandom);
 				}
 			}
 		}
@@ -2001,7 +2094,7 @@ void make_block(BlockMakeData *data)
 			for (u32 i=0; i<surface_humidity*5*tree_count; i++) {
 				s16 x = grassrandom.range(node_min.X, node_max.X);
 				s16 z = grassrandom.range(node_min.Z, node_max.Z);
-				s16 y = find_ground_level_from_noise(data, v2s16(x,z), 4);
+				s16 y = get_column_ground_level(data, hf, ground_levels, x, z);
 				if (y < WATER_LEVEL)
 					continue;
 				if (y < node_min.Y || y > node_max.Y)
@@ -2029,7 +2122,7 @@ void make_block(BlockMakeData *data)
 					continue;
 				if (vmanip.m_area.contains(p)) {
 					if (y > 20 || y < 10) {
-						if (myrand_range(0,20) == 0) {
+						if (grassrandom.range(0,20) == 0) {
 							if (y > 20) {
 								vmanip.m_data[vmanip.m_area.index(p)] = CONTENT_TEA;
 							}else{
@@ -2051,7 +2144,8 @@ BlockMakeData::BlockMakeData():
 	no_op(false),
 	vmanip(NULL),
 	seed(0),
-	type(MGT_DEFAULT)
+	type(MGT_DEFAULT),
+	heightfields(NULL)
 {}
 
 BlockMakeData::~BlockMakeData()
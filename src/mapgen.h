@@ -28,6 +28,10 @@
 
 #include "common_irrlicht.h"
 #include "utility.h" // UniqueQueue
+#include "constants.h" // MAP_BLOCKSIZE
+#include <jmutex.h>
+#include <map>
+#include <list>
 
 class MapBlock;
 class ManualMapVoxelManipulator;
@@ -45,6 +49,67 @@ enum MapGenType {
 
 namespace mapgen
 {
+	/*
+		The 2d terrain values of one sector, which are the same for
+		every block stacked in it.
+	*/
+	struct SectorHeightfield
+	{
+		v2s16 sectorpos;
+		// Ground is where p.Y - ground_height < ground noise * ground_factor
+		double ground_factor[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+		double ground_height[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+		bool have_sand[MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+		// These are sampled at the center of the sector
+		double surface_humidity;
+		double tree_amount;
+		// Approximate ground levels found from the noise
+		double average_ground_level;
+		double minimum_ground_level;
+		double maximum_ground_level;
+
+		// Index of a node column in the arrays
+		u32 index(s16 x, s16 z) const
+		{
+			return (z-sectorpos.Y*MAP_BLOCKSIZE)*MAP_BLOCKSIZE
+					+ (x-sectorpos.X*MAP_BLOCKSIZE);
+		}
+		bool contains(s16 x, s16 z) const
+		{
+			return (
+				x >= sectorpos.X*MAP_BLOCKSIZE
+				&& x < (sectorpos.X+1)*MAP_BLOCKSIZE
+				&& z >= sectorpos.Y*MAP_BLOCKSIZE
+				&& z < (sectorpos.Y+1)*MAP_BLOCKSIZE
+			);
+		}
+	};
+
+	struct BlockMakeData;
+
+	/*
+		Keeps the heightfields of recently generated sectors, so that
+		the blocks of a column don't each redo the 2d noise and the
+		ground level searches. Shared by the emerge threads.
+	*/
+	class HeightfieldCache
+	{
+	public:
+		HeightfieldCache(u32 max_sectors=1024);
+		~HeightfieldCache();
+
+		// Copies the heightfield of a sector to hf, generating it if needed
+		void get(BlockMakeData *data, v2s16 sectorpos, SectorHeightfield &hf);
+		void clear();
+
+	private:
+		std::map<v2s16, SectorHeightfield*> m_sectors;
+		// Insertion order, oldest first
+		std::list<v2s16> m_order;
+		u32 m_max_sectors;
+		JMutex m_mutex;
+	};
+
 	struct BlockMakeData
 	{
 		bool no_op;
@@ -53,6 +118,8 @@ namespace mapgen
 		MapGenType type;
 		v3s16 blockpos;
 		UniqueQueue<v3s16> transforming_liquid;
+		// May be NULL, then heightfields are generated for every block
+		HeightfieldCache *heightfields;
 
 		BlockMakeData();
 		~BlockMakeData();
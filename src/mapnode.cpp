@@ -41,45 +41,59 @@ ContentFeatures::~ContentFeatures()
 	delete initial_metadata;
 }
 
-std::vector<NodeBox> transformNodeBox(MapNode &n,
-		const std::vector<NodeBox> &nodebox)
+/* The rotation of a node's boxes, 0 (none) to 5 */
+static int nodebox_facedir(const ContentFeatures &f, MapNode &n)
 {
-	std::vector<NodeBox> boxes;
 	int facedir = 0;
 	if (
-		content_features(n).param2_type == CPT_FACEDIR_SIMPLE
-		|| content_features(n).param2_type == CPT_FACEDIR_WALLMOUNT
+		f.param2_type == CPT_FACEDIR_SIMPLE
+		|| f.param2_type == CPT_FACEDIR_WALLMOUNT
 	) {
 		facedir = n.param2&0x0F;
 	}else if (
-		content_features(n).param_type == CPT_FACEDIR_SIMPLE
-		|| content_features(n).param_type == CPT_FACEDIR_WALLMOUNT
+		f.param_type == CPT_FACEDIR_SIMPLE
+		|| f.param_type == CPT_FACEDIR_WALLMOUNT
 	) {
 		facedir = n.param1;
 	}
+	if (facedir > 5)
+		return 0;
+	return facedir;
+}
+
+static void rotate_nodebox(aabb3f &box, int facedir)
+{
+	if (facedir == 1) {
+		box.MinEdge.rotateXZBy(-90);
+		box.MaxEdge.rotateXZBy(-90);
+		box.repair();
+	}else if (facedir == 2) {
+		box.MinEdge.rotateXZBy(180);
+		box.MaxEdge.rotateXZBy(180);
+		box.repair();
+	}else if (facedir == 3) {
+		box.MinEdge.rotateXZBy(90);
+		box.MaxEdge.rotateXZBy(90);
+		box.repair();
+	}else if (facedir == 4) {
+		box.MinEdge.rotateXYBy(-90);
+		box.MaxEdge.rotateXYBy(-90);
+		box.repair();
+	}else if (facedir == 5) {
+		box.MinEdge.rotateXYBy(90);
+		box.MaxEdge.rotateXYBy(90);
+		box.repair();
+	}
+}
+
+std::vector<NodeBox> transformNodeBox(MapNode &n,
+		const std::vector<NodeBox> &nodebox)
+{
+	std::vector<NodeBox> boxes;
+	int facedir = nodebox_facedir(content_features(n), n);
 	for(std::vector<NodeBox>::const_iterator i = nodebox.begin(); i != nodebox.end(); i++) {
 		NodeBox box = *i;
-		if (facedir == 1) {
-			box.m_box.MinEdge.rotateXZBy(-90);
-			box.m_box.MaxEdge.rotateXZBy(-90);
-			box.m_box.repair();
-		}else if (facedir == 2) {
-			box.m_box.MinEdge.rotateXZBy(180);
-			box.m_box.MaxEdge.rotateXZBy(180);
-			box.m_box.repair();
-		}else if (facedir == 3) {
-			box.m_box.MinEdge.rotateXZBy(90);
-			box.m_box.MaxEdge.rotateXZBy(90);
-			box.m_box.repair();
-		}else if (facedir == 4) {
-			box.m_box.MinEdge.rotateXYBy(-90);
-			box.m_box.MaxEdge.rotateXYBy(-90);
-			box.m_box.repair();
-		}else if (facedir == 5) {
-			box.m_box.MinEdge.rotateXYBy(90);
-			box.m_box.MaxEdge.rotateXYBy(90);
-			box.m_box.repair();
-		}
+		rotate_nodebox(box.m_box, facedir);
 		boxes.push_back(box);
 	}
 	return boxes;
@@ -90,6 +104,28 @@ std::vector<NodeBox> ContentFeatures::getNodeBoxes(MapNode &n) const
 	return transformNodeBox(n, nodeboxes);
 }
 
+const std::vector<aabb3f> &ContentFeatures::getCollisionBoxes(MapNode &n) const
+{
+	return collision_boxes[nodebox_facedir(*this, n)];
+}
+
+void ContentFeatures::updateCollisionBoxes()
+{
+	for (int facedir=0; facedir<6; facedir++) {
+		collision_boxes[facedir].clear();
+		if (!walkable)
+			continue;
+		for (std::vector<NodeBox>::iterator i = nodeboxes.begin(); i != nodeboxes.end(); i++) {
+			aabb3f box = i->m_box;
+			rotate_nodebox(box, facedir);
+			// Nodes that can't be jumped on are higher than they look
+			if (!jumpable)
+				box.MaxEdge.Y = 1.0*BS;
+			collision_boxes[facedir].push_back(box);
+		}
+	}
+}
+
 std::vector<NodeBox> ContentFeatures::getWieldNodeBoxes() const
 {
 	if (wield_nodeboxes.size() > 0)
@@ -308,6 +344,10 @@ void init_mapnode()
 	content_mapnode_stair(repeat);
 	content_mapnode_slab(repeat);
 	content_mapnode_special(repeat);
+
+	for (u16 i=0; i <= MAX_CONTENT; i++) {
+		g_content_features[i].updateCollisionBoxes();
+	}
 }
 
 v3s16 facedir_rotate(u8 facedir, v3s16 dir)
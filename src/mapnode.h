@@ -311,6 +311,8 @@ struct ContentFeatures
 	std::wstring description;
 	std::vector<NodeBox> nodeboxes;
 	std::vector<NodeBox> wield_nodeboxes;
+	// See getCollisionBoxes()
+	std::vector<aabb3f> collision_boxes[6];
 
 	// positions for text on faces
 	FaceText facetexts[6];
@@ -610,6 +612,15 @@ struct ContentFeatures
 	*/
 	std::vector<NodeBox> getNodeBoxes(MapNode &n) const;
 
+	/*
+		The node boxes as getNodeBoxes() would give them for each
+		rotation, with nodes that can't be jumped on made a node higher.
+		Made by init_mapnode() once all content is set up, so that
+		collision doesn't have to transform them for every node.
+	*/
+	const std::vector<aabb3f> &getCollisionBoxes(MapNode &n) const;
+	void updateCollisionBoxes();
+
 	void setNodeBox(NodeBox nb)
 	{
 		nodeboxes.clear();
@@ -882,7 +893,11 @@ struct MapNode
 	*/
 	u8 param2;
 
-	u32 envticks;
+	/*
+		Keep this small, blocks and voxel manipulators hold thousands
+		of these. Per node counters such as the environment ticks live
+		in a side table in MapBlock.
+	*/
 
 	MapNode(const MapNode & n)
 	{
@@ -894,7 +909,6 @@ struct MapNode
 		content = a_content;
 		param1 = a_param1;
 		param2 = a_param2;
-		envticks = 0;
 	}
 
 	bool operator==(const MapNode &other)
@@ -912,7 +926,6 @@ struct MapNode
 	void setContent(content_t c)
 	{
 		content = c;
-		envticks = 0;
 	}
 
 	u8 getLightBanksWithSource()
@@ -28,6 +28,7 @@
 #include "client.h"
 #include "exceptions.h"
 #include "mapblock.h"
+#include "map.h"
 
 MapSector::MapSector(Map *parent, v2s16 pos):
 		m_parent(parent),
@@ -49,6 +50,7 @@ void MapSector::deleteBlocks()
 	// Delete all
 	core::map<s16, MapBlock*>::Iterator i = m_blocks.getIterator();
 	for (; i.atEnd() == false; i++) {
+		m_parent->unindexBlock(i.getNode()->getValue());
 		delete i.getNode()->getValue();
 	}
 
@@ -97,6 +99,7 @@ MapBlock * MapSector::createBlankBlock(s16 y)
 	MapBlock *block = createBlankBlockNoInsert(y);
 
 	m_blocks.insert(y, block);
+	m_parent->indexBlock(block);
 
 	return block;
 }
@@ -114,6 +117,7 @@ void MapSector::insertBlock(MapBlock *block)
 
 	// Insert into container
 	m_blocks.insert(block_y, block);
+	m_parent->indexBlock(block);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
@@ -125,6 +129,7 @@ void MapSector::deleteBlock(MapBlock *block)
 
 	// Remove from container
 	m_blocks.remove(block_y);
+	m_parent->unindexBlock(block);
 
 	// Delete
 	delete block;
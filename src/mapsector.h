@@ -67,6 +67,11 @@ public:
 
 	void getBlocks(core::list<MapBlock*> &dest);
 
+	u32 getBlockCount()
+	{
+		return m_blocks.size();
+	}
+
 protected:
 
 	// The pile of MapBlocks
@@ -26,6 +26,7 @@
 #include <math.h>
 #include "noise.h"
 #include <iostream>
+#include <vector>
 #include "debug.h"
 
 #define NOISE_MAGIC_X 1619
@@ -79,22 +80,34 @@ double triLinearInterpolation(
 	);
 }
 
-double noise2d(int x, int y, int seed)
+/*
+	Hashes the sum of the magic multiples of a lattice point to a value.
+	This is done unsigned so that the overflows wrap around the same way
+	with every compiler and optimization level (the build uses -fwrapv
+	for the same reason), and so that rows of points can be done in a
+	simple loop.
+*/
+static inline double lattice_value(unsigned int n)
 {
-	int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
+	n &= 0x7fffffff;
 	n = (n>>13)^n;
 	n = (n * (n*n*60493+19990303) + 1376312589) & 0x7fffffff;
 	return 1.0 - (double)n/1073741824;
 }
 
+double noise2d(int x, int y, int seed)
+{
+	return lattice_value(NOISE_MAGIC_X * (unsigned int)x
+			+ NOISE_MAGIC_Y * (unsigned int)y
+			+ NOISE_MAGIC_SEED * (unsigned int)seed);
+}
+
 double noise3d(int x, int y, int z, int seed)
 {
-	int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
-	n = (n>>13)^n;
-	n = (n * (n*n*60493+19990303) + 1376312589) & 0x7fffffff;
-	return 1.0 - (double)n/1073741824;
+	return lattice_value(NOISE_MAGIC_X * (unsigned int)x
+			+ NOISE_MAGIC_Y * (unsigned int)y
+			+ NOISE_MAGIC_Z * (unsigned int)z
+			+ NOISE_MAGIC_SEED * (unsigned int)seed);
 }
 
 #if 0
@@ -271,6 +284,268 @@ double noise3d_param(const NoiseParams &param, double x, double y, double z)
 	else assert(0);
 }
 
+/*
+	Grid noise
+*/
+
+/*
+	Lattice cells and the positions within them of the points along
+	one axis of a grid, for one octave.
+*/
+struct NoiseAxis
+{
+	std::vector<int> cell;
+	std::vector<double> frac;
+	int min;
+	int max;
+
+	void set(const double *v, int size, double f)
+	{
+		cell.resize(size);
+		frac.resize(size);
+		min = 0;
+		max = 0;
+		for (int i=0; i<size; i++) {
+			double x = v[i]*f;
+			int x0 = (x > 0.0 ? (int)x : (int)x - 1);
+			cell[i] = x0;
+			frac[i] = x - (double)x0;
+			if (i == 0 || x0 < min)
+				min = x0;
+			if (i == 0 || x0 > max)
+				max = x0;
+		}
+	}
+	// Amount of lattice points covering the axis
+	int latticeSize()
+	{
+		return max-min+2;
+	}
+};
+
+void noise2d_perlin_grid(const double *xs, int size_x,
+		const double *ys, int size_y,
+		int seed, int octaves, double persistence, double *result)
+{
+	int count = size_x*size_y;
+	for (int i=0; i<count; i++) {
+		result[i] = 0;
+	}
+	if (count == 0)
+		return;
+
+	NoiseAxis ax;
+	NoiseAxis ay;
+	std::vector<double> lattice;
+	double f = 1.0;
+	double g = 1.0;
+	for (int oct=0; oct<octaves; oct++) {
+		ax.set(xs, size_x, f);
+		ay.set(ys, size_y, f);
+		int lx = ax.latticeSize();
+		int ly = ay.latticeSize();
+
+		if ((double)lx*ly <= (double)count*4+64) {
+			// Hash each lattice point once, a row at a time
+			unsigned int s = NOISE_MAGIC_SEED*(unsigned int)(seed+oct);
+			lattice.resize(lx*ly);
+			for (int y=0; y<ly; y++) {
+				unsigned int row = NOISE_MAGIC_Y*(unsigned int)(ay.min+y) + s;
+				double *l = &lattice[y*lx];
+				for (int x=0; x<lx; x++) {
+					l[x] = lattice_value(NOISE_MAGIC_X*(unsigned int)(ax.min+x) + row);
+				}
+			}
+			for (int y=0; y<size_y; y++) {
+				const double *l0 = &lattice[(ay.cell[y]-ay.min)*lx];
+				const double *l1 = l0+lx;
+				double *r = &result[y*size_x];
+				for (int x=0; x<size_x; x++) {
+					int i = ax.cell[x]-ax.min;
+					r[x] += g * biLinearInterpolation(
+							l0[i], l0[i+1], l1[i], l1[i+1],
+							ax.frac[x], ay.frac[y]);
+				}
+			}
+		}else{
+			// The points are sparser than the lattice
+			for (int y=0; y<size_y; y++) {
+				int y0 = ay.cell[y];
+				double *r = &result[y*size_x];
+				for (int x=0; x<size_x; x++) {
+					int x0 = ax.cell[x];
+					r[x] += g * biLinearInterpolation(
+							noise2d(x0, y0, seed+oct),
+							noise2d(x0+1, y0, seed+oct),
+							noise2d(x0, y0+1, seed+oct),
+							noise2d(x0+1, y0+1, seed+oct),
+							ax.frac[x], ay.frac[y]);
+				}
+			}
+		}
+
+		f *= 2.0;
+		g *= persistence;
+	}
+}
+
+/*
+	noise3d_perlin() or noise3d_perlin_abs() over a grid. Values are
+	stored at result[ix*stride_x+iy*stride_y+iz*stride_z].
+*/
+static void noise3d_perlin_grid(const double *xs, int size_x,
+		const double *ys, int size_y,
+		const double *zs, int size_z,
+		int stride_x, int stride_y, int stride_z,
+		int seed, int octaves, double persistence, bool abs,
+		double *result)
+{
+	int count = size_x*size_y*size_z;
+	for (int i=0; i<count; i++) {
+		result[i] = 0;
+	}
+	if (count == 0)
+		return;
+
+	NoiseAxis ax;
+	NoiseAxis ay;
+	NoiseAxis az;
+	std::vector<double> lattice;
+	double f = 1.0;
+	double g = 1.0;
+	for (int oct=0; oct<octaves; oct++) {
+		ax.set(xs, size_x, f);
+		ay.set(ys, size_y, f);
+		az.set(zs, size_z, f);
+		int lx = ax.latticeSize();
+		int ly = ay.latticeSize();
+		int lz = az.latticeSize();
+		bool use_lattice = ((double)lx*ly*lz <= (double)count*4+64);
+		if (use_lattice) {
+			// Hash each lattice point once, a row at a time
+			unsigned int s = NOISE_MAGIC_SEED*(unsigned int)(seed+oct);
+			lattice.resize(lx*ly*lz);
+			for (int z=0; z<lz; z++)
+			for (int y=0; y<ly; y++) {
+				unsigned int row = NOISE_MAGIC_Y*(unsigned int)(ay.min+y)
+						+ NOISE_MAGIC_Z*(unsigned int)(az.min+z) + s;
+				double *l = &lattice[(z*ly+y)*lx];
+				for (int x=0; x<lx; x++) {
+					l[x] = lattice_value(NOISE_MAGIC_X*(unsigned int)(ax.min+x) + row);
+				}
+			}
+		}
+
+		for (int z=0; z<size_z; z++)
+		for (int y=0; y<size_y; y++) {
+			double *r = &result[y*stride_y+z*stride_z];
+			double yl = ay.frac[y];
+			double zl = az.frac[z];
+			if (use_lattice) {
+				const double *l00 = &lattice[((az.cell[z]-az.min)*ly + ay.cell[y]-ay.min)*lx];
+				const double *l10 = l00+lx;
+				const double *l01 = l00+lx*ly;
+				const double *l11 = l01+lx;
+				for (int x=0; x<size_x; x++) {
+					int i = ax.cell[x]-ax.min;
+					double v = triLinearInterpolation(
+							l00[i], l00[i+1], l10[i], l10[i+1],
+							l01[i], l01[i+1], l11[i], l11[i+1],
+							ax.frac[x], yl, zl);
+					if (abs)
+						v = fabs(v);
+					r[x*stride_x] += g * v;
+				}
+			}else{
+				// The points are sparser than the lattice
+				int y0 = ay.cell[y];
+				int z0 = az.cell[z];
+				for (int x=0; x<size_x; x++) {
+					int x0 = ax.cell[x];
+					double v = triLinearInterpolation(
+							noise3d(x0, y0, z0, seed+oct),
+							noise3d(x0+1, y0, z0, seed+oct),
+							noise3d(x0, y0+1, z0, seed+oct),
+							noise3d(x0+1, y0+1, z0, seed+oct),
+							noise3d(x0, y0, z0+1, seed+oct),
+							noise3d(x0+1, y0, z0+1, seed+oct),
+							noise3d(x0, y0+1, z0+1, seed+oct),
+							noise3d(x0+1, y0+1, z0+1, seed+oct),
+							ax.frac[x], yl, zl);
+					if (abs)
+						v = fabs(v);
+					r[x*stride_x] += g * v;
+				}
+			}
+		}
+
+		f *= 2.0;
+		g *= persistence;
+	}
+}
+
+void noise3d_param_grid(const NoiseParams &param,
+		const double *xs, int size_x,
+		const double *ys, int size_y,
+		const double *zs, int size_z, double *result)
+{
+	int count = size_x*size_y*size_z;
+
+	if (param.type == NOISE_CONSTANT_ONE) {
+		for (int i=0; i<count; i++) {
+			result[i] = 1.0;
+		}
+		return;
+	}
+
+	if (count == 0)
+		return;
+
+	double s = param.pos_scale;
+	std::vector<double> x(xs, xs+size_x);
+	std::vector<double> y(ys, ys+size_y);
+	std::vector<double> z(zs, zs+size_z);
+	for (int i=0; i<size_x; i++) {
+		x[i] /= s;
+	}
+	for (int i=0; i<size_y; i++) {
+		y[i] /= s;
+	}
+	for (int i=0; i<size_z; i++) {
+		z[i] /= s;
+	}
+
+	if (param.type == NOISE_PERLIN_CONTOUR_FLIP_YZ) {
+		// The noise is sampled with y and z swapped
+		noise3d_perlin_grid(&x[0], size_x, &z[0], size_z, &y[0], size_y,
+				1, size_x*size_y, size_x,
+				param.seed, param.octaves, param.persistence, false,
+				result);
+	}else if (
+		param.type == NOISE_PERLIN
+		|| param.type == NOISE_PERLIN_ABS
+		|| param.type == NOISE_PERLIN_CONTOUR
+	) {
+		noise3d_perlin_grid(&x[0], size_x, &y[0], size_y, &z[0], size_z,
+				1, size_x, size_x*size_y,
+				param.seed, param.octaves, param.persistence,
+				param.type == NOISE_PERLIN_ABS,
+				result);
+	}else{
+		assert(0);
+	}
+
+	if (param.type == NOISE_PERLIN_CONTOUR || param.type == NOISE_PERLIN_CONTOUR_FLIP_YZ) {
+		for (int i=0; i<count; i++) {
+			result[i] = contour(param.noise_scale*result[i]);
+		}
+	}else{
+		for (int i=0; i<count; i++) {
+			result[i] = param.noise_scale*result[i];
+		}
+	}
+}
+
 /*
 	NoiseBuffer
 */
@@ -315,32 +590,35 @@ void NoiseBuffer::create(const NoiseParams &param,
 
 	m_data = new double[m_size_x*m_size_y*m_size_z];
 
-	for(int x=0; x<m_size_x; x++)
-	for(int y=0; y<m_size_y; y++)
-	for(int z=0; z<m_size_z; z++)
-	{
-		double xd = (m_start_x + (double)x*m_samplelength_x);
-		double yd = (m_start_y + (double)y*m_samplelength_y);
-		double zd = (m_start_z + (double)z*m_samplelength_z);
-		double a = noise3d_param(param, xd,yd,zd);
-		intSet(x,y,z, a);
-	}
+	fillGrid(param, m_data);
 }
 
 void NoiseBuffer::multiply(const NoiseParams &param)
 {
 	assert(m_data != NULL);
 
+	int count = m_size_x*m_size_y*m_size_z;
+	double *a = new double[count];
+	fillGrid(param, a);
+	for(int i=0; i<count; i++)
+		m_data[i] = m_data[i] * a[i];
+	delete[] a;
+}
+
+void NoiseBuffer::fillGrid(const NoiseParams &param, double *result)
+{
+	std::vector<double> xs(m_size_x);
+	std::vector<double> ys(m_size_y);
+	std::vector<double> zs(m_size_z);
 	for(int x=0; x<m_size_x; x++)
+		xs[x] = (m_start_x + (double)x*m_samplelength_x);
 	for(int y=0; y<m_size_y; y++)
+		ys[y] = (m_start_y + (double)y*m_samplelength_y);
 	for(int z=0; z<m_size_z; z++)
-	{
-		double xd = (m_start_x + (double)x*m_samplelength_x);
-		double yd = (m_start_y + (double)y*m_samplelength_y);
-		double zd = (m_start_z + (double)z*m_samplelength_z);
-		double a = noise3d_param(param, xd,yd,zd);
-		intMultiply(x,y,z, a);
-	}
+		zs[z] = (m_start_z + (double)z*m_samplelength_z);
+
+	noise3d_param_grid(param, &xs[0], m_size_x, &ys[0], m_size_y,
+			&zs[0], m_size_z, result);
 }
 
 // Deprecated
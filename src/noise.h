@@ -121,6 +121,24 @@ struct NoiseParams
 
 double noise3d_param(const NoiseParams &param, double x, double y, double z);
 
+/*
+	Grid versions of the noise functions, which evaluate a whole grid of
+	points at once and share the lattice values between neighbouring
+	points. They give exactly the same values as the single point
+	functions.
+
+	The points are (xs[ix], ys[iy]) and (xs[ix], ys[iy], zs[iz]), stored
+	at result[iy*size_x+ix] and result[(iz*size_y+iy)*size_x+ix].
+*/
+void noise2d_perlin_grid(const double *xs, int size_x,
+		const double *ys, int size_y,
+		int seed, int octaves, double persistence, double *result);
+
+void noise3d_param_grid(const NoiseParams &param,
+		const double *xs, int size_x,
+		const double *ys, int size_y,
+		const double *zs, int size_z, double *result);
+
 class NoiseBuffer
 {
 public:
@@ -147,6 +165,9 @@ public:
 	//bool contains(double x, double y, double z);
 
 private:
+	// Fills result with the noise at each point of the buffer
+	void fillGrid(const NoiseParams &param, double *result);
+
 	double *m_data;
 	double m_start_x, m_start_y, m_start_z;
 	double m_samplelength_x, m_samplelength_y, m_samplelength_z;
@@ -0,0 +1,396 @@
+/************************************************************************
+* pathfinder.cpp
+* voxelands - 3d voxel world sandbox game
+* Copyright (C) Lisa 'darkrose' Milne 2015 <lisa@ltmnet.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*
+* License updated from GPLv2 or later to GPLv3 or later by Lisa Milne
+* for Voxelands.
+************************************************************************/
+
+#include "pathfinder.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapnode.h"
+#include "content_mapnode.h"
+#include "settings.h"
+#include "profiler.h"
+#include "main.h"
+#include <algorithm>
+
+/*
+	The steps a walking mob can take: along an axis, possibly up or down
+	a node, or diagonally on the level
+*/
+static const v3s16 path_moves[16] = {
+	v3s16(1,0,0), v3s16(-1,0,0), v3s16(0,0,1), v3s16(0,0,-1),
+	v3s16(1,1,0), v3s16(-1,1,0), v3s16(0,1,1), v3s16(0,1,-1),
+	v3s16(1,-1,0), v3s16(-1,-1,0), v3s16(0,-1,1), v3s16(0,-1,-1),
+	v3s16(1,0,1), v3s16(1,0,-1), v3s16(-1,0,1), v3s16(-1,0,-1)
+};
+static const s32 path_move_costs[16] = {
+	10, 10, 10, 10,
+	15, 15, 15, 15,
+	15, 15, 15, 15,
+	14, 14, 14, 14
+};
+
+/* Never more than the cost of getting from a to b with the steps above */
+static s32 path_estimate(v3s16 a, v3s16 b)
+{
+	s32 dx = abs(a.X-b.X);
+	s32 dy = abs(a.Y-b.Y);
+	s32 dz = abs(a.Z-b.Z);
+	return 10*MYMAX(dx,dz) + 4*MYMIN(dx,dz) + 5*dy;
+}
+
+static u8 path_node_flags(content_t c)
+{
+	ContentFeatures &f = content_features(c);
+	u8 flags = 0;
+	if ((c == CONTENT_AIR || !f.walkable) && f.liquid_type != LIQUID_SOURCE)
+		flags |= PF_OPEN;
+	if (c == CONTENT_WATERSOURCE)
+		flags |= PF_WATER;
+	if (f.jumpable)
+		flags |= PF_JUMPABLE;
+	if (c != CONTENT_AIR && f.liquid_type == LIQUID_NONE && f.walkable)
+		flags |= PF_FLOOR;
+	return flags;
+}
+
+PathFinder::PathFinder(Map *map):
+	m_map(map),
+	m_last_blockpos(0,0,0),
+	m_last_block(NULL),
+	m_ignore_flags(0),
+	m_step(0),
+	m_cleanup_timer(0),
+	m_last_request(0)
+{
+}
+
+PathFinder::~PathFinder()
+{
+	for (std::map<v3s16, PathBlock*>::iterator i = m_blocks.begin(); i != m_blocks.end(); i++) {
+		delete i->second;
+	}
+}
+
+void PathFinder::step(float dtime)
+{
+	// Cached blocks are checked against the map again this step
+	m_step++;
+	m_last_block = NULL;
+	m_ignore_flags = path_node_flags(CONTENT_IGNORE);
+
+	m_cleanup_timer += dtime;
+	if (m_cleanup_timer > 5.0) {
+		for (std::map<v3s16, PathBlock*>::iterator i = m_blocks.begin(); i != m_blocks.end(); ) {
+			PathBlock *b = i->second;
+			b->unused_time += m_cleanup_timer;
+			if (b->unused_time < 10.0) {
+				i++;
+				continue;
+			}
+			delete b;
+			m_blocks.erase(i++);
+		}
+		for (std::map<u16, PathRequest>::iterator i = m_requests.begin(); i != m_requests.end(); ) {
+			i->second.unused_time += m_cleanup_timer;
+			if (i->second.unused_time < 10.0) {
+				i++;
+				continue;
+			}
+			m_requests.erase(i++);
+		}
+		m_cleanup_timer = 0;
+	}
+
+	if (m_requests.size() == 0)
+		return;
+
+	/*
+		Run searches until the budget is used up, starting after the
+		one that was run last
+	*/
+	static SettingHandle<s32> budget_h(g_settings, "mob_pathfind_budget");
+	s32 budget = budget_h.get();
+	s32 searched = 0;
+	std::map<u16, PathRequest>::iterator i = m_requests.upper_bound(m_last_request);
+	for (u32 n=0; n<m_requests.size() && searched < budget; n++, i++) {
+		if (i == m_requests.end())
+			i = m_requests.begin();
+		PathRequest &r = i->second;
+		m_last_request = i->first;
+		while (!r.done && searched < budget) {
+			searched++;
+			if (!expandSearch(r))
+				break;
+		}
+	}
+	static u32 prof_searched = g_profiler->getId("SEnv: path nodes searched");
+	g_profiler->avg(prof_searched, searched);
+}
+
+u8 PathFinder::getFlags(v3s16 p)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	PathBlock *b = getBlock(blockpos);
+	if (b == NULL)
+		return m_ignore_flags;
+	v3s16 rp = p - blockpos*MAP_BLOCKSIZE;
+	return b->flags[rp.Z*MAP_BLOCKSIZE*MAP_BLOCKSIZE + rp.Y*MAP_BLOCKSIZE + rp.X];
+}
+
+bool PathFinder::isFree(v3s16 p, v3s16 size, bool swim)
+{
+	u8 need = swim ? PF_WATER : PF_OPEN;
+	for (s16 dx=0; dx<size.X; dx++)
+	for (s16 dy=0; dy<size.Y; dy++)
+	for (s16 dz=0; dz<size.Z; dz++) {
+		if ((getFlags(p+v3s16(dx,dy,dz))&need) == 0)
+			return false;
+	}
+	return (getFlags(p+v3s16(0,-1,0))&PF_JUMPABLE) != 0;
+}
+
+bool PathFinder::getNextStep(u16 id, v3s16 start, v3s16 goal, v3s16 size, v3s16 &next)
+{
+	std::map<u16, PathRequest>::iterator i = m_requests.find(id);
+	if (i == m_requests.end()) {
+		startSearch(m_requests[id], start, goal, size);
+		return false;
+	}
+	PathRequest &r = i->second;
+	r.unused_time = 0;
+
+	bool goal_moved = (
+		abs(goal.X-r.goal.X) > PATH_GOAL_SLACK
+		|| abs(goal.Y-r.goal.Y) > PATH_GOAL_SLACK
+		|| abs(goal.Z-r.goal.Z) > PATH_GOAL_SLACK
+		|| size != r.size
+	);
+	if (!r.done) {
+		if (goal_moved)
+			startSearch(r, start, goal, size);
+		return false;
+	}
+
+	// Find where along the path the mob is
+	if (r.path_i >= r.path.size() || r.path[r.path_i] != start) {
+		for (r.path_i=0; r.path_i<r.path.size(); r.path_i++) {
+			if (r.path[r.path_i] == start)
+				break;
+		}
+	}
+	if (goal_moved || r.path_i >= r.path.size()) {
+		startSearch(r, start, goal, size);
+		return false;
+	}
+	// At the end of the path
+	if (r.path_i+1 >= r.path.size())
+		return false;
+
+	next = r.path[r.path_i+1];
+	// Something has been built in the way
+	if (!isPassable(next, size)) {
+		startSearch(r, start, goal, size);
+		return false;
+	}
+	return true;
+}
+
+PathFinder::PathBlock *PathFinder::getBlock(v3s16 blockpos)
+{
+	if (m_last_block != NULL && blockpos == m_last_blockpos)
+		return m_last_block;
+
+	PathBlock *b = NULL;
+	std::map<v3s16, PathBlock*>::iterator i = m_blocks.find(blockpos);
+	if (i != m_blocks.end())
+		b = i->second;
+
+	if (b == NULL || b->checked_step != m_step) {
+		MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+		if (block == NULL || block->isDummy()) {
+			if (b != NULL) {
+				delete b;
+				m_blocks.erase(i);
+			}
+			return NULL;
+		}
+		if (b == NULL) {
+			b = new PathBlock;
+			b->block = NULL;
+			m_blocks[blockpos] = b;
+		}
+		if (b->block != block || b->version != block->getContentVersion())
+			fillBlock(b, block);
+		b->checked_step = m_step;
+	}
+
+	b->unused_time = 0;
+	m_last_blockpos = blockpos;
+	m_last_block = b;
+	return b;
+}
+
+void PathFinder::fillBlock(PathBlock *b, MapBlock *block)
+{
+	// The flags of the previous node, as neighbours are mostly the same
+	content_t last_c = CONTENT_IGNORE;
+	u8 last_flags = m_ignore_flags;
+	u32 i = 0;
+	bool valid;
+	for (s16 z=0; z<MAP_BLOCKSIZE; z++)
+	for (s16 y=0; y<MAP_BLOCKSIZE; y++)
+	for (s16 x=0; x<MAP_BLOCKSIZE; x++) {
+		content_t c = block->getNodeNoCheck(x,y,z,&valid).getContent();
+		if (c != last_c) {
+			last_c = c;
+			last_flags = path_node_flags(c);
+		}
+		b->flags[i++] = last_flags;
+	}
+	b->block = block;
+	b->version = block->getContentVersion();
+}
+
+void PathFinder::startSearch(PathRequest &r, v3s16 start, v3s16 goal, v3s16 size)
+{
+	r.start = start;
+	r.goal = goal;
+	r.size = size;
+	r.unused_time = 0;
+	r.done = false;
+	r.nodes.clear();
+	r.index.clear();
+	r.open = std::priority_queue<std::pair<s32, s32> >();
+	r.path.clear();
+	r.path_i = 0;
+
+	SearchNode n;
+	n.pos = start;
+	n.g = 0;
+	n.parent = -1;
+	n.closed = false;
+	r.nodes.push_back(n);
+	r.index[start] = 0;
+	r.best = 0;
+	r.best_h = path_estimate(start, goal);
+	r.open.push(std::make_pair(-r.best_h, 0));
+}
+
+bool PathFinder::expandSearch(PathRequest &r)
+{
+	// Skip nodes that were queued again with a lower cost and done since
+	while (!r.open.empty() && r.nodes[r.open.top().second].closed) {
+		r.open.pop();
+	}
+	if (r.open.empty()) {
+		finishSearch(r, r.best);
+		return false;
+	}
+
+	s32 ci = r.open.top().second;
+	r.open.pop();
+	r.nodes[ci].closed = true;
+	v3s16 pos = r.nodes[ci].pos;
+	s32 g = r.nodes[ci].g;
+
+	s32 h = path_estimate(pos, r.goal);
+	if (h < r.best_h) {
+		r.best = ci;
+		r.best_h = h;
+	}
+	// Next to the goal is close enough, it's usually a player
+	v3s16 d = r.goal - pos;
+	if (abs(d.X) <= 1 && abs(d.Y) <= 1 && abs(d.Z) <= 1) {
+		finishSearch(r, ci);
+		return false;
+	}
+	// Gone too far, go as near as was found
+	if (r.nodes.size() >= PATH_MAX_NODES) {
+		finishSearch(r, r.best);
+		return false;
+	}
+
+	for (u32 k=0; k<16; k++) {
+		v3s16 move = path_moves[k];
+		v3s16 np = pos + move;
+		if (
+			abs(np.X-r.start.X) > PATH_MAX_DISTANCE
+			|| abs(np.Y-r.start.Y) > PATH_MAX_DISTANCE
+			|| abs(np.Z-r.start.Z) > PATH_MAX_DISTANCE
+		)
+			continue;
+		s32 ng = g + path_move_costs[k];
+		s32 ni;
+		std::map<v3s16, s32>::iterator it = r.index.find(np);
+		if (it == r.index.end()) {
+			bool passable = isPassable(np, r.size);
+			// Don't cut corners
+			if (passable && move.X != 0 && move.Z != 0) {
+				passable = isPassable(pos+v3s16(move.X,0,0), r.size)
+						&& isPassable(pos+v3s16(0,0,move.Z), r.size);
+			}
+			if (!passable) {
+				r.index[np] = -1;
+				continue;
+			}
+			SearchNode n;
+			n.pos = np;
+			n.g = ng;
+			n.parent = ci;
+			n.closed = false;
+			r.nodes.push_back(n);
+			ni = r.nodes.size()-1;
+			r.index[np] = ni;
+		}else{
+			ni = it->second;
+			if (ni < 0 || r.nodes[ni].closed || ng >= r.nodes[ni].g)
+				continue;
+			r.nodes[ni].g = ng;
+			r.nodes[ni].parent = ci;
+		}
+		r.open.push(std::make_pair(-(ng + path_estimate(np, r.goal)), ni));
+	}
+	return true;
+}
+
+void PathFinder::finishSearch(PathRequest &r, s32 last)
+{
+	r.path.clear();
+	for (s32 i=last; i>=0; i=r.nodes[i].parent) {
+		r.path.push_back(r.nodes[i].pos);
+	}
+	std::reverse(r.path.begin(), r.path.end());
+	r.path_i = 0;
+	r.done = true;
+
+	// Let go of the search state
+	r.nodes.clear();
+	r.index.clear();
+	r.open = std::priority_queue<std::pair<s32, s32> >();
+
+	static u32 prof_searches = g_profiler->getId("SEnv: path searches done");
+	g_profiler->add(prof_searches, 1);
+}
+
+bool PathFinder::isPassable(v3s16 p, v3s16 size)
+{
+	return isFree(p, size, false) && isWalkable(p);
+}
@@ -0,0 +1,157 @@
+/************************************************************************
+* pathfinder.h
+* voxelands - 3d voxel world sandbox game
+* Copyright (C) Lisa 'darkrose' Milne 2015 <lisa@ltmnet.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*
+* License updated from GPLv2 or later to GPLv3 or later by Lisa Milne
+* for Voxelands.
+************************************************************************/
+
+#ifndef PATHFINDER_HEADER
+#define PATHFINDER_HEADER
+
+#include "common_irrlicht.h"
+#include "constants.h"
+#include <map>
+#include <queue>
+#include <vector>
+
+class Map;
+class MapBlock;
+
+/*
+	Flags of a node for mob movement
+*/
+// nothing solid or liquid source in it, mobs can be in it
+#define PF_OPEN 0x01
+// water source, swimming mobs can be in it
+#define PF_WATER 0x02
+// mobs can jump off it
+#define PF_JUMPABLE 0x04
+// solid ground, mobs can stand on it
+#define PF_FLOOR 0x08
+
+// The most nodes a single search looks at
+#define PATH_MAX_NODES 600
+// How far from its start a search goes, in nodes along any axis
+#define PATH_MAX_DISTANCE 24
+// How far the goal can move before a path is searched again
+#define PATH_GOAL_SLACK 2
+
+/*
+	Path finding for mobs.
+
+	Keeps the movement flags of the nodes of the blocks mobs look at, so
+	that checking a position doesn't go through the map every time. A
+	cached block is updated when its content version changes, at most
+	once per step.
+
+	Searches are bounded A* over the positions a walking mob can step
+	to. A mob asks for its next step with getNextStep(), which starts a
+	search if there's no usable path yet. The searches are run by step()
+	a little at a time, so that however many mobs are searching, only
+	mob_pathfind_budget nodes are looked at per step.
+*/
+class PathFinder
+{
+public:
+	PathFinder(Map *map);
+	~PathFinder();
+
+	void step(float dtime);
+
+	u8 getFlags(v3s16 p);
+	// Whether a mob of size can be at p, as MobSAO::checkFreePosition()
+	bool isFree(v3s16 p, v3s16 size, bool swim);
+	// Whether there's ground to stand on at p
+	bool isWalkable(v3s16 p)
+	{
+		return (getFlags(p+v3s16(0,-1,0))&PF_FLOOR) != 0;
+	}
+
+	/*
+		Sets next to the position a walking mob at start should go to
+		next on the way to goal. Returns false if there's no path yet,
+		the mob should then move some other way for now.
+	*/
+	bool getNextStep(u16 id, v3s16 start, v3s16 goal, v3s16 size, v3s16 &next);
+
+private:
+	struct PathBlock
+	{
+		u8 flags[MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE];
+		// What the flags were made from, only compared, never used
+		MapBlock *block;
+		u32 version;
+		u32 checked_step;
+		float unused_time;
+	};
+
+	struct SearchNode
+	{
+		v3s16 pos;
+		s32 g;
+		s32 parent;
+		bool closed;
+	};
+
+	struct PathRequest
+	{
+		v3s16 start;
+		v3s16 goal;
+		v3s16 size;
+		float unused_time;
+		bool done;
+
+		// Search state
+		std::vector<SearchNode> nodes;
+		// Index into nodes of each position seen, -1 if not passable
+		std::map<v3s16, s32> index;
+		// Open nodes by negated estimated cost
+		std::priority_queue<std::pair<s32, s32> > open;
+		s32 best;
+		s32 best_h;
+
+		// The found path, from start, and where along it the mob is
+		std::vector<v3s16> path;
+		u32 path_i;
+	};
+
+	PathBlock *getBlock(v3s16 blockpos);
+	void fillBlock(PathBlock *b, MapBlock *block);
+
+	void startSearch(PathRequest &r, v3s16 start, v3s16 goal, v3s16 size);
+	// Looks at the next open node, returns false when the search is over
+	bool expandSearch(PathRequest &r);
+	void finishSearch(PathRequest &r, s32 last);
+	bool isPassable(v3s16 p, v3s16 size);
+
+	Map *m_map;
+	std::map<v3s16, PathBlock*> m_blocks;
+	// The last block looked up, most lookups are in the same block
+	v3s16 m_last_blockpos;
+	PathBlock *m_last_block;
+	// Flags of nodes that aren't loaded
+	u8 m_ignore_flags;
+	u32 m_step;
+	float m_cleanup_timer;
+
+	std::map<u16, PathRequest> m_requests;
+	// The request searched last, so each gets its turn
+	u16 m_last_request;
+};
+
+#endif
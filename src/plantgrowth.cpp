@@ -566,7 +566,7 @@ void plantgrowth_cactus(ServerEnvironment *env, v3s16 p0)
 		MapNode nn = env->getMap().getNodeNoEx(p0+v3s16(0,height,0));
 		if (nn.getContent() == CONTENT_AIR) {
 			break;
-		}else if (nn.getContent() != CONTENT_CACTUS || nn.envticks < 5) {
+		}else if (nn.getContent() != CONTENT_CACTUS || env->getMap().getNodeTicks(p0+v3s16(0,height,0)) < 5) {
 			return;
 		}
 	}
@@ -102,6 +102,14 @@ void initializePaths(char* argv0);
 	{
 		return GetTickCount();
 	}
+	// Microseconds, for timing short operations
+	inline u64 getTimeUs()
+	{
+		LARGE_INTEGER freq, t;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&t);
+		return (u64)(t.QuadPart/(freq.QuadPart/1000000.0));
+	}
 #else // Posix
 	#include <sys/time.h>
 	inline u32 getTimeMs()
@@ -110,6 +118,13 @@ void initializePaths(char* argv0);
 		gettimeofday(&tv, NULL);
 		return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 	}
+	// Microseconds, for timing short operations
+	inline u64 getTimeUs()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+	}
 	/*#include <sys/timeb.h>
 	inline u32 getTimeMs()
 	{
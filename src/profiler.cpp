@@ -0,0 +1,348 @@
+/************************************************************************
+* Minetest-c55
+* Copyright (C) 2011 celeron55, Perttu Ahola <celeron55@gmail.com>
+*
+* profiler.cpp
+* voxelands - 3d voxel world sandbox game
+* Copyright (C) Lisa 'darkrose' Milne 2014 <lisa@ltmnet.com>
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*
+* License updated from GPLv2 or later to GPLv3 or later by Lisa Milne
+* for Voxelands.
+************************************************************************/
+
+#include "profiler.h"
+#include "threads.h"
+#include <time.h>
+
+// The bucket of a duration, see PROFILER_BUCKETS
+static u32 bucket_of(u32 us)
+{
+	if (us < 16)
+		return us;
+	u32 e = 4;
+	while (e < 31 && (us>>(e+1)) != 0)
+		e++;
+	return 16 + (e-4)*4 + ((us>>(e-2))&3);
+}
+
+// The lowest duration in a bucket
+static u32 bucket_start(u32 b)
+{
+	if (b < 16)
+		return b;
+	u32 e = (b-16)/4 + 4;
+	return (4 + (b-16)%4) << (e-2);
+}
+
+static void json_string(std::ostream &o, const std::string &s)
+{
+	o<<'"';
+	for (u32 i=0; i<s.size(); i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			o<<'\\';
+		o<<s[i];
+	}
+	o<<'"';
+}
+
+Profiler::Profiler()
+{
+	m_mutex.Init();
+	for (u32 i=0; i<PROFILER_SHARDS; i++) {
+		m_shards[i].mutex.Init();
+	}
+}
+
+u32 Profiler::getId(const std::string &name)
+{
+	JMutexAutoLock lock(m_mutex);
+
+	std::map<std::string, u32>::iterator n = m_ids.find(name);
+	if (n != m_ids.end())
+		return n->second;
+
+	u32 id = m_ids.size();
+	m_ids[name] = id;
+	return id;
+}
+
+Profiler::Counter &Profiler::getCounter(Shard *&shard, u32 id)
+{
+	unsigned long t = (unsigned long)get_current_thread_id();
+	// Thread ids are often aligned addresses, so mix in the higher bits
+	shard = &m_shards[((t>>4)^(t>>12)^(t>>20))%PROFILER_SHARDS];
+	shard->mutex.Lock();
+	if (id >= shard->counters.size())
+		shard->counters.resize(id+1);
+	return shard->counters[id];
+}
+
+void Profiler::add(u32 id, float value)
+{
+	Shard *shard;
+	Counter &c = getCounter(shard, id);
+	c.sum += value;
+	c.adds++;
+	shard->mutex.Unlock();
+}
+
+void Profiler::avg(u32 id, float value)
+{
+	Shard *shard;
+	Counter &c = getCounter(shard, id);
+	c.sum += value;
+	c.avgs++;
+	shard->mutex.Unlock();
+}
+
+void Profiler::addTime(u32 id, u32 us, bool average)
+{
+	Shard *shard;
+	Counter &c = getCounter(shard, id);
+	c.sum += (float)us/1000000.0;
+	if (average) {
+		c.avgs++;
+	}else{
+		c.adds++;
+	}
+	if (us > c.max_us)
+		c.max_us = us;
+	if (c.histogram.size() == 0)
+		c.histogram.resize(PROFILER_BUCKETS, 0);
+	c.histogram[bucket_of(us)]++;
+	shard->mutex.Unlock();
+}
+
+void Profiler::clear()
+{
+	for (u32 i=0; i<PROFILER_SHARDS; i++) {
+		JMutexAutoLock lock(m_shards[i].mutex);
+		std::vector<Counter> &counters = m_shards[i].counters;
+		for (u32 k=0; k<counters.size(); k++) {
+			counters[k] = Counter();
+		}
+	}
+}
+
+void Profiler::merge(std::vector<Counter> &counters)
+{
+	{
+		JMutexAutoLock lock(m_mutex);
+		counters.resize(m_ids.size());
+	}
+
+	for (u32 i=0; i<PROFILER_SHARDS; i++) {
+		JMutexAutoLock lock(m_shards[i].mutex);
+		std::vector<Counter> &shard = m_shards[i].counters;
+		for (u32 k=0; k<shard.size() && k<counters.size(); k++) {
+			mergeCounter(counters[k], shard[k]);
+		}
+	}
+}
+
+void Profiler::mergeCounter(Counter &to, const Counter &from)
+{
+	to.sum += from.sum;
+	to.adds += from.adds;
+	to.avgs += from.avgs;
+	if (from.max_us > to.max_us)
+		to.max_us = from.max_us;
+	if (from.histogram.size() == 0)
+		return;
+	if (to.histogram.size() == 0)
+		to.histogram.resize(PROFILER_BUCKETS, 0);
+	for (u32 b=0; b<PROFILER_BUCKETS; b++) {
+		to.histogram[b] += from.histogram[b];
+	}
+}
+
+u32 Profiler::addWindow()
+{
+	JMutexAutoLock lock(m_mutex);
+
+	m_windows.push_back(std::vector<Counter>());
+	return m_windows.size()-1;
+}
+
+void Profiler::takeWindow(u32 window, std::vector<Counter> &counters)
+{
+	// Held over the shard locks, getCounter() never takes it
+	JMutexAutoLock lock(m_mutex);
+	assert(window < m_windows.size());
+
+	for (u32 w=0; w<m_windows.size(); w++) {
+		m_windows[w].resize(m_ids.size());
+	}
+
+	for (u32 i=0; i<PROFILER_SHARDS; i++) {
+		JMutexAutoLock shardlock(m_shards[i].mutex);
+		std::vector<Counter> &shard = m_shards[i].counters;
+		for (u32 k=0; k<shard.size() && k<m_ids.size(); k++) {
+			if (shard[k].adds == 0 && shard[k].avgs == 0)
+				continue;
+			for (u32 w=0; w<m_windows.size(); w++) {
+				mergeCounter(m_windows[w][k], shard[k]);
+			}
+			shard[k] = Counter();
+		}
+	}
+
+	counters.clear();
+	counters.swap(m_windows[window]);
+}
+
+u32 Profiler::getPercentile(const Counter &c, float fraction)
+{
+	u32 total = 0;
+	for (u32 b=0; b<c.histogram.size(); b++) {
+		total += c.histogram[b];
+	}
+	if (total == 0)
+		return 0;
+
+	u32 wanted = (u32)(total*fraction);
+	if (wanted >= total)
+		wanted = total-1;
+	u32 seen = 0;
+	for (u32 b=0; b<c.histogram.size(); b++) {
+		seen += c.histogram[b];
+		if (seen <= wanted)
+			continue;
+		if (b+1 >= PROFILER_BUCKETS)
+			return c.max_us;
+		u32 end = bucket_start(b+1)-1;
+		return end < c.max_us ? end : c.max_us;
+	}
+	return c.max_us;
+}
+
+void Profiler::printPage(std::ostream &o, u32 page, u32 pagecount)
+{
+	std::vector<Counter> counters;
+	merge(counters);
+	printCounters(o, counters, page, pagecount);
+}
+
+void Profiler::printWindow(std::ostream &o, u32 window)
+{
+	std::vector<Counter> counters;
+	takeWindow(window, counters);
+	printCounters(o, counters, 1, 1);
+}
+
+void Profiler::printCounters(std::ostream &o, const std::vector<Counter> &counters, u32 page, u32 pagecount)
+{
+	std::map<std::string, u32> ids;
+	{
+		JMutexAutoLock lock(m_mutex);
+		ids = m_ids;
+	}
+
+	u32 minindex, maxindex;
+	paging(ids.size(), page, pagecount, minindex, maxindex);
+
+	for (std::map<std::string, u32>::iterator i = ids.begin(); i != ids.end(); i++) {
+		if (maxindex == 0)
+			break;
+		maxindex--;
+
+		if (minindex != 0) {
+			minindex--;
+			continue;
+		}
+
+		const std::string &name = i->first;
+		// Registered after the merge
+		if (i->second >= counters.size())
+			continue;
+		const Counter &c = counters[i->second];
+
+		o<<"  "<<name<<": ";
+		s32 clampsize = 40;
+		s32 space = clampsize - name.size();
+		for (s32 j=0; j<space; j++) {
+			if (j%2 == 0 && j < space - 1) {
+				o<<"-";
+			}else{
+				o<<" ";
+			}
+		}
+		if (c.avgs > 0) {
+			o<<(c.sum / c.avgs);
+		}else{
+			o<<c.sum;
+		}
+		if (c.histogram.size() != 0) {
+			o<<" (p50 "<<getPercentile(c, 0.5)<<"us"
+				<<", p99 "<<getPercentile(c, 0.99)<<"us"
+				<<", max "<<c.max_us<<"us)";
+		}
+		o<<std::endl;
+	}
+}
+
+void Profiler::dump(std::ostream &o)
+{
+	std::vector<Counter> counters;
+	merge(counters);
+	dumpCounters(o, counters);
+}
+
+void Profiler::dumpWindow(std::ostream &o, u32 window)
+{
+	std::vector<Counter> counters;
+	takeWindow(window, counters);
+	dumpCounters(o, counters);
+}
+
+/*
+	{"time":<unix time>,"counters":{"<name>":{"value":<sum or average>,
+	"count":<calls>[,"p50_us":..,"p99_us":..,"max_us":..]},...}}
+*/
+void Profiler::dumpCounters(std::ostream &o, const std::vector<Counter> &counters)
+{
+	std::map<std::string, u32> ids;
+	{
+		JMutexAutoLock lock(m_mutex);
+		ids = m_ids;
+	}
+
+	o<<"{\"time\":"<<(u32)time(NULL)<<",\"counters\":{";
+	bool first = true;
+	for (std::map<std::string, u32>::iterator i = ids.begin(); i != ids.end(); i++) {
+		if (i->second >= counters.size())
+			continue;
+		const Counter &c = counters[i->second];
+		u32 count = c.adds + c.avgs;
+		if (count == 0)
+			continue;
+
+		if (!first)
+			o<<",";
+		first = false;
+
+		json_string(o, i->first);
+		o<<":{\"value\":"<<(c.avgs > 0 ? c.sum/c.avgs : c.sum)
+			<<",\"count\":"<<count;
+		if (c.histogram.size() != 0) {
+			o<<",\"p50_us\":"<<getPercentile(c, 0.5)
+				<<",\"p99_us\":"<<getPercentile(c, 0.99)
+				<<",\"max_us\":"<<c.max_us;
+		}
+		o<<"}";
+	}
+	o<<"}}"<<std::endl;
+}
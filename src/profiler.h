@@ -28,134 +28,119 @@
 
 #include "common_irrlicht.h"
 #include <string>
+#include <map>
+#include <vector>
 #include "utility.h"
+#include "porting.h"
 #include <jmutex.h>
 #include <jmutexautolock.h>
 
+// Shards of the counters, threads are spread over them by id
+#define PROFILER_SHARDS 8
+// Histogram buckets: exact up to 15us, then 4 per power of two
+#define PROFILER_BUCKETS 128
+
 /*
 	Time profiler
-*/
 
+	Counters are registered by name once, getId() gives the number to
+	use them by. The name versions of add() and avg() look the id up
+	every time, which is fine for things done a few times a step, but
+	code run often should keep the id.
+
+	Each thread adds to one of several shards of the counters, so
+	threads rarely wait on each other. The shards are only merged when
+	the counters are printed or dumped.
+
+	Durations from ScopeProfiler also go in a histogram of the counter,
+	from which the median, 99th percentile and maximum are reported.
+*/
 class Profiler
 {
 public:
-	Profiler()
-	{
-		m_mutex.Init();
-	}
+	Profiler();
+
+	// Gets the id of a counter, registering it the first time
+	u32 getId(const std::string &name);
+
+	// Counters are either summed or averaged over the calls to them
+	void add(u32 id, float value);
+	void avg(u32 id, float value);
+	// A duration, added or averaged in seconds and kept in the histogram
+	void addTime(u32 id, u32 us, bool average);
 
 	void add(const std::string &name, float value)
 	{
-		JMutexAutoLock lock(m_mutex);
-		{
-			/* No average shall have been used; mark add used as -2 */
-			core::map<std::string, int>::Node *n = m_avgcounts.find(name);
-			if(n == NULL)
-				m_avgcounts[name] = -2;
-			else{
-				if(n->getValue() == -1)
-					n->setValue(-2);
-				assert(n->getValue() == -2);
-			}
-		}
-		{
-			core::map<std::string, float>::Node *n = m_data.find(name);
-			if(n == NULL)
-				m_data[name] = value;
-			else
-				n->setValue(n->getValue() + value);
-		}
+		add(getId(name), value);
 	}
-
 	void avg(const std::string &name, float value)
 	{
-		JMutexAutoLock lock(m_mutex);
-		{
-			core::map<std::string, int>::Node *n = m_avgcounts.find(name);
-			if(n == NULL)
-				m_avgcounts[name] = 1;
-			else{
-				/* No add shall have been used */
-				assert(n->getValue() != -2);
-				if(n->getValue() <= 0)
-					n->setValue(1);
-				else
-					n->setValue(n->getValue() + 1);
-			}
-		}
-		{
-			core::map<std::string, float>::Node *n = m_data.find(name);
-			if(n == NULL)
-				m_data[name] = value;
-			else
-				n->setValue(n->getValue() + value);
-		}
+		avg(getId(name), value);
 	}
 
-	void clear()
-	{
-		JMutexAutoLock lock(m_mutex);
-		for(core::map<std::string, float>::Iterator
-				i = m_data.getIterator();
-				i.atEnd() == false; i++)
-		{
-			i.getNode()->setValue(0);
-		}
-		m_avgcounts.clear();
-	}
+	void clear();
 
 	void print(std::ostream &o)
 	{
 		printPage(o, 1, 1);
 	}
+	void printPage(std::ostream &o, u32 page, u32 pagecount);
 
-	void printPage(std::ostream &o, u32 page, u32 pagecount)
-	{
-		JMutexAutoLock lock(m_mutex);
-		
-		u32 minindex, maxindex;
-		paging(m_data.size(), page, pagecount, minindex, maxindex);
-
-		for(core::map<std::string, float>::Iterator
-				i = m_data.getIterator();
-				i.atEnd() == false; i++)
-		{
-			if(maxindex == 0)
-				break;
-			maxindex--;
-
-			if(minindex != 0)
-			{
-				minindex--;
-				continue;
-			}
-
-			std::string name = i.getNode()->getKey();
-			int avgcount = 1;
-			core::map<std::string, int>::Node *n = m_avgcounts.find(name);
-			if(n){
-				if(n->getValue() >= 1)
-					avgcount = n->getValue();
-			}
-			o<<"  "<<name<<": ";
-			s32 clampsize = 40;
-			s32 space = clampsize - name.size();
-			for(s32 j=0; j<space; j++)
-			{
-				if(j%2 == 0 && j < space - 1)
-					o<<"-";
-				else
-					o<<" ";
-			}
-			o<<(i.getNode()->getValue() / avgcount);
-			o<<std::endl;
-		}
-	}
+	// Writes all counters as one line of JSON
+	void dump(std::ostream &o);
+
+	/*
+		Windows let several readers each get the counters since they
+		last read them, instead of sharing one clear(). Reading a window
+		moves the counters into all windows and then empties that one.
+	*/
+	u32 addWindow();
+	void printWindow(std::ostream &o, u32 window);
+	void dumpWindow(std::ostream &o, u32 window);
 
 private:
+	struct Counter
+	{
+		float sum;
+		u32 adds;
+		u32 avgs;
+		u32 max_us;
+		// Empty until a duration is added
+		std::vector<u32> histogram;
+
+		Counter():
+			sum(0),
+			adds(0),
+			avgs(0),
+			max_us(0)
+		{}
+	};
+
+	struct Shard
+	{
+		JMutex mutex;
+		std::vector<Counter> counters;
+	};
+
+	// Locks and returns the counter of id in the shard of this thread
+	Counter &getCounter(Shard *&shard, u32 id);
+	// Sums the counters of all shards
+	void merge(std::vector<Counter> &counters);
+	// Adds from to to
+	static void mergeCounter(Counter &to, const Counter &from);
+	// Empties the shards into the windows, and window into counters
+	void takeWindow(u32 window, std::vector<Counter> &counters);
+	void printCounters(std::ostream &o, const std::vector<Counter> &counters, u32 page, u32 pagecount);
+	void dumpCounters(std::ostream &o, const std::vector<Counter> &counters);
+	// The upper bound of a histogram percentile, in microseconds
+	static u32 getPercentile(const Counter &c, float fraction);
+
 	JMutex m_mutex;
-	core::map<std::string, float> m_data;
-	core::map<std::string, int> m_avgcounts;
+	// Names to ids, the order counters are printed in
+	std::map<std::string, u32> m_ids;
+	// Counters not yet read by each window, behind m_mutex
+	std::vector<std::vector<Counter> > m_windows;
+	Shard m_shards[PROFILER_SHARDS];
 };
 
 enum ScopeProfilerType{
@@ -163,54 +148,61 @@ enum ScopeProfilerType{
 	SPT_AVG
 };
 
+/*
+	Adds the time until it goes out of scope to a counter
+*/
 class ScopeProfiler
 {
 public:
 	ScopeProfiler(Profiler *profiler, const std::string &name,
 			enum ScopeProfilerType type = SPT_ADD):
 		m_profiler(profiler),
-		m_name(name),
-		m_timer(NULL),
-		m_type(type)
+		m_id(0),
+		m_type(type),
+		m_start(0)
 	{
-		if(m_profiler)
-			m_timer = new TimeTaker(m_name.c_str());
+		if (m_profiler) {
+			m_id = m_profiler->getId(name);
+			m_start = porting::getTimeUs();
+		}
 	}
-	// name is copied
 	ScopeProfiler(Profiler *profiler, const char *name,
 			enum ScopeProfilerType type = SPT_ADD):
 		m_profiler(profiler),
-		m_name(name),
-		m_timer(NULL),
-		m_type(type)
+		m_id(0),
+		m_type(type),
+		m_start(0)
+	{
+		if (m_profiler) {
+			m_id = m_profiler->getId(name);
+			m_start = porting::getTimeUs();
+		}
+	}
+	// For code run often, with an id from Profiler::getId()
+	ScopeProfiler(Profiler *profiler, u32 id,
+			enum ScopeProfilerType type = SPT_ADD):
+		m_profiler(profiler),
+		m_id(id),
+		m_type(type),
+		m_start(0)
 	{
-		if(m_profiler)
-			m_timer = new TimeTaker(m_name.c_str());
+		if (m_profiler)
+			m_start = porting::getTimeUs();
 	}
 	~ScopeProfiler()
 	{
-		if(m_timer)
-		{
-			float duration_ms = m_timer->stop(true);
-			float duration = duration_ms / 1000.0;
-			if(m_profiler){
-				switch(m_type){
-				case SPT_ADD:
-					m_profiler->add(m_name, duration);
-					break;
-				case SPT_AVG:
-					m_profiler->avg(m_name, duration);
-					break;
-				}
-			}
-			delete m_timer;
+		if (m_profiler) {
+			u64 duration = porting::getTimeUs() - m_start;
+			if (duration > 0xFFFFFFFF)
+				duration = 0xFFFFFFFF;
+			m_profiler->addTime(m_id, duration, m_type == SPT_AVG);
 		}
 	}
 private:
 	Profiler *m_profiler;
-	std::string m_name;
-	TimeTaker *m_timer;
+	u32 m_id;
 	enum ScopeProfilerType m_type;
+	u64 m_start;
 };
 
 #endif
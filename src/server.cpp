@@ -131,6 +131,9 @@ void * EmergeThread::Thread()
 
 	bool enable_mapgen_debug_info = g_settings->getBool("enable_mapgen_debug_info");
 
+	// Blocks put back in the queue in a row, see below
+	u32 deferred_count = 0;
+
 	/*
 		Get block info from queue, emerge them and send them
 		to clients.
@@ -200,15 +203,44 @@ void * EmergeThread::Thread()
 
 		ServerMap &map = ((ServerMap&)m_server->m_env.getMap());
 
-		//core::map<v3s16, MapBlock*> changed_blocks;
-		//core::map<v3s16, MapBlock*> lighting_invalidated_blocks;
+		/*
+			Read the block, and the next ones in the queue, from the
+			database before taking the environment lock
+		*/
+		{
+			std::vector<v3s16> wanted;
+			wanted.push_back(p);
+			m_server->m_emerge_queue.getPositions(wanted, MAP_READ_AHEAD_BATCH-1);
+			map.readAhead(wanted);
+		}
 
 		MapBlock *block = NULL;
 		bool got_block = true;
 		core::map<v3s16, MapBlock*> modified_blocks;
 
 		/*
-			Fetch block from map or generate a single block
+			Set when the block is to be generated. The generation itself
+			runs outside the environment lock, only initBlockMake and
+			finishBlockMake are done with it locked.
+		*/
+		bool generate = false;
+		bool deferred = false;
+		mapgen::BlockMakeData data;
+		/*
+			The blocks of the area as they were copied for generation,
+			by their serial in the map and their content version. If
+			any of them is gone, or one that was already generated has
+			changed, when the result is to be blitted back, the block is
+			generated again so that edits made meanwhile aren't
+			overwritten. Blocks that weren't generated yet are replaced
+			anyway.
+		*/
+		u32 area_serials[27];
+		u32 area_versions[27];
+		bool area_generated[27];
+
+		/*
+			Fetch block from map or prepare it for generation
 		*/
 		{
 			JMutexAutoLock envlock(m_server->m_env_mutex);
@@ -222,32 +254,49 @@ void * EmergeThread::Thread()
 				if(enable_mapgen_debug_info)
 					infostream<<"EmergeThread: not in memory, loading"<<std::endl;
 
-				// Get, load or create sector
-				/*ServerMapSector *sector =
-						(ServerMapSector*)map.createSector(p2d);*/
-
-				// Load/generate block
-
-				/*block = map.emergeBlock(p, sector, changed_blocks,
-						lighting_invalidated_blocks);*/
-
 				block = map.loadBlock(p);
 
 				if(only_from_disk == false)
 				{
 					if(block == NULL || block->isGenerated() == false)
+						generate = true;
+				}
+
+				if(generate)
+				{
+					/*
+						Another thread is generating an area that
+						overlaps this one, try again later
+					*/
+					if(m_server->isEmergeGenerating(p))
+					{
+						deferred = true;
+					}
+					else
 					{
 						if(enable_mapgen_debug_info)
 							infostream<<"EmergeThread: generating"<<std::endl;
-						block = map.generateBlock(p, modified_blocks);
-					}
-				}
 
-				if(enable_mapgen_debug_info)
-					infostream<<"EmergeThread: ended up with: "
-							<<analyze_block(block)<<std::endl;
+						m_server->m_emerge_generating.insert(p, true);
+						map.initBlockMake(&data, p);
 
-				if(block == NULL)
+						if(data.no_op == false)
+						{
+							u32 k = 0;
+							for(s16 z=-1; z<=1; z++)
+							for(s16 y=-1; y<=1; y++)
+							for(s16 x=-1; x<=1; x++, k++)
+							{
+								MapBlock *b = map.getBlockNoCreateNoEx(p+v3s16(x,y,z));
+								assert(b);
+								area_serials[k] = b->getUsageSerial();
+								area_versions[k] = b->getContentVersion();
+								area_generated[k] = b->isGenerated();
+							}
+						}
+					}
+				}
+				else if(block == NULL)
 				{
 					got_block = false;
 				}
@@ -264,57 +313,97 @@ void * EmergeThread::Thread()
 					m_server->m_env.activateBlock(block, 3600);
 				}
 			}
-			else
+		}
+
+		if(deferred)
+		{
+			m_server->m_emerge_queue.requeue(*q);
+			/*
+				Don't spin if everything left in the queue is
+				waiting for other threads, wait for one of them to
+				finish instead
+			*/
+			deferred_count++;
+			if(deferred_count > m_server->m_emerge_queue.size())
 			{
-				/*if(block->getLightingExpired()){
-					lighting_invalidated_blocks[block->getPos()] = block;
-				}*/
+				deferred_count = 0;
+				m_server->m_emerge_finished.Wait(500);
 			}
-
-			// TODO: Some additional checking and lighting updating,
-			//       see emergeBlock
+			continue;
 		}
+		deferred_count = 0;
 
-		{//envlock
-		JMutexAutoLock envlock(m_server->m_env_mutex);
-
-		if(got_block)
+		/*
+			Generate block, without holding the environment lock
+		*/
+		if(generate)
 		{
+			if(data.no_op == false)
+			{
+				TimeTaker t("mapgen::make_block()");
+				mapgen::make_block(&data);
+
+				if(enable_mapgen_debug_info == false)
+					t.stop(true); // Hide output
+			}
+
+			JMutexAutoLock envlock(m_server->m_env_mutex);
+
+			m_server->m_emerge_generating.remove(p);
+			m_server->m_emerge_finished.Post();
+
 			/*
-				Collect a list of blocks that have been modified in
-				addition to the fetched one.
+				The blocks may have been unloaded or changed while
+				generating, in which case the result can't be blitted
+				back
 			*/
+			bool area_unchanged = true;
+			if(data.no_op == false)
+			{
+				u32 k = 0;
+				for(s16 z=-1; z<=1 && area_unchanged; z++)
+				for(s16 y=-1; y<=1 && area_unchanged; y++)
+				for(s16 x=-1; x<=1 && area_unchanged; x++, k++)
+				{
+					MapBlock *b = map.getBlockNoCreateNoEx(p+v3s16(x,y,z));
+					if(b == NULL
+							|| b->getUsageSerial() != area_serials[k]
+							|| (area_generated[k]
+							&& b->getContentVersion() != area_versions[k]))
+						area_unchanged = false;
+				}
+			}
 
-#if 0
-			if(lighting_invalidated_blocks.size() > 0)
+			if(area_unchanged == false)
 			{
-				/*infostream<<"lighting "<<lighting_invalidated_blocks.size()
-						<<" blocks"<<std::endl;*/
+				if(enable_mapgen_debug_info)
+					infostream<<"EmergeThread: area changed while generating,"
+							<<" generating again"<<std::endl;
+				m_server->m_emerge_queue.requeue(*q);
+				continue;
+			}
 
-				// 50-100ms for single block generation
-				//TimeTaker timer("** EmergeThread updateLighting");
+			// Blit data back on map, update lighting, add mobs and whatever this does
+			map.finishBlockMake(&data, modified_blocks);
 
-				// Update lighting without locking the environment mutex,
-				// add modified blocks to changed blocks
-				map.updateLighting(lighting_invalidated_blocks, modified_blocks);
-			}
+			block = map.getBlockNoCreateNoEx(p);
 
-			// Add all from changed_blocks to modified_blocks
-			for(core::map<v3s16, MapBlock*>::Iterator i = changed_blocks.getIterator();
-					i.atEnd() == false; i++)
+			if(enable_mapgen_debug_info)
+				infostream<<"EmergeThread: ended up with: "
+						<<analyze_block(block)<<std::endl;
+
+			if(block == NULL)
 			{
-				MapBlock *block = i.getNode()->getValue();
-				modified_blocks.insert(block->getPos(), block);
+				got_block = false;
 			}
-#endif
-		}
-		// If we got no block, there should be no invalidated blocks
-		else
-		{
-			//assert(lighting_invalidated_blocks.size() == 0);
-		}
+			else
+			{
+				MapEditEventIgnorer ign(&m_server->m_ignore_map_edit_events);
 
-		}//envlock
+				// Activate objects and stuff
+				m_server->m_env.activateBlock(block, 3600);
+			}
+		}
 
 		/*
 			Set sent status of modified blocks on clients
@@ -348,6 +437,9 @@ void * EmergeThread::Thread()
 			}
 		}
 
+		// Get the server thread to send them
+		if(modified_blocks.size() > 0)
+			m_server->m_wakeup.Post();
 	}
 
 	END_DEBUG_EXCEPTION_HANDLER(errorstream)
@@ -372,9 +464,14 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 		return;
 	}
 
+	// This runs for every client every step
+	static SettingHandle<u16> max_simul_sends_h(g_settings, "max_simultaneous_block_sends_per_client");
+	static SettingHandle<float> min_time_from_building_h(g_settings, "full_block_send_enable_min_time_from_building");
+	static SettingHandle<s16> max_send_d_h(g_settings, "max_block_send_distance");
+	static SettingHandle<s16> max_gen_d_h(g_settings, "max_block_generate_distance");
+
 	// Won't send anything if already sending
-	if(m_blocks_sending.size() >= g_settings->getU16
-			("max_simultaneous_block_sends_per_client"))
+	if(m_blocks_sending.size() >= max_simul_sends_h.get())
 	{
 		//infostream<<"Not sending any blocks, Queue full."<<std::endl;
 		return;
@@ -434,8 +531,7 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 
 	//infostream<<"d_start="<<d_start<<std::endl;
 
-	u16 max_simul_sends_setting = g_settings->getU16
-			("max_simultaneous_block_sends_per_client");
+	u16 max_simul_sends_setting = max_simul_sends_h.get();
 	u16 max_simul_sends_usually = max_simul_sends_setting;
 
 	/*
@@ -444,8 +540,7 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 		Decrease send rate if player is building stuff.
 	*/
 	m_time_from_building += dtime;
-	if(m_time_from_building < g_settings->getFloat(
-				"full_block_send_enable_min_time_from_building"))
+	if(m_time_from_building < min_time_from_building_h.get())
 	{
 		max_simul_sends_usually
 			= LIMITED_MAX_SIMULTANEOUS_BLOCK_SENDS;
@@ -465,8 +560,8 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 	*/
 	s32 new_nearest_unsent_d = -1;
 
-	s16 d_max = g_settings->getS16("max_block_send_distance");
-	s16 d_max_gen = g_settings->getS16("max_block_generate_distance");
+	s16 d_max = max_send_d_h.get();
+	s16 d_max_gen = max_gen_d_h.get();
 
 	// Don't loop very much at a time
 	s16 max_d_increment_at_time = 2;
@@ -705,7 +800,7 @@ void RemoteClient::GetNextBlocks(Server *server, float dtime,
 						flags |= BLOCK_EMERGE_FLAG_FROMDISK;
 
 					server->m_emerge_queue.addBlock(peer_id, p, flags);
-					server->m_emergethread.trigger();
+					server->triggerEmergeThreads();
 
 					if(nearest_emerged_d == -1)
 						nearest_emerged_d = d;
@@ -746,7 +841,7 @@ queue_full_break:
 	} else if(nearest_emergefull_d != -1){
 		new_nearest_unsent_d = nearest_emergefull_d;
 	} else {
-		if(d > g_settings->getS16("max_block_send_distance")){
+		if(d > max_send_d_h.get()){
 			new_nearest_unsent_d = 0;
 			m_nothing_to_send_pause_timer = 2.0;
 			/*infostream<<"GetNextBlocks(): d wrapped around for "
@@ -951,6 +1046,15 @@ u32 PIChecksum(core::list<PlayerInfo> &l)
 	return checksum;
 }
 
+/* Appends an active object message with its object id header to buf */
+static void appendActiveObjectMessage(std::string &buf, u16 id, const std::string &data)
+{
+	char idbuf[2];
+	writeU16((u8*)&idbuf[0], id);
+	buf.append(idbuf, 2);
+	buf += serializeString(data);
+}
+
 /*
 	Server
 */
@@ -961,10 +1065,9 @@ Server::Server(
 	):
 	m_env(new ServerMap(mapsavedir), this),
 	m_con(PROTOCOL_ID, 512, CONNECTION_TIMEOUT, this),
-	m_authmanager(mapsavedir+DIR_DELIM+"auth.txt"),
+	m_authmanager(mapsavedir),
 	m_banmanager(mapsavedir+DIR_DELIM+"ipban.txt"),
 	m_thread(this),
-	m_emergethread(this),
 	m_time_of_day_send_timer(0),
 	m_uptime(0),
 	m_mapsavedir(mapsavedir),
@@ -978,11 +1081,26 @@ Server::Server(
 	m_emergethread_trigger_timer = 0.0;
 	m_savemap_timer = 0.0;
 	m_send_object_info_timer = 0.0;
+	m_object_send_round = 0;
+	m_send_cache_size = 0;
 
 	m_env_mutex.Init();
 	m_con_mutex.Init();
 	m_step_dtime_mutex.Init();
 	m_step_dtime = 0.0;
+	m_wakeup.Init();
+	m_con.SetEventSignal(&m_wakeup);
+	m_emerge_finished.Init();
+
+	{
+		u16 count = g_settings->getU16("num_emerge_threads");
+		if (count < 1)
+			count = 1;
+		for (u16 i=0; i<count; i++) {
+			m_emergethreads.push_back(new EmergeThread(this));
+		}
+		infostream<<"Server: Using "<<count<<" emerge threads"<<std::endl;
+	}
 
 	// Register us to receive map edit events
 	m_env.getMap().addEventReceiver(this);
@@ -1074,6 +1192,14 @@ Server::~Server()
 			delete i.getNode()->getValue();
 		}
 	}
+
+	/*
+		Delete emerge threads, these were stopped above
+	*/
+	for (u32 i=0; i<m_emergethreads.size(); i++) {
+		delete m_emergethreads[i];
+	}
+	m_emergethreads.clear();
 }
 
 void Server::start(unsigned short port)
@@ -1140,11 +1266,15 @@ void Server::stop()
 
 	infostream<<"Server: Stopping and waiting threads"<<std::endl;
 
-	// Stop threads (set run=false first so both start stopping)
+	// Stop threads (set run=false first so they all start stopping)
 	m_thread.setRun(false);
-	m_emergethread.setRun(false);
+	for (u32 i=0; i<m_emergethreads.size(); i++) {
+		m_emergethreads[i]->setRun(false);
+	}
 	m_thread.stop();
-	m_emergethread.stop();
+	for (u32 i=0; i<m_emergethreads.size(); i++) {
+		m_emergethreads[i]->stop();
+	}
 
 	infostream<<"Server: Threads stopped"<<std::endl;
 }
@@ -1161,6 +1291,7 @@ bool Server::step(float dtime)
 		JMutexAutoLock lock(m_step_dtime_mutex);
 		m_step_dtime += dtime;
 	}
+	m_wakeup.Post();
 	return true;
 }
 
@@ -1168,7 +1299,8 @@ void Server::AsyncRunStep()
 {
 	DSTACK(__FUNCTION_NAME);
 
-	g_profiler->add("Server::AsyncRunStep (num)", 1);
+	static u32 prof_steps = g_profiler->getId("Server::AsyncRunStep (num)");
+	g_profiler->add(prof_steps, 1);
 
 	float dtime;
 	{
@@ -1177,7 +1309,8 @@ void Server::AsyncRunStep()
 	}
 
 	{
-		ScopeProfiler sp(g_profiler, "Server: sel and send blocks to clients");
+		static u32 prof_send_blocks = g_profiler->getId("Server: sel and send blocks to clients");
+		ScopeProfiler sp(g_profiler, prof_send_blocks);
 		// Send blocks to clients
 		SendBlocks(dtime);
 	}
@@ -1185,7 +1318,8 @@ void Server::AsyncRunStep()
 	if(dtime < 0.001)
 		return;
 
-	g_profiler->add("Server::AsyncRunStep with dtime (num)", 1);
+	static u32 prof_dtime_steps = g_profiler->getId("Server::AsyncRunStep with dtime (num)");
+	g_profiler->add(prof_dtime_steps, 1);
 
 	//infostream<<"Server steps "<<dtime<<std::endl;
 	//infostream<<"Server::AsyncRunStep(): dtime="<<dtime<<std::endl;
@@ -1205,7 +1339,8 @@ void Server::AsyncRunStep()
 	{
 		// Process connection's timeouts
 		JMutexAutoLock lock2(m_con_mutex);
-		ScopeProfiler sp(g_profiler, "Server: connection timeout processing");
+		static u32 prof_timeouts = g_profiler->getId("Server: connection timeout processing");
+		ScopeProfiler sp(g_profiler, prof_timeouts);
 		m_con.RunTimeouts(dtime);
 	}
 
@@ -1221,7 +1356,8 @@ void Server::AsyncRunStep()
 	{
 		JMutexAutoLock envlock(m_env_mutex);
 
-		float time_speed = g_settings->getFloat("time_speed");
+		static SettingHandle<float> time_speed_h(g_settings, "time_speed");
+		float time_speed = time_speed_h.get();
 
 		m_env.setTimeOfDaySpeed(time_speed);
 
@@ -1250,17 +1386,24 @@ void Server::AsyncRunStep()
 	{
 		JMutexAutoLock lock(m_env_mutex);
 		// Step environment
-		ScopeProfiler sp(g_profiler, "SEnv step");
-		ScopeProfiler sp2(g_profiler, "SEnv step avg", SPT_AVG);
+		static u32 prof_env_step = g_profiler->getId("SEnv step");
+		static u32 prof_env_step_avg = g_profiler->getId("SEnv step avg");
+		ScopeProfiler sp(g_profiler, prof_env_step);
+		ScopeProfiler sp2(g_profiler, prof_env_step_avg, SPT_AVG);
 		m_env.step(dtime);
 	}
 
-	const float map_timer_and_unload_dtime = 2.92;
+	/*
+		This only looks at the blocks that are due, so it's done often
+		to spread unloading many blocks over several steps
+	*/
+	const float map_timer_and_unload_dtime = 0.5;
 	if(m_map_timer_and_unload_interval.step(dtime, map_timer_and_unload_dtime))
 	{
 		JMutexAutoLock lock(m_env_mutex);
 		// Run Map's timers and unload unused data
-		ScopeProfiler sp(g_profiler, "Server: map timer and unload");
+		static u32 prof_unload = g_profiler->getId("Server: map timer and unload");
+		ScopeProfiler sp(g_profiler, prof_unload);
 		m_env.getMap().timerUpdate(map_timer_and_unload_dtime,
 				g_settings->getFloat("server_unload_unused_data_timeout"));
 	}
@@ -1279,10 +1422,16 @@ void Server::AsyncRunStep()
 
 		JMutexAutoLock lock(m_env_mutex);
 
-		ScopeProfiler sp(g_profiler, "Server: liquid transform");
+		static u32 prof_liquid = g_profiler->getId("Server: liquid transform");
+		ScopeProfiler sp(g_profiler, prof_liquid);
+
+		static SettingHandle<s32> time_budget_h(g_settings, "liquid_update_time_budget");
+		s32 time_budget = time_budget_h.get();
+		if(time_budget < 0)
+			time_budget = 0;
 
 		core::map<v3s16, MapBlock*> modified_blocks;
-		m_env.getMap().transformLiquids(modified_blocks);
+		m_env.getMap().transformLiquids(modified_blocks, time_budget);
 		/*
 			Set the modified blocks unsent for all the clients
 		*/
@@ -1338,10 +1487,12 @@ void Server::AsyncRunStep()
 		JMutexAutoLock envlock(m_env_mutex);
 		JMutexAutoLock conlock(m_con_mutex);
 
-		ScopeProfiler sp(g_profiler, "Server: checking added and deleted objs");
+		static u32 prof_added_deleted = g_profiler->getId("Server: checking added and deleted objs");
+		ScopeProfiler sp(g_profiler, prof_added_deleted);
 
 		// Radius inside which objects are active
-		s16 radius = g_settings->getS16("active_object_send_range_blocks");
+		static SettingHandle<s16> radius_h(g_settings, "active_object_send_range_blocks");
+		s16 radius = radius_h.get();
 		radius *= MAP_BLOCKSIZE;
 
 		for (core::map<u16, RemoteClient*>::Iterator i = m_clients.getIterator(); i.atEnd() == false; i++) {
@@ -1382,6 +1533,7 @@ void Server::AsyncRunStep()
 				// Remove from known objects
 				std::map<u16, bool>::iterator c = client->m_known_objects.find(id);
 				client->m_known_objects.erase(c);
+				client->m_object_states.erase(id);
 
 				if (obj && obj->m_known_by_count > 0) {
 					obj->m_known_by_count--;
@@ -1420,6 +1572,7 @@ void Server::AsyncRunStep()
 				}
 				// Add to known objects
 				client->m_known_objects[id] = true;
+				client->m_object_states.erase(id);
 
 				if (obj)
 					obj->m_known_by_count++;
@@ -1489,6 +1642,15 @@ void Server::AsyncRunStep()
 			message_list->push_back(aom);
 		}
 
+		m_object_send_round++;
+		// Objects further than this many blocks get fewer position updates
+		static SettingHandle<float> near_range_h(g_settings, "active_object_near_range_blocks");
+		f32 near_range = near_range_h.get();
+		// Counted for every object and client
+		static u32 prof_deferred = g_profiler->getId("Server: deferred object positions");
+		static u32 prof_deltas = g_profiler->getId("Server: object position deltas");
+		static u32 prof_bases = g_profiler->getId("Server: object position bases");
+
 		// Route data to every client
 		for(core::map<u16, RemoteClient*>::Iterator
 			i = m_clients.getIterator();
@@ -1512,22 +1674,100 @@ void Server::AsyncRunStep()
 				for(core::list<ActiveObjectMessage>::Iterator
 						k = list->begin(); k != list->end(); k++)
 				{
-					// Compose the full new data with header
-					ActiveObjectMessage aom = *k;
-					std::string new_data;
-					// Add object id
-					char buf[2];
-					writeU16((u8*)&buf[0], aom.id);
-					new_data.append(buf, 2);
-					// Add data
-					new_data += serializeString(aom.datastring);
-					// Add data to buffer
-					if(aom.reliable)
-						reliable_data += new_data;
-					else
-						unreliable_data += new_data;
+					ActiveObjectMessage &aom = *k;
+					// Position updates are sent below when it's their turn
+					if (!aom.reliable && aom.datastring.size() >= AO_POSITION_SIZE
+							&& aom.datastring[0] == AO_CMD_POSITION) {
+						RemoteClient::ObjectSendState &state = client->m_object_states[id];
+						state.pending = aom.datastring;
+						state.has_pending = true;
+						continue;
+					}
+					appendActiveObjectMessage(aom.reliable ? reliable_data : unreliable_data,
+							id, aom.datastring);
+				}
+			}
+
+			/*
+				Send pending position updates. Objects near the player
+				get one every time, further ones every 2nd or 4th time.
+			*/
+			Player *player = m_env.getPlayer(client->peer_id);
+			for (std::map<u16, RemoteClient::ObjectSendState>::iterator
+					j = client->m_object_states.begin();
+					j != client->m_object_states.end(); j++) {
+				RemoteClient::ObjectSendState &state = j->second;
+				if (!state.has_pending)
+					continue;
+				u16 id = j->first;
+				ServerActiveObject *obj = m_env.getActiveObject(id);
+				if (obj && player) {
+					f32 d = obj->getBasePosition().getDistanceFrom(player->getPosition())
+							/ (MAP_BLOCKSIZE*BS);
+					u32 interval = 1;
+					if (d > near_range*2) {
+						interval = 4;
+					}else if (d > near_range) {
+						interval = 2;
+					}
+					// Spread the objects out over the rounds
+					if ((m_object_send_round + id) % interval != 0) {
+						g_profiler->add(prof_deferred, 1);
+						continue;
+					}
 				}
+				state.has_pending = false;
+
+				// Old clients only know full positions
+				if (client->net_proto_version < 11) {
+					appendActiveObjectMessage(unreliable_data, id, state.pending);
+					continue;
+				}
+
+				const std::string &data = state.pending;
+				v3s32 p(
+					readS32((u8*)&data[1]),
+					readS32((u8*)&data[5]),
+					readS32((u8*)&data[9])
+				);
+				std::string message;
+				if (state.has_base) {
+					v3s32 d = p - state.base;
+					s32 dx = (d.X + (d.X < 0 ? -AO_DELTA_QUANTUM/2 : AO_DELTA_QUANTUM/2))
+							/ AO_DELTA_QUANTUM;
+					s32 dy = (d.Y + (d.Y < 0 ? -AO_DELTA_QUANTUM/2 : AO_DELTA_QUANTUM/2))
+							/ AO_DELTA_QUANTUM;
+					s32 dz = (d.Z + (d.Z < 0 ? -AO_DELTA_QUANTUM/2 : AO_DELTA_QUANTUM/2))
+							/ AO_DELTA_QUANTUM;
+					if (dx >= -32767 && dx <= 32767 && dy >= -32767 && dy <= 32767
+							&& dz >= -32767 && dz <= 32767) {
+						char buf[8];
+						writeU8((u8*)&buf[0], AO_CMD_POSITION_DELTA);
+						writeU8((u8*)&buf[1], state.base_seq);
+						writeS16((u8*)&buf[2], dx);
+						writeS16((u8*)&buf[4], dy);
+						writeS16((u8*)&buf[6], dz);
+						message.append(buf, 8);
+						message.append(data, AO_POSITION_SIZE, std::string::npos);
+						appendActiveObjectMessage(unreliable_data, id, message);
+						g_profiler->add(prof_deltas, 1);
+						continue;
+					}
+				}
+
+				// Start from a new base, which the client is sure to get
+				state.base = p;
+				state.base_seq++;
+				state.has_base = true;
+				char buf[2];
+				writeU8((u8*)&buf[0], AO_CMD_POSITION_BASE);
+				writeU8((u8*)&buf[1], state.base_seq);
+				message.append(buf, 2);
+				message.append(data, 1, std::string::npos);
+				appendActiveObjectMessage(reliable_data, id, message);
+				g_profiler->add(prof_bases, 1);
 			}
+
 			/*
 				reliable_data and unreliable_data are now ready.
 				Send them.
@@ -1700,9 +1940,10 @@ void Server::AsyncRunStep()
 		Send object positions
 	*/
 	{
+		static SettingHandle<float> objectdata_interval_h(g_settings, "objectdata_interval");
 		float &counter = m_objectdata_timer;
 		counter += dtime;
-		if(counter >= g_settings->getFloat("objectdata_interval"))
+		if(counter >= objectdata_interval_h.get())
 		{
 			JMutexAutoLock lock1(m_env_mutex);
 			JMutexAutoLock lock2(m_con_mutex);
@@ -1726,23 +1967,21 @@ void Server::AsyncRunStep()
 		{
 			counter = 0.0;
 
-			m_emergethread.trigger();
+			triggerEmergeThreads();
 		}
 	}
 
-	// Save map, players and auth stuff
+	// Save map and players, auth is saved as it changes
 	{
+		static SettingHandle<float> save_interval_h(g_settings, "server_map_save_interval");
 		float &counter = m_savemap_timer;
 		counter += dtime;
-		if(counter >= g_settings->getFloat("server_map_save_interval"))
+		if(counter >= save_interval_h.get())
 		{
 			counter = 0.0;
 
-			ScopeProfiler sp(g_profiler, "Server: saving stuff");
-
-			// Auth stuff
-			if(m_authmanager.isModified())
-				m_authmanager.save();
+			static u32 prof_saving = g_profiler->getId("Server: saving stuff");
+			ScopeProfiler sp(g_profiler, prof_saving);
 
 			//Bann stuff
 			if(m_banmanager.isModified())
@@ -1780,50 +2019,122 @@ void Server::AsyncRunStep()
 void Server::Receive()
 {
 	DSTACK(__FUNCTION_NAME);
-	SharedBuffer<u8> data;
-	u16 peer_id;
-	u32 datasize;
-	try{
-		{
-			JMutexAutoLock conlock(m_con_mutex);
-			datasize = m_con.Receive(peer_id, data);
-		}
 
-		// This has to be called so that the client list gets synced
-		// with the peer list of the connection
-		handlePeerChanges();
+	/*
+		In batch mode everything that has arrived is picked up and
+		processed in one go, for at most server_ingest_time_budget
+		microseconds. What isn't processed in time is left for the next
+		call.
+	*/
+	bool batch = g_settings->getBool("server_ingest_batch");
+	s32 time_budget = 0;
+	if (batch)
+		time_budget = g_settings->getS32("server_ingest_time_budget");
+	if (time_budget < 0)
+		time_budget = 0;
 
-		ProcessData(*data, datasize, peer_id);
+	/*
+		Sleep until there's data, a step or a finished emerge instead of
+		polling. The timeout only keeps things going if a wakeup gets
+		lost somehow.
+	*/
+	if (m_ingest_queue.empty() && m_con.GetEventQueueSize() == 0) {
+		static u32 prof_idle = g_profiler->getId("Server: idle wait");
+		ScopeProfiler sp(g_profiler, prof_idle);
+		m_wakeup.Wait(500);
 	}
-	catch(con::InvalidIncomingDataException &e)
+	// Whatever else has been signalled is handled by this same round
+	while (m_wakeup.TryWait()) {}
+
+	u64 start_time = porting::getTimeUs();
+
 	{
-		infostream<<"Server::Receive(): "
-				"InvalidIncomingDataException: what()="
-				<<e.what()<<std::endl;
+		JMutexAutoLock conlock(m_con_mutex);
+		static u32 prof_ingest_depth = g_profiler->getId("Server: ingest queue depth");
+		g_profiler->avg(prof_ingest_depth,
+				m_con.GetEventQueueSize() + m_ingest_queue.size());
+		do{
+			IngestPacket packet;
+			try{
+				packet.datasize = m_con.Receive(packet.peer_id, packet.data,
+						false, packet.time_ms);
+			}
+			catch(con::NoIncomingDataException &e)
+			{
+				break;
+			}
+			queueIngestPacket(packet);
+		}while(batch && porting::getTimeUs() - start_time < (u64)time_budget);
 	}
-	catch(con::PeerNotFoundException &e)
-	{
-		//NOTE: This is not needed anymore
 
-		// The peer has been disconnected.
-		// Find the associated player and remove it.
+	if (m_ingest_queue.empty())
+		return;
 
-		/*JMutexAutoLock envlock(m_env_mutex);
+	// This has to be called so that the client list gets synced
+	// with the peer list of the connection
+	handlePeerChanges();
 
-		infostream<<"ServerThread: peer_id="<<peer_id
-				<<" has apparently closed connection. "
-				<<"Removing player."<<std::endl;
+	// Environment is locked first.
+	JMutexAutoLock envlock(m_env_mutex);
+	JMutexAutoLock conlock(m_con_mutex);
 
-		m_env.removePlayer(peer_id);*/
+	static u32 prof_latency = g_profiler->getId("Server: ingest latency ms");
+	u32 now_ms = porting::getTimeMs();
+	u32 processed = 0;
+	while (processed < m_ingest_queue.size()) {
+		IngestPacket &packet = m_ingest_queue[processed++];
+		g_profiler->avg(prof_latency, now_ms - packet.time_ms);
+		try{
+			ProcessData(*packet.data, packet.datasize, packet.peer_id);
+		}
+		catch(con::InvalidIncomingDataException &e)
+		{
+			infostream<<"Server::Receive(): "
+					"InvalidIncomingDataException: what()="
+					<<e.what()<<std::endl;
+		}
+		catch(con::PeerNotFoundException &e)
+		{
+			// The peer has been disconnected, it is removed by
+			// handlePeerChanges()
+		}
+		if (!batch || porting::getTimeUs() - start_time >= (u64)time_budget)
+			break;
+	}
+	m_ingest_queue.erase(m_ingest_queue.begin(), m_ingest_queue.begin()+processed);
+
+	static u32 prof_ingest_batch = g_profiler->getId("Server: ingest packets per batch");
+	g_profiler->avg(prof_ingest_batch, processed);
+}
+
+/*
+	Adds received data to m_ingest_queue. A player position following
+	another one from the same peer replaces it, as only the latest one
+	matters.
+*/
+void Server::queueIngestPacket(const IngestPacket &packet)
+{
+	if (packet.datasize >= 2 && readU16(&packet.data[0]) == TOSERVER_PLAYERPOS) {
+		for (s32 i=(s32)m_ingest_queue.size()-1; i>=0; i--) {
+			IngestPacket &queued = m_ingest_queue[i];
+			if (queued.peer_id != packet.peer_id)
+				continue;
+			if (queued.datasize >= 2 && readU16(&queued.data[0]) == TOSERVER_PLAYERPOS) {
+				queued.data = packet.data;
+				queued.datasize = packet.datasize;
+				static u32 prof_coalesced = g_profiler->getId("Server: coalesced player positions");
+				g_profiler->add(prof_coalesced, 1);
+				return;
+			}
+			break;
+		}
 	}
+	m_ingest_queue.push_back(packet);
 }
 
 void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 {
 	DSTACK(__FUNCTION_NAME);
-	// Environment is locked first.
-	JMutexAutoLock envlock(m_env_mutex);
-	JMutexAutoLock conlock(m_con_mutex);
 
 	try{
 		Address address = m_con.GetPeerAddress(peer_id);
@@ -1986,7 +2297,6 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 			m_authmanager.add(playername);
 			m_authmanager.setPassword(playername, checkpwd);
 			m_authmanager.setPrivs(playername, stringToPrivs(g_settings->get("default_privs")));
-			m_authmanager.save();
 		}
 
 		// Enforce user limit.
@@ -2978,7 +3288,6 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 					}
 				}
 			}else if (wieldcontent == CONTENT_CRAFTITEM_FERTILIZER && selected_node_features.fertilizer_affects) {
-				selected_node.envticks = 1024;
 				// send the node
 				core::list<u16> far_players;
 				core::map<v3s16, MapBlock*> modified_blocks;
@@ -3006,6 +3315,7 @@ void Server::ProcessData(u8 *data, u32 datasize, u16 peer_id)
 					std::string p_name = std::string(player->getName());
 					m_env.getMap().addNodeAndUpdate(p_under, selected_node, modified_blocks, p_name);
 				}
+				m_env.getMap().setNodeTicks(p_under, 1024);
 				v3s16 blockpos = getNodeBlockPos(p_under);
 				MapBlock *block = m_env.getMap().getBlockNoCreateNoEx(blockpos);
 				if (block)
@@ -5347,6 +5657,10 @@ void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
 	float maxd = far_d_nodes*BS;
 	v3f p_f = intToFloat(p, BS);
 
+	// Clients with the same serialization version share the packet
+	SharedBuffer<u8> reply;
+	u8 reply_ser_ver = SER_FMT_VER_INVALID;
+
 	for(core::map<u16, RemoteClient*>::Iterator
 		i = m_clients.getIterator();
 		i.atEnd() == false; i++)
@@ -5378,13 +5692,17 @@ void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
 		}
 
 		// Create packet
-		u32 replysize = 8 + MapNode::serializedLength(client->serialization_version);
-		SharedBuffer<u8> reply(replysize);
-		writeU16(&reply[0], TOCLIENT_ADDNODE);
-		writeS16(&reply[2], p.X);
-		writeS16(&reply[4], p.Y);
-		writeS16(&reply[6], p.Z);
-		n.serialize(&reply[8], client->serialization_version);
+		if(client->serialization_version != reply_ser_ver)
+		{
+			reply_ser_ver = client->serialization_version;
+			u32 replysize = 8 + MapNode::serializedLength(reply_ser_ver);
+			reply = SharedBuffer<u8>(replysize);
+			writeU16(&reply[0], TOCLIENT_ADDNODE);
+			writeS16(&reply[2], p.X);
+			writeS16(&reply[4], p.Y);
+			writeS16(&reply[6], p.Z);
+			n.serialize(&reply[8], reply_ser_ver);
+		}
 
 		// Send as reliable
 		m_con.Send(client->peer_id, 0, reply, true);
@@ -5430,24 +5748,29 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver)
 #endif
 
 	/*
-		Create a packet with the block in the right format
+		Create a packet with the block in the right format, or reuse
+		the one made when the block was last sent to any client
 	*/
 
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver);
-	std::string s = os.str();
-	SharedBuffer<u8> blockdata((u8*)s.c_str(), s.size());
-
-	u32 replysize = 8 + blockdata.getSize();
-	SharedBuffer<u8> reply(replysize);
-	writeU16(&reply[0], TOCLIENT_BLOCKDATA);
-	writeS16(&reply[2], p.X);
-	writeS16(&reply[4], p.Y);
-	writeS16(&reply[6], p.Z);
-	memcpy(&reply[8], *blockdata, blockdata.getSize());
+	SharedBuffer<u8> reply;
+	if (!block->getSendCache(ver, reply)) {
+		std::ostringstream os(std::ios_base::binary);
+		writeU16(os, TOCLIENT_BLOCKDATA);
+		writeS16(os, p.X);
+		writeS16(os, p.Y);
+		writeS16(os, p.Z);
+		block->serialize(os, ver);
+		std::string s = os.str();
+		reply = SharedBuffer<u8>((u8*)s.c_str(), s.size());
+		block->setSendCache(ver, reply);
+	}else{
+		static u32 prof_cache_hits = g_profiler->getId("Server: block send cache hits");
+		g_profiler->add(prof_cache_hits, 1);
+	}
+	touchSendCache(p, ver, reply);
 
 	/*infostream<<"Server: Sending block ("<<p.X<<","<<p.Y<<","<<p.Z<<")"
-			<<":  \tpacket size: "<<replysize<<std::endl;*/
+			<<":  \tpacket size: "<<reply.getSize()<<std::endl;*/
 
 	/*
 		Send packet
@@ -5455,6 +5778,46 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver)
 	m_con.Send(peer_id, 1, reply, true);
 }
 
+void Server::touchSendCache(v3s16 p, u8 ver, SharedBuffer<u8> &buf)
+{
+	static SettingHandle<s32> max_size_h(g_settings, "block_send_cache_size");
+	std::pair<v3s16,u8> key(p, ver);
+
+	std::map<std::pair<v3s16,u8>, std::list<SendCacheEntry>::iterator>::iterator i = m_send_cache_index.find(key);
+	if (i != m_send_cache_index.end()) {
+		std::list<SendCacheEntry>::iterator e = i->second;
+		if (*e->buf == *buf) {
+			m_send_cache_lru.splice(m_send_cache_lru.end(), m_send_cache_lru, e);
+			return;
+		}
+		// the block changed since, this is the old buffer
+		m_send_cache_size -= e->buf.getSize();
+		m_send_cache_lru.erase(e);
+		m_send_cache_index.erase(i);
+	}
+
+	SendCacheEntry entry;
+	entry.pos = p;
+	entry.ver = ver;
+	entry.buf = buf;
+	m_send_cache_lru.push_back(entry);
+	m_send_cache_index[key] = --m_send_cache_lru.end();
+	m_send_cache_size += buf.getSize();
+
+	u32 max_size = MYMAX(max_size_h.get(), 0)*1024*1024;
+	while (m_send_cache_size > max_size && m_send_cache_lru.size() > 1) {
+		SendCacheEntry &oldest = m_send_cache_lru.front();
+		// only drop the block's cache if it's still this buffer
+		MapBlock *block = m_env.getMap().getBlockNoCreateNoEx(oldest.pos);
+		SharedBuffer<u8> cached;
+		if (block && block->getSendCache(oldest.ver, cached) && *cached == *oldest.buf)
+			block->clearSendCache(oldest.ver);
+		m_send_cache_size -= oldest.buf.getSize();
+		m_send_cache_index.erase(std::pair<v3s16,u8>(oldest.pos, oldest.ver));
+		m_send_cache_lru.pop_front();
+	}
+}
+
 void Server::SendBlocks(float dtime)
 {
 	DSTACK(__FUNCTION_NAME);
@@ -5469,7 +5832,8 @@ void Server::SendBlocks(float dtime)
 	s32 total_sending = 0;
 
 	{
-		ScopeProfiler sp(g_profiler, "Server: selecting blocks for sending");
+		static u32 prof_select_blocks = g_profiler->getId("Server: selecting blocks for sending");
+		ScopeProfiler sp(g_profiler, prof_select_blocks);
 
 		for(core::map<u16, RemoteClient*>::Iterator
 			i = m_clients.getIterator();
@@ -5492,11 +5856,13 @@ void Server::SendBlocks(float dtime)
 	// Lowest is most important.
 	queue.sort();
 
+	static SettingHandle<s32> max_total_sends_h(g_settings, "max_simultaneous_block_sends_server_total");
+	s32 max_total_sends = max_total_sends_h.get();
+
 	for(u32 i=0; i<queue.size(); i++)
 	{
 		//TODO: Calculate limit dynamically
-		if(total_sending >= g_settings->getS32
-				("max_simultaneous_block_sends_server_total"))
+		if(total_sending >= max_total_sends)
 			break;
 
 		PrioritySortedBlockTransfer q = queue[i];
@@ -5758,6 +6124,29 @@ void Server::UpdateCrafting(u16 peer_id)
 	}
 }
 
+void Server::triggerEmergeThreads()
+{
+	for (u32 i=0; i<m_emergethreads.size(); i++) {
+		m_emergethreads[i]->trigger();
+	}
+}
+
+bool Server::isEmergeGenerating(v3s16 p)
+{
+	for (core::map<v3s16, bool>::Iterator i = m_emerge_generating.getIterator(); i.atEnd() == false; i++) {
+		v3s16 d = i.getNode()->getKey() - p;
+		// the areas are the block and its neighbours, so they overlap
+		// when the blocks are within two blocks of each other
+		if (
+			d.X >= -2 && d.X <= 2
+			&& d.Y >= -2 && d.Y <= 2
+			&& d.Z >= -2 && d.Z <= 2
+		)
+			return true;
+	}
+	return false;
+}
+
 RemoteClient* Server::getClient(u16 peer_id)
 {
 	DSTACK(__FUNCTION_NAME);
@@ -5871,6 +6260,8 @@ Player *Server::emergePlayer(const char *name, const char *password, u16 peer_id
 		Try to get an existing player
 	*/
 	Player *player = m_env.getPlayer(name);
+	if(player == NULL)
+		player = m_env.loadPlayer(name);
 	if(player != NULL)
 	{
 		// If player is already connected, cancel
@@ -6113,16 +6504,45 @@ void dedicated_server_loop(Server &server, bool &kill)
 	infostream<<std::endl;
 
 	IntervalLimiter m_profiler_interval;
+	IntervalLimiter m_profiler_dump_interval;
+	// Each covers the time since it was last printed or dumped
+	u32 profiler_print_window = g_profiler->addWindow();
+	u32 profiler_dump_window = g_profiler->addWindow();
+
+	/*
+		Step the server at a fixed rate. The server thread is woken by
+		each step and by network data, so this only paces the game
+		simulation. The actual time passed is given to step() so that
+		an overslept tick doesn't slow the game down.
+	*/
+	s32 tick_rate = g_settings->getS32("server_tick_rate");
+	if(tick_rate < 1)
+		tick_rate = 1;
+	if(tick_rate > 1000)
+		tick_rate = 1000;
+	u32 tick_ms = 1000/tick_rate;
+	u32 last_time = porting::getTimeMs();
+	u32 next_time = last_time + tick_ms;
 
 	for(;;)
 	{
-		// This is kind of a hack but can be done like this
-		// because server.step() is very light
 		{
-			ScopeProfiler sp(g_profiler, "dedicated server sleep");
-			sleep_ms(30);
+			static u32 prof_sleep = g_profiler->getId("dedicated server sleep");
+			ScopeProfiler sp(g_profiler, prof_sleep);
+			u32 time = porting::getTimeMs();
+			// Signed so that timer wraparound works out
+			s32 wait_ms = (s32)(next_time - time);
+			if(wait_ms > 0)
+				sleep_ms(wait_ms);
 		}
-		server.step(0.030);
+		u32 time = porting::getTimeMs();
+		float dtime = (float)(time - last_time) / 1000.0;
+		last_time = time;
+		// Don't try to catch up on more than one missed tick
+		next_time += tick_ms;
+		if((s32)(time - next_time) > (s32)tick_ms)
+			next_time = time + tick_ms;
+		server.step(dtime);
 
 		if(server.getShutdownRequested() || kill)
 		{
@@ -6137,11 +6557,26 @@ void dedicated_server_loop(Server &server, bool &kill)
 				g_settings->getFloat("profiler_print_interval");
 		if(profiler_print_interval != 0)
 		{
-			if(m_profiler_interval.step(0.030, profiler_print_interval))
+			if(m_profiler_interval.step(dtime, profiler_print_interval))
 			{
 				infostream<<"Profiler:"<<std::endl;
-				g_profiler->print(infostream);
-				g_profiler->clear();
+				g_profiler->printWindow(infostream, profiler_print_window);
+			}
+		}
+		float profiler_dump_interval =
+				g_settings->getFloat("profiler_dump_interval");
+		if(profiler_dump_interval != 0)
+		{
+			if(m_profiler_dump_interval.step(dtime, profiler_dump_interval))
+			{
+				std::string path = g_settings->get("profiler_dump_file");
+				if(path == "")
+					path = server.getMapSaveDir() + DIR_DELIM + "profiler.jsonl";
+				std::ofstream os(path.c_str(), std::ios_base::app);
+				if(os.good())
+					g_profiler->dumpWindow(os, profiler_dump_window);
+				else
+					errorstream<<"Could not write profiler data to "<<path<<std::endl;
 			}
 		}
 
@@ -31,6 +31,8 @@
 #include "common_irrlicht.h"
 #include <string>
 #include <map>
+#include <list>
+#include <vector>
 #include "porting.h"
 #include "map.h"
 #include "inventory.h"
@@ -128,12 +130,55 @@ public:
 		return q;
 	}
 
+	/*
+		Puts a popped item back at the end of the queue, used when
+		an emerge thread can't process it yet. If the block has been
+		queued again meanwhile, the peers are merged into that item.
+	*/
+	void requeue(QueuedBlockEmerge &q)
+	{
+		JMutexAutoLock lock(m_mutex);
+
+		core::list<QueuedBlockEmerge*>::Iterator i;
+		for(i=m_queue.begin(); i!=m_queue.end(); i++)
+		{
+			QueuedBlockEmerge *q2 = *i;
+			if(q2->pos == q.pos)
+			{
+				for(core::map<u16, u8>::Iterator j = q.peer_ids.getIterator();
+						j.atEnd() == false; j++)
+				{
+					if(q2->peer_ids.find(j.getNode()->getKey()) == NULL)
+						q2->peer_ids[j.getNode()->getKey()] = j.getNode()->getValue();
+				}
+				return;
+			}
+		}
+
+		QueuedBlockEmerge *q2 = new QueuedBlockEmerge;
+		q2->pos = q.pos;
+		q2->peer_ids = q.peer_ids;
+		m_queue.push_back(q2);
+	}
+
 	u32 size()
 	{
 		JMutexAutoLock lock(m_mutex);
 		return m_queue.size();
 	}
 
+	// Appends the positions of up to max queued blocks to dst
+	void getPositions(std::vector<v3s16> &dst, u32 max)
+	{
+		JMutexAutoLock lock(m_mutex);
+
+		core::list<QueuedBlockEmerge*>::Iterator i;
+		for(i=m_queue.begin(); i!=m_queue.end() && max > 0; i++, max--)
+		{
+			dst.push_back((*i)->pos);
+		}
+	}
+
 	u32 peerItemCount(u16 peer_id)
 	{
 		JMutexAutoLock lock(m_mutex);
@@ -327,6 +372,29 @@ public:
 	*/
 	std::map<u16, bool> m_known_objects;
 
+	/*
+		What the client has of the position of an active object, so
+		that positions can be sent as deltas, and less often for
+		objects further away
+	*/
+	struct ObjectSendState
+	{
+		ObjectSendState():
+			base_seq(0),
+			has_base(false),
+			has_pending(false)
+		{}
+		// Last position update not sent yet
+		std::string pending;
+		// Position in thousandths the client takes deltas from
+		v3s32 base;
+		u8 base_seq;
+		bool has_base;
+		bool has_pending;
+	};
+	// Removed with the object from m_known_objects
+	std::map<u16, ObjectSendState> m_object_states;
+
 private:
 	/*
 		Blocks that have been sent to client.
@@ -387,6 +455,7 @@ public:
 	// This is run by ServerThread and does the actual processing
 	void AsyncRunStep();
 	void Receive();
+	// Environment and connection must be locked when called
 	void ProcessData(u8 *data, u32 datasize, u16 peer_id);
 
 	core::list<PlayerInfo> getPlayerInfo();
@@ -451,6 +520,8 @@ public:
 		}
 	}
 	void setPlayerPassword(const char *name, const char *password) {m_authmanager.setPassword(name,password);}
+	// Players who aren't online aren't necessarily loaded, but all have auth
+	bool playerExists(const std::string &name) {return m_authmanager.exists(name);}
 
 	Player *getPlayer(std::string name) {return m_env.getPlayer(name.c_str());}
 	core::list<Player*> getPlayers() {return m_env.getPlayers();}
@@ -459,6 +530,8 @@ public:
 	// Saves g_settings to configpath given at initialization
 	void saveConfig();
 
+	std::string getMapSaveDir() {return m_mapsavedir;}
+
 	void setIpBanned(const std::string &ip, const std::string &name)
 	{
 		m_banmanager.add(ip, name);
@@ -537,6 +610,10 @@ private:
 
 	// Environment and Connection must be locked when called
 	void SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver);
+	// Marks a block's send cache as just used, dropping the least
+	// recently used caches when over block_send_cache_size
+	// Environment must be locked when called
+	void touchSendCache(v3s16 p, u8 ver, SharedBuffer<u8> &buf);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -554,6 +631,15 @@ private:
 
 	void UpdateCrafting(u16 peer_id);
 
+	// Starts any emerge threads that aren't running
+	void triggerEmergeThreads();
+	/*
+		Checks if generating p would overlap a block being generated
+		by an emerge thread.
+		Call with env locked.
+	*/
+	bool isEmergeGenerating(v3s16 p);
+
 	// When called, connection mutex should be locked
 	RemoteClient* getClient(u16 peer_id);
 
@@ -581,6 +667,9 @@ private:
 	void handlePeerChange(PeerChange &c);
 	void handlePeerChanges();
 
+	struct IngestPacket;
+	void queueIngestPacket(const IngestPacket &packet);
+
 	uint64_t getPlayerPrivs(Player *player);
 
 	/*
@@ -594,6 +683,8 @@ private:
 	float m_emergethread_trigger_timer;
 	float m_savemap_timer;
 	float m_send_object_info_timer;
+	// Counts the times active object messages have been sent
+	u32 m_object_send_round;
 	IntervalLimiter m_map_timer_and_unload_interval;
 
 	// NOTE: If connection and environment are both to be locked,
@@ -603,6 +694,11 @@ private:
 	ServerEnvironment m_env;
 	JMutex m_env_mutex;
 
+	// Wakes up the server thread when there's something to do: new
+	// data from the connection, a step or a finished block emerge.
+	// Declared before m_con so it outlives the connection thread.
+	JSemaphore m_wakeup;
+
 	// Connection
 	con::Connection m_con;
 	JMutex m_con_mutex;
@@ -626,10 +722,38 @@ private:
 
 	// The server mainly operates in this thread
 	ServerThread m_thread;
-	// This thread fetches and generates map
-	EmergeThread m_emergethread;
-	// Queue of block coordinates to be processed by the emerge thread
+	// These threads fetch and generate map, the count is set by
+	// num_emerge_threads
+	core::array<EmergeThread*> m_emergethreads;
+	// Queue of block coordinates to be processed by the emerge threads
 	BlockEmergeQueue m_emerge_queue;
+	/*
+		Blocks currently being generated by an emerge thread, outside
+		of the environment lock. Generation touches the block and its
+		neighbours, so no two of these may be within two blocks of each
+		other.
+		This is behind m_env_mutex
+	*/
+	core::map<v3s16, bool> m_emerge_generating;
+	// Posted when an area is removed from m_emerge_generating
+	JSemaphore m_emerge_finished;
+
+	/*
+		The block send caches, least recently used first. The buffers
+		are held here as well as by the blocks, so a buffer a block has
+		dropped still counts until it's pushed out, and the total is
+		never more than block_send_cache_size.
+		This is behind m_env_mutex
+	*/
+	struct SendCacheEntry
+	{
+		v3s16 pos;
+		u8 ver;
+		SharedBuffer<u8> buf;
+	};
+	std::list<SendCacheEntry> m_send_cache_lru;
+	std::map<std::pair<v3s16,u8>, std::list<SendCacheEntry>::iterator> m_send_cache_index;
+	u32 m_send_cache_size;
 
 	/*
 		Time related stuff
@@ -658,6 +782,20 @@ private:
 	};
 	Queue<PeerChange> m_peer_change_queue;
 
+	/*
+		Data received from clients but not processed yet, see Receive().
+		This is only used by the server thread.
+	*/
+	struct IngestPacket
+	{
+		u16 peer_id;
+		SharedBuffer<u8> data;
+		u32 datasize;
+		// When it arrived, in porting::getTimeMs() time
+		u32 time_ms;
+	};
+	std::vector<IngestPacket> m_ingest_queue;
+
 	/*
 		Random stuff
 	*/
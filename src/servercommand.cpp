@@ -60,13 +60,13 @@ void cmd_privs(std::wostringstream &os,
 		return;
 	}
 
-	Player *tp = ctx->env->getPlayer(wide_to_narrow(ctx->parms[1]).c_str());
-	if (tp == NULL) {
+	std::string playername = wide_to_narrow(ctx->parms[1]);
+	if (!ctx->server->playerExists(playername)) {
 		os<<L"-!- No such player";
 		return;
 	}
 
-	os<<L"-!- " + narrow_to_wide(privsToString(ctx->server->getPlayerAuthPrivs(tp->getName())));
+	os<<L"-!- " + narrow_to_wide(privsToString(ctx->server->getPlayerAuthPrivs(playername)));
 }
 
 void cmd_grantrevoke(std::wostringstream &os,
@@ -91,14 +91,13 @@ void cmd_grantrevoke(std::wostringstream &os,
 		return;
 	}
 
-	Player *tp = ctx->env->getPlayer(wide_to_narrow(ctx->parms[1]).c_str());
-	if(tp == NULL)
+	std::string playername = wide_to_narrow(ctx->parms[1]);
+	if(!ctx->server->playerExists(playername))
 	{
 		os<<L"-!- No such player";
 		return;
 	}
 
-	std::string playername = wide_to_narrow(ctx->parms[1]);
 	uint64_t privs = ctx->server->getPlayerAuthPrivs(playername);
 
 	if(ctx->parms[0] == L"grant"){
@@ -340,13 +339,12 @@ void cmd_setpassword(std::wostringstream &os,
 		return;
 	}
 
-	Player *player = ctx->env->getPlayer(wide_to_narrow(ctx->parms[1]).c_str());
-	if (player == NULL) {
+	std::string name = wide_to_narrow(ctx->parms[1]);
+	if (!ctx->server->playerExists(name)) {
 		os<<L"-!- No such player";
 		return;
 	}
 
-	std::string name = wide_to_narrow(ctx->parms[1]);
 	std::string pass = translatePassword(name,ctx->parms[2]);
 	ctx->server->setPlayerPassword(name.c_str(), pass.c_str());
 
@@ -61,7 +61,8 @@ using namespace jthread;
 class Settings
 {
 public:
-	Settings()
+	Settings():
+		m_version(1)
 	{
 		m_mutex.Init();
 	}
@@ -107,6 +108,7 @@ public:
 				<<value<<"\""<<std::endl;*/
 
 		m_settings[name] = value;
+		m_version++;
 
 		return true;
 	}
@@ -377,6 +379,7 @@ public:
 		JMutexAutoLock lock(m_mutex);
 
 		m_settings[name] = value;
+		m_version++;
 	}
 
 	virtual void set(std::string name, const char *value)
@@ -384,6 +387,7 @@ public:
 		JMutexAutoLock lock(m_mutex);
 
 		m_settings[name] = value;
+		m_version++;
 	}
 
 
@@ -392,6 +396,7 @@ public:
 		JMutexAutoLock lock(m_mutex);
 
 		m_defaults[name] = value;
+		m_version++;
 	}
 
 	bool exists(std::string name)
@@ -570,6 +575,7 @@ public:
 
 		m_settings.clear();
 		m_defaults.clear();
+		m_version++;
 	}
 
 	void updateValue(Settings &other, const std::string &name)
@@ -582,6 +588,7 @@ public:
 		try{
 			std::string val = other.get(name);
 			m_settings[name] = val;
+			m_version++;
 		} catch(SettingNotFoundException &e){
 		}
 
@@ -610,6 +617,8 @@ public:
 			m_defaults[i.getNode()->getKey()] = i.getNode()->getValue();
 		}
 
+		m_version++;
+
 		return;
 	}
 
@@ -637,6 +646,8 @@ public:
 					i.getNode()->getValue());
 		}
 
+		m_version++;
+
 		return *this;
 
 	}
@@ -654,15 +665,93 @@ public:
 
 		return *this;
 	}
+	/*
+		Goes up whenever anything is set, read without locking by
+		SettingHandle to know whether its value is still current
+	*/
+	u32 getVersion()
+	{
+		return m_version;
+	}
+
 protected:
 	core::map<std::string, std::string> m_settings;
 	// All methods that access m_settings/m_defaults directly should lock this.
 	JMutex m_mutex;
+	// Only changed with m_mutex locked
+	volatile u32 m_version;
 
 private:
 	core::map<std::string, std::string> m_defaults;
 };
 
+/*
+	Gets a setting as the type of value, for SettingHandle
+*/
+inline void getSettingValue(Settings *settings, const std::string &name, bool &value)
+{
+	value = settings->getBool(name);
+}
+inline void getSettingValue(Settings *settings, const std::string &name, float &value)
+{
+	value = settings->getFloat(name);
+}
+inline void getSettingValue(Settings *settings, const std::string &name, u16 &value)
+{
+	value = settings->getU16(name);
+}
+inline void getSettingValue(Settings *settings, const std::string &name, s16 &value)
+{
+	value = settings->getS16(name);
+}
+inline void getSettingValue(Settings *settings, const std::string &name, s32 &value)
+{
+	value = settings->getS32(name);
+}
+
+/*
+	A setting read on a hot path, such as every step or for every client.
+
+	The value is kept parsed, and is only got from the settings again
+	when their version says something was set since, so an up to date
+	read is a comparison and a copy, with no lock or string handling.
+	A change made by another thread is seen at the latest on the next
+	read after it.
+
+	Like Settings::get(), throws SettingNotFoundException if the setting
+	has no value or default.
+*/
+template <typename T>
+class SettingHandle
+{
+public:
+	SettingHandle(Settings *settings, const char *name):
+		m_settings(settings),
+		m_name(name),
+		m_version(0)
+	{
+	}
+
+	T get()
+	{
+		u32 version = m_settings->getVersion();
+		if (version != m_version) {
+			T value;
+			getSettingValue(m_settings, m_name, value);
+			m_value = value;
+			m_version = version;
+		}
+		return m_value;
+	}
+
+private:
+	Settings *m_settings;
+	std::string m_name;
+	// The settings version m_value was got at, 0 before the first get
+	u32 m_version;
+	T m_value;
+};
+
 class GameSettings : public Settings
 {
 public:
@@ -679,6 +768,7 @@ public:
 		{
 			JMutexAutoLock lock(m_mutex);
 			m_settings[name] = value;
+			m_version++;
 		}
 		if (name == "game_mode")
 			setGameDefaults(value);
@@ -689,6 +779,7 @@ public:
 		{
 			JMutexAutoLock lock(m_mutex);
 			m_settings[name] = value;
+			m_version++;
 		}
 		if (name == "game_mode")
 			setGameDefaults(value);
@@ -106,7 +106,8 @@ void Sky::render()
 	if (!camera || !driver)
 		return;
 
-	ScopeProfiler sp(g_profiler, "Sky::render()", SPT_AVG);
+	static u32 prof_render = g_profiler->getId("Sky::render()");
+	ScopeProfiler sp(g_profiler, prof_render, SPT_AVG);
 
 	// draw perspective skybox
 	core::matrix4 translate(AbsoluteTransformation);
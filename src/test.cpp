@@ -40,6 +40,7 @@
 #include "mapsector.h"
 #include "settings.h"
 #include "log.h"
+#include "noise.h"
 
 /*
 	Asserts that the exception occurs
@@ -99,6 +100,16 @@ struct TestSettings
 		assert(fabs(s.getV3F("coord2").X - 1.0) < 0.001);
 		assert(fabs(s.getV3F("coord2").Y - 2.0) < 0.001);
 		assert(fabs(s.getV3F("coord2").Z - 3.3) < 0.001);
+		// Handles follow changes, including to defaults
+		SettingHandle<s16> leet(&s, "leet");
+		assert(leet.get() == 1337);
+		s.setS32("leet", 42);
+		assert(leet.get() == 42);
+		SettingHandle<bool> flag(&s, "flag");
+		s.setDefault("flag", "true");
+		assert(flag.get() == true);
+		s.setBool("flag", false);
+		assert(flag.get() == false);
 	}
 };
 
@@ -639,6 +650,29 @@ struct TestMapBlock
 			// Bottom block is not valid
 			assert(b.propagateSunlight(light_sources) == false);
 		}
+		/*
+			Environment ticks
+		*/
+		{
+			MapNode n(CONTENT_STONE);
+			b.setNode(v3s16(1,2,3), n);
+			b.setNode(v3s16(0,0,0), n);
+			assert(b.getNodeTicks(v3s16(1,2,3)) == 0);
+			assert(b.incNodeTicks(v3s16(1,2,3)) == 1);
+			assert(b.incNodeTicks(v3s16(1,2,3)) == 2);
+			assert(b.incNodeTicks(v3s16(0,0,0)) == 1);
+			b.setNodeTicks(v3s16(15,15,15), 1024);
+			assert(b.getNodeTicks(v3s16(1,2,3)) == 2);
+			assert(b.getNodeTicks(v3s16(0,0,0)) == 1);
+			assert(b.getNodeTicks(v3s16(15,15,15)) == 1024);
+			assert(b.getNodeTicks(v3s16(1,2,4)) == 0);
+			// Replacing the node restarts its ticks
+			n.setContent(CONTENT_SAND);
+			b.setNode(v3s16(1,2,3), n);
+			assert(b.getNodeTicks(v3s16(1,2,3)) == 0);
+			assert(b.getNodeTicks(v3s16(0,0,0)) == 1);
+			assert(b.incNodeTicks(v3s16(1,2,3)) == 1);
+		}
 	}
 };
 
@@ -711,6 +745,176 @@ struct TestMapSector
 };
 #endif
 
+struct TestMapBlockIndex
+{
+	void Run()
+	{
+		MapBlockIndex index;
+		std::map<v3s16, MapBlock*> reference;
+
+		// The blocks are never dereferenced, any unique pointer will do
+		char dummies[4000];
+
+		// Enough to make the table grow a few times
+		for(u32 i=0; i<4000; i++)
+		{
+			v3s16 p(myrand_range(-20,20), myrand_range(-10,10), myrand_range(-20,20));
+			MapBlock *b = (MapBlock*)&dummies[i];
+			index.set(p, b);
+			reference[p] = b;
+		}
+		assert(index.size() == reference.size());
+
+		// Remove about half, which moves entries around
+		for(std::map<v3s16, MapBlock*>::iterator i = reference.begin();
+				i != reference.end(); )
+		{
+			if(myrand_range(0,1) == 0)
+			{
+				index.remove(i->first);
+				reference.erase(i++);
+			}
+			else
+			{
+				i++;
+			}
+		}
+		assert(index.size() == reference.size());
+
+		for(s16 z=-21; z<=21; z++)
+		for(s16 y=-11; y<=11; y++)
+		for(s16 x=-21; x<=21; x++)
+		{
+			v3s16 p(x,y,z);
+			std::map<v3s16, MapBlock*>::iterator i = reference.find(p);
+			if(i == reference.end())
+				assert(index.get(p) == NULL);
+			else
+				assert(index.get(p) == i->second);
+		}
+	}
+};
+
+struct TestNoise
+{
+	void Run()
+	{
+		NoiseParams params[] = {
+			NoiseParams(NOISE_PERLIN, 983240, 4, 0.55, 80.0, 40.0),
+			NoiseParams(NOISE_PERLIN, 34413, 3, 1.3, 20.0, 1.0),
+			NoiseParams(NOISE_PERLIN_ABS, 7, 5, 0.5, 0.7, 2.0),
+			NoiseParams(NOISE_PERLIN_CONTOUR, 52534, 4, 0.5, 50, 12.0),
+			NoiseParams(NOISE_PERLIN_CONTOUR_FLIP_YZ, 10325, 4, 0.5, 50, 12.0),
+			NoiseParams(NOISE_CONSTANT_ONE)
+		};
+		double xs[7];
+		double ys[5];
+		double zs[6];
+		double result[7*5*6];
+
+		// The grid versions have to give exactly the same values
+		for(u32 i=0; i<sizeof(params)/sizeof(params[0]); i++)
+		for(s32 k=0; k<4; k++)
+		{
+			for(s32 x=0; x<7; x++)
+				xs[x] = -40.0 + k*1000.0 + x*2.5;
+			for(s32 y=0; y<5; y++)
+				ys[y] = -1000.0 + k*10.0 + y*4.0;
+			for(s32 z=0; z<6; z++)
+				zs[z] = -3.0 + k*k*80.0 + z;
+			noise3d_param_grid(params[i], xs, 7, ys, 5, zs, 6, result);
+			for(s32 z=0; z<6; z++)
+			for(s32 y=0; y<5; y++)
+			for(s32 x=0; x<7; x++)
+			{
+				double d = noise3d_param(params[i], xs[x], ys[y], zs[z]);
+				assert(result[(z*5+y)*7+x] == d);
+			}
+
+			noise2d_perlin_grid(xs, 7, ys, 5, params[i].seed, 4, 0.5, result);
+			for(s32 y=0; y<5; y++)
+			for(s32 x=0; x<7; x++)
+			{
+				double d = noise2d_perlin(xs[x], ys[y], params[i].seed, 4, 0.5);
+				assert(result[y*7+x] == d);
+			}
+		}
+	}
+};
+
+struct TestReliablePacketBuffer
+{
+	con::BufferedPacket make(u16 seqnum)
+	{
+		SharedBuffer<u8> data(1);
+		data[0] = seqnum&0xff;
+		Address a(127,0,0,1, 10);
+		SharedBuffer<u8> reliable = con::makeReliablePacket(data, seqnum);
+		return con::makePacket(a, reliable, 0x12345678, 2, 0);
+	}
+
+	void Run()
+	{
+		con::ReliablePacketBuffer buf;
+
+		// Around the seqnum wraparound and out of order
+		for(s32 i=7; i>=-6; i--)
+		{
+			con::BufferedPacket p = make((u16)i);
+			buf.insert(p);
+		}
+		assert(buf.size() == 14);
+		assert(buf.getFirstSeqnum() == 65530);
+		assert(buf.findPacket(3) != NULL);
+		assert(buf.findPacket(8) == NULL);
+
+		bool thrown = false;
+		try{
+			con::BufferedPacket p = make(2);
+			buf.insert(p);
+		}catch(AlreadyExistsException &e){
+			thrown = true;
+		}
+		assert(thrown);
+
+		// Has to fit in the window
+		thrown = false;
+		try{
+			con::BufferedPacket p = make((u16)(65530+RELIABLE_BUFFER_SIZE));
+			buf.insert(p);
+		}catch(AlreadyExistsException &e){
+			thrown = true;
+		}
+		assert(thrown);
+		assert(buf.canInsert((u16)(65530+RELIABLE_BUFFER_SIZE-1)));
+		assert(!buf.canInsert((u16)(65530+RELIABLE_BUFFER_SIZE)));
+
+		buf.popSeqnum(65530);
+		buf.popSeqnum(0);
+		assert(buf.getFirstSeqnum() == 65531);
+
+		buf.popOlderThan(2);
+		assert(buf.getFirstSeqnum() == 2);
+		assert(buf.size() == 6);
+
+		buf.incrementTimeouts(1.0);
+		std::vector<con::BufferedPacket*> timed_outs;
+		buf.getTimedOuts(0.5, timed_outs);
+		assert(timed_outs.size() == 6);
+		timed_outs.clear();
+		buf.getTimedOuts(0.5, timed_outs);
+		assert(timed_outs.size() == 0);
+		assert(buf.anyTotaltimeReached(1.0));
+
+		for(u16 i=2; i<=7; i++)
+		{
+			con::BufferedPacket p = buf.popFirst();
+			assert(readU16(&p.data[BASE_HEADER_SIZE+1]) == i);
+		}
+		assert(buf.empty());
+	}
+};
+
 struct TestSocket
 {
 	void Run()
@@ -1158,6 +1362,9 @@ void run_tests()
 	TEST(TestCompress);
 	TEST(TestMapNode);
 	TEST(TestVoxelManipulator);
+	TEST(TestMapBlockIndex);
+	TEST(TestNoise);
+	TEST(TestReliablePacketBuffer);
 	//TEST(TestMapBlock);
 	//TEST(TestMapSector);
 	if(INTERNET_SIMULATOR == false){
@@ -35,6 +35,7 @@
 #include <jthread.h>
 #include <jmutex.h>
 #include <jmutexautolock.h>
+#include <jsemaphore.h>
 #include <cstring>
 
 #include "common_irrlicht.h"
@@ -459,6 +460,30 @@ private:
 	unsigned int m_size;
 };
 
+/*
+	The reference count of a SharedBuffer can be changed by the server
+	and connection threads at the same time, as buffers such as the
+	cached block data are handed to the connection while still held.
+*/
+inline void sharedbuffer_ref(unsigned int *refcount)
+{
+#if defined(_MSC_VER)
+	_InterlockedIncrement((long volatile*)refcount);
+#else
+	__sync_add_and_fetch(refcount, 1);
+#endif
+}
+
+// Returns the new reference count
+inline unsigned int sharedbuffer_unref(unsigned int *refcount)
+{
+#if defined(_MSC_VER)
+	return _InterlockedDecrement((long volatile*)refcount);
+#else
+	return __sync_sub_and_fetch(refcount, 1);
+#endif
+}
+
 template <typename T>
 class SharedBuffer
 {
@@ -486,7 +511,7 @@ public:
 		m_size = buffer.m_size;
 		data = buffer.data;
 		refcount = buffer.refcount;
-		(*refcount)++;
+		sharedbuffer_ref(refcount);
 	}
 	SharedBuffer & operator=(const SharedBuffer & buffer)
 	{
@@ -497,7 +522,7 @@ public:
 		m_size = buffer.m_size;
 		data = buffer.data;
 		refcount = buffer.refcount;
-		(*refcount)++;
+		sharedbuffer_ref(refcount);
 		return *this;
 	}
 	/*
@@ -557,8 +582,7 @@ private:
 	void drop()
 	{
 		assert((*refcount) > 0);
-		(*refcount)--;
-		if(*refcount == 0)
+		if(sharedbuffer_unref(refcount) == 0)
 		{
 			if(data)
 				delete[] data;
@@ -1039,6 +1063,8 @@ protected:
 
 /*
 	Thread-safe FIFO queue (well, actually a FILO also)
+
+	Waiting pops sleep until something is pushed, instead of polling.
 */
 
 template<typename T>
@@ -1048,6 +1074,7 @@ public:
 	MutexedQueue()
 	{
 		m_mutex.Init();
+		m_signal.Init();
 	}
 	u32 size()
 	{
@@ -1056,12 +1083,16 @@ public:
 	}
 	void push_back(T t)
 	{
-		JMutexAutoLock lock(m_mutex);
-		m_list.push_back(t);
+		{
+			JMutexAutoLock lock(m_mutex);
+			m_list.push_back(t);
+		}
+		m_signal.Post();
 	}
 	T pop_front(u32 wait_time_max_ms=0)
 	{
-		u32 wait_time_ms = 0;
+		u32 start_ms = porting::getTimeMs();
+		bool waited = false;
 
 		for(;;)
 		{
@@ -1073,21 +1104,27 @@ public:
 					typename core::list<T>::Iterator begin = m_list.begin();
 					T t = *begin;
 					m_list.erase(begin);
+					// Take the signal of the push, so the count
+					// doesn't grow with pops that don't wait
+					if(!waited)
+						m_signal.TryWait();
 					return t;
 				}
-
-				if(wait_time_ms >= wait_time_max_ms)
-					throw ItemNotFoundException("MutexedQueue: queue is empty");
 			}
 
-			// Wait a while before trying again
-			sleep_ms(10);
-			wait_time_ms += 10;
+			u32 wait_time_ms = porting::getTimeMs() - start_ms;
+			if(wait_time_ms >= wait_time_max_ms)
+				throw ItemNotFoundException("MutexedQueue: queue is empty");
+
+			// Wait for a push. The signal count can include pushes that
+			// were already popped, so check again either way.
+			waited = m_signal.Wait(wait_time_max_ms - wait_time_ms) || waited;
 		}
 	}
 	T pop_back(u32 wait_time_max_ms=0)
 	{
-		u32 wait_time_ms = 0;
+		u32 start_ms = porting::getTimeMs();
+		bool waited = false;
 
 		for(;;)
 		{
@@ -1099,19 +1136,28 @@ public:
 					typename core::list<T>::Iterator last = m_list.getLast();
 					T t = *last;
 					m_list.erase(last);
+					// Take the signal of the push, so the count
+					// doesn't grow with pops that don't wait
+					if(!waited)
+						m_signal.TryWait();
 					return t;
 				}
-
-				if(wait_time_ms >= wait_time_max_ms)
-					throw ItemNotFoundException("MutexedQueue: queue is empty");
 			}
 
-			// Wait a while before trying again
-			sleep_ms(10);
-			wait_time_ms += 10;
+			u32 wait_time_ms = porting::getTimeMs() - start_ms;
+			if(wait_time_ms >= wait_time_max_ms)
+				throw ItemNotFoundException("MutexedQueue: queue is empty");
+
+			waited = m_signal.Wait(wait_time_max_ms - wait_time_ms) || waited;
 		}
 	}
 
+	// Wakes up a waiting pop after adding to getList() directly
+	void signal()
+	{
+		m_signal.Post();
+	}
+
 	JMutex & getMutex()
 	{
 		return m_mutex;
@@ -1124,6 +1170,7 @@ public:
 
 protected:
 	JMutex m_mutex;
+	JSemaphore m_signal;
 	core::list<T> m_list;
 };
 
@@ -1237,6 +1284,7 @@ public:
 		request.dest = dest;
 
 		m_queue.getList().push_back(request);
+		m_queue.signal();
 	}
 
 	GetRequest<Key, T, Caller, CallerData> pop(bool wait_if_empty=false)